@@ -47,10 +47,14 @@ namespace X
 			mstrException += "Line number: " + strLineNumber + "\n";
 			mstrException += "Source Filename: " + strSourceFilename + "\n";
 
-			// Log the exception to the global log file
-			std::string strLog("Exception Thrown! ");
-			strLog += strText;
-			pGlobals->pLog->add(strLog, strFunctionName, strLineNumber, strSourceFilename, true, CColourf(1, 0, 0, 1));
+			// Log the exception to the global log file, if one has been created.
+			// Image2Ico never calls CGlobals::init(), so there is no log and an exception must still be catchable.
+			if (pGlobals && pGlobals->pLog)
+			{
+				std::string strLog("Exception Thrown! ");
+				strLog += strText;
+				pGlobals->pLog->add(strLog, strFunctionName, strLineNumber, strSourceFilename, true, CColourf(1, 0, 0, 1));
+			}
 		}
 		std::string mstrException;	///< String holding the complete text of the exception.
 	};
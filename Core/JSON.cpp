@@ -0,0 +1,520 @@
+#include "JSON.h"
+#include "Exceptions.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace X
+{
+	namespace
+	{
+		const int kMaxDepth = 64;	///< Deepest nesting of arrays and objects parsed, so hostile input can't exhaust the stack
+
+		/// \brief Appends the UTF-8 encoding of a code point
+		void appendUTF8(std::string& str, unsigned int uiCodePoint)
+		{
+			if (uiCodePoint < 0x80)
+				str += char(uiCodePoint);
+			else if (uiCodePoint < 0x800)
+			{
+				str += char(0xC0 | (uiCodePoint >> 6));
+				str += char(0x80 | (uiCodePoint & 0x3F));
+			}
+			else if (uiCodePoint < 0x10000)
+			{
+				str += char(0xE0 | (uiCodePoint >> 12));
+				str += char(0x80 | ((uiCodePoint >> 6) & 0x3F));
+				str += char(0x80 | (uiCodePoint & 0x3F));
+			}
+			else
+			{
+				str += char(0xF0 | (uiCodePoint >> 18));
+				str += char(0x80 | ((uiCodePoint >> 12) & 0x3F));
+				str += char(0x80 | ((uiCodePoint >> 6) & 0x3F));
+				str += char(0x80 | (uiCodePoint & 0x3F));
+			}
+		}
+
+		/// \brief Appends a string as a quoted JSON string
+		void writeString(std::string& strText, const std::string& str)
+		{
+			strText += '"';
+			for (unsigned char c : str)
+			{
+				switch (c)
+				{
+				case '"':	strText += "\\\"";	break;
+				case '\\':	strText += "\\\\";	break;
+				case '\b':	strText += "\\b";	break;
+				case '\f':	strText += "\\f";	break;
+				case '\n':	strText += "\\n";	break;
+				case '\r':	strText += "\\r";	break;
+				case '\t':	strText += "\\t";	break;
+				default:
+					if (c < 0x20)
+					{
+						char szEscape[8];
+						snprintf(szEscape, sizeof(szEscape), "\\u%04x", c);
+						strText += szEscape;
+					}
+					else
+						strText += char(c);
+				}
+			}
+			strText += '"';
+		}
+
+		/// \brief Recursive descent parser used by CJSONValue::parse()
+		class CParser
+		{
+		public:
+			CParser(const std::string& strText) : _mstrText(strText), _muiPos(0) {}
+
+			bool parseDocument(CJSONValue& value, std::string& strError)
+			{
+				bool bOK = _parseValue(value, 0);
+				if (bOK)
+				{
+					_skipWhitespace();
+					if (_muiPos != _mstrText.size())
+						bOK = _fail("unexpected text after the value");
+				}
+				if (!bOK)
+					strError = _mstrError + " at offset " + std::to_string(_muiPos);
+				return bOK;
+			}
+		private:
+			const std::string& _mstrText;
+			size_t _muiPos;
+			std::string _mstrError;
+
+			bool _fail(const char* pError)
+			{
+				if (_mstrError.empty())
+					_mstrError = pError;
+				return false;
+			}
+
+			void _skipWhitespace(void)
+			{
+				while (_muiPos < _mstrText.size() && (' ' == _mstrText[_muiPos] || '\t' == _mstrText[_muiPos] || '\n' == _mstrText[_muiPos] || '\r' == _mstrText[_muiPos]))
+					_muiPos++;
+			}
+
+			bool _match(const char* pLiteral)
+			{
+				size_t uiLength = 0;
+				while (pLiteral[uiLength])
+					uiLength++;
+				if (0 != _mstrText.compare(_muiPos, uiLength, pLiteral))
+					return false;
+				_muiPos += uiLength;
+				return true;
+			}
+
+			bool _parseValue(CJSONValue& value, int iDepth)
+			{
+				_skipWhitespace();
+				if (_muiPos >= _mstrText.size())
+					return _fail("unexpected end of text");
+				const char c = _mstrText[_muiPos];
+				if ('{' == c || '[' == c)
+				{
+					if (iDepth >= kMaxDepth)
+						return _fail("nested too deeply");
+					return '{' == c ? _parseObject(value, iDepth + 1) : _parseArray(value, iDepth + 1);
+				}
+				if ('"' == c)
+				{
+					std::string str;
+					if (!_parseString(str))
+						return false;
+					value = CJSONValue(str);
+					return true;
+				}
+				if (_match("true"))
+					value = CJSONValue(true);
+				else if (_match("false"))
+					value = CJSONValue(false);
+				else if (_match("null"))
+					value = CJSONValue();
+				else
+					return _parseNumber(value);
+				return true;
+			}
+
+			bool _parseObject(CJSONValue& value, int iDepth)
+			{
+				value = CJSONValue::makeObject();
+				_muiPos++;
+				_skipWhitespace();
+				if (_muiPos < _mstrText.size() && '}' == _mstrText[_muiPos])
+				{
+					_muiPos++;
+					return true;
+				}
+				for (;;)
+				{
+					_skipWhitespace();
+					if (_muiPos >= _mstrText.size() || '"' != _mstrText[_muiPos])
+						return _fail("expected a member name");
+					std::string strName;
+					if (!_parseString(strName))
+						return false;
+					_skipWhitespace();
+					if (_muiPos >= _mstrText.size() || ':' != _mstrText[_muiPos])
+						return _fail("expected ':'");
+					_muiPos++;
+					CJSONValue member;
+					if (!_parseValue(member, iDepth))
+						return false;
+					value.set(strName, member);
+					_skipWhitespace();
+					if (_muiPos < _mstrText.size() && ',' == _mstrText[_muiPos])
+					{
+						_muiPos++;
+						continue;
+					}
+					if (_muiPos < _mstrText.size() && '}' == _mstrText[_muiPos])
+					{
+						_muiPos++;
+						return true;
+					}
+					return _fail("expected ',' or '}'");
+				}
+			}
+
+			bool _parseArray(CJSONValue& value, int iDepth)
+			{
+				value = CJSONValue::makeArray();
+				_muiPos++;
+				_skipWhitespace();
+				if (_muiPos < _mstrText.size() && ']' == _mstrText[_muiPos])
+				{
+					_muiPos++;
+					return true;
+				}
+				for (;;)
+				{
+					CJSONValue element;
+					if (!_parseValue(element, iDepth))
+						return false;
+					value.append(element);
+					_skipWhitespace();
+					if (_muiPos < _mstrText.size() && ',' == _mstrText[_muiPos])
+					{
+						_muiPos++;
+						continue;
+					}
+					if (_muiPos < _mstrText.size() && ']' == _mstrText[_muiPos])
+					{
+						_muiPos++;
+						return true;
+					}
+					return _fail("expected ',' or ']'");
+				}
+			}
+
+			bool _parseHex4(unsigned int& uiValue)
+			{
+				if (_muiPos + 4 > _mstrText.size())
+					return _fail("incomplete \\u escape");
+				uiValue = 0;
+				for (int i = 0; i < 4; i++)
+				{
+					const char c = _mstrText[_muiPos++];
+					uiValue <<= 4;
+					if (c >= '0' && c <= '9')
+						uiValue |= unsigned(c - '0');
+					else if (c >= 'a' && c <= 'f')
+						uiValue |= unsigned(c - 'a' + 10);
+					else if (c >= 'A' && c <= 'F')
+						uiValue |= unsigned(c - 'A' + 10);
+					else
+						return _fail("invalid \\u escape");
+				}
+				return true;
+			}
+
+			bool _parseString(std::string& str)
+			{
+				_muiPos++;	// Opening quote
+				for (;;)
+				{
+					if (_muiPos >= _mstrText.size())
+						return _fail("unterminated string");
+					const unsigned char c = (unsigned char)_mstrText[_muiPos++];
+					if ('"' == c)
+						return true;
+					if (c < 0x20)
+						return _fail("control character in string");
+					if ('\\' != c)
+					{
+						str += char(c);
+						continue;
+					}
+					if (_muiPos >= _mstrText.size())
+						return _fail("unterminated string");
+					switch (_mstrText[_muiPos++])
+					{
+					case '"':	str += '"';		break;
+					case '\\':	str += '\\';	break;
+					case '/':	str += '/';		break;
+					case 'b':	str += '\b';	break;
+					case 'f':	str += '\f';	break;
+					case 'n':	str += '\n';	break;
+					case 'r':	str += '\r';	break;
+					case 't':	str += '\t';	break;
+					case 'u':
+					{
+						unsigned int uiCodePoint;
+						if (!_parseHex4(uiCodePoint))
+							return false;
+						if (uiCodePoint >= 0xD800 && uiCodePoint < 0xDC00)
+						{
+							// High surrogate, which must be followed by a low one
+							unsigned int uiLow;
+							if (!_match("\\u") || !_parseHex4(uiLow) || uiLow < 0xDC00 || uiLow >= 0xE000)
+								return _fail("unpaired surrogate in \\u escape");
+							uiCodePoint = 0x10000 + ((uiCodePoint - 0xD800) << 10) + (uiLow - 0xDC00);
+						}
+						else if (uiCodePoint >= 0xDC00 && uiCodePoint < 0xE000)
+							return _fail("unpaired surrogate in \\u escape");
+						appendUTF8(str, uiCodePoint);
+						break;
+					}
+					default:
+						return _fail("invalid escape in string");
+					}
+				}
+			}
+
+			bool _parseNumber(CJSONValue& value)
+			{
+				// Check the grammar strictly, as strtod() accepts more than JSON does, such as hex, inf and leading '+'
+				const size_t uiStart = _muiPos;
+				auto isDigit = [this]() { return _muiPos < _mstrText.size() && _mstrText[_muiPos] >= '0' && _mstrText[_muiPos] <= '9'; };
+				if (_muiPos < _mstrText.size() && '-' == _mstrText[_muiPos])
+					_muiPos++;
+				if (!isDigit())
+					return _fail("invalid value");
+				if ('0' == _mstrText[_muiPos])
+					_muiPos++;
+				else
+					while (isDigit())
+						_muiPos++;
+				if (_muiPos < _mstrText.size() && '.' == _mstrText[_muiPos])
+				{
+					_muiPos++;
+					if (!isDigit())
+						return _fail("invalid number");
+					while (isDigit())
+						_muiPos++;
+				}
+				if (_muiPos < _mstrText.size() && ('e' == _mstrText[_muiPos] || 'E' == _mstrText[_muiPos]))
+				{
+					_muiPos++;
+					if (_muiPos < _mstrText.size() && ('+' == _mstrText[_muiPos] || '-' == _mstrText[_muiPos]))
+						_muiPos++;
+					if (!isDigit())
+						return _fail("invalid number");
+					while (isDigit())
+						_muiPos++;
+				}
+				value = CJSONValue(std::strtod(_mstrText.substr(uiStart, _muiPos - uiStart).c_str(), nullptr));
+				return true;
+			}
+		};
+	}
+
+	CJSONValue::CJSONValue()
+	{
+		_meType = TYPE_NULL;
+		_mbBool = false;
+		_mdNumber = 0.0;
+	}
+
+	CJSONValue::CJSONValue(bool bValue)
+	{
+		_meType = TYPE_BOOL;
+		_mbBool = bValue;
+		_mdNumber = 0.0;
+	}
+
+	CJSONValue::CJSONValue(double dValue)
+	{
+		_meType = TYPE_NUMBER;
+		_mbBool = false;
+		_mdNumber = dValue;
+	}
+
+	CJSONValue::CJSONValue(const std::string& strValue)
+	{
+		_meType = TYPE_STRING;
+		_mbBool = false;
+		_mdNumber = 0.0;
+		_mstrString = strValue;
+	}
+
+	CJSONValue::CJSONValue(const char* pValue)
+	{
+		_meType = TYPE_STRING;
+		_mbBool = false;
+		_mdNumber = 0.0;
+		_mstrString = pValue;
+	}
+
+	CJSONValue CJSONValue::makeArray(void)
+	{
+		CJSONValue value;
+		value._meType = TYPE_ARRAY;
+		return value;
+	}
+
+	CJSONValue CJSONValue::makeObject(void)
+	{
+		CJSONValue value;
+		value._meType = TYPE_OBJECT;
+		return value;
+	}
+
+	CJSONValue::EType CJSONValue::getType(void) const
+	{
+		return _meType;
+	}
+
+	bool CJSONValue::getBool(void) const
+	{
+		ThrowIfTrue(_meType != TYPE_BOOL, "CJSONValue::getBool() failed as the value isn't a bool.");
+		return _mbBool;
+	}
+
+	double CJSONValue::getNumber(void) const
+	{
+		ThrowIfTrue(_meType != TYPE_NUMBER, "CJSONValue::getNumber() failed as the value isn't a number.");
+		return _mdNumber;
+	}
+
+	const std::string& CJSONValue::getString(void) const
+	{
+		ThrowIfTrue(_meType != TYPE_STRING, "CJSONValue::getString() failed as the value isn't a string.");
+		return _mstrString;
+	}
+
+	size_t CJSONValue::size(void) const
+	{
+		if (TYPE_ARRAY == _meType)
+			return _mvArray.size();
+		if (TYPE_OBJECT == _meType)
+			return _mvObject.size();
+		return 0;
+	}
+
+	const CJSONValue& CJSONValue::at(size_t uiIndex) const
+	{
+		ThrowIfTrue(_meType != TYPE_ARRAY, "CJSONValue::at() failed as the value isn't an array.");
+		ThrowIfTrue(uiIndex >= _mvArray.size(), "CJSONValue::at() failed as the index is out of range.");
+		return _mvArray[uiIndex];
+	}
+
+	const CJSONValue* CJSONValue::find(const std::string& strName) const
+	{
+		for (const std::pair<std::string, CJSONValue>& member : _mvObject)
+		{
+			if (member.first == strName)
+				return &member.second;
+		}
+		return nullptr;
+	}
+
+	void CJSONValue::append(const CJSONValue& value)
+	{
+		ThrowIfTrue(_meType != TYPE_ARRAY, "CJSONValue::append() failed as the value isn't an array.");
+		_mvArray.push_back(value);
+	}
+
+	void CJSONValue::set(const std::string& strName, const CJSONValue& value)
+	{
+		ThrowIfTrue(_meType != TYPE_OBJECT, "CJSONValue::set() failed as the value isn't an object.");
+		for (std::pair<std::string, CJSONValue>& member : _mvObject)
+		{
+			if (member.first == strName)
+			{
+				member.second = value;
+				return;
+			}
+		}
+		_mvObject.emplace_back(strName, value);
+	}
+
+	std::string CJSONValue::toString(void) const
+	{
+		std::string strText;
+		_write(strText);
+		return strText;
+	}
+
+	bool CJSONValue::parse(const std::string& strText, CJSONValue& value, std::string& strError)
+	{
+		CParser parser(strText);
+		return parser.parseDocument(value, strError);
+	}
+
+	void CJSONValue::_write(std::string& strText) const
+	{
+		switch (_meType)
+		{
+		case TYPE_NULL:
+			strText += "null";
+			break;
+		case TYPE_BOOL:
+			strText += _mbBool ? "true" : "false";
+			break;
+		case TYPE_NUMBER:
+		{
+			char szNumber[32];
+			if (!std::isfinite(_mdNumber))
+				strText += "null";
+			else if (std::floor(_mdNumber) == _mdNumber && std::fabs(_mdNumber) < 1e15)
+			{
+				snprintf(szNumber, sizeof(szNumber), "%.0f", _mdNumber);
+				strText += szNumber;
+			}
+			else
+			{
+				// The shortest of these which reads back as the same number, so 0.1 isn't written as 0.10000000000000001
+				snprintf(szNumber, sizeof(szNumber), "%.15g", _mdNumber);
+				if (std::strtod(szNumber, nullptr) != _mdNumber)
+					snprintf(szNumber, sizeof(szNumber), "%.17g", _mdNumber);
+				strText += szNumber;
+			}
+			break;
+		}
+		case TYPE_STRING:
+			writeString(strText, _mstrString);
+			break;
+		case TYPE_ARRAY:
+			strText += '[';
+			for (size_t i = 0; i < _mvArray.size(); i++)
+			{
+				if (i)
+					strText += ',';
+				_mvArray[i]._write(strText);
+			}
+			strText += ']';
+			break;
+		case TYPE_OBJECT:
+			strText += '{';
+			for (size_t i = 0; i < _mvObject.size(); i++)
+			{
+				if (i)
+					strText += ',';
+				writeString(strText, _mvObject[i].first);
+				strText += ':';
+				_mvObject[i].second._write(strText);
+			}
+			strText += '}';
+			break;
+		}
+	}
+}
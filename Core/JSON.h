@@ -0,0 +1,119 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace X
+{
+	/// \brief A small JSON value, enough to read and write line based messages such as those of Image2Ico's serve mode.
+	///
+	/// Objects keep their members in the order they were added, so written text is repeatable and reads naturally.
+	/// Numbers are held as doubles.
+	/// \code
+	/// CJSONValue job;
+	/// std::string strError;
+	/// if (CJSONValue::parse("{\"input\": \"logo.png\", \"sizes\": [16, 32]}", job, strError))
+	/// {
+	///		const CJSONValue* pInput = job.find("input");
+	///		if (pInput && pInput->isString())
+	///			std::string strInput = pInput->getString();
+	/// }
+	/// CJSONValue reply = CJSONValue::makeObject();
+	/// reply.set("ok", true);
+	/// std::string strLine = reply.toString();	// {"ok":true}
+	/// \endcode
+	class CJSONValue
+	{
+	public:
+		/// \brief The type of a value
+		enum EType
+		{
+			TYPE_NULL,
+			TYPE_BOOL,
+			TYPE_NUMBER,
+			TYPE_STRING,
+			TYPE_ARRAY,
+			TYPE_OBJECT
+		};
+
+		/// \brief Constructor, creates a null value
+		CJSONValue();
+
+		/// \brief Constructor, creates a true or false value
+		CJSONValue(bool bValue);
+
+		/// \brief Constructor, creates a number value
+		CJSONValue(double dValue);
+
+		/// \brief Constructor, creates a string value
+		CJSONValue(const std::string& strValue);
+
+		/// \brief Constructor, creates a string value
+		CJSONValue(const char* pValue);
+
+		/// \brief Returns a new, empty array
+		static CJSONValue makeArray(void);
+
+		/// \brief Returns a new, empty object
+		static CJSONValue makeObject(void);
+
+		/// \brief Returns the type of this value
+		EType getType(void) const;
+
+		bool isNull(void) const { return TYPE_NULL == _meType; }
+		bool isBool(void) const { return TYPE_BOOL == _meType; }
+		bool isNumber(void) const { return TYPE_NUMBER == _meType; }
+		bool isString(void) const { return TYPE_STRING == _meType; }
+		bool isArray(void) const { return TYPE_ARRAY == _meType; }
+		bool isObject(void) const { return TYPE_OBJECT == _meType; }
+
+		/// \brief Returns the value of a bool. If this isn't a bool, an exception occurs.
+		bool getBool(void) const;
+
+		/// \brief Returns the value of a number. If this isn't a number, an exception occurs.
+		double getNumber(void) const;
+
+		/// \brief Returns the value of a string. If this isn't a string, an exception occurs.
+		const std::string& getString(void) const;
+
+		/// \brief Returns the number of elements of an array or members of an object, or 0 for any other type.
+		size_t size(void) const;
+
+		/// \brief Returns an element of an array. If this isn't an array or the index is out of range, an exception occurs.
+		const CJSONValue& at(size_t uiIndex) const;
+
+		/// \brief Returns the member of an object with the given name, or nullptr if there is none or this isn't an object.
+		const CJSONValue* find(const std::string& strName) const;
+
+		/// \brief Appends an element to an array. If this isn't an array, an exception occurs.
+		void append(const CJSONValue& value);
+
+		/// \brief Sets the member of an object with the given name, adding it after the others if it doesn't exist yet.
+		///
+		/// If this isn't an object, an exception occurs.
+		void set(const std::string& strName, const CJSONValue& value);
+
+		/// \brief Returns this value as compact JSON text on a single line.
+		///
+		/// Whole numbers are written without a decimal point and numbers which aren't finite are written as null.
+		std::string toString(void) const;
+
+		/// \brief Parses JSON text into a value.
+		///
+		/// \param strText The text to parse. Whitespace may surround the value, but nothing else may follow it.
+		/// \param value Set to the parsed value.
+		/// \param strError Set to a description of the problem, and where it is, if the text isn't valid JSON.
+		/// \return False if the text isn't valid JSON.
+		static bool parse(const std::string& strText, CJSONValue& value, std::string& strError);
+	private:
+		EType _meType;												///< The type of this value
+		bool _mbBool;												///< The value of a bool
+		double _mdNumber;											///< The value of a number
+		std::string _mstrString;									///< The value of a string
+		std::vector<CJSONValue> _mvArray;							///< The elements of an array
+		std::vector<std::pair<std::string, CJSONValue>> _mvObject;	///< The members of an object, in the order they were added
+
+		/// \brief Appends the JSON text of this value to strText
+		void _write(std::string& strText) const;
+	};
+}
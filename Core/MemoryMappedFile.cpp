@@ -0,0 +1,125 @@
+#include "MemoryMappedFile.h"
+#include "Utilities.h"
+#include <fstream>
+
+#ifdef PLATFORM_WINDOWS
+#define NOMINMAX				// Set this before including windows.h so that the min/max macros located in algorithm header take precedence
+#define WIN32_LEAN_AND_MEAN		// Exclude rarely used stuff from Windows headers
+#include <Windows.h>
+#elif PLATFORM_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace X
+{
+	CMemoryMappedFile::CMemoryMappedFile()
+	{
+		_mpData = nullptr;
+		_muiSize = 0;
+		_mpMapping = nullptr;
+	}
+
+	CMemoryMappedFile::~CMemoryMappedFile()
+	{
+		close();
+	}
+
+	bool CMemoryMappedFile::open(const std::string& strFilename)
+	{
+		close();
+
+#ifdef PLATFORM_WINDOWS
+		HANDLE hFile = CreateFileA(strFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (INVALID_HANDLE_VALUE == hFile)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && uint64_t(fileSize.QuadPart) <= uint64_t(SIZE_MAX))
+		{
+			// The view keeps its own reference to the mapping, so both handles can be closed straight away
+			HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (hMapping)
+			{
+				_mpMapping = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(hMapping);
+			}
+		}
+		CloseHandle(hFile);
+		if (_mpMapping)
+		{
+			_mpData = static_cast<const uint8_t*>(_mpMapping);
+			_muiSize = size_t(fileSize.QuadPart);
+			return true;
+		}
+#elif PLATFORM_LINUX
+		int iFile = ::open(strFilename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (iFile < 0)
+			return false;
+		struct stat fileStat;
+		if (0 == fstat(iFile, &fileStat) && S_ISREG(fileStat.st_mode) && fileStat.st_size > 0)
+		{
+			// The mapping keeps the file referenced, so it can be closed straight away
+			void* pMapping = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, iFile, 0);
+			if (MAP_FAILED != pMapping)
+			{
+				madvise(pMapping, size_t(fileStat.st_size), MADV_SEQUENTIAL);
+				_mpMapping = pMapping;
+			}
+		}
+		::close(iFile);
+		if (_mpMapping)
+		{
+			_mpData = static_cast<const uint8_t*>(_mpMapping);
+			_muiSize = size_t(fileStat.st_size);
+			return true;
+		}
+#endif
+
+		// Couldn't map it, so read it instead
+		std::ifstream file(strFilename, std::ios::in | std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+		const std::streamoff iSize = file.tellg();
+		if (iSize < 0)
+			return false;
+		_mvFallback.resize(size_t(iSize));
+		file.seekg(0, std::ios::beg);
+		if (iSize > 0 && !file.read(reinterpret_cast<char*>(_mvFallback.data()), iSize))
+		{
+			_mvFallback.clear();
+			return false;
+		}
+		_mpData = _mvFallback.data();
+		_muiSize = _mvFallback.size();
+		return true;
+	}
+
+	void CMemoryMappedFile::close(void)
+	{
+		if (_mpMapping)
+		{
+#ifdef PLATFORM_WINDOWS
+			UnmapViewOfFile(_mpMapping);
+#elif PLATFORM_LINUX
+			munmap(_mpMapping, _muiSize);
+#endif
+			_mpMapping = nullptr;
+		}
+		_mvFallback.clear();
+		_mvFallback.shrink_to_fit();
+		_mpData = nullptr;
+		_muiSize = 0;
+	}
+
+	const uint8_t* CMemoryMappedFile::getData(void) const
+	{
+		return _mpData;
+	}
+
+	size_t CMemoryMappedFile::getSize(void) const
+	{
+		return _muiSize;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace X
+{
+	/// \brief Gives read only access to the whole of a file's contents, mapped into memory.
+	///
+	/// Opening maps the file rather than reading it, so only the pages actually touched are ever read from disk, and there's
+	/// a single open of the file however many times its contents are then looked at.
+	/// If the file can't be mapped, such as an empty file or one on a device which doesn't support mapping, it is read into
+	/// memory instead, so callers never need to care which happened.
+	/// \code
+	/// CMemoryMappedFile file;
+	/// if (file.open("image.png"))
+	///		decode(file.getData(), file.getSize());
+	/// \endcode
+	class CMemoryMappedFile
+	{
+	public:
+		/// \brief Constructor, nothing is open
+		CMemoryMappedFile();
+
+		/// \brief Destructor, calls close()
+		~CMemoryMappedFile();
+
+		CMemoryMappedFile(const CMemoryMappedFile&) = delete;
+		CMemoryMappedFile& operator=(const CMemoryMappedFile&) = delete;
+
+		/// \brief Opens and maps the given file, closing any file already open.
+		///
+		/// \param strFilename The file to open
+		/// \return False if the file couldn't be opened or read.
+		bool open(const std::string& strFilename);
+
+		/// \brief Unmaps and closes the file, if one is open. getData() and getSize() then return nullptr and 0.
+		void close(void);
+
+		/// \brief Returns the file's contents, or nullptr if no file is open. Valid until close() is called.
+		const uint8_t* getData(void) const;
+
+		/// \brief Returns the size of the file in bytes, or 0 if no file is open.
+		size_t getSize(void) const;
+	private:
+		const uint8_t* _mpData;				///< The file's contents, either mapped or pointing into _mvFallback
+		size_t _muiSize;					///< Size of the file in bytes
+		void* _mpMapping;					///< The start of the mapped view, or nullptr if not mapped
+		std::vector<uint8_t> _mvFallback;	///< The file's contents, if they had to be read rather than mapped
+	};
+}
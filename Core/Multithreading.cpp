@@ -1,6 +1,348 @@
 #include "Multithreading.h"
+#include "Utilities.h"
 
 namespace X
 {
+	namespace
+	{
+		thread_local CThreadPool* tlpCurrentPool = nullptr;	///< The pool the calling thread is a worker of, if any
+		thread_local size_t tluiCurrentWorker = 0;			///< Index of the calling thread in tlpCurrentPool
+	}
 
-}
\ No newline at end of file
+	CThreadPool::CThreadPool(unsigned int uiNumThreads)
+	{
+		_muiNumQueued = 0;
+		_muiNumUnfinished = 0;
+		_muiNumSleeping = 0;
+		_mbStopping = false;
+		if (0 == uiNumThreads)
+			uiNumThreads = (unsigned int)getCPULogicalCoresCount();
+		if (0 == uiNumThreads)
+			uiNumThreads = 1;
+		for (unsigned int ui = 0; ui < uiNumThreads + 1; ui++)
+			_mvQueues.push_back(std::make_unique<SQueue>());
+		for (unsigned int ui = 0; ui < uiNumThreads; ui++)
+			_mvThreads.emplace_back(&CThreadPool::_workerMain, this, (size_t)ui);
+	}
+
+	CThreadPool::~CThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mMutex);
+			_mbStopping = true;
+		}
+		_mcvTaskAdded.notify_all();
+		for (std::thread& thread : _mvThreads)
+			thread.join();
+	}
+
+	void CThreadPool::add(std::function<void()> task)
+	{
+		// Workers keep their own tasks to themselves, everyone else shares the last queue
+		const bool bFromWorker = this == tlpCurrentPool;
+		SQueue& queue = bFromWorker ? *_mvQueues[tluiCurrentWorker] : *_mvQueues.back();
+		_muiNumUnfinished++;
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.dequeTasks.push_back(std::move(task));
+			_muiNumQueued++;
+		}
+
+		// A worker going to sleep counts itself as sleeping before checking _muiNumQueued, so either it sees the task or it's
+		// counted here. Only then is it worth taking the lock to wake it.
+		if (_muiNumSleeping > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mMutex);
+			}
+			_mcvTaskAdded.notify_one();
+		}
+	}
+
+	void CThreadPool::waitForAll(void)
+	{
+		std::unique_lock<std::mutex> lock(_mMutex);
+		_mcvAllDone.wait(lock, [this]() { return 0 == _muiNumUnfinished; });
+	}
+
+	unsigned int CThreadPool::getNumThreads(void) const
+	{
+		return (unsigned int)_mvThreads.size();
+	}
+
+	void CThreadPool::parallelFor(size_t uiBegin, size_t uiEnd, size_t uiGrainSize, const std::function<void(size_t uiFirst, size_t uiLast)>& funcBody, unsigned int uiMaxConcurrency)
+	{
+		if (uiEnd <= uiBegin)
+			return;
+		const size_t uiRange = uiEnd - uiBegin;
+		if (0 == uiGrainSize)
+		{
+			uiGrainSize = uiRange / (size_t(getNumThreads()) * 4);
+			if (0 == uiGrainSize)
+				uiGrainSize = 1;
+		}
+		const size_t uiNumChunks = (uiRange - 1) / uiGrainSize + 1;
+
+		// The calling thread is one of the runners, the rest are tasks on the pool
+		size_t uiNumRunners = getNumThreads() + 1;
+		if (uiMaxConcurrency > 0 && uiNumRunners > uiMaxConcurrency)
+			uiNumRunners = uiMaxConcurrency;
+		if (uiNumRunners > uiNumChunks)
+			uiNumRunners = uiNumChunks;
+		if (uiNumRunners < 2)
+		{
+			funcBody(uiBegin, uiEnd);
+			return;
+		}
+
+		// Each runner claims the next chunk until there are none left
+		std::atomic<size_t> uiNextChunk(0);
+		auto runChunks = [&]()
+		{
+			for (;;)
+			{
+				const size_t uiChunk = uiNextChunk++;
+				if (uiChunk >= uiNumChunks)
+					return;
+				const size_t uiFirst = uiBegin + uiChunk * uiGrainSize;
+				const size_t uiLast = uiChunk + 1 == uiNumChunks ? uiEnd : uiFirst + uiGrainSize;
+				try
+				{
+					funcBody(uiFirst, uiLast);
+				}
+				catch (...)
+				{
+					uiNextChunk = uiNumChunks;
+					throw;
+				}
+			}
+		};
+
+		// Runners which only start once every chunk has been claimed return straight away, and the group runs any which
+		// haven't started at all itself while waiting, so a busy pool only costs parallelism, never a wait.
+		CTaskGroup group(*this);
+		for (size_t ui = 1; ui < uiNumRunners; ui++)
+			group.run(runChunks);
+		std::exception_ptr exception;
+		try
+		{
+			runChunks();
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+
+		// The tasks use this function's locals, so must all have finished before leaving, even when throwing
+		try
+		{
+			group.wait();
+		}
+		catch (...)
+		{
+			if (!exception)
+				exception = std::current_exception();
+		}
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+	void CThreadPool::parallelFor2D(size_t uiBeginX, size_t uiEndX, size_t uiBeginY, size_t uiEndY, size_t uiGrainSizeX, size_t uiGrainSizeY,
+		const std::function<void(size_t uiFirstX, size_t uiLastX, size_t uiFirstY, size_t uiLastY)>& funcBody, unsigned int uiMaxConcurrency)
+	{
+		if (uiEndX <= uiBeginX || uiEndY <= uiBeginY)
+			return;
+		const size_t uiRangeX = uiEndX - uiBeginX;
+		const size_t uiRangeY = uiEndY - uiBeginY;
+		if (0 == uiGrainSizeX)
+			uiGrainSizeX = uiRangeX;
+		const size_t uiNumTilesX = (uiRangeX - 1) / uiGrainSizeX + 1;
+		if (0 == uiGrainSizeY)
+		{
+			uiGrainSizeY = uiRangeY * uiNumTilesX / (size_t(getNumThreads()) * 4);
+			if (0 == uiGrainSizeY)
+				uiGrainSizeY = 1;
+		}
+		const size_t uiNumTilesY = (uiRangeY - 1) / uiGrainSizeY + 1;
+
+		// Tiles are numbered along each row of tiles in turn, so neighbouring tiles tend to run at about the same time
+		parallelFor(0, uiNumTilesX * uiNumTilesY, 1, [&](size_t uiFirstTile, size_t uiLastTile)
+		{
+			for (size_t uiTile = uiFirstTile; uiTile < uiLastTile; uiTile++)
+			{
+				const size_t uiTileX = uiTile % uiNumTilesX;
+				const size_t uiTileY = uiTile / uiNumTilesX;
+				const size_t uiFirstX = uiBeginX + uiTileX * uiGrainSizeX;
+				const size_t uiFirstY = uiBeginY + uiTileY * uiGrainSizeY;
+				const size_t uiLastX = uiTileX + 1 == uiNumTilesX ? uiEndX : uiFirstX + uiGrainSizeX;
+				const size_t uiLastY = uiTileY + 1 == uiNumTilesY ? uiEndY : uiFirstY + uiGrainSizeY;
+				funcBody(uiFirstX, uiLastX, uiFirstY, uiLastY);
+			}
+		}, uiMaxConcurrency);
+	}
+
+	CThreadPool& CThreadPool::getGlobal(void)
+	{
+		static CThreadPool pool;
+		return pool;
+	}
+
+	void CThreadPool::_workerMain(size_t uiWorker)
+	{
+		tlpCurrentPool = this;
+		tluiCurrentWorker = uiWorker;
+		std::function<void()> task;
+		for (;;)
+		{
+			if (_takeTask(task))
+			{
+				try
+				{
+					task();
+				}
+				catch (...)
+				{
+				}
+				task = nullptr;	// Free what the task holds before waiting for the next
+				if (1 == _muiNumUnfinished--)
+				{
+					{
+						std::lock_guard<std::mutex> lock(_mMutex);
+					}
+					_mcvAllDone.notify_all();
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(_mMutex);
+			_muiNumSleeping++;
+			_mcvTaskAdded.wait(lock, [this]() { return _mbStopping || _muiNumQueued > 0; });
+			_muiNumSleeping--;
+			if (_mbStopping && 0 == _muiNumQueued)
+				return;	// Stopping and nothing left to run
+		}
+	}
+
+	bool CThreadPool::_takeTask(std::function<void()>& task)
+	{
+		if (0 == _muiNumQueued)
+			return false;
+
+		// Newest first from our own queue, while what it works on is likely still in the cache
+		const size_t uiWorker = tluiCurrentWorker;
+		{
+			SQueue& queue = *_mvQueues[uiWorker];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.dequeTasks.empty())
+			{
+				task = std::move(queue.dequeTasks.back());
+				queue.dequeTasks.pop_back();
+				_muiNumQueued--;
+				return true;
+			}
+		}
+
+		// Then oldest first from the shared queue and the other workers', starting with the shared one so outside work isn't held up
+		const size_t uiNumWorkers = _mvQueues.size() - 1;	// Not _mvThreads, which the constructor may still be adding to
+		for (size_t ui = 0; ui < uiNumWorkers; ui++)
+		{
+			SQueue& queue = 0 == ui ? *_mvQueues.back() : *_mvQueues[(uiWorker + ui) % uiNumWorkers];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.dequeTasks.empty())
+			{
+				task = std::move(queue.dequeTasks.front());
+				queue.dequeTasks.pop_front();
+				_muiNumQueued--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	CTaskGroup::CTaskGroup(CThreadPool& pool) :
+		_mPool(pool),
+		_mpState(std::make_shared<SState>())
+	{
+		_mpState->uiNumUnfinished = 0;
+	}
+
+	CTaskGroup::~CTaskGroup()
+	{
+		try
+		{
+			wait();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	void CTaskGroup::run(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mpState->mutex);
+			_mpState->dequeTasks.push_back(std::move(task));
+			_mpState->uiNumUnfinished++;
+		}
+		_mpState->cvChanged.notify_all();
+
+		// The pool's task only runs whichever of the group's tasks is oldest by then, if wait() hasn't already run them all
+		std::shared_ptr<SState> pState = _mpState;
+		_mPool.add([pState]() { pState->runOne(); });
+	}
+
+	void CTaskGroup::wait(void)
+	{
+		SState& state = *_mpState;
+		for (;;)
+		{
+			if (state.runOne())
+				continue;
+			std::unique_lock<std::mutex> lock(state.mutex);
+			state.cvChanged.wait(lock, [&state]() { return 0 == state.uiNumUnfinished || !state.dequeTasks.empty(); });
+			if (0 == state.uiNumUnfinished)
+				break;
+		}
+
+		std::exception_ptr exception;
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			std::swap(exception, state.exception);
+		}
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+	bool CTaskGroup::SState::runOne(void)
+	{
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (dequeTasks.empty())
+				return false;
+			task = std::move(dequeTasks.front());
+			dequeTasks.pop_front();
+		}
+		std::exception_ptr exceptionThrown;
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			exceptionThrown = std::current_exception();
+		}
+		task = nullptr;
+
+		bool bLast;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (exceptionThrown && !exception)
+				exception = exceptionThrown;
+			bLast = 0 == --uiNumUnfinished;
+		}
+		if (bLast)
+			cvChanged.notify_all();
+		return true;
+	}
+}
@@ -1,6 +1,176 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace X
 {
+	/// \brief A fixed number of worker threads which share out tasks between them by work stealing.
+	///
+	/// The threads are created once by the constructor and are reused for every task, so adding a task costs a lock and
+	/// at most a wake up rather than a thread creation.
+	/// Each worker thread has its own queue. A task added from within a task goes on the adding thread's queue, which that
+	/// thread runs newest first while the data the task works on is still in its cache. A worker with nothing left to do takes
+	/// the oldest task from another worker's queue, so nested work spreads out over every thread without them all contending
+	/// for a single queue. Tasks added from other threads go on a shared queue, run oldest first.
+	///
+	/// getGlobal() is a pool with a thread per logical CPU core, shared by every CPU heavy part of the project so they don't
+	/// each create threads of their own. Work is usually given to it through parallelFor() or a CTaskGroup.
+	/// \code
+	/// // Run some tasks and wait for them
+	/// CThreadPool pool(4);
+	/// for (auto& job : vJobs)
+	///		pool.add([&job]() { job.run(); });
+	/// pool.waitForAll();
+	///
+	/// // Process the rows of an image on every core
+	/// CThreadPool::getGlobal().parallelFor(0, uiHeight, 0, [&](size_t uiFirstRow, size_t uiLastRow)
+	/// {
+	///		for (size_t uiRow = uiFirstRow; uiRow < uiLastRow; uiRow++)
+	///			processRow(uiRow);
+	/// });
+	/// \endcode
+	class CThreadPool
+	{
+	public:
+		/// \brief Constructor, starts the worker threads.
+		///
+		/// \param uiNumThreads Number of worker threads. 0 creates one per logical CPU core.
+		CThreadPool(unsigned int uiNumThreads = 0);
 
-}
\ No newline at end of file
+		/// \brief Destructor, runs any tasks still waiting, then stops the worker threads.
+		~CThreadPool();
+
+		CThreadPool(const CThreadPool&) = delete;
+		CThreadPool& operator=(const CThreadPool&) = delete;
+
+		/// \brief Adds a task to be run by the next idle worker thread.
+		///
+		/// \param task The task to run. Any exceptions it throws are caught and discarded, so a task should report its own errors.
+		/// Use a CTaskGroup to have them passed on instead.
+		///
+		/// May be called from any thread, including from within a task.
+		void add(std::function<void()> task);
+
+		/// \brief Waits until every task added so far, and any they add in turn, has finished.
+		///
+		/// Must not be called from within a task.
+		void waitForAll(void);
+
+		/// \brief Returns the number of worker threads.
+		unsigned int getNumThreads(void) const;
+
+		/// \brief Calls funcBody over the range uiBegin to uiEnd, split into chunks which are run concurrently, and waits for them all.
+		///
+		/// \param uiBegin The first index of the range
+		/// \param uiEnd One past the last index of the range
+		/// \param uiGrainSize The number of indices in each chunk. 0 picks a size giving roughly 4 chunks per thread.
+		/// \param funcBody Called with the first index of a chunk and one past its last. Must be safe to call from several threads at once.
+		/// \param uiMaxConcurrency The most chunks run at once. 0 for as many as there are threads.
+		///
+		/// Chunks are handed out in order to whichever thread is free next, so uneven chunks balance themselves out.
+		/// The calling thread runs chunks too, so this may be called from within a task, including nested parallelFor() calls.
+		/// If funcBody throws, no more chunks are started and the first exception is thrown on once the running ones finish.
+		void parallelFor(size_t uiBegin, size_t uiEnd, size_t uiGrainSize, const std::function<void(size_t uiFirst, size_t uiLast)>& funcBody, unsigned int uiMaxConcurrency = 0);
+
+		/// \brief Calls funcBody over a 2D range split into tiles which are run concurrently, and waits for them all.
+		///
+		/// \param uiBeginX The first X index of the range
+		/// \param uiEndX One past the last X index of the range
+		/// \param uiBeginY The first Y index of the range
+		/// \param uiEndY One past the last Y index of the range
+		/// \param uiGrainSizeX The width of each tile. 0 for the whole width, so each tile is a band of rows.
+		/// \param uiGrainSizeY The height of each tile. 0 picks a height giving roughly 4 tiles per thread.
+		/// \param funcBody Called with the X range then the Y range of a tile, each as the first index and one past the last.
+		/// \param uiMaxConcurrency The most tiles run at once. 0 for as many as there are threads.
+		///
+		/// Otherwise the same as parallelFor().
+		void parallelFor2D(size_t uiBeginX, size_t uiEndX, size_t uiBeginY, size_t uiEndY, size_t uiGrainSizeX, size_t uiGrainSizeY,
+			const std::function<void(size_t uiFirstX, size_t uiLastX, size_t uiFirstY, size_t uiLastY)>& funcBody, unsigned int uiMaxConcurrency = 0);
+
+		/// \brief Returns the pool shared by the whole program, with a thread per logical CPU core, created when first called.
+		static CThreadPool& getGlobal(void);
+	private:
+		/// \brief A queue of tasks, one for each worker thread plus one for tasks added from other threads
+		struct SQueue
+		{
+			std::mutex mutex;								///< Guards dequeTasks
+			std::deque<std::function<void()>> dequeTasks;	///< Tasks waiting to be run
+		};
+
+		std::vector<std::thread> _mvThreads;				///< The worker threads
+		std::vector<std::unique_ptr<SQueue>> _mvQueues;		///< A queue for each worker thread, then the shared queue
+		std::atomic<size_t> _muiNumQueued;					///< Number of tasks waiting in all of the queues
+		std::atomic<size_t> _muiNumUnfinished;				///< Number of tasks added which haven't finished yet
+		std::atomic<unsigned int> _muiNumSleeping;			///< Number of worker threads waiting on _mcvTaskAdded
+		std::mutex _mMutex;									///< Guards the waits on the condition variables below
+		std::condition_variable _mcvTaskAdded;				///< Notified when a task is added or the pool is stopping
+		std::condition_variable _mcvAllDone;				///< Notified when the last unfinished task finishes
+		bool _mbStopping;									///< Set by the destructor to stop the worker threads
+
+		/// \brief The function each worker thread runs until the pool is stopped
+		void _workerMain(size_t uiWorker);
+
+		/// \brief Takes the next task to run, from the calling worker thread's own queue first, then the shared queue, then other workers' queues.
+		///
+		/// \return False if every queue is empty
+		bool _takeTask(std::function<void()>& task);
+	};
+
+	/// \brief A set of tasks run on a CThreadPool which can be waited for together.
+	///
+	/// Unlike CThreadPool::waitForAll(), waiting only covers this group's tasks, and may be done from within a task of the
+	/// same pool. While waiting, the calling thread runs the group's tasks which haven't started yet itself, so a group never
+	/// waits on a pool whose threads are all busy. It never runs other tasks, so what's on the waiting thread's stack can't be re-entered.
+	/// The first exception thrown by any of the group's tasks is thrown on by wait().
+	/// \code
+	/// CTaskGroup group;
+	/// group.run([&]() { computeLeft(); });
+	/// group.run([&]() { computeRight(); });
+	/// group.wait();
+	/// \endcode
+	class CTaskGroup
+	{
+	public:
+		/// \brief Constructor
+		///
+		/// \param pool The pool whose threads run the tasks
+		CTaskGroup(CThreadPool& pool = CThreadPool::getGlobal());
+
+		/// \brief Destructor, waits for the group's tasks. Any exception they threw is discarded, so call wait() first to see it.
+		~CTaskGroup();
+
+		CTaskGroup(const CTaskGroup&) = delete;
+		CTaskGroup& operator=(const CTaskGroup&) = delete;
+
+		/// \brief Adds a task to the group and starts it on the pool. May be called from within the group's own tasks.
+		void run(std::function<void()> task);
+
+		/// \brief Waits until every task of the group, including any they add, has finished.
+		///
+		/// If any of them threw an exception, the first is thrown on here, and the group may then be used again.
+		void wait(void);
+	private:
+		/// \brief What the pool's tasks need of the group, kept alive by them until they've run, which may be after the group is gone.
+		struct SState
+		{
+			std::mutex mutex;								///< Guards everything below
+			std::condition_variable cvChanged;				///< Notified when a task is added or the last unfinished one finishes
+			std::deque<std::function<void()>> dequeTasks;	///< Tasks which haven't started yet
+			size_t uiNumUnfinished;							///< Number of tasks added which haven't finished yet
+			std::exception_ptr exception;					///< The first exception thrown by a task
+
+			/// \brief Runs the oldest task which hasn't started yet, if any, returning false if there was none.
+			bool runOne(void);
+		};
+
+		CThreadPool& _mPool;				///< The pool the tasks run on
+		std::shared_ptr<SState> _mpState;	///< Shared with the pool's tasks
+	};
+}
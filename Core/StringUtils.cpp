@@ -520,5 +520,47 @@ namespace X
 			stringToLowercase(str2Lower);
 			return str1Lower.compare(str2Lower);
 		}
+
+		bool wildcardMatch(const std::string& strText, const std::string& strPattern, bool bCaseSensitive)
+		{
+			auto charsEqual = [bCaseSensitive](char c1, char c2)
+			{
+				if (bCaseSensitive)
+					return c1 == c2;
+				return std::tolower((unsigned char)c1) == std::tolower((unsigned char)c2);
+			};
+
+			// Greedy matching with backtracking to the most recent '*'.
+			// Each '*' only ever needs to remember its latest position, so this is linear in practice and never recursive.
+			size_t iText = 0;
+			size_t iPattern = 0;
+			size_t iStarPattern = std::string::npos;
+			size_t iStarText = 0;
+			while (iText < strText.length())
+			{
+				if (iPattern < strPattern.length() && strPattern[iPattern] == '*')
+				{
+					iStarPattern = iPattern++;
+					iStarText = iText;
+				}
+				else if (iPattern < strPattern.length() && (strPattern[iPattern] == '?' || charsEqual(strPattern[iPattern], strText[iText])))
+				{
+					iPattern++;
+					iText++;
+				}
+				else if (iStarPattern != std::string::npos)
+				{
+					// Let the last '*' swallow one more character and try again
+					iPattern = iStarPattern + 1;
+					iText = ++iStarText;
+				}
+				else
+					return false;
+			}
+			// Any remaining pattern must be all '*'
+			while (iPattern < strPattern.length() && strPattern[iPattern] == '*')
+				iPattern++;
+			return iPattern == strPattern.length();
+		}
 	}
 }
\ No newline at end of file
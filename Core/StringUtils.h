@@ -286,5 +286,16 @@ namespace X
 		/// \return An integer value indicating the relationship between the two strings. 0 if they are the same, a negative value if str1 is less than str2, a positive value if str1 is greater than str2
 		int compareCaseInsensitive(const std::string& str1, const std::string& str2);
 
+
+		/// \brief Returns whether the given text matches the given wildcard pattern.
+		///
+		/// \param strText The text to test, typically a filename without any directory part.
+		/// \param strPattern The pattern, where '*' matches any run of characters (including none) and '?' matches exactly one character.
+		/// \param bCaseSensitive If false, characters are compared regardless of case.
+		/// \return True if the whole of strText matches strPattern.
+		/// 
+		/// For example, "icon_*.png" matches "icon_drive.png" and "icon_.png" but not "icon_drive.jpg".
+		bool wildcardMatch(const std::string& strText, const std::string& strPattern, bool bCaseSensitive = true);
+
 	}   // namespace StringUtils
 }
\ No newline at end of file
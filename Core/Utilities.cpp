@@ -1,6 +1,7 @@
 #include "Utilities.h"
 #include "Logging.h"
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <thread>	// For std::thread::hardware_concurrency();
 #include "Exceptions.h"
@@ -19,6 +20,12 @@
 #include <unistd.h>				// For chdir on Linux
 #endif
 
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>				// For __cpuid and _xgetbv
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>				// For __cpuid_count
+#endif
+
 namespace X
 {
 	void getHueColour(float fHueAmount, float& fRed, float& fGreen, float& fBlue)
@@ -179,6 +186,71 @@ namespace X
 		return (size_t)std::thread::hardware_concurrency();
 	}
 
+	namespace
+	{
+		/// \brief Fills iRegisters with EAX, EBX, ECX and EDX from CPUID for the given leaf and subleaf
+		void readCPUID(int iLeaf, int iSubleaf, int iRegisters[4])
+		{
+#if defined(_M_X64) || defined(_M_IX86)
+			__cpuidex(iRegisters, iLeaf, iSubleaf);
+#elif defined(__x86_64__) || defined(__i386__)
+			unsigned int a, b, c, d;
+			__cpuid_count(iLeaf, iSubleaf, a, b, c, d);
+			iRegisters[0] = int(a);
+			iRegisters[1] = int(b);
+			iRegisters[2] = int(c);
+			iRegisters[3] = int(d);
+#else
+			iRegisters[0] = iRegisters[1] = iRegisters[2] = iRegisters[3] = 0;
+#endif
+		}
+
+		/// \brief Returns which register states the operating system saves on a context switch, from XGETBV. Only call if CPUID says OSXSAVE.
+		uint64_t readXCR0(void)
+		{
+#if defined(_M_X64) || defined(_M_IX86)
+			return _xgetbv(0);
+#elif defined(__x86_64__) || defined(__i386__)
+			unsigned int uiLow, uiHigh;
+			__asm__ volatile("xgetbv" : "=a"(uiLow), "=d"(uiHigh) : "c"(0));
+			return (uint64_t(uiHigh) << 32) | uiLow;
+#else
+			return 0;
+#endif
+		}
+
+		SCPUFeatures detectCPUFeatures(void)
+		{
+			SCPUFeatures features = {};
+			int iRegisters[4];
+			readCPUID(0, 0, iRegisters);
+			const int iMaxLeaf = iRegisters[0];
+			if (iMaxLeaf < 1)
+				return features;
+
+			readCPUID(1, 0, iRegisters);
+			features.bSSE2 = 0 != (iRegisters[3] & (1 << 26));
+			features.bSSSE3 = 0 != (iRegisters[2] & (1 << 9));
+			features.bSSE41 = 0 != (iRegisters[2] & (1 << 19));
+			const bool bOSXSAVE = 0 != (iRegisters[2] & (1 << 27));
+			const bool bAVX = 0 != (iRegisters[2] & (1 << 28));
+
+			// AVX2 also needs the operating system to save the upper halves of the YMM registers, or they'd be lost on a context switch
+			if (iMaxLeaf >= 7 && bOSXSAVE && bAVX && 6 == (readXCR0() & 6))
+			{
+				readCPUID(7, 0, iRegisters);
+				features.bAVX2 = 0 != (iRegisters[1] & (1 << 5));
+			}
+			return features;
+		}
+	}
+
+	const SCPUFeatures& getCPUFeatures(void)
+	{
+		static const SCPUFeatures features = detectCPUFeatures();
+		return features;
+	}
+
 	void getMemoryInfo(double& dGBSystemTotal, double& dGBSystemAvailable, double& dGBSystemUsed, double& dGBUsedByProcess)
 	{
 #ifdef PLATFORM_WINDOWS
@@ -501,4 +573,85 @@ namespace X
 		return glm::quat(s * 0.5f, rotationAxis.x * invs, rotationAxis.y * invs, rotationAxis.z * invs);
 	}
 */
+
+	uint64_t computeHash64(const void* pData, size_t uiSizeInBytes, uint64_t uiSeed)
+	{
+		const uint64_t kPrime1 = 11400714785074694791ULL;
+		const uint64_t kPrime2 = 14029467366897019727ULL;
+		const uint64_t kPrime3 = 1609587929392839161ULL;
+		const uint64_t kPrime4 = 9650029242287828579ULL;
+		const uint64_t kPrime5 = 2870177450012600261ULL;
+
+		auto rotateLeft = [](uint64_t uiValue, int iBits) { return (uiValue << iBits) | (uiValue >> (64 - iBits)); };
+		auto read64 = [](const uint8_t* p) { uint64_t uiValue; memcpy(&uiValue, p, 8); return uiValue; };
+		auto read32 = [](const uint8_t* p) { uint32_t uiValue; memcpy(&uiValue, p, 4); return uiValue; };
+		auto mixRound = [&](uint64_t uiAccumulator, uint64_t uiInput)
+		{
+			uiAccumulator += uiInput * kPrime2;
+			uiAccumulator = rotateLeft(uiAccumulator, 31);
+			return uiAccumulator * kPrime1;
+		};
+		auto mergeRound = [&](uint64_t uiAccumulator, uint64_t uiValue)
+		{
+			uiAccumulator ^= mixRound(0, uiValue);
+			return uiAccumulator * kPrime1 + kPrime4;
+		};
+
+		const uint8_t* p = static_cast<const uint8_t*>(pData);
+		const uint8_t* pEnd = p + uiSizeInBytes;
+		uint64_t uiHash;
+		if (uiSizeInBytes >= 32)
+		{
+			// Four independent lanes of 8 bytes each
+			uint64_t v1 = uiSeed + kPrime1 + kPrime2;
+			uint64_t v2 = uiSeed + kPrime2;
+			uint64_t v3 = uiSeed;
+			uint64_t v4 = uiSeed - kPrime1;
+			const uint8_t* pLimit = pEnd - 32;
+			do
+			{
+				v1 = mixRound(v1, read64(p));
+				v2 = mixRound(v2, read64(p + 8));
+				v3 = mixRound(v3, read64(p + 16));
+				v4 = mixRound(v4, read64(p + 24));
+				p += 32;
+			} while (p <= pLimit);
+			uiHash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+			uiHash = mergeRound(uiHash, v1);
+			uiHash = mergeRound(uiHash, v2);
+			uiHash = mergeRound(uiHash, v3);
+			uiHash = mergeRound(uiHash, v4);
+		}
+		else
+			uiHash = uiSeed + kPrime5;
+		uiHash += uint64_t(uiSizeInBytes);
+
+		// Remaining bytes
+		while (p + 8 <= pEnd)
+		{
+			uiHash ^= mixRound(0, read64(p));
+			uiHash = rotateLeft(uiHash, 27) * kPrime1 + kPrime4;
+			p += 8;
+		}
+		if (p + 4 <= pEnd)
+		{
+			uiHash ^= uint64_t(read32(p)) * kPrime1;
+			uiHash = rotateLeft(uiHash, 23) * kPrime2 + kPrime3;
+			p += 4;
+		}
+		while (p < pEnd)
+		{
+			uiHash ^= uint64_t(*p) * kPrime5;
+			uiHash = rotateLeft(uiHash, 11) * kPrime1;
+			p++;
+		}
+
+		// Final mix so that every input bit affects every output bit
+		uiHash ^= uiHash >> 33;
+		uiHash *= kPrime2;
+		uiHash ^= uiHash >> 29;
+		uiHash *= kPrime3;
+		uiHash ^= uiHash >> 32;
+		return uiHash;
+	}
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 //#include <vector>
 //#include <chrono>
 //#include <deque>
+#include <cstdint>
 #include <vector>
 
 
@@ -352,6 +353,20 @@ namespace X
 	/// \return The number of logical CPU cores (If we have a single core CPU, with "hyperthreading", this would be 2.
 	size_t getCPULogicalCoresCount(void);
 
+	/// \brief The vector instruction sets which the CPU and operating system support, from getCPUFeatures()
+	struct SCPUFeatures
+	{
+		bool bSSE2;		///< 128 bit integer and double instructions
+		bool bSSSE3;	///< Adds byte shuffles, pshufb
+		bool bSSE41;	///< Adds blends, min/max of 32 bit integers and more
+		bool bAVX2;		///< 256 bit integer instructions. Only set if the operating system saves the 256 bit registers too.
+	};
+
+	/// \brief Returns which vector instruction sets can be used, as read from CPUID on first call.
+	///
+	/// On CPUs other than x86 and x64, every member is false.
+	const SCPUFeatures& getCPUFeatures(void);
+
 	/// \brief Returns the memory information about the process and system
 	///
 	/// \param dGBSystemTotal The total amount of memory on the system in GB
@@ -366,6 +381,17 @@ namespace X
 	/// \param fProcessTotalCPUUsage The total CPU usage of the current process in percent
 	/// \return A vector containing the system's CPU usage of each core in percent
 	std::vector<float> getCPUUsage(float& fSystemTotalCPUUsage, float& fProcessTotalCPUUsage);
+
+	/// \brief Computes a 64 bit hash of the given data
+	///
+	/// \param pData The data to hash
+	/// \param uiSizeInBytes The number of bytes of data
+	/// \param uiSeed A seed value. Different seeds give unrelated hashes for the same data.
+	/// \return The hash value
+	/// 
+	/// This is the XXH64 algorithm, which reads 32 bytes per step, so it is quick enough to tell whether large buffers such as image data have changed.
+	/// It is not a cryptographic hash.
+	uint64_t computeHash64(const void* pData, size_t uiSizeInBytes, uint64_t uiSeed = 0);
 /*
 	// Given two vectors, returns the rotation quaternion needed to rotate v1 to match v2
 //	glm::quat rotationBetweenVectors(glm::vec3 v1, glm::vec3 v2);
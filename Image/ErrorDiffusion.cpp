@@ -0,0 +1,93 @@
+#include "ErrorDiffusion.h"
+#include "../Core/Exceptions.h"
+#include "../Core/Multithreading.h"
+#include <climits>
+#include <thread>
+
+namespace X
+{
+	namespace
+	{
+		const SDiffusionKernel kKernels[] =
+		{
+			{ "Floyd-Steinberg", 4, 4, { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } } },
+			{ "Atkinson", 3, 6, { { 1, 0, 1 }, { 2, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }, { 0, 2, 1 } } },
+			{ "Sierra", 5, 10, { { 1, 0, 5 }, { 2, 0, 3 }, { -2, 1, 2 }, { -1, 1, 4 }, { 0, 1, 5 }, { 1, 1, 4 }, { 2, 1, 2 }, { -1, 2, 2 }, { 0, 2, 3 }, { 1, 2, 2 } } },
+			{ "Sierra Lite", 2, 3, { { 1, 0, 2 }, { -1, 1, 1 }, { 0, 1, 1 } } }
+		};
+	}
+
+	const SDiffusionKernel& SDiffusionKernel::get(EKernel eKernel)
+	{
+		ThrowIfTrue(eKernel < KERNEL_FLOYD_STEINBERG || eKernel > KERNEL_SIERRA_LITE, "Unknown error diffusion kernel.");
+		return kKernels[eKernel];
+	}
+
+	int SDiffusionKernel::getMaxOffsetY(void) const
+	{
+		int iMaxOffsetY = 0;
+		for (int iTap = 0; iTap < iNumTaps; iTap++)
+		{
+			if (taps[iTap].iOffsetY > iMaxOffsetY)
+				iMaxOffsetY = taps[iTap].iOffsetY;
+		}
+		return iMaxOffsetY;
+	}
+
+	CDiffusionWavefront::CDiffusionWavefront(int iNumRows, int iMaxOffsetY, unsigned int uiMaxThreads) :
+		_mvProgress(size_t(iNumRows > 0 ? iNumRows : 0))
+	{
+		_miNumRows = iNumRows;
+		_miMaxOffsetY = iMaxOffsetY;
+		_muiMaxThreads = uiMaxThreads;
+
+		// parallelFor() runs at most a chunk per pool thread plus the calling thread
+		unsigned int uiNumRunners = CThreadPool::getGlobal().getNumThreads() + 1;
+		if (uiMaxThreads > 0 && uiNumRunners > uiMaxThreads)
+			uiNumRunners = uiMaxThreads;
+		_miNumRunners = int(uiNumRunners);
+	}
+
+	int CDiffusionWavefront::getNumRowsKept(void) const
+	{
+		// The rows being run, along with the rows above the oldest of them which it reads
+		return _miNumRunners + _miMaxOffsetY;
+	}
+
+	void CDiffusionWavefront::run(const std::function<void(int iY)>& funcRow)
+	{
+		auto runRow = [&](int iY)
+		{
+			// The slot this row uses last held row iY - getNumRowsKept(), which the rows up to _miMaxOffsetY below it read.
+			// Rows finish in order, so once the last of those is done, the slot is free. That's rarely still running.
+			waitForProgress(iY - getNumRowsKept() + _miMaxOffsetY, INT_MAX);
+			funcRow(iY);
+			setProgress(iY, INT_MAX);
+		};
+		if (1 == _miNumRunners)
+		{
+			for (int iY = 0; iY < _miNumRows; iY++)
+				runRow(iY);
+			return;
+		}
+		CThreadPool::getGlobal().parallelFor(0, size_t(_miNumRows), 1, [&](size_t uiFirstRow, size_t uiLastRow)
+		{
+			for (size_t uiRow = uiFirstRow; uiRow < uiLastRow; uiRow++)
+				runRow(int(uiRow));
+		}, _muiMaxThreads);
+	}
+
+	void CDiffusionWavefront::setProgress(int iY, int iNumPixels)
+	{
+		_mvProgress[size_t(iY)].store(iNumPixels, std::memory_order_release);
+	}
+
+	void CDiffusionWavefront::waitForProgress(int iY, int iNumPixels) const
+	{
+		if (iY < 0)
+			return;
+		const std::atomic<int>& atomicProgress = _mvProgress[size_t(iY)];
+		while (atomicProgress.load(std::memory_order_acquire) < iNumPixels)
+			std::this_thread::yield();
+	}
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace X
+{
+	/// \brief The pattern with which error diffusion dithering spreads each pixel's quantisation error over the pixels after it.
+	///
+	/// Each tap gives a share of the error to the pixel iOffsetX along the scan and iOffsetY rows down. Shares are whole numbers
+	/// out of 1 << iShift, so dithering is done entirely in integers and gives the same result on every CPU.
+	struct SDiffusionKernel
+	{
+		/// \brief The kernels which get() returns
+		enum EKernel
+		{
+			KERNEL_FLOYD_STEINBERG,	///< 4 taps over 2 rows, the classic
+			KERNEL_ATKINSON,		///< 6 taps over 3 rows, passing on only 3/4 of the error, which keeps more contrast but loses detail in highlights and shadows
+			KERNEL_SIERRA,			///< 10 taps over 3 rows, smoother than Floyd-Steinberg
+			KERNEL_SIERRA_LITE		///< 3 taps over 2 rows, the quickest
+		};
+
+		/// \brief One share of a pixel's error
+		struct STap
+		{
+			int iOffsetX;	///< Pixels along the scan, negative being back towards where the row's scan began
+			int iOffsetY;	///< Rows down, from 0 to kMaxOffsetY. Taps on the same row must have a positive iOffsetX.
+			int iWeight;	///< The share, out of 1 << iShift
+		};
+
+		static const int kMaxTaps = 12;		///< Most taps of any kernel
+		static const int kMaxOffsetX = 2;	///< Furthest any tap reaches either side
+		static const int kMaxOffsetY = 2;	///< Furthest any tap reaches down
+
+		const char* pszName;	///< Name of the kernel, for logging
+		int iShift;				///< The taps' weights are out of 1 << iShift
+		int iNumTaps;			///< Number of taps used in taps
+		STap taps[kMaxTaps];	///< The taps
+
+		/// \brief Returns the given kernel
+		static const SDiffusionKernel& get(EKernel eKernel);
+
+		/// \brief Returns the number of rows down the furthest tap reaches
+		int getMaxOffsetY(void) const;
+	};
+
+	/// \brief Runs error diffusion over the rows of an image as a wavefront, several rows at once with each a little behind the one above it.
+	///
+	/// A row can't be dithered until the rows above have passed on their error, but it only needs that for the pixels just ahead of
+	/// where it has got to, not the whole row. So each row's thread posts how far along it is with setProgress(), and the row below
+	/// waits with waitForProgress() only once it catches up. As each pixel's inputs are the same whichever thread got there first,
+	/// the result is the same whatever the number of threads.
+	///
+	/// Rows are run through CThreadPool::parallelFor(), which claims them in order, so the row waited for is always already running.
+	/// Used by diffuseError(), which should be used rather than this.
+	class CDiffusionWavefront
+	{
+	public:
+		/// \brief Constructor
+		///
+		/// \param iNumRows The number of rows to run
+		/// \param iMaxOffsetY How many rows below its own each row passes error to
+		/// \param uiMaxThreads The most threads to use, the calling thread counting as one. 0 for every thread of CThreadPool::getGlobal() as well.
+		CDiffusionWavefront(int iNumRows, int iMaxOffsetY, unsigned int uiMaxThreads);
+
+		/// \brief Returns how many rows of error must be kept, so that a row's slot isn't reused until every row reading it is done.
+		/// Row iY uses slot iY modulo this.
+		int getNumRowsKept(void) const;
+
+		/// \brief Calls funcRow with each row, concurrently if allowed, once the row which last used its slot is no longer needed.
+		/// funcRow mustn't throw.
+		void run(const std::function<void(int iY)>& funcRow);
+
+		/// \brief Posts that row iY has finished its first iNumPixels pixels, in the order it scans them
+		void setProgress(int iY, int iNumPixels);
+
+		/// \brief Waits until row iY has finished at least its first iNumPixels pixels. Returns straight away for rows above the image.
+		void waitForProgress(int iY, int iNumPixels) const;
+	private:
+		int _miNumRows;								///< Number of rows run
+		int _miMaxOffsetY;							///< How many rows below its own each row passes error to
+		unsigned int _muiMaxThreads;				///< Most threads to use
+		int _miNumRunners;							///< Most rows run at once
+		std::vector<std::atomic<int>> _mvProgress;	///< Number of pixels each row has finished, INT_MAX once it's done
+	};
+
+	/// \brief Dithers an image by error diffusion, passing each pixel's quantisation error on to the pixels after it.
+	///
+	/// \param pPixels The image's pixels, rows packed top to bottom. Only the first 3 channels are dithered, alpha being left as is.
+	/// \param iWidth The width of the image
+	/// \param iHeight The height of the image
+	/// \param kernel How the error is passed on, see SDiffusionKernel
+	/// \param bSerpentine If true, odd rows are scanned right to left, which avoids the diagonal artifacts of scanning one way.
+	/// Each row then needs the whole row above finished first, so rows are run one at a time.
+	/// \param uiMaxThreads The most threads to use, the calling thread counting as one. 0 for every thread of CThreadPool::getGlobal() as well.
+	/// \param quantise Called as quantise(iX, iY, piRGB) for each pixel in turn with the colour it should be, error included and clamped
+	/// to between 0 and 255, which it replaces with the colour the pixel is to be. Called from several threads at once if uiMaxThreads isn't 1.
+	///
+	/// Each row's error is kept as 16 bit integers in a small ring of rows rather than added to the image, so it isn't rounded or
+	/// clamped to a byte along the way. Each pixel then sums the shares due to it from the rows above, in a fixed order.
+	template <int iNumChannels, typename TQuantise>
+	void diffuseError(unsigned char* pPixels, int iWidth, int iHeight, const SDiffusionKernel& kernel, bool bSerpentine, unsigned int uiMaxThreads, TQuantise quantise);
+
+	/// \brief Number of pixels diffuseError() dithers between posting how far a row has got. Larger steps mean fewer atomic operations, smaller ones a shorter lag between rows.
+	const int kDiffusionProgressStep = 32;
+
+	template <int iNumChannels, typename TQuantise>
+	void diffuseError(unsigned char* pPixels, int iWidth, int iHeight, const SDiffusionKernel& kernel, bool bSerpentine, unsigned int uiMaxThreads, TQuantise quantise)
+	{
+		static_assert(3 == iNumChannels || 4 == iNumChannels, "Only 3 or 4 channel images can be dithered.");
+		if (iWidth < 1 || iHeight < 1)
+			return;
+		const int iMaxOffsetY = kernel.getMaxOffsetY();
+		CDiffusionWavefront wavefront(iHeight, iMaxOffsetY, bSerpentine ? 1 : uiMaxThreads);
+
+		// Each row of error is padded either side by the furthest a tap reaches, with zeroes which are never written,
+		// so pixels near the edges need no checks. Rows above the image are a row of zeroes.
+		const size_t uiErrorRowSize = (size_t(iWidth) + 2 * SDiffusionKernel::kMaxOffsetX) * 3;
+		const int iNumRowsKept = wavefront.getNumRowsKept();
+		std::vector<int16_t> vErrorRows(uiErrorRowSize * (size_t(iNumRowsKept) + 1), 0);
+		auto getErrorRow = [&](int iY) -> int16_t*
+		{
+			const size_t uiSlot = iY < 0 ? size_t(iNumRowsKept) : size_t(iY % iNumRowsKept);
+			return vErrorRows.data() + uiSlot * uiErrorRowSize + SDiffusionKernel::kMaxOffsetX * 3;
+		};
+		auto getDirection = [bSerpentine](int iY) { return bSerpentine && (iY & 1) ? -1 : 1; };
+
+		wavefront.run([&](int iY)
+		{
+			// Where each tap's share of error comes from. Pixel X takes it from X minus the offset, along the scan of the row it came from.
+			const int16_t* pTapSource[SDiffusionKernel::kMaxTaps];
+			int iTapWeight[SDiffusionKernel::kMaxTaps];
+			for (int iTap = 0; iTap < kernel.iNumTaps; iTap++)
+			{
+				const SDiffusionKernel::STap& tap = kernel.taps[iTap];
+				const int iSourceDirection = getDirection(iY - tap.iOffsetY);
+				pTapSource[iTap] = getErrorRow(iY - tap.iOffsetY) - ptrdiff_t(iSourceDirection) * tap.iOffsetX * 3;
+				iTapWeight[iTap] = tap.iWeight;
+			}
+			const int iDirection = getDirection(iY);
+			int16_t* pError = getErrorRow(iY);
+			unsigned char* pRow = pPixels + size_t(iY) * iWidth * iNumChannels;
+			const int iRounding = kernel.iShift > 0 ? 1 << (kernel.iShift - 1) : 0;
+
+			for (int iStep = 0; iStep < iWidth; iStep += kDiffusionProgressStep)
+			{
+				const int iStepEnd = iStep + kDiffusionProgressStep < iWidth ? iStep + kDiffusionProgressStep : iWidth;
+
+				// Wait for the rows above to be far enough along to have passed on their error to this run of pixels.
+				// Scanned the same way, that's the furthest any tap reaches back past the end of the run. Otherwise it's the whole row.
+				for (int iOffsetY = 1; iOffsetY <= iMaxOffsetY; iOffsetY++)
+				{
+					const bool bSameDirection = getDirection(iY - iOffsetY) == iDirection;
+					const int iNeeded = iStepEnd + SDiffusionKernel::kMaxOffsetX;
+					wavefront.waitForProgress(iY - iOffsetY, bSameDirection && iNeeded < iWidth ? iNeeded : iWidth);
+				}
+
+				for (int i = iStep; i < iStepEnd; i++)
+				{
+					const int iX = iDirection > 0 ? i : iWidth - 1 - i;
+					int iRGB[3];
+					unsigned char* pPixel = pRow + size_t(iX) * iNumChannels;
+					for (int iChannel = 0; iChannel < 3; iChannel++)
+					{
+						const ptrdiff_t iIndex = ptrdiff_t(iX) * 3 + iChannel;
+						int iSum = 0;
+						for (int iTap = 0; iTap < kernel.iNumTaps; iTap++)
+							iSum += int(pTapSource[iTap][iIndex]) * iTapWeight[iTap];
+						const int iValue = int(pPixel[iChannel]) + ((iSum + iRounding) >> kernel.iShift);
+						iRGB[iChannel] = iValue < 0 ? 0 : (iValue > 255 ? 255 : iValue);
+					}
+					int iQuantised[3] = { iRGB[0], iRGB[1], iRGB[2] };
+					quantise(iX, iY, iQuantised);
+					for (int iChannel = 0; iChannel < 3; iChannel++)
+					{
+						pPixel[iChannel] = (unsigned char)iQuantised[iChannel];
+						pError[ptrdiff_t(iX) * 3 + iChannel] = int16_t(iRGB[iChannel] - iQuantised[iChannel]);
+					}
+				}
+				wavefront.setProgress(iY, iStepEnd);
+			}
+		});
+	}
+}
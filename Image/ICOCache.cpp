@@ -0,0 +1,175 @@
+#include "ICOCache.h"
+#include "../Core/Exceptions.h"
+#include "../Core/Utilities.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief Mixed into every key. Increase this whenever a change to the conversion itself would change the .ico files written,
+		/// so that entries made by older versions are never hit and are evicted in time.
+		const uint32_t kCacheFormatVersion = 1;
+
+		const char* kEntryExtension = ".ico";
+	}
+
+	CICOCache::CICOCache(const std::string& strDirectory, uint64_t uiMaxSizeInBytes)
+	{
+		_mstrDirectory = strDirectory;
+		_muiMaxSizeInBytes = uiMaxSizeInBytes;
+		_muiSizeInBytes = 0;
+		_matomicNumHits = 0;
+		_matomicNumMisses = 0;
+
+		std::error_code errorCode;
+		std::filesystem::create_directories(_mstrDirectory, errorCode);
+		ThrowIfFalse(std::filesystem::is_directory(_mstrDirectory, errorCode), "CICOCache::CICOCache() failed to create the cache directory " + _mstrDirectory);
+	}
+
+	uint64_t CICOCache::computeKey(const std::vector<uint8_t>& vSourceFileData, const CImage::SICOSettings& settings)
+	{
+		std::vector<uint32_t> vSettings;
+		vSettings.push_back(kCacheFormatVersion);
+		vSettings.push_back(uint32_t(settings.vIconSizes.size()));
+		for (int iSize : settings.vIconSizes)
+			vSettings.push_back(uint32_t(iSize));
+		vSettings.push_back(settings.bUseResizePyramid ? 1 : 0);
+		vSettings.push_back(uint32_t(settings.ePNGEffort));
+		vSettings.push_back(settings.bAllowPNGPassthrough ? 1 : 0);
+		uint32_t uiSharpenAmountBits;
+		memcpy(&uiSharpenAmountBits, &settings.fSharpenAmount, sizeof(uiSharpenAmountBits));
+		vSettings.push_back(uiSharpenAmountBits);
+		vSettings.push_back(uint32_t(settings.iPaletteBitsPerPixel));
+		vSettings.push_back(uint32_t(settings.iPaletteMaxSize));
+		vSettings.push_back(uint32_t(settings.ePaletteDither));
+		vSettings.push_back(settings.bPalettePNG ? 1 : 0);
+
+		const uint64_t uiSourceHash = computeHash64(vSourceFileData.data(), vSourceFileData.size());
+		return computeHash64(vSettings.data(), vSettings.size() * sizeof(uint32_t), uiSourceHash);
+	}
+
+	bool CICOCache::fetch(uint64_t uiKey, const std::string& strOutputFilename)
+	{
+		const std::string strEntry = _getEntryFilename(uiKey);
+		std::error_code errorCode;
+		bool bFound = std::filesystem::is_regular_file(strEntry, errorCode);
+		if (bFound)
+		{
+			// Removing the output first means a hard link from an earlier run is replaced, rather than the entry it shares being written through.
+			std::filesystem::remove(strOutputFilename, errorCode);
+			std::filesystem::create_hard_link(strEntry, strOutputFilename, errorCode);
+			if (errorCode)
+				bFound = std::filesystem::copy_file(strEntry, strOutputFilename, std::filesystem::copy_options::overwrite_existing, errorCode);
+		}
+		if (!bFound)
+		{
+			_matomicNumMisses++;
+			return false;
+		}
+
+		// Mark as recently used. This also touches a hard linked output, which is then newer than its source, as a build would expect.
+		std::filesystem::last_write_time(strEntry, std::filesystem::file_time_type::clock::now(), errorCode);
+		_matomicNumHits++;
+		return true;
+	}
+
+	bool CICOCache::store(uint64_t uiKey, const std::vector<uint8_t>& vICOData)
+	{
+		const std::string strEntry = _getEntryFilename(uiKey);
+
+		// Written under a name unique to this thread and moment, then renamed, so a reader never sees a partly written entry
+		const size_t uiUnique = std::hash<std::thread::id>()(std::this_thread::get_id()) ^ size_t(std::chrono::steady_clock::now().time_since_epoch().count());
+		std::string strTemp = strEntry + "." + std::to_string(uiUnique) + ".tmp";
+		std::ofstream ofs(strTemp, std::ios::out | std::ios::binary);
+		if (!ofs)
+			return false;
+		ofs.write(reinterpret_cast<const char*>(vICOData.data()), std::streamsize(vICOData.size()));
+		ofs.close();
+
+		std::error_code errorCode;
+		if (ofs.fail())
+		{
+			std::filesystem::remove(strTemp, errorCode);
+			return false;
+		}
+		std::filesystem::rename(strTemp, strEntry, errorCode);
+		if (errorCode)
+		{
+			std::filesystem::remove(strTemp, errorCode);
+			return false;
+		}
+		return true;
+	}
+
+	size_t CICOCache::evict(void)
+	{
+		struct SEntry
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type timeLastUsed;
+			uint64_t uiSize;
+		};
+		std::vector<SEntry> vEntries;
+		_muiSizeInBytes = 0;
+		std::error_code errorCode;
+		for (const std::filesystem::directory_entry& dirEntry : std::filesystem::directory_iterator(_mstrDirectory, errorCode))
+		{
+			if (!dirEntry.is_regular_file(errorCode) || dirEntry.path().extension() != kEntryExtension)
+				continue;
+			SEntry entry;
+			entry.path = dirEntry.path();
+			entry.timeLastUsed = dirEntry.last_write_time(errorCode);
+			entry.uiSize = dirEntry.file_size(errorCode);
+			if (errorCode)
+				continue;
+			_muiSizeInBytes += entry.uiSize;
+			vEntries.push_back(entry);
+		}
+		if (_muiSizeInBytes <= _muiMaxSizeInBytes)
+			return 0;
+
+		std::sort(vEntries.begin(), vEntries.end(), [](const SEntry& a, const SEntry& b) { return a.timeLastUsed < b.timeLastUsed; });
+		size_t iNumRemoved = 0;
+		for (const SEntry& entry : vEntries)
+		{
+			if (_muiSizeInBytes <= _muiMaxSizeInBytes)
+				break;
+			if (std::filesystem::remove(entry.path, errorCode))
+			{
+				_muiSizeInBytes -= entry.uiSize;
+				iNumRemoved++;
+			}
+		}
+		return iNumRemoved;
+	}
+
+	uint64_t CICOCache::getSizeInBytes(void) const
+	{
+		return _muiSizeInBytes;
+	}
+
+	size_t CICOCache::getNumHits(void) const
+	{
+		return _matomicNumHits;
+	}
+
+	size_t CICOCache::getNumMisses(void) const
+	{
+		return _matomicNumMisses;
+	}
+
+	std::string CICOCache::_getEntryFilename(uint64_t uiKey) const
+	{
+		char szKey[17];
+		snprintf(szKey, sizeof(szKey), "%016llx", static_cast<unsigned long long>(uiKey));
+		return (std::filesystem::path(_mstrDirectory) / (std::string(szKey) + kEntryExtension)).string();
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "Image.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace X
+{
+	/// \brief An on disk cache of converted .ico files, keyed by the contents of the source image file and the conversion settings.
+	///
+	/// Each entry is a complete .ico file named after its 64 bit key, so a hit only needs the source file to be hashed,
+	/// not decoded. The output file is then hard linked to the entry, or copied if that isn't possible.
+	/// The cache is kept within a size limit by removing the least recently used entries, using each file's last write time,
+	/// which is updated on every hit.
+	///
+	/// Any number of threads may use one object at once, and several processes may share one directory, as entries are
+	/// written to a temporary file first and then renamed into place.
+	/// \code
+	/// CICOCache cache("build/icocache", 256 * 1024 * 1024);
+	/// uint64_t uiKey = CICOCache::computeKey(vSourceFileData, settings);
+	/// if (!cache.fetch(uiKey, "icon.ico"))
+	/// {
+	///		// Convert as usual into vICOData, write it out, then...
+	///		cache.store(uiKey, vICOData);
+	/// }
+	/// cache.evict();
+	/// \endcode
+	class CICOCache
+	{
+	public:
+		/// \brief Constructor, creates the cache directory if it doesn't exist yet.
+		///
+		/// \param strDirectory The directory holding the cache entries.
+		/// \param uiMaxSizeInBytes The total size of all entries which evict() reduces the cache to.
+		///
+		/// If the directory cannot be created, an exception occurs.
+		CICOCache(const std::string& strDirectory, uint64_t uiMaxSizeInBytes);
+
+		/// \brief Computes the key of an entry from the source image file's contents and every setting which changes the .ico file written.
+		///
+		/// \param vSourceFileData The complete contents of the source image file.
+		/// \param settings The settings the .ico file is created with.
+		/// \return The key to pass to fetch() and store().
+		///
+		/// SICOSettings::bMultithreaded is ignored as it doesn't change the output.
+		static uint64_t computeKey(const std::vector<uint8_t>& vSourceFileData, const CImage::SICOSettings& settings);
+
+		/// \brief Makes the given output file a copy of the entry with the given key, if there is one.
+		///
+		/// \param uiKey The key computed by computeKey()
+		/// \param strOutputFilename The .ico file to create. Any existing file is removed first rather than overwritten.
+		/// \return True on a hit, false if there is no such entry or it couldn't be linked or copied.
+		///
+		/// Counts towards getNumHits() or getNumMisses().
+		bool fetch(uint64_t uiKey, const std::string& strOutputFilename);
+
+		/// \brief Adds an entry to the cache, replacing any existing one with the same key.
+		///
+		/// \param uiKey The key computed by computeKey()
+		/// \param vICOData The complete .ico file
+		/// \return False if the entry couldn't be written. The cache is still usable, it just won't hit on this key.
+		bool store(uint64_t uiKey, const std::vector<uint8_t>& vICOData);
+
+		/// \brief Removes the least recently used entries until the cache is no larger than its size limit.
+		///
+		/// \return The number of entries removed.
+		///
+		/// Call this once a batch of conversions is complete, rather than after each one.
+		size_t evict(void);
+
+		/// \brief Returns the total size of all entries, as found by the last call to evict().
+		uint64_t getSizeInBytes(void) const;
+
+		/// \brief Returns the number of calls to fetch() which found an entry.
+		size_t getNumHits(void) const;
+
+		/// \brief Returns the number of calls to fetch() which didn't find an entry.
+		size_t getNumMisses(void) const;
+	private:
+		std::string _mstrDirectory;				///< The directory holding the cache entries
+		uint64_t _muiMaxSizeInBytes;			///< The size evict() reduces the cache to
+		uint64_t _muiSizeInBytes;				///< Total size of all entries found by the last call to evict()
+		std::atomic<size_t> _matomicNumHits;	///< Number of calls to fetch() which found an entry
+		std::atomic<size_t> _matomicNumMisses;	///< Number of calls to fetch() which didn't find an entry
+
+		/// \brief Returns the filename of the entry with the given key.
+		std::string _getEntryFilename(uint64_t uiKey) const;
+	};
+}
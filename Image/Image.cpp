@@ -1,9 +1,12 @@
 #include "Image.h"
 
 #include "../Core/Exceptions.h"
+#include "../Core/MemoryMappedFile.h"
+#include "../Core/Multithreading.h"
 #include "../Core/StringUtils.h"
 #include "../Core/Utilities.h"
 #include "../Math/Vector3f.h"
+#include "PixelKernels.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -16,7 +19,9 @@
 
 #include <random>
 #include "FastNoiseLite.h"
-#include <complex>
+#include <algorithm>
+#include <cstdlib>
+#include <type_traits>
 
 namespace X
 {
@@ -39,12 +44,58 @@ namespace X
 		uint32_t dwBytesInRes;  // Size of the image data
 		uint32_t dwImageOffset; // Offset of the image data from the beginning of the file
 	};
+
+	/// \brief Structure for .ico saving of paletted BMP image data
+	struct BITMAPINFOHEADER {
+		uint32_t biSize;
+		int32_t  biWidth;
+		int32_t  biHeight;
+		uint16_t biPlanes;
+		uint16_t biBitCount;
+		uint32_t biCompression;
+		uint32_t biSizeImage;
+		int32_t  biXPelsPerMeter;
+		int32_t  biYPelsPerMeter;
+		uint32_t biClrUsed;
+		uint32_t biClrImportant;
+	};
 #pragma pack(pop) // Reset to default packing
 
+	CImage::SICOSettings::SICOSettings()
+	{
+		vIconSizes = { 16, 32, 48, 64, 128, 256 };
+		bUseResizePyramid = true;
+		bMultithreaded = true;
+		ePNGEffort = CPNGEncoder::EFFORT_DEFAULT;
+		bAllowPNGPassthrough = true;
+		fSharpenAmount = 0.0f;
+		iPaletteBitsPerPixel = 0;
+		iPaletteMaxSize = 32;
+		ePaletteDither = CPalette::DITHER_FLOYD_STEINBERG;
+		bPalettePNG = false;
+	}
+
+	CImage::SMandelbrotShortcuts::SMandelbrotShortcuts()
+	{
+		bSkipBulbs = false;
+		bCheckPeriodicity = false;
+		bSubdivide = false;
+	}
+
+	CImage::SMandelbrotShortcuts CImage::SMandelbrotShortcuts::exact(void)
+	{
+		SMandelbrotShortcuts shortcuts;
+		shortcuts.bSkipBulbs = true;
+		shortcuts.bCheckPeriodicity = true;
+		return shortcuts;
+	}
+
 	CImage::CImage()
 	{
 		_mpData = 0;
+		_mpBuffer = nullptr;
 		_muiDataSize = 0;
+		_muiSourcePNGPixelHash = 0;
 		free();
 	}
 
@@ -53,29 +104,241 @@ namespace X
 		free();
 	}
 
+	CImage::CImage(const CImage& other)
+	{
+		_mpData = 0;
+		_mpBuffer = nullptr;
+		_muiDataSize = 0;
+		_muiSourcePNGPixelHash = 0;
+		free();
+		if (other._mpData)
+			other.copyTo(*this);
+	}
+
+	CImage::CImage(CImage&& other) noexcept
+	{
+		_mpData = 0;
+		_mpBuffer = nullptr;
+		_muiDataSize = 0;
+		_muiSourcePNGPixelHash = 0;
+		_miWidth = _miHeight = _miNumChannels = 0;
+		swap(other);
+	}
+
 	CImage& CImage::operator=(const CImage& other)
 	{
 		// Guard against self assignment
 		if (this == &other)
 			return *this;
 
-		other.copyTo(*this);
+		if (other._mpData)
+			other.copyTo(*this);
+		else
+			free();
 		return *this;
 	}
 
+	CImage& CImage::operator=(CImage&& other) noexcept
+	{
+		if (this != &other)
+		{
+			free();
+			swap(other);
+		}
+		return *this;
+	}
 
-	void CImage::free(void)
+	void CImage::swap(CImage& other) noexcept
+	{
+		std::swap(_mpData, other._mpData);
+		std::swap(_mpBuffer, other._mpBuffer);
+		std::swap(_muiDataSize, other._muiDataSize);
+		std::swap(_miWidth, other._miWidth);
+		std::swap(_miHeight, other._miHeight);
+		std::swap(_miNumChannels, other._miNumChannels);
+		_mvSourcePNG.swap(other._mvSourcePNG);
+		std::swap(_muiSourcePNGPixelHash, other._muiSourcePNGPixelHash);
+	}
+
+	void CImage::adoptData(unsigned char* pData, unsigned int iWidth, unsigned int iHeight, unsigned short iNumChannels, DataDeleter funcDeleter)
+	{
+		ThrowIfTrue(!pData, "Given data is null.");
+		ThrowIfTrue(iWidth < 1, "Given width < 1.");
+		ThrowIfTrue(iHeight < 1, "Given height < 1.");
+		ThrowIfTrue(iNumChannels < 3 || iNumChannels > 4, "Given number of channels must be 3 or 4.");
+
+		free();
+		_setData(pData, std::move(funcDeleter));
+		_miWidth = iWidth;
+		_miHeight = iHeight;
+		_miNumChannels = iNumChannels;
+		_muiDataSize = _miWidth * _miHeight * _miNumChannels;
+	}
+
+	unsigned char* CImage::releaseData(DataDeleter& funcDeleter)
+	{
+		funcDeleter = [](unsigned char* p) { std::free(p); };
+		if (!_mpBuffer)
+			return nullptr;
+
+		// Other images keep shared data, so give the caller a copy of it
+		_detach();
+		unsigned char* pData = _mpBuffer->pData;
+		if (_mpBuffer->pAllocator)
+		{
+			CPixelAllocator* pAllocator = _mpBuffer->pAllocator;
+			const size_t uiAllocatedSize = _mpBuffer->uiAllocatedSize;
+			funcDeleter = [pAllocator, uiAllocatedSize](unsigned char* p) { pAllocator->deallocate(p, uiAllocatedSize); };
+		}
+		else if (_mpBuffer->funcDeleter)
+			funcDeleter = std::move(_mpBuffer->funcDeleter);
+
+		// Now that the data isn't ours, free() only resets the rest
+		delete _mpBuffer;
+		_mpBuffer = nullptr;
+		_mpData = NULL;
+		free();
+		return pData;
+	}
+
+	void CImage::_setData(unsigned char* pData, DataDeleter funcDeleter)
+	{
+		SPixelBuffer* pBuffer = new SPixelBuffer;
+		pBuffer->pData = pData;
+		pBuffer->funcDeleter = std::move(funcDeleter);
+		pBuffer->pAllocator = nullptr;
+		pBuffer->uiAllocatedSize = 0;
+		pBuffer->uiRefCount.store(1, std::memory_order_relaxed);
+		_mpBuffer = pBuffer;
+		_mpData = pData;
+	}
+
+	void CImage::_allocateData(bool bClear)
+	{
+		CPixelAllocator& allocator = getAllocator();
+		unsigned char* pData = allocator.allocate(_muiDataSize, bClear);
+		ThrowIfTrue(!pData, "Failed to allocate memory.");
+		try
+		{
+			_setData(pData, DataDeleter());
+		}
+		catch (...)
+		{
+			allocator.deallocate(pData, _muiDataSize);
+			throw;
+		}
+		_mpBuffer->pAllocator = &allocator;
+		_mpBuffer->uiAllocatedSize = _muiDataSize;
+	}
+
+	// The allocator set by setAllocator(), or nullptr for the global one
+	static std::atomic<CPixelAllocator*> atomicAllocator(nullptr);
+
+	void CImage::setAllocator(CPixelAllocator* pAllocator)
+	{
+		atomicAllocator.store(pAllocator, std::memory_order_release);
+	}
+
+	CPixelAllocator& CImage::getAllocator(void)
 	{
-		if (_mpData)
+		CPixelAllocator* pAllocator = atomicAllocator.load(std::memory_order_acquire);
+		return pAllocator ? *pAllocator : CPixelAllocator::getGlobal();
+	}
+
+	// The limit set by setMaxThreads(), 0 for no limit
+	static std::atomic<unsigned int> atomicMaxThreads(0);
+
+	void CImage::setMaxThreads(unsigned int uiMaxThreads)
+	{
+		atomicMaxThreads.store(uiMaxThreads, std::memory_order_relaxed);
+	}
+
+	unsigned int CImage::getMaxThreads(void)
+	{
+		return atomicMaxThreads.load(std::memory_order_relaxed);
+	}
+
+	void CImage::_forEachRowBand(int iNumRows, int iRowLength, const std::function<void(int iFirstRow, int iLastRow)>& funcBody, bool bMultithreaded)
+	{
+		if (iNumRows < 1 || iRowLength < 1)
+			return;
+		const unsigned int uiMaxThreads = getMaxThreads();
+		if (!bMultithreaded || 1 == uiMaxThreads || size_t(iNumRows) * size_t(iRowLength) < kMinPixelsForThreads)
+		{
+			funcBody(0, iNumRows);
+			return;
+		}
+
+		// Around 4 bands per thread so that they balance out, but none so small that handing it to another thread isn't worth it
+		CThreadPool& pool = CThreadPool::getGlobal();
+		const size_t uiMinRowsPerBand = (kMinPixelsForThreads / 4 + iRowLength - 1) / iRowLength;
+		size_t uiRowsPerBand = size_t(iNumRows) / (size_t(pool.getNumThreads()) * 4);
+		if (uiRowsPerBand < uiMinRowsPerBand)
+			uiRowsPerBand = uiMinRowsPerBand;
+		pool.parallelFor(0, iNumRows, uiRowsPerBand, [&funcBody](size_t uiFirstRow, size_t uiLastRow)
+		{
+			funcBody(int(uiFirstRow), int(uiLastRow));
+		}, uiMaxThreads);
+	}
+
+	void CImage::_releaseBuffer(void)
+	{
+		if (_mpBuffer)
+		{
+			if (1 == _mpBuffer->uiRefCount.fetch_sub(1, std::memory_order_acq_rel))
+			{
+				if (_mpBuffer->pAllocator)
+					_mpBuffer->pAllocator->deallocate(_mpBuffer->pData, _mpBuffer->uiAllocatedSize);
+				else if (_mpBuffer->funcDeleter)
+					_mpBuffer->funcDeleter(_mpBuffer->pData);
+				else
+					std::free(_mpBuffer->pData);
+				delete _mpBuffer;
+			}
+			_mpBuffer = nullptr;
+		}
+		_mpData = NULL;
+	}
+
+	void CImage::_detachShared(void)
+	{
+		// Keep a reference to the shared buffer until the copy is made, so it can't be freed meanwhile
+		SPixelBuffer* pShared = _mpBuffer;
+		_mpBuffer = nullptr;
+		try
+		{
+			_allocateData(false);
+		}
+		catch (...)
 		{
-			delete[] _mpData;
-			_mpData = NULL;
-			_muiDataSize = 0;
+			_mpBuffer = pShared;
+			_mpData = pShared->pData;
+			throw;
 		}
+		memcpy(_mpData, pShared->pData, _muiDataSize);
+
+		// Let go of the shared buffer, which frees it if the other images have let go of it meanwhile
+		SPixelBuffer* pOwn = _mpBuffer;
+		_mpBuffer = pShared;
+		_releaseBuffer();
+		_mpBuffer = pOwn;
+		_mpData = pOwn->pData;
+	}
+
+	bool CImage::isDataShared(void) const
+	{
+		return _mpBuffer && _mpBuffer->uiRefCount.load(std::memory_order_acquire) > 1;
+	}
+
+	void CImage::free(void)
+	{
+		_releaseBuffer();
+		_muiDataSize = 0;
 		_miWidth = _miHeight = _miNumChannels = 0;
+		_mvSourcePNG.clear();
 	}
 
-	void CImage::createBlank(unsigned int iWidth, unsigned int iHeight, unsigned short iNumChannels)
+	void CImage::createBlank(unsigned int iWidth, unsigned int iHeight, unsigned short iNumChannels, bool bClear)
 	{
 		free();
 		ThrowIfTrue(iWidth < 1, "Given width < 1.");
@@ -87,68 +350,87 @@ namespace X
 		_miHeight = iHeight;
 		_miNumChannels = iNumChannels;
 		_muiDataSize = _miWidth * _miHeight * _miNumChannels;
-		_mpData = new unsigned char[_muiDataSize];
-		ThrowIfTrue(!_mpData, "Failed to allocate memory.");
+		_allocateData(bClear);
+	}
+
+	bool CImage::load(const std::string& strFilename, bool bFlipForOpenGL, int iMinSizeNeeded)
+	{
+		if (StringUtils::hasFilenameExtension(strFilename, "dif"))
+		{
+			free();
+			return _loadDIF(strFilename, bFlipForOpenGL);
+		}
 
-		// Zero out the new memory all to zero
-		for (unsigned int i = 0; i < _muiDataSize; ++i)
+		// The file is opened once and everything, from detecting its format to decoding it, works from the mapped bytes
+		CMemoryMappedFile file;
+		if (!file.open(strFilename))
 		{
-			_mpData[i] = 0;
+			free();
+			return false;
 		}
+		return loadFromMemory(file.getData(), file.getSize(), bFlipForOpenGL, iMinSizeNeeded);
 	}
 
-	bool CImage::load(const std::string& strFilename, bool bFlipForOpenGL)
+	bool CImage::loadFromMemory(const uint8_t* pFileData, size_t uiFileSize, bool bFlipForOpenGL, int iMinSizeNeeded)
 	{
 		free();
+		if (!pFileData || uiFileSize > size_t(kMaxInt))
+			return false;
 
-		if (StringUtils::hasFilenameExtension(strFilename, "dif"))
-			return _loadDIF(strFilename, bFlipForOpenGL);
-
-		// Use stb_image to load...
-		stbi_set_flip_vertically_on_load(bFlipForOpenGL);
-
-		// Get number of channels in the image file
+		// Get number of channels in the image data. Grey is expanded to RGB and grey with alpha to RGBA by stb_image itself.
 		int iDims[2];
-		int iNumChannels = 3;
-		loadInfo(strFilename, iDims[0], iDims[1], iNumChannels);
-		stbi_uc* pixels = 0;
-		if (4 == iNumChannels)
-			pixels = stbi_load(strFilename.c_str(), &_miWidth, &_miHeight, &_miNumChannels, STBI_rgb_alpha);
-		else if (3 == iNumChannels)
-			pixels = stbi_load(strFilename.c_str(), &_miWidth, &_miHeight, &_miNumChannels, STBI_rgb);
-		else if (1 == iNumChannels)
-			pixels = stbi_load(strFilename.c_str(), &_miWidth, &_miHeight, &_miNumChannels, 1);
-
-		if (!pixels)
+		int iNumChannels = 0;
+		if (!stbi_info_from_memory(pFileData, int(uiFileSize), &iDims[0], &iDims[1], &iNumChannels))
 			return false;
-
-		// If number of channels is 1, then we convert that 1 channel to 3 and duplicate the R to G and B
-		if (1 == iNumChannels)
+		const int iDesiredChannels = (4 == iNumChannels || 2 == iNumChannels) ? STBI_rgb_alpha : STBI_rgb;
+
+		// Per thread settings, so that images may be loaded on many threads at once
+		stbi_set_flip_vertically_on_load_thread(bFlipForOpenGL);
+		stbi_set_jpeg_min_decode_size_thread(iMinSizeNeeded, iMinSizeNeeded);
+		int iChannelsInFile = 0;
+		stbi_uc* pixels = stbi_load_from_memory(pFileData, int(uiFileSize), &_miWidth, &_miHeight, &iChannelsInFile, iDesiredChannels);
+		stbi_set_jpeg_min_decode_size_thread(0, 0);
+		if (!pixels)
 		{
-			_miNumChannels = 3;
+			_miWidth = _miHeight = 0;
+			return false;
 		}
 
-		// Compute size and allocate
+		// stb_image allocates with malloc(), as does this class, so its buffer becomes this image's data as is
+		_setData(pixels, DataDeleter());
+		_miNumChannels = iDesiredChannels;
 		_muiDataSize = _miWidth * _miHeight * _miNumChannels;
-		_mpData = new unsigned char[_muiDataSize];
 
-		if (1 != iNumChannels)
-			memcpy(_mpData, pixels, static_cast<size_t>(_muiDataSize));
-		else // We need to copy the R to G and B
-		{
-			unsigned int iPixelIndex = 0;
-			for (unsigned int i = 0; i < _muiDataSize; i += 3)
-			{
-				_mpData[i] = pixels[iPixelIndex];
-				_mpData[i + 1] = pixels[iPixelIndex];
-				_mpData[i + 2] = pixels[iPixelIndex];
-				iPixelIndex++;
-			}
-		}
-		stbi_image_free(pixels);
+		if (!bFlipForOpenGL)
+			_keepSourcePNGIfSuitable(pFileData, uiFileSize);
 		return true;
 	}
 
+	void CImage::_keepSourcePNGIfSuitable(const uint8_t* pFileData, size_t uiFileSize)
+	{
+		_mvSourcePNG.clear();
+
+		// Only square RGBA images of a size which a .ico file can hold are worth keeping
+		if (4 != _miNumChannels || _miWidth != _miHeight || _miWidth > 256)
+			return;
+		if (uiFileSize < 33)	// Signature and IHDR chunk
+			return;
+
+		// Must be a PNG whose IHDR chunk says it's 8 bits per channel RGBA (colour type 6) without interlacing,
+		// which is the format Windows expects of PNG images stored in a .ico file.
+		const uint8_t uiSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		if (0 != memcmp(pFileData, uiSignature, 8) || 0 != memcmp(pFileData + 12, "IHDR", 4))
+			return;
+		const uint8_t* pIHDR = pFileData + 16;
+		const uint32_t uiWidth = (uint32_t(pIHDR[0]) << 24) | (uint32_t(pIHDR[1]) << 16) | (uint32_t(pIHDR[2]) << 8) | pIHDR[3];
+		const uint32_t uiHeight = (uint32_t(pIHDR[4]) << 24) | (uint32_t(pIHDR[5]) << 16) | (uint32_t(pIHDR[6]) << 8) | pIHDR[7];
+		if (uiWidth != uint32_t(_miWidth) || uiHeight != uint32_t(_miHeight) || 8 != pIHDR[8] || 6 != pIHDR[9] || 0 != pIHDR[12])
+			return;
+
+		_mvSourcePNG.assign(pFileData, pFileData + uiFileSize);
+		_muiSourcePNGPixelHash = computeHash64(_mpData, _muiDataSize);
+	}
+
 	bool CImage::loadInfo(const std::string& strFilename, int& iWidth, int& iHeight, int& iNumChannels)
 	{
 		if (StringUtils::hasFilenameExtension(strFilename, "dif"))
@@ -180,11 +462,18 @@ namespace X
 		ThrowIfTrue(!stbi_write_jpg(strFilename.c_str(), _miWidth, _miHeight, _miNumChannels, _mpData, iQuality), "Image failed to be written.");
 	}
 
-	void CImage::saveAsPNG(const std::string& strFilename, bool bFlipOnSave) const
+	void CImage::saveAsPNG(const std::string& strFilename, bool bFlipOnSave, CPNGEncoder::EEffort ePNGEffort) const
 	{
 		ThrowIfTrue(!_mpData, "CImage::saveAsPNG() failed. Image not yet created.");
-		stbi_flip_vertically_on_write(bFlipOnSave); // flag is non-zero to flip data vertically
-		ThrowIfTrue(!stbi_write_png(strFilename.c_str(), _miWidth, _miHeight, _miNumChannels, _mpData, _miWidth * _miNumChannels), "Image failed to be written.");
+		// CPNGEncoder rather than stb_image_write, as it compresses large images such as atlas pages on all cores
+		CPNGEncoder encoder(ePNGEffort);
+		std::vector<uint8_t> vPNGData;
+		ThrowIfTrue(!encoder.encode(_mpData, _miWidth, _miHeight, _miNumChannels, vPNGData, bFlipOnSave), "Image failed to be encoded.");
+		std::ofstream ofs(strFilename, std::ios::binary);
+		ThrowIfTrue(!ofs, "Image failed to be written.");
+		ofs.write(reinterpret_cast<const char*>(vPNGData.data()), std::streamsize(vPNGData.size()));
+		ofs.close();
+		ThrowIfTrue(ofs.fail(), "Image failed to be written.");
 	}
 
 	void CImage::saveAsTGA(const std::string& strFilename, bool bFlipOnSave) const
@@ -197,38 +486,45 @@ namespace X
 	void CImage::fill(unsigned char ucRed, unsigned char ucGreen, unsigned char ucBlue, unsigned char ucAlpha)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		unsigned int i = 0;
-
-		// 3 Colour channels
-		if (3 == _miNumChannels)
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			while (i < _muiDataSize)
+			unsigned int i = iFirstRow * iRowSize;
+			const unsigned int iEnd = iLastRow * iRowSize;
+
+			// 3 Colour channels
+			if (3 == _miNumChannels)
 			{
-				_mpData[i] = ucRed;
-				_mpData[i + 1] = ucGreen;
-				_mpData[i + 2] = ucBlue;
-				i += _miNumChannels;
+				while (i < iEnd)
+				{
+					_mpData[i] = ucRed;
+					_mpData[i + 1] = ucGreen;
+					_mpData[i + 2] = ucBlue;
+					i += _miNumChannels;
+				}
 			}
-		}
 
-		// 4 colour channels
-		if (4 == _miNumChannels)
-		{
-			while (i < _muiDataSize)
+			// 4 colour channels
+			if (4 == _miNumChannels)
 			{
-				_mpData[i] = ucRed;
-				_mpData[i + 1] = ucGreen;
-				_mpData[i + 2] = ucBlue;
-				_mpData[i + 3] = ucAlpha;
-				i += _miNumChannels;
+				while (i < iEnd)
+				{
+					_mpData[i] = ucRed;
+					_mpData[i + 1] = ucGreen;
+					_mpData[i + 2] = ucBlue;
+					_mpData[i + 3] = ucAlpha;
+					i += _miNumChannels;
+				}
 			}
-		}
+		});
 	}
 
 	void CImage::fillCellularNoise(float fFrequency, unsigned int uiOctaves, CColourRamp colourRamp)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
 		// Create and configure FastNoise object
 		FastNoiseLite noise;
@@ -237,51 +533,55 @@ namespace X
 		noise.SetFractalOctaves(uiOctaves);
 		noise.SetFractalType(FastNoiseLite::FractalType_Ridged);
 		// Gather noise data
-		int index = 0;
-		float fNoise;
-		CColourf colour;
-		if (3 == _miNumChannels)
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			for (int y = 0; y < _miHeight; y++)
+			int index = iFirstRow * _miWidth * _miNumChannels;
+			float fNoise;
+			CColourf colour;
+			if (3 == _miNumChannels)
 			{
-				for (int x = 0; x < _miWidth; x++)
+				for (int y = iFirstRow; y < iLastRow; y++)
 				{
-					// Get noise value for pixel and convert from -1 to 1 to 0 to 1
-					fNoise = noise.GetNoise((float)x, (float)y);
-					fNoise += 1.0f;
-					fNoise *= 0.5f;
-					colour = colourRamp.getRampColour(fNoise);
-
-					_mpData[index++] = unsigned char(colour.red * 255.0f);
-					_mpData[index++] = unsigned char(colour.green * 255.0f);
-					_mpData[index++] = unsigned char(colour.blue * 255.0f);
+					for (int x = 0; x < _miWidth; x++)
+					{
+						// Get noise value for pixel and convert from -1 to 1 to 0 to 1
+						fNoise = noise.GetNoise((float)x, (float)y);
+						fNoise += 1.0f;
+						fNoise *= 0.5f;
+						colour = colourRamp.getRampColour(fNoise);
+
+						_mpData[index++] = unsigned char(colour.red * 255.0f);
+						_mpData[index++] = unsigned char(colour.green * 255.0f);
+						_mpData[index++] = unsigned char(colour.blue * 255.0f);
+					}
 				}
 			}
-		}
-		else if (4 == _miNumChannels)
-		{
-			for (int y = 0; y < _miHeight; y++)
+			else if (4 == _miNumChannels)
 			{
-				for (int x = 0; x < _miWidth; x++)
+				for (int y = iFirstRow; y < iLastRow; y++)
 				{
-					// Get noise value for pixel and convert from -1 to 1 to 0 to 1
-					fNoise = noise.GetNoise((float)x, (float)y);
-					fNoise += 1.0f;
-					fNoise *= 0.5f;
-					colour = colourRamp.getRampColour(fNoise);
-
-					_mpData[index++] = unsigned char(colour.red * 255.0f);
-					_mpData[index++] = unsigned char(colour.green * 255.0f);
-					_mpData[index++] = unsigned char(colour.blue * 255.0f);
-					_mpData[index++] = unsigned char(colour.alpha * 255.0f);
+					for (int x = 0; x < _miWidth; x++)
+					{
+						// Get noise value for pixel and convert from -1 to 1 to 0 to 1
+						fNoise = noise.GetNoise((float)x, (float)y);
+						fNoise += 1.0f;
+						fNoise *= 0.5f;
+						colour = colourRamp.getRampColour(fNoise);
+
+						_mpData[index++] = unsigned char(colour.red * 255.0f);
+						_mpData[index++] = unsigned char(colour.green * 255.0f);
+						_mpData[index++] = unsigned char(colour.blue * 255.0f);
+						_mpData[index++] = unsigned char(colour.alpha * 255.0f);
+					}
 				}
 			}
-		}
+		});
 	}
 
 	void CImage::fillPerlinNoise(float fFrequency, unsigned int uiOctaves, CColourRamp colourRamp)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 		
 		// Create and configure FastNoise object
 		FastNoiseLite noise;
@@ -290,260 +590,357 @@ namespace X
 		noise.SetFractalOctaves(uiOctaves);
 		noise.SetFractalType(FastNoiseLite::FractalType_FBm);
 		// Gather noise data
-		int index = 0;
-		float fNoise;
-		CColourf colour;
-		if (3 == _miNumChannels)
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			for (int y = 0; y < _miHeight; y++)
+			int index = iFirstRow * _miWidth * _miNumChannels;
+			float fNoise;
+			CColourf colour;
+			if (3 == _miNumChannels)
 			{
-				for (int x = 0; x < _miWidth; x++)
+				for (int y = iFirstRow; y < iLastRow; y++)
 				{
-					// Get noise value for pixel and convert from -1 to 1 to 0 to 1
-					fNoise = noise.GetNoise((float)x, (float)y);
-					fNoise += 1.0f;
-					fNoise *= 0.5f;
-					colour = colourRamp.getRampColour(fNoise);
-
-					_mpData[index++] = unsigned char(colour.red * 255.0f);
-					_mpData[index++] = unsigned char(colour.green * 255.0f);
-					_mpData[index++] = unsigned char(colour.blue * 255.0f);
+					for (int x = 0; x < _miWidth; x++)
+					{
+						// Get noise value for pixel and convert from -1 to 1 to 0 to 1
+						fNoise = noise.GetNoise((float)x, (float)y);
+						fNoise += 1.0f;
+						fNoise *= 0.5f;
+						colour = colourRamp.getRampColour(fNoise);
+
+						_mpData[index++] = unsigned char(colour.red * 255.0f);
+						_mpData[index++] = unsigned char(colour.green * 255.0f);
+						_mpData[index++] = unsigned char(colour.blue * 255.0f);
+					}
 				}
 			}
-		}
-		else if (4 == _miNumChannels)
-		{
-			for (int y = 0; y < _miHeight; y++)
+			else if (4 == _miNumChannels)
 			{
-				for (int x = 0; x < _miWidth; x++)
+				for (int y = iFirstRow; y < iLastRow; y++)
 				{
-					// Get noise value for pixel and convert from -1 to 1 to 0 to 1
-					fNoise = noise.GetNoise((float)x, (float)y);
-					fNoise += 1.0f;
-					fNoise *= 0.5f;
-					colour = colourRamp.getRampColour(fNoise);
-
-					_mpData[index++] = unsigned char(colour.red * 255.0f);
-					_mpData[index++] = unsigned char(colour.green * 255.0f);
-					_mpData[index++] = unsigned char(colour.blue * 255.0f);
-					_mpData[index++] = unsigned char(colour.alpha * 255.0f);
+					for (int x = 0; x < _miWidth; x++)
+					{
+						// Get noise value for pixel and convert from -1 to 1 to 0 to 1
+						fNoise = noise.GetNoise((float)x, (float)y);
+						fNoise += 1.0f;
+						fNoise *= 0.5f;
+						colour = colourRamp.getRampColour(fNoise);
+
+						_mpData[index++] = unsigned char(colour.red * 255.0f);
+						_mpData[index++] = unsigned char(colour.green * 255.0f);
+						_mpData[index++] = unsigned char(colour.blue * 255.0f);
+						_mpData[index++] = unsigned char(colour.alpha * 255.0f);
+					}
 				}
 			}
-		}
+		});
 	}
 
 	void CImage::fillRandomNoise(CColourRamp colourRamp)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
-		unsigned int i = 0;
+		_detach();
 
-		// Seed the random number generator with a non-deterministic value
+		// Seed the random number generator with a non-deterministic value.
+		// Each row gets a generator of its own, seeded from this one, so rows can be filled in any order on any thread.
 		std::random_device rd;
 		std::mt19937 gen(rd());
-		// Generate a random integer between 0 and 255
-		//std::uniform_int_distribution<> distrib(0, 255);
-		std::uniform_real_distribution<> distrib(0.0, 1.0);
-		CColourf colour;
-		double dPosition;
-		if (4 == _miNumChannels)
+		std::vector<std::mt19937::result_type> vRowSeeds(_miHeight);
+		for (auto& seed : vRowSeeds)
+			seed = gen();
+
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			while (i < _muiDataSize)
+			// Generate a random integer between 0 and 255
+			//std::uniform_int_distribution<> distrib(0, 255);
+			std::uniform_real_distribution<> distrib(0.0, 1.0);
+			CColourf colour;
+			double dPosition;
+			for (int iRow = iFirstRow; iRow < iLastRow; iRow++)
 			{
-				dPosition = distrib(gen);
-				colour = colourRamp.getRampColour(float(dPosition));
-				_mpData[i] = unsigned char(colour.red * 255.0f);
-				_mpData[i + 1] = unsigned char(colour.green * 255.0f);
-				_mpData[i + 2] = unsigned char(colour.blue * 255.0f);
-				_mpData[i + 3] = unsigned char(colour.alpha * 255.0f);
-				i += _miNumChannels;
+				std::mt19937 genRow(vRowSeeds[iRow]);
+				unsigned int i = iRow * iRowSize;
+				const unsigned int iEnd = i + iRowSize;
+				if (4 == _miNumChannels)
+				{
+					while (i < iEnd)
+					{
+						dPosition = distrib(genRow);
+						colour = colourRamp.getRampColour(float(dPosition));
+						_mpData[i] = unsigned char(colour.red * 255.0f);
+						_mpData[i + 1] = unsigned char(colour.green * 255.0f);
+						_mpData[i + 2] = unsigned char(colour.blue * 255.0f);
+						_mpData[i + 3] = unsigned char(colour.alpha * 255.0f);
+						i += _miNumChannels;
+					}
+				}
+				else if (3 == _miNumChannels)
+				{
+					while (i < iEnd)
+					{
+						dPosition = distrib(genRow);
+						colour = colourRamp.getRampColour(float(dPosition));
+						_mpData[i] = unsigned char(colour.red * 255.0f);
+						_mpData[i + 1] = unsigned char(colour.green * 255.0f);
+						_mpData[i + 2] = unsigned char(colour.blue * 255.0f);
+						i += _miNumChannels;
+					}
+				}
 			}
-		}
-		else if (3 == _miNumChannels)
+		});
+	}
+
+	namespace
+	{
+		/// \brief Works out the iteration counts of one tile of fillMandelbrot(), a row at a time, or by Mariani-Silver subdivision
+		class CMandelbrotTile
 		{
-			while (i < _muiDataSize)
+		public:
+			/// \brief Constructor
+			///
+			/// \param kernels The kernels to iterate pixels with
+			/// \param view Where each pixel's point is, and how it's iterated
+			/// \param iTileX The column of the tile's top left pixel within the image
+			/// \param iTileY The row of the tile's top left pixel within the image
+			/// \param puiIterations Where to write the counts, rows CImage::kMandelbrotTileSize apart
+			CMandelbrotTile(const SPixelKernels& kernels, const SPixelKernels::SMandelbrotView& view, int iTileX, int iTileY, unsigned int* puiIterations) :
+				_mKernels(kernels), _mView(view)
 			{
-				dPosition = distrib(gen);
-				colour = colourRamp.getRampColour(float(dPosition));
-				_mpData[i] = unsigned char(colour.red * 255.0f);
-				_mpData[i + 1] = unsigned char(colour.green * 255.0f);
-				_mpData[i + 2] = unsigned char(colour.blue * 255.0f);
-				i += _miNumChannels;
+				_miTileX = iTileX;
+				_miTileY = iTileY;
+				_mpuiIterations = puiIterations;
 			}
-		}
-	}
 
-	void CImage::fillMandelbrot(CColourRamp colourRamp, double minX, double maxX, double minY, double maxY,unsigned int uiMaxIterations)
-	{
-		ThrowIfTrue(!_mpData, "Image not yet created.");
-		ThrowIfTrue(uiMaxIterations == 0, "uiMaxIterations must be at least one.");
+			/// \brief Works out the counts of a tile iWidth by iHeight, iterating every pixel, or subdividing it if bSubdivide
+			void fill(int iWidth, int iHeight, bool bSubdivide)
+			{
+				if (!bSubdivide)
+				{
+					for (int iY = 0; iY < iHeight; iY++)
+						_iterateRow(0, iWidth, iY);
+					return;
+				}
+				_iterateRow(0, iWidth, 0);
+				if (iHeight > 1)
+					_iterateRow(0, iWidth, iHeight - 1);
+				_iterateColumn(0, 1, iHeight - 1);
+				if (iWidth > 1)
+					_iterateColumn(iWidth - 1, 1, iHeight - 1);
+				_subdivide(0, 0, iWidth - 1, iHeight - 1);
+			}
+		private:
+			const SPixelKernels& _mKernels;				///< The kernels to iterate pixels with
+			const SPixelKernels::SMandelbrotView& _mView;	///< Where each pixel's point is, and how it's iterated
+			int _miTileX;								///< The column of the tile's top left pixel within the image
+			int _miTileY;								///< The row of the tile's top left pixel within the image
+			unsigned int* _mpuiIterations;				///< The tile's counts, rows CImage::kMandelbrotTileSize apart
+
+			/// \brief Rectangles with no more pixels inside their border than this are iterated in full rather than split further
+			static const int kMinSubdivideArea = 64;
+
+			/// \brief Returns the count of the given pixel of the tile
+			unsigned int& _at(int iX, int iY)
+			{
+				return _mpuiIterations[iY * CImage::kMandelbrotTileSize + iX];
+			}
 
-		// Define the complex plane boundaries
+			/// \brief Iterates the pixels from iFirstX up to iLastX of row iY
+			void _iterateRow(int iFirstX, int iLastX, int iY)
+			{
+				if (iFirstX < iLastX)
+					_mKernels.mandelbrot(_mView, (unsigned int)(_miTileX + iFirstX), (unsigned int)(_miTileY + iY), false, &_at(iFirstX, iY), size_t(iLastX - iFirstX));
+			}
 
-		// Calculate pixel width and height
-		const double dx = (maxX - minX) / _miWidth;
-		const double dy = (maxY - minY) / _miHeight;
+			/// \brief Iterates the pixels from iFirstY up to iLastY of column iX
+			void _iterateColumn(int iX, int iFirstY, int iLastY)
+			{
+				if (iFirstY >= iLastY)
+					return;
+				unsigned int uiColumn[CImage::kMandelbrotTileSize];
+				_mKernels.mandelbrot(_mView, (unsigned int)(_miTileX + iX), (unsigned int)(_miTileY + iFirstY), true, uiColumn, size_t(iLastY - iFirstY));
+				for (int iY = iFirstY; iY < iLastY; iY++)
+					_at(iX, iY) = uiColumn[iY - iFirstY];
+			}
 
-		// Iterate over each pixel
-		unsigned int iIndex;
-		if (_miNumChannels == 3)
-		{
-			for (int y = 0; y < _miHeight; ++y)
+			/// \brief Works out the counts inside the rectangle from iX0, iY0 to iX1, iY1 inclusive, whose border is already worked out
+			void _subdivide(int iX0, int iY0, int iX1, int iY1)
 			{
-				for (int x = 0; x < _miWidth; ++x)
+				if (iX1 - iX0 < 2 || iY1 - iY0 < 2)
+					return;
+				const unsigned int uiBorder = _at(iX0, iY0);
+				bool bUniform = true;
+				bool bTouchesSet = false;
+				auto checkBorder = [&](int iX, int iY)
+				{
+					bUniform = bUniform && _at(iX, iY) == uiBorder;
+					bTouchesSet = bTouchesSet || _at(iX, iY) == _mView.uiMaxIterations;
+				};
+				for (int iX = iX0; iX <= iX1; iX++)
+				{
+					checkBorder(iX, iY0);
+					checkBorder(iX, iY1);
+				}
+				for (int iY = iY0 + 1; iY < iY1; iY++)
 				{
-					// Calculate the complex number for the current pixel
-					std::complex<double> c(minX + x * dx, minY + y * dy);
-					std::complex<double> z(0.0, 0.0);
-
-					unsigned int iterations = 0;
-					while (std::abs(z) < 2.0 && iterations < uiMaxIterations) {
-						z = z * z + c;
-						++iterations;
+					checkBorder(iX0, iY);
+					checkBorder(iX1, iY);
+				}
+				if (bUniform && !_spansOrigin(iX0, iY0, iX1, iY1))
+				{
+					for (int iY = iY0 + 1; iY < iY1; iY++)
+					{
+						for (int iX = iX0 + 1; iX < iX1; iX++)
+							_at(iX, iY) = uiBorder;
 					}
+					return;
+				}
 
-					// Assign a color based on the number of iterations
-					iIndex = x + (y * _miWidth);
-					iIndex *= _miNumChannels;
-					CColourf colour = colourRamp.getRampColour(float(iterations) / float(uiMaxIterations));
+				// Splitting only pays where it might find areas of the set, which cost the most to iterate. Elsewhere the counts
+				// are cheap, and too varied to come out the same all round many rectangles.
+				if (!bTouchesSet || (iX1 - iX0 - 1) * (iY1 - iY0 - 1) <= kMinSubdivideArea)
+				{
+					for (int iY = iY0 + 1; iY < iY1; iY++)
+						_iterateRow(iX0 + 1, iX1, iY);
+					return;
+				}
 
-					_mpData[iIndex] = unsigned char(colour.red * 255.0f);
-					_mpData[iIndex + 1] = unsigned char(colour.green * 255.0f);
-					_mpData[iIndex + 2] = unsigned char(colour.blue * 255.0f);
+				// Split across the longer side, the line between the halves being the border of both
+				if (iX1 - iX0 >= iY1 - iY0)
+				{
+					const int iMidX = (iX0 + iX1) / 2;
+					_iterateColumn(iMidX, iY0 + 1, iY1);
+					_subdivide(iX0, iY0, iMidX, iY1);
+					_subdivide(iMidX, iY0, iX1, iY1);
+				}
+				else
+				{
+					const int iMidY = (iY0 + iY1) / 2;
+					_iterateRow(iX0 + 1, iX1, iMidY);
+					_subdivide(iX0, iY0, iX1, iMidY);
+					_subdivide(iX0, iMidY, iX1, iY1);
 				}
 			}
-		}
-		else if (_miNumChannels == 4)
-		{
-			for (int y = 0; y < _miHeight; ++y)
+
+			/// \brief Returns whether the rectangle from iX0, iY0 to iX1, iY1 holds the point 0, so might hold the whole set
+			bool _spansOrigin(int iX0, int iY0, int iX1, int iY1) const
 			{
-				for (int x = 0; x < _miWidth; ++x)
-				{
-					// Calculate the complex number for the current pixel
-					std::complex<double> c(minX + x * dx, minY + y * dy);
-					std::complex<double> z(0.0, 0.0);
-
-					unsigned int iterations = 0;
-					while (std::abs(z) < 2.0 && iterations < uiMaxIterations) {
-						z = z * z + c;
-						++iterations;
-					}
+				const double dReal0 = _mView.dRealMin + (_miTileX + iX0) * _mView.dRealStep;
+				const double dReal1 = _mView.dRealMin + (_miTileX + iX1) * _mView.dRealStep;
+				const double dImaginary0 = _mView.dImaginaryMin + (_miTileY + iY0) * _mView.dImaginaryStep;
+				const double dImaginary1 = _mView.dImaginaryMin + (_miTileY + iY1) * _mView.dImaginaryStep;
+				return std::min(dReal0, dReal1) <= 0.0 && std::max(dReal0, dReal1) >= 0.0 && std::min(dImaginary0, dImaginary1) <= 0.0 && std::max(dImaginary0, dImaginary1) >= 0.0;
+			}
+		};
+	}
 
-					// Assign a color based on the number of iterations
-					iIndex = x + (y * _miWidth);
-					iIndex *= _miNumChannels;
-					CColourf colour = colourRamp.getRampColour(float(iterations) / float(uiMaxIterations));
+	void CImage::fillMandelbrot(CColourRamp colourRamp, double minX, double maxX, double minY, double maxY,unsigned int uiMaxIterations, const SMandelbrotShortcuts& shortcuts)
+	{
+		ThrowIfTrue(!_mpData, "Image not yet created.");
+		ThrowIfTrue(uiMaxIterations == 0, "uiMaxIterations must be at least one.");
+		_detach();
 
-					_mpData[iIndex] = unsigned char(colour.red * 255.0f);
-					_mpData[iIndex + 1] = unsigned char(colour.green * 255.0f);
-					_mpData[iIndex + 2] = unsigned char(colour.blue * 255.0f);
-					_mpData[iIndex + 3] = unsigned char(colour.alpha * 255.0f);
-				}
-			}
-		}
+		// The plain C++ kernels, a pixel at a time, are the reference which fillMandelbrotMT() matches
+		const std::vector<unsigned char> vColourTable = _mandelbrotColourTable(colourRamp, uiMaxIterations);
+		const size_t uiNumTiles = _getNumMandelbrotTiles();
+		_fillMandelbrotTiles(0, uiNumTiles, *SPixelKernels::getFor(SPixelKernels::INSTRUCTIONS_SCALAR), vColourTable, colourRamp, minX, maxX, minY, maxY, uiMaxIterations, shortcuts);
 	}
 
-	void CImage::fillMandelbrotMT(CColourRamp colourRamp, double minX, double maxX, double minY, double maxY, unsigned int uiMaxIterations)
+	void CImage::fillMandelbrotMT(CColourRamp colourRamp, double minX, double maxX, double minY, double maxY, unsigned int uiMaxIterations, const SMandelbrotShortcuts& shortcuts)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
 		ThrowIfTrue(uiMaxIterations == 0, "uiMaxIterations must be at least one.");
+		_detach();
 
-		unsigned int num_threads = std::thread::hardware_concurrency();
-		unsigned int iThread = 0;
-		unsigned int iStep = _miHeight / num_threads;
-		unsigned int uiYFirst = 0;
-		unsigned int uiYLast = 0;
-		std::vector<std::thread> threads;
-		for (unsigned int i = 0; i < num_threads; i++)
+		// Tiles inside the set take up to uiMaxIterations times longer than those outside, so they're claimed a tile at a time
+		// by whichever thread is free next, rather than each thread being given an equal share up front
+		const std::vector<unsigned char> vColourTable = _mandelbrotColourTable(colourRamp, uiMaxIterations);
+		const SPixelKernels& kernels = SPixelKernels::get();
+		CThreadPool::getGlobal().parallelFor(0, _getNumMandelbrotTiles(), 1, [&](size_t uiFirstTile, size_t uiLastTile)
 		{
-			uiYLast += iStep;
-			threads.push_back(std::thread());
-			threads[i] = std::thread(&CImage::_fillMandelbrotMT_threadMain, this, uiYFirst, uiYLast, colourRamp, minX, maxX, minY, maxY, uiMaxIterations);
-			uiYFirst += iStep;
-		}
-		// Take up any slack
-		if (uiYLast < (unsigned int)_miHeight)
-		{
-			uiYLast = _miHeight;
-			threads.push_back(std::thread());
-			threads[threads.size()-1] = std::thread(&CImage::_fillMandelbrotMT_threadMain, this, uiYFirst, uiYLast, colourRamp, minX, maxX, minY, maxY, uiMaxIterations);
-			num_threads++;
-		}
+			_fillMandelbrotTiles(uiFirstTile, uiLastTile, kernels, vColourTable, colourRamp, minX, maxX, minY, maxY, uiMaxIterations, shortcuts);
+		}, getMaxThreads());
+	}
 
-		for (unsigned int i = 0; i < num_threads; i++)
+	std::vector<unsigned char> CImage::_mandelbrotColourTable(CColourRamp& colourRamp, unsigned int uiMaxIterations) const
+	{
+		const unsigned int uiNumColours = std::min(uiMaxIterations, kMandelbrotColourTableMax) + 1;
+		std::vector<unsigned char> vColourTable(size_t(uiNumColours) * 4);
+		for (unsigned int ui = 0; ui < uiNumColours; ui++)
 		{
-			threads[i].join();
+			CColourf colour = colourRamp.getRampColour(float(ui) / float(uiMaxIterations));
+			vColourTable[size_t(ui) * 4] = unsigned char(colour.red * 255.0f);
+			vColourTable[size_t(ui) * 4 + 1] = unsigned char(colour.green * 255.0f);
+			vColourTable[size_t(ui) * 4 + 2] = unsigned char(colour.blue * 255.0f);
+			vColourTable[size_t(ui) * 4 + 3] = unsigned char(colour.alpha * 255.0f);
 		}
-
+		return vColourTable;
 	}
 
-	void CImage::_fillMandelbrotMT_threadMain(unsigned int uiYFirst, unsigned int uiYLast, CColourRamp colourRamp, double minX, double maxX, double minY, double maxY, unsigned int uiMaxIterations)
+	size_t CImage::_getNumMandelbrotTiles(void) const
 	{
-		// Define the complex plane boundaries
+		const size_t uiTilesAcross = (size_t(_miWidth) + kMandelbrotTileSize - 1) / kMandelbrotTileSize;
+		const size_t uiTilesDown = (size_t(_miHeight) + kMandelbrotTileSize - 1) / kMandelbrotTileSize;
+		return uiTilesAcross * uiTilesDown;
+	}
 
+	void CImage::_fillMandelbrotTiles(size_t uiFirstTile, size_t uiLastTile, const SPixelKernels& kernels, const std::vector<unsigned char>& vColourTable, CColourRamp colourRamp,
+		double minX, double maxX, double minY, double maxY, unsigned int uiMaxIterations, const SMandelbrotShortcuts& shortcuts)
+	{
 		// Calculate pixel width and height
-		const double dx = (maxX - minX) / _miWidth;
-		const double dy = (maxY - minY) / _miHeight;
-
-		// Iterate over each pixel
-		unsigned int iIndex;
-		if (_miNumChannels == 3)
+		SPixelKernels::SMandelbrotView view;
+		view.dRealMin = minX;
+		view.dRealStep = (maxX - minX) / _miWidth;
+		view.dImaginaryMin = minY;
+		view.dImaginaryStep = (maxY - minY) / _miHeight;
+		view.uiMaxIterations = uiMaxIterations;
+		view.bSkipBulbs = shortcuts.bSkipBulbs;
+		view.bCheckPeriodicity = shortcuts.bCheckPeriodicity;
+
+		const size_t uiTilesAcross = (size_t(_miWidth) + kMandelbrotTileSize - 1) / kMandelbrotTileSize;
+		const unsigned int uiNumColours = (unsigned int)(vColourTable.size() / 4);
+		std::vector<unsigned int> vIterations(size_t(kMandelbrotTileSize) * kMandelbrotTileSize);
+		for (size_t uiTile = uiFirstTile; uiTile < uiLastTile; uiTile++)
 		{
-			for (unsigned int y = uiYFirst; y < uiYLast; ++y)
+			const int iTileX = int(uiTile % uiTilesAcross) * kMandelbrotTileSize;
+			const int iTileY = int(uiTile / uiTilesAcross) * kMandelbrotTileSize;
+			const int iTileWidth = std::min(kMandelbrotTileSize, _miWidth - iTileX);
+			const int iTileHeight = std::min(kMandelbrotTileSize, _miHeight - iTileY);
+			CMandelbrotTile tile(kernels, view, iTileX, iTileY, vIterations.data());
+			tile.fill(iTileWidth, iTileHeight, shortcuts.bSubdivide);
+
+			// Assign a colour based on the number of iterations
+			for (int y = 0; y < iTileHeight; ++y)
 			{
-				for (int x = 0; x < _miWidth; ++x)
+				const unsigned int* puiIterations = vIterations.data() + size_t(y) * kMandelbrotTileSize;
+				unsigned char* pPixel = _mpData + (size_t(iTileY + y) * _miWidth + iTileX) * _miNumChannels;
+				for (int x = 0; x < iTileWidth; ++x)
 				{
-					// Calculate the complex number for the current pixel
-					std::complex<double> c(minX + x * dx, minY + y * dy);
-					std::complex<double> z(0.0, 0.0);
-
-					unsigned int iterations = 0;
-					while (std::abs(z) < 2.0 && iterations < uiMaxIterations) {
-						z = z * z + c;
-						++iterations;
+					unsigned char ucColour[4];
+					const unsigned char* pColour = ucColour;
+					if (puiIterations[x] < uiNumColours)
+						pColour = vColourTable.data() + size_t(puiIterations[x]) * 4;
+					else
+					{
+						CColourf colour = colourRamp.getRampColour(float(puiIterations[x]) / float(uiMaxIterations));
+						ucColour[0] = unsigned char(colour.red * 255.0f);
+						ucColour[1] = unsigned char(colour.green * 255.0f);
+						ucColour[2] = unsigned char(colour.blue * 255.0f);
+						ucColour[3] = unsigned char(colour.alpha * 255.0f);
 					}
-
-					// Assign a color based on the number of iterations
-					iIndex = x + (y * _miWidth);
-					iIndex *= _miNumChannels;
-					CColourf colour = colourRamp.getRampColour(float(iterations) / float(uiMaxIterations));
-
-					_mpData[iIndex] = unsigned char(colour.red * 255.0f);
-					_mpData[iIndex + 1] = unsigned char(colour.green * 255.0f);
-					_mpData[iIndex + 2] = unsigned char(colour.blue * 255.0f);
+					memcpy(pPixel, pColour, size_t(_miNumChannels));
+					pPixel += _miNumChannels;
 				}
 			}
 		}
-		else if (_miNumChannels == 4)
-		{
-			for (unsigned int y = uiYFirst; y < uiYLast; ++y)
-			{
-				for (unsigned int x = 0; x < (unsigned int)_miWidth; ++x)
-				{
-					// Calculate the complex number for the current pixel
-					std::complex<double> c(minX + x * dx, minY + y * dy);
-					std::complex<double> z(0.0, 0.0);
-
-					unsigned int iterations = 0;
-					while (std::abs(z) < 2.0 && iterations < uiMaxIterations) {
-						z = z * z + c;
-						++iterations;
-					}
-
-					// Assign a color based on the number of iterations
-					iIndex = x + (y * _miWidth);
-					iIndex *= _miNumChannels;
-					CColourf colour = colourRamp.getRampColour(float(iterations) / float(uiMaxIterations));
+	}
 
-					_mpData[iIndex] = unsigned char(colour.red * 255.0f);
-					_mpData[iIndex + 1] = unsigned char(colour.green * 255.0f);
-					_mpData[iIndex + 2] = unsigned char(colour.blue * 255.0f);
-					_mpData[iIndex + 3] = unsigned char(colour.alpha * 255.0f);
-				}
-			}
-		}
+	unsigned char* CImage::getData(void)
+	{
+		_detach();
+		return _mpData;
 	}
 
-	unsigned char* CImage::getData(void) const
+	const unsigned char* CImage::getData(void) const
 	{
 		return _mpData;
 	}
@@ -596,23 +993,19 @@ namespace X
 	void CImage::swapRedAndBlue(void)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		unsigned int i = 0;
-		int i2;
-		unsigned char chTemp;
-		while (i < _muiDataSize)
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			i2 = i + 2;
-			chTemp = _mpData[i];
-			_mpData[i] = _mpData[i2];
-			_mpData[i2] = chTemp;
-			i += _miNumChannels;
-		}
+			SPixelKernels::get().swapRedAndBlue(_mpData + iFirstRow * iRowSize, size_t(iLastRow - iFirstRow) * _miWidth, _miNumChannels);
+		});
 	}
 
 	void CImage::ditherBayerMatrix(void)
 	{
 		ThrowIfFalse(_mpData, "Image data is not available.");
+		_detach();
 
 		// Bayer matrix for 4x4 dithering
 		const int bayerMatrix[4][4] = {
@@ -625,404 +1018,485 @@ namespace X
 		const int matrixSize = 4;
 		const int matrixMaxValue = 16;
 
-		for (int y = 0; y < _miHeight; ++y)
+		// Each pixel depends only on itself and its position, so bands of rows can be done in any order
+		forEachPixel([&](auto& pixel, int x, int y)
 		{
-			for (int x = 0; x < _miWidth; ++x)
-			{
-				unsigned char r, g, b, a;
-				getPixel(x, y, r, g, b, a);
-
-				// Apply Bayer matrix thresholding
-				int threshold = bayerMatrix[y % matrixSize][x % matrixSize];
-				r = (r > threshold * 255 / matrixMaxValue) ? 255 : 0;
-				g = (g > threshold * 255 / matrixMaxValue) ? 255 : 0;
-				b = (b > threshold * 255 / matrixMaxValue) ? 255 : 0;
-
-				setPixel(x, y, r, g, b, a);
-			}
-		}
+			// Apply Bayer matrix thresholding
+			const int threshold = bayerMatrix[y % matrixSize][x % matrixSize] * 255 / matrixMaxValue;
+			for (int iChannel = 0; iChannel < 3; iChannel++)
+				pixel.uc[iChannel] = (pixel.uc[iChannel] > threshold) ? 255 : 0;
+		}, true);
 	}
 
 	void CImage::ditherFloydSteinberg(void)
+	{
+		ditherErrorDiffusion();
+	}
+
+	void CImage::ditherErrorDiffusion(SDiffusionKernel::EKernel eKernel, bool bSerpentine, bool bMultithreaded)
 	{
 		ThrowIfFalse(_mpData, "Image data is not available.");
+		const SDiffusionKernel& kernel = SDiffusionKernel::get(eKernel);
+		_detach();
 
-		for (int y = 0; y < _miHeight; ++y)
+		unsigned int uiMaxThreads = getMaxThreads();
+		if (!bMultithreaded || size_t(_miWidth) * size_t(_miHeight) < kMinPixelsForThreads)
+			uiMaxThreads = 1;
+		dispatchChannels([&](auto channels)
 		{
-			for (int x = 0; x < _miWidth; ++x)
+			// Find the closest colour, each of red, green and blue being 0 or 255
+			diffuseError<decltype(channels)::value>(_mpData, _miWidth, _miHeight, kernel, bSerpentine, uiMaxThreads, [](int, int, int* piRGB)
 			{
-				unsigned char r, g, b, a;
-				getPixel(x, y, r, g, b, a);
-
-				// Find the closest color (0 or 255)
-				unsigned char newR = (r > 127) ? 255 : 0;
-				unsigned char newG = (g > 127) ? 255 : 0;
-				unsigned char newB = (b > 127) ? 255 : 0;
-
-				// Calculate the error
-				int errR = r - newR;
-				int errG = g - newG;
-				int errB = b - newB;
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+					piRGB[iChannel] = piRGB[iChannel] > 127 ? 255 : 0;
+			});
+		});
+	}
 
-				// Set the new pixel value
-				setPixel(x, y, newR, newG, newB, a);
+	namespace
+	{
+		/// \brief Width and height in pixels of the tiles the transforms below work through, small enough that the rows of a tile
+		/// read and the rows written all stay in the L1 cache together
+		const int kTransformTileSize = 32;
 
-				// Distribute the error to neighboring pixels
-				if (x + 1 < _miWidth)
-				{
-					_ditherFloydSteinbergAddError(x + 1, y, errR, errG, errB, 7.0 / 16.0);
-				}
-				if (x - 1 >= 0 && y + 1 < _miHeight)
-				{
-					_ditherFloydSteinbergAddError(x - 1, y + 1, errR, errG, errB, 3.0 / 16.0);
-				}
-				if (y + 1 < _miHeight)
+		/// \brief Writes rows iFirstRow to one before iLastRow of an image iDstWidth pixels wide, taking each pixel X, Y from
+		/// pSrc at iSrcOrigin + X * iSrcStepX + Y * iSrcStepY pixels.
+		///
+		/// Rotations and transposes read the source a column at a time, so rather than whole rows this works through square tiles,
+		/// each row of a tile reading the pixels next to those read by the row before, which are still in the cache.
+		template <typename TPixel>
+		void transformTiled(const TPixel* pSrc, TPixel* pDst, int iDstWidth, int iFirstRow, int iLastRow, ptrdiff_t iSrcOrigin, ptrdiff_t iSrcStepX, ptrdiff_t iSrcStepY)
+		{
+			for (int iTileY = iFirstRow; iTileY < iLastRow; iTileY += kTransformTileSize)
+			{
+				const int iTileLastY = std::min(iTileY + kTransformTileSize, iLastRow);
+				for (int iTileX = 0; iTileX < iDstWidth; iTileX += kTransformTileSize)
 				{
-					_ditherFloydSteinbergAddError(x, y + 1, errR, errG, errB, 5.0 / 16.0);
+					const int iTileLastX = std::min(iTileX + kTransformTileSize, iDstWidth);
+					for (int iY = iTileY; iY < iTileLastY; iY++)
+					{
+						TPixel* pDstRow = pDst + ptrdiff_t(iY) * iDstWidth;
+						const TPixel* pSrcRow = pSrc + iSrcOrigin + iY * iSrcStepY;
+						for (int iX = iTileX; iX < iTileLastX; iX++)
+							pDstRow[iX] = pSrcRow[iX * iSrcStepX];
+					}
 				}
-				if (x + 1 < _miWidth && y + 1 < _miHeight)
+			}
+		}
+
+		/// \brief Transposes tile rows iFirstTileRow to one before iLastTileRow of a square image iSize pixels across, in place.
+		///
+		/// Each tile on or right of the diagonal is swapped with its mirror below it, so each pair of tiles is only swapped by
+		/// the one tile row, and tile rows may be done concurrently. Both tiles are copied out a row at a time first, as reading
+		/// a tile's columns straight from an image whose rows are a power of two bytes apart would use the same few cache sets for all of them.
+		template <typename TPixel>
+		void transposeSquareTiled(TPixel* pData, int iSize, int iFirstTileRow, int iLastTileRow)
+		{
+			TPixel tileA[kTransformTileSize][kTransformTileSize];
+			TPixel tileB[kTransformTileSize][kTransformTileSize];
+			for (int iTileRow = iFirstTileRow; iTileRow < iLastTileRow; iTileRow++)
+			{
+				const int iTileY = iTileRow * kTransformTileSize;
+				const int iTileHeight = std::min(kTransformTileSize, iSize - iTileY);
+				for (int iTileX = iTileY; iTileX < iSize; iTileX += kTransformTileSize)
 				{
-					_ditherFloydSteinbergAddError(x + 1, y + 1, errR, errG, errB, 1.0 / 16.0);
+					// Tile A is at iTileX, iTileY and tile B its mirror at iTileY, iTileX, which on the diagonal is A itself
+					const int iTileWidth = std::min(kTransformTileSize, iSize - iTileX);
+					for (int iY = 0; iY < iTileHeight; iY++)
+						std::copy_n(pData + ptrdiff_t(iTileY + iY) * iSize + iTileX, iTileWidth, tileA[iY]);
+					for (int iY = 0; iY < iTileWidth; iY++)
+						std::copy_n(pData + ptrdiff_t(iTileX + iY) * iSize + iTileY, iTileHeight, tileB[iY]);
+
+					for (int iY = 0; iY < iTileHeight; iY++)
+					{
+						TPixel* pRow = pData + ptrdiff_t(iTileY + iY) * iSize + iTileX;
+						for (int iX = 0; iX < iTileWidth; iX++)
+							pRow[iX] = tileB[iX][iY];
+					}
+					for (int iY = 0; iY < iTileWidth; iY++)
+					{
+						TPixel* pRow = pData + ptrdiff_t(iTileX + iY) * iSize + iTileY;
+						for (int iX = 0; iX < iTileHeight; iX++)
+							pRow[iX] = tileA[iX][iY];
+					}
 				}
 			}
 		}
 	}
 
-	void CImage::_ditherFloydSteinbergAddError(int x, int y, int errR, int errG, int errB, double factor)
+	void CImage::flipVertically(bool bMultithreaded)
 	{
-		unsigned char r, g, b, a;
-		getPixel(x, y, r, g, b, a);
-
-		int newR = r + static_cast<int>(errR * factor);
-		int newG = g + static_cast<int>(errG * factor);
-		int newB = b + static_cast<int>(errB * factor);
-
-		// Clamp the values to the valid range [0, 255]
-		newR = std::clamp(newR, 0, 255);
-		newG = std::clamp(newG, 0, 255);
-		newB = std::clamp(newB, 0, 255);
+		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		setPixel(x, y, static_cast<unsigned char>(newR), static_cast<unsigned char>(newG), static_cast<unsigned char>(newB), a);
+		// Swap each row in the top half with its mirror in the bottom half, in place
+		const size_t iRowSizeBytes = size_t(_miWidth) * _miNumChannels;
+		_forEachRowBand(_miHeight / 2, _miWidth, [&](int iFirstRow, int iLastRow)
+		{
+			for (int iRow = iFirstRow; iRow < iLastRow; iRow++)
+			{
+				unsigned char* pTop = _mpData + iRowSizeBytes * iRow;
+				unsigned char* pBottom = _mpData + iRowSizeBytes * (_miHeight - 1 - iRow);
+				std::swap_ranges(pTop, pTop + iRowSizeBytes, pBottom);
+			}
+		}, bMultithreaded);
 	}
 
-	void CImage::flipVertically(void)
+	void CImage::flipHorizontally(bool bMultithreaded)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		// Size of a row
-		unsigned int iRowSize = _miWidth * _miNumChannels;
-
-		// Allocate new flipped image
-		unsigned char* pNewImageStartAddress = new unsigned char[_muiDataSize];
-		unsigned char* pNewImage = pNewImageStartAddress;
-		ThrowIfTrue(0 == pNewImage, "Failed to allocate memory.");
-
-		// Get pointer to current image
-		unsigned char* pOldImage = _mpData;
-		// Increment old image pointer to point to last row
-		pOldImage += iRowSize * (_miHeight - 1);
-
-		// Copy each row into new image
-		unsigned int iRowSizeBytes = iRowSize * sizeof(unsigned char);
-		for (int iRow = 0; iRow < _miHeight; ++iRow)
+		dispatchChannels([&](auto channels)
 		{
-			memcpy(pNewImage, pOldImage, iRowSizeBytes);
-			// Adjust pointers
-			pNewImage += iRowSizeBytes;
-			pOldImage -= iRowSizeBytes;
-		}
-		// Now pNewImage contains flipped image data
-		delete[] _mpData;	// Delete old image data
-		_mpData = pNewImageStartAddress;	// Make image data point to the new data
+			using TPixel = SPixel<decltype(channels)::value>;
+			TPixel* pPixels = reinterpret_cast<TPixel*>(_mpData);
+			_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
+			{
+				for (int iRow = iFirstRow; iRow < iLastRow; iRow++)
+				{
+					TPixel* pRow = pPixels + ptrdiff_t(iRow) * _miWidth;
+					std::reverse(pRow, pRow + _miWidth);
+				}
+			}, bMultithreaded);
+		});
 	}
 
 	void CImage::invert(bool bInvertColour, bool bInvertAlpha)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		unsigned int i = 0;
-		int iIndex;
-		if (bInvertColour)
-		{
-			while (i < _muiDataSize)
-			{
-				iIndex = i;
-				_mpData[iIndex] = 255 - _mpData[iIndex]; ++iIndex;
-				_mpData[iIndex] = 255 - _mpData[iIndex]; ++iIndex;
-				_mpData[iIndex] = 255 - _mpData[iIndex];
-				i += _miNumChannels;
-			}
-		}
-
-		if (_miNumChannels == 4 && bInvertAlpha)
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			i = 3;
-			while (i < _muiDataSize)
-			{
-				_mpData[i] = 255 - _mpData[i];
-				i += _miNumChannels;
-			}
-		}
+			SPixelKernels::get().invert(_mpData + iFirstRow * iRowSize, size_t(iLastRow - iFirstRow) * _miWidth, _miNumChannels, bInvertColour, bInvertAlpha);
+		});
 	}
 
 	void CImage::greyscaleSimple(void)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		unsigned int i = 0;
-		float f1Over3 = 1.0f / 3.0f;
-		float fTmp;
-		unsigned char cTmp;
-		while (i < _muiDataSize)
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			fTmp = float(_mpData[i]);
-			fTmp += float(_mpData[i + 1]);
-			fTmp += float(_mpData[i + 2]);
-			fTmp *= f1Over3;
-			cTmp = (unsigned char)fTmp;
-			_mpData[i] = cTmp;
-			_mpData[i + 1] = cTmp;
-			_mpData[i + 2] = cTmp;
-			i += _miNumChannels;
-		}
+			unsigned int i = iFirstRow * iRowSize;
+			const unsigned int iEnd = iLastRow * iRowSize;
+			float f1Over3 = 1.0f / 3.0f;
+			float fTmp;
+			unsigned char cTmp;
+			while (i < iEnd)
+			{
+				fTmp = float(_mpData[i]);
+				fTmp += float(_mpData[i + 1]);
+				fTmp += float(_mpData[i + 2]);
+				fTmp *= f1Over3;
+				cTmp = (unsigned char)fTmp;
+				_mpData[i] = cTmp;
+				_mpData[i + 1] = cTmp;
+				_mpData[i + 2] = cTmp;
+				i += _miNumChannels;
+			}
+		});
 	}
 
 
 	void CImage::greyscale(float fRedSensitivity, float fGreenSensitivity, float fBlueSensitivity)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		CVector3f vCol(fRedSensitivity, fGreenSensitivity, fBlueSensitivity);
-
-		unsigned int i = 0;
-		float fTmp;
-		unsigned char cTmp;
-		while (i < _muiDataSize)
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			fTmp = 0.0f;
-			fTmp = float(_mpData[i]) * vCol.x;
-			fTmp += float(_mpData[i + 1]) * vCol.y;
-			fTmp += float(_mpData[i + 2]) * vCol.z;
-			cTmp = (unsigned char)fTmp;
-			_mpData[i] = cTmp;
-			_mpData[i + 1] = cTmp;
-			_mpData[i + 2] = cTmp;
-			i += _miNumChannels;
-		}
+			SPixelKernels::get().greyscale(_mpData + iFirstRow * iRowSize, size_t(iLastRow - iFirstRow) * _miWidth, _miNumChannels, fRedSensitivity, fGreenSensitivity, fBlueSensitivity);
+		});
 	}
 
 	void CImage::adjustBrightness(int iAmount)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		unsigned int i = 0;
-		int iCol;
-		while (i < _muiDataSize)
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			iCol = (int)_mpData[i] + iAmount;
-			clamp(iCol, 0, 255);
-			_mpData[i] = unsigned char(iCol);
-
-			iCol = (int)_mpData[i + 1] + iAmount;
-			clamp(iCol, 0, 255);
-			_mpData[i + 1] = unsigned char(iCol);
-
-			iCol = (int)_mpData[i + 2] + iAmount;
-			clamp(iCol, 0, 255);
-			_mpData[i + 2] = unsigned char(iCol);
-			i += _miNumChannels;
-		}
+			SPixelKernels::get().adjustBrightness(_mpData + iFirstRow * iRowSize, size_t(iLastRow - iFirstRow) * _miWidth, _miNumChannels, iAmount);
+		});
 	}
 
 	void CImage::adjustContrast(int iAmount)
 	{
 		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
 		clamp(iAmount, -100, 100);
-		double dPixel;
-		double d1Over255 = 1.0 / 255.0;
 		double dContrast = (100.0 + double(iAmount)) * 0.01; // 0 and 2
 		dContrast *= dContrast;	// 0 and 4
-		unsigned int i = 0;
-		int iIndex;
-		while (i < _muiDataSize)
-		{
-			iIndex = i;
-			dPixel = double(_mpData[iIndex]) * d1Over255;
-			dPixel -= 0.5;
-			dPixel *= dContrast;
-			dPixel += 0.5;
-			dPixel *= 255;
-			clamp(dPixel, 0.0, 255.0);
-			_mpData[iIndex] = unsigned char(dPixel);
-			++iIndex;
-
-			dPixel = double(_mpData[iIndex]) * d1Over255;
-			dPixel -= 0.5;
-			dPixel *= dContrast;
-			dPixel += 0.5;
-			dPixel *= 255;
-			clamp(dPixel, 0.0, 255.0);
-			_mpData[iIndex] = unsigned char(dPixel);
-			++iIndex;
-
-			dPixel = double(_mpData[iIndex]) * d1Over255;
-			dPixel -= 0.5;
-			dPixel *= dContrast;
-			dPixel += 0.5;
-			dPixel *= 255;
-			clamp(dPixel, 0.0, 255.0);
-			_mpData[iIndex] = unsigned char(dPixel);
-
-			i += _miNumChannels;
-		}
+		const unsigned int iRowSize = _miWidth * _miNumChannels;
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
+		{
+			SPixelKernels::get().adjustContrast(_mpData + iFirstRow * iRowSize, size_t(iLastRow - iFirstRow) * _miWidth, _miNumChannels, dContrast);
+		});
 	}
 
 	void CImage::copyTo(CImage& destImage) const
 	{
 		ThrowIfTrue(!_mpData, "Source image not yet created.");
 
-		// If destination image is the same as this one, do nothing
-		if (destImage._mpData == this->_mpData)
+		// If destination image is the same as this one, or already shares its data, do nothing
+		if (destImage._mpBuffer == this->_mpBuffer)
 			return;
 
+		// Share the data rather than copying it. Whichever image is modified first gets its own copy, see _detach().
 		destImage.free();
-		destImage.createBlank(_miWidth, _miHeight, _miNumChannels);
-		memcpy(destImage._mpData, _mpData, sizeof(unsigned char) * _muiDataSize);
+		_mpBuffer->uiRefCount.fetch_add(1, std::memory_order_relaxed);
+		destImage._mpBuffer = _mpBuffer;
+		destImage._mpData = _mpData;
+		destImage._muiDataSize = _muiDataSize;
+		destImage._miWidth = _miWidth;
+		destImage._miHeight = _miHeight;
+		destImage._miNumChannels = _miNumChannels;
+	}
+
+	namespace
+	{
+		/// \brief Draws uiNumPixels RGBA pixels over those of pDst, which has uiDstChannels channels, 3 or 4, using the source's alpha.
+		///
+		/// Neither is premultiplied, so where the destination has alpha too, its colour's weight is its alpha times what the source lets through.
+		void blendRowOver(const unsigned char* pSrc, unsigned char* pDst, size_t uiNumPixels, unsigned int uiDstChannels)
+		{
+			for (size_t ui = 0; ui < uiNumPixels; ui++, pSrc += 4, pDst += uiDstChannels)
+			{
+				const unsigned int uiSrcAlpha = pSrc[3];
+				if (0 == uiSrcAlpha)
+					continue;
+				if (255 == uiSrcAlpha)
+				{
+					memcpy(pDst, pSrc, uiDstChannels);
+					continue;
+				}
+
+				const unsigned int uiLetThrough = 255 - uiSrcAlpha;
+				if (3 == uiDstChannels)
+				{
+					for (int iChannel = 0; iChannel < 3; iChannel++)
+						pDst[iChannel] = (unsigned char)((pSrc[iChannel] * uiSrcAlpha + pDst[iChannel] * uiLetThrough + 127) / 255);
+					continue;
+				}
+
+				// Weights are scaled by 255, so the colours' total weight is the resulting alpha times 255
+				const unsigned int uiDstWeight = pDst[3] * uiLetThrough;
+				const unsigned int uiSrcWeight = uiSrcAlpha * 255;
+				const unsigned int uiTotalWeight = uiSrcWeight + uiDstWeight;
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+					pDst[iChannel] = (unsigned char)((pSrc[iChannel] * uiSrcWeight + pDst[iChannel] * uiDstWeight + uiTotalWeight / 2) / uiTotalWeight);
+				pDst[3] = (unsigned char)((uiTotalWeight + 127) / 255);
+			}
+		}
 	}
 
-	void CImage::copyRectTo(CImage& destImage, int iSrcPosX, int iSrcPosY, int iSrcWidth, int iSrcHeight, int iDestPosX, int iDestPosY) const
+	void CImage::copyRectTo(CImage& destImage, int iSrcPosX, int iSrcPosY, int iSrcWidth, int iSrcHeight, int iDestPosX, int iDestPosY, bool bAlphaBlend) const
 	{
 		// Check that both images have data
 		ThrowIfTrue(!_mpData, "Source image not yet created.");
 		ThrowIfTrue(!destImage._mpData, "Destination image not yet created.");
 
-		// Compute source rect
-		int iSrcLeft = iSrcPosX;
-		int iSrcBot = iSrcPosY;
-		int iSrcRight = iSrcLeft + iSrcWidth;
-		int iSrcTop = iSrcBot + iSrcHeight;
-		// Compute destination rect
-		int iDstLeft = iDestPosX;
-		int iDstBot = iDestPosY;
-		int iDstRight = iDstLeft + iSrcWidth;
-		int iDstTop = iDstBot + iSrcHeight;
-
-		// The above may be invalid due to different sizes, invalid positions, dims etc.
-		// Invalid starting positions
-		if (iSrcLeft >= _miWidth)
-			return;
-		if (iSrcBot >= _miHeight)
-			return;
-		if (iDstLeft >= destImage._miWidth)
-			return;
-		if (iDstBot >= destImage._miHeight)
+		// Clip the region's left and bottom edges to those of both images, moving the other image's position along with them
+		int iWidth = iSrcWidth;
+		int iHeight = iSrcHeight;
+		if (iSrcPosX < 0)
+		{
+			iWidth += iSrcPosX;
+			iDestPosX -= iSrcPosX;
+			iSrcPosX = 0;
+		}
+		if (iDestPosX < 0)
+		{
+			iWidth += iDestPosX;
+			iSrcPosX -= iDestPosX;
+			iDestPosX = 0;
+		}
+		if (iSrcPosY < 0)
+		{
+			iHeight += iSrcPosY;
+			iDestPosY -= iSrcPosY;
+			iSrcPosY = 0;
+		}
+		if (iDestPosY < 0)
+		{
+			iHeight += iDestPosY;
+			iSrcPosY -= iDestPosY;
+			iDestPosY = 0;
+		}
+
+		// Then its right and top edges
+		iWidth = std::min(iWidth, std::min(_miWidth - iSrcPosX, destImage._miWidth - iDestPosX));
+		iHeight = std::min(iHeight, std::min(_miHeight - iSrcPosY, destImage._miHeight - iDestPosY));
+		if (iWidth < 1 || iHeight < 1)
 			return;
-		// Clamp right and top to edges of their respective images
-		clamp(iSrcRight, iSrcLeft, _miWidth);
-		clamp(iSrcTop, iSrcBot, _miHeight);
-		clamp(iDstRight, iDstLeft, destImage._miWidth);
-		clamp(iDstTop, iDstBot, destImage._miHeight);
-		// Compute rect dims for both images
-		unsigned int iSrcRectWidth = iSrcRight - iSrcLeft;
-		unsigned int iSrcRectHeight = iSrcTop - iSrcBot;
-		unsigned int iDstRectWidth = iDstRight - iDstLeft;
-		unsigned int iDstRectHeight = iDstTop - iDstBot;
-		// Compute smallest rect
-		unsigned int iMinWidth = iSrcRectWidth;
-		if (iMinWidth > iDstRectWidth)
-			iMinWidth = iDstRectWidth;
-		unsigned int iMinHeight = iSrcRectHeight;
-		if (iMinHeight > iDstRectHeight)
-			iMinHeight = iDstRectHeight;
-		// If minimum = zero, then do nothing
-		if (iMinWidth == 0)
+
+		// Blending a region of this image over an overlapping one would read pixels already blended, so blend from a copy of it
+		const bool bBlend = bAlphaBlend && 4 == _miNumChannels;
+		if (bBlend && this == &destImage)
+		{
+			CImage region;
+			region.createBlank(iWidth, iHeight, _miNumChannels, false);
+			copyRectTo(region, iSrcPosX, iSrcPosY, iWidth, iHeight, 0, 0);
+			region.copyRectTo(destImage, 0, 0, iWidth, iHeight, iDestPosX, iDestPosY, true);
 			return;
-		if (iMinHeight == 0)
+		}
+
+		// Only once the destination has its own pixels, as when it is this image, that's what to read from too
+		destImage._detach();
+		const size_t uiSrcRowBytes = size_t(_miWidth) * _miNumChannels;
+		const size_t uiDstRowBytes = size_t(destImage._miWidth) * destImage._miNumChannels;
+		const unsigned char* pSrcFirst = _mpData + uiSrcRowBytes * iSrcPosY + size_t(iSrcPosX) * _miNumChannels;
+		unsigned char* pDstFirst = destImage._mpData + uiDstRowBytes * iDestPosY + size_t(iDestPosX) * destImage._miNumChannels;
+
+		// Copying within this image to higher rows must go from the top row down, so rows aren't overwritten before they're copied.
+		// Within a row, memmove() takes care of the overlap.
+		const bool bTopDown = this == &destImage && iDestPosY > iSrcPosY;
+		const SPixelKernels& kernels = SPixelKernels::get();
+		for (int iRow = 0; iRow < iHeight; iRow++)
+		{
+			const int iRowIndex = bTopDown ? iHeight - 1 - iRow : iRow;
+			const unsigned char* pSrc = pSrcFirst + uiSrcRowBytes * iRowIndex;
+			unsigned char* pDst = pDstFirst + uiDstRowBytes * iRowIndex;
+			if (bBlend)
+				blendRowOver(pSrc, pDst, size_t(iWidth), destImage._miNumChannels);
+			else if (_miNumChannels == destImage._miNumChannels)
+				memmove(pDst, pSrc, size_t(iWidth) * _miNumChannels);
+			else if (3 == _miNumChannels)
+				kernels.addAlphaChannel(pSrc, pDst, size_t(iWidth), 255);
+			else
+				kernels.removeAlphaChannel(pSrc, pDst, size_t(iWidth));
+		}
+	}
+
+	void CImage::copyToAddBorder(CImage& outputImage) const
+	{
+		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
+
+		// Compute new larger dimensions and create the larger image
+		int newWidth = _miWidth + 2;
+		int newHeight = _miHeight + 2;
+		outputImage.createBlank(newWidth, newHeight, _miNumChannels);
+
+		// Copy this image to the centre of the larger image
+		copyRectTo(outputImage, 0, 0, _miWidth, _miHeight, 1, 1);
+
+		// Now copy the edges of this image to the destination image, leaving its corners
+		copyRectTo(outputImage, 0, 0, _miWidth, 1, 1, 0);
+		copyRectTo(outputImage, 0, _miHeight - 1, _miWidth, 1, 1, newHeight - 1);
+		copyRectTo(outputImage, 0, 0, 1, _miHeight, 0, 1);
+		copyRectTo(outputImage, _miWidth - 1, 0, 1, _miHeight, newWidth - 1, 1);
+	}
+
+	void CImage::rotateClockwise(bool bMultithreaded)
+	{
+		ThrowIfTrue(!_mpData, "Image not yet created.");
+
+		// A square image can be rotated in place by transposing it then flipping it
+		if (_miWidth == _miHeight)
+		{
+			transpose(bMultithreaded);
+			flipVertically(bMultithreaded);
 			return;
+		}
 
-		unsigned char colTmp[4];
-		unsigned int isx, isy;
-		unsigned int idx, idy;
-		for (unsigned int ix = 0; ix < iMinWidth; ++ix)
+		// The pixel at X, Y comes from the source's column width - 1 - Y, row X
+		const int iSrcWidth = _miWidth;
+		_transformInto(iSrcWidth - 1, iSrcWidth, -1, bMultithreaded);
+	}
+
+	void CImage::rotateAntiClockwise(bool bMultithreaded)
+	{
+		ThrowIfTrue(!_mpData, "Image not yet created.");
+
+		// A square image can be rotated in place by transposing it then flipping it
+		if (_miWidth == _miHeight)
 		{
-			for (unsigned int iy = 0; iy < iMinHeight; ++iy)
-			{
-				isx = iSrcLeft + ix;
-				isy = iSrcBot + iy;
-				idx = iDstLeft + ix;
-				idy = iDstBot + iy;
-				getPixel(isx, isy, colTmp[0], colTmp[1], colTmp[2], colTmp[3]);
-				destImage.setPixel(idx, idy, colTmp[0], colTmp[1], colTmp[2], colTmp[3]);
-			}
+			transpose(bMultithreaded);
+			flipHorizontally(bMultithreaded);
+			return;
 		}
+
+		// The pixel at X, Y comes from the source's column Y, row height - 1 - X
+		const int iSrcWidth = _miWidth;
+		_transformInto(ptrdiff_t(_miHeight - 1) * iSrcWidth, -iSrcWidth, 1, bMultithreaded);
 	}
 
-	void CImage::copyToAddBorder(CImage& outputImage) const
+	void CImage::rotate180(bool bMultithreaded)
 	{
-		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
+		ThrowIfTrue(!_mpData, "Image not yet created.");
+		_detach();
 
-		// Compute new larger dimensions and create the larger image
-		int newWidth = _miWidth + 2;
-		int newHeight = _miHeight + 2;
-		outputImage.createBlank(newWidth, newHeight, _miNumChannels);
+		// Swap each row in the top half with its mirror in the bottom half, reversing both, and reverse the middle row if there is one
+		dispatchChannels([&](auto channels)
+		{
+			using TPixel = SPixel<decltype(channels)::value>;
+			TPixel* pPixels = reinterpret_cast<TPixel*>(_mpData);
+			_forEachRowBand((_miHeight + 1) / 2, _miWidth, [&](int iFirstRow, int iLastRow)
+			{
+				for (int iRow = iFirstRow; iRow < iLastRow; iRow++)
+				{
+					TPixel* pTop = pPixels + ptrdiff_t(iRow) * _miWidth;
+					TPixel* pBottom = pPixels + ptrdiff_t(_miHeight - 1 - iRow) * _miWidth;
+					if (pTop == pBottom)
+					{
+						std::reverse(pTop, pTop + _miWidth);
+						continue;
+					}
+					for (int iX = 0; iX < _miWidth; iX++)
+						std::swap(pTop[iX], pBottom[_miWidth - 1 - iX]);
+				}
+			}, bMultithreaded);
+		});
+	}
 
-		// Copy this image to the centre of the larger image
-		copyRectTo(outputImage, 0, 0, _miWidth, _miHeight, 1, 1);
+	void CImage::transpose(bool bMultithreaded)
+	{
+		ThrowIfTrue(!_mpData, "Image not yet created.");
 
-		// Now copy the edges of this image to the destination image
-		unsigned char r, g, b, a;
-		int heightOfOutputImageMinusOne = newHeight - 1;
-		// Top and bottom edges
-		for (int iX = 0; iX < _miWidth; iX++)
+		if (_miWidth == _miHeight)
 		{
-			// Top pixel row
-			getPixel(iX, 0, r, g, b, a);
-			outputImage.setPixel(iX + 1, 0, r, g, b, a);
-
-			// Bottom pixel row
-			getPixel(iX, _miHeight - 1, r, g, b, a);
-			outputImage.setPixel(iX + 1, heightOfOutputImageMinusOne, r, g, b, a);
+			_detach();
+			dispatchChannels([&](auto channels)
+			{
+				using TPixel = SPixel<decltype(channels)::value>;
+				TPixel* pPixels = reinterpret_cast<TPixel*>(_mpData);
+				const int iNumTileRows = (_miWidth + kTransformTileSize - 1) / kTransformTileSize;
+				_forEachRowBand(iNumTileRows, _miWidth * kTransformTileSize, [&](int iFirstTileRow, int iLastTileRow)
+				{
+					transposeSquareTiled(pPixels, _miWidth, iFirstTileRow, iLastTileRow);
+				}, bMultithreaded);
+			});
+			return;
 		}
-		int widthOfOutputImageMinusOne = newWidth - 1;
-		// Left and right edges
-		for (int iY = 0; iY < _miHeight; iY++)
-		{
-			// Left pixel column
-			getPixel(0, iY, r, g, b, a);
-			outputImage.setPixel(0, iY + 1, r, g, b, a);
 
-			// Right pixel column
-			getPixel(_miWidth - 1, iY, r, g, b, a);
-			outputImage.setPixel(widthOfOutputImageMinusOne, iY + 1, r, g, b, a);
-		}
+		// The pixel at X, Y comes from the source's column Y, row X
+		_transformInto(0, _miWidth, 1, bMultithreaded);
 	}
 
-	void CImage::rotateClockwise(void)
+	void CImage::_transformInto(ptrdiff_t iSrcOrigin, ptrdiff_t iSrcStepX, ptrdiff_t iSrcStepY, bool bMultithreaded)
 	{
-		CImage oldImage;
-		copyTo(oldImage);
+		// Take this image's data rather than copying it, then write the transformed pixels into a new buffer
+		CImage oldImage(std::move(*this));
+		createBlank(oldImage._miHeight, oldImage._miWidth, oldImage._miNumChannels, false);
 
-		unsigned char col[4];
-		int idstX;
-		int idstY;
-
-		// Non squared?
-		if (_miWidth != _miHeight)
-		{
-			createBlank(_miHeight, _miWidth, _miNumChannels);
-		}
-
-		for (int isrcX = 0; isrcX < oldImage._miWidth; ++isrcX)
+		dispatchChannels([&](auto channels)
 		{
-			idstY = _miHeight - isrcX - 1;
-			for (int isrcY = 0; isrcY < oldImage._miHeight; ++isrcY)
+			using TPixel = SPixel<decltype(channels)::value>;
+			const TPixel* pSrc = reinterpret_cast<const TPixel*>(oldImage._mpData);
+			TPixel* pDst = reinterpret_cast<TPixel*>(_mpData);
+			_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 			{
-				idstX = isrcY;
-				oldImage.getPixel(isrcX, isrcY, col[0], col[1], col[2], col[3]);
-				setPixel(idstX, idstY, col[0], col[1], col[2], col[3]);
-			}
-		}
+				transformTiled(pSrc, pDst, _miWidth, iFirstRow, iLastRow, iSrcOrigin, iSrcStepX, iSrcStepY);
+			}, bMultithreaded);
+		});
 	}
 
 	void CImage::edgeDetect(CImage& outputImage, unsigned char r, unsigned char g, unsigned char b)
@@ -1031,51 +1505,88 @@ namespace X
 		ThrowIfTrue(_miNumChannels < 3, "Some image data exists, but doesn't have enough colour channels.");
 
 		outputImage.createBlank(_miWidth, _miHeight, 4);
-		int iX = 0;
-		int iY = 0;
-		while (iX < (int)_miWidth)
+		const SPixel<4> pixelEdge = { { 255, 255, 255, 255 } };
+		const SPixel<4> pixelNotEdge = { { 0, 0, 0, 0 } };
+		const CImage& source = *this;
+		dispatchChannels([&](auto channels)
 		{
-			while (iY < (int)_miHeight)
+			constexpr int iNumChannels = decltype(channels)::value;
+			_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 			{
-				if (_isPixelEdge(iX, iY, r, g, b))
-					outputImage.setPixel(iX, iY, 255, 255, 255, 255);
-				else
-					outputImage.setPixel(iX, iY, 0, 0, 0, 0);
-				++iY;
-			}
-			++iX;
-			iY = 0;
-		}
+				CBorderedRows<SPixel<iNumChannels>> rowsBordered(source.getRow<iNumChannels>(0).data(), _miWidth, _miHeight, 1, 1, SFilterBorder());
+				for (int iY = iFirstRow; iY < iLastRow; ++iY)
+				{
+					std::span<SPixel<4>> rowOutput = outputImage.getRow<4>(iY);
+
+					// Pixels on the edge of the image are never edges
+					if (0 == iY || _miHeight - 1 == iY)
+					{
+						std::fill(rowOutput.begin(), rowOutput.end(), pixelNotEdge);
+						continue;
+					}
+					const SPixel<iNumChannels>* const* ppRows = rowsBordered.getRows(iY);
+					const SPixel<iNumChannels>* pRowBelow = ppRows[0];
+					const SPixel<iNumChannels>* pRow = ppRows[1];
+					const SPixel<iNumChannels>* pRowAbove = ppRows[2];
+					rowOutput[0] = pixelNotEdge;
+					for (int iX = 1; iX < _miWidth - 1; ++iX)
+						rowOutput[iX] = _isPixelEdge(pRowBelow, pRow, pRowAbove, iX, r, g, b) ? pixelEdge : pixelNotEdge;
+					rowOutput[_miWidth - 1] = pixelNotEdge;
+				}
+			});
+		});
 	}
 
-	void CImage::removeAlphaChannel(void)
+	void CImage::convolve(const SFilterKernel& kernel, const SFilterBorder& border, bool bFilterAlpha, bool bMultithreaded)
 	{
 		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
-		ThrowIfTrue(_miNumChannels != 4, "Some image data exists, but the alpha data doesn't exist (Image doesn't hold 4 channels)");
+		_filter(kernel, border, bFilterAlpha, 0.0f, bMultithreaded);
+	}
 
-		// Copy this image to a new tmp image
-		CImage old;
-		copyTo(old);
+	void CImage::blurGaussian(float fSigma, const SFilterBorder& border, bool bMultithreaded)
+	{
+		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
+		_filter(SFilterKernel::gaussian(fSigma), border, true, 0.0f, bMultithreaded);
+	}
 
-		// Recreate this one, but with 3 channels
-		createBlank(old.getWidth(), old.getHeight(), 3);
+	void CImage::sharpenUnsharpMask(float fSigma, float fAmount, const SFilterBorder& border, bool bMultithreaded)
+	{
+		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
+		SFilterKernel kernel = SFilterKernel::gaussian(fSigma);
+		if (0.0f == fAmount)
+			return;
+		_filter(kernel, border, false, fAmount, bMultithreaded);
+	}
 
-		// Copy RGB from old to this...
-		unsigned int iIndex = 0;
-		int iIndexOld = 0;
-		while (iIndex < _muiDataSize)
+	void CImage::_filter(const SFilterKernel& kernel, const SFilterBorder& border, bool bFilterAlpha, float fUnsharpAmount, bool bMultithreaded)
+	{
+		// Each band reads the rows around it from the old pixels, so the result is written to a new buffer
+		CImage oldImage(std::move(*this));
+		createBlank(oldImage._miWidth, oldImage._miHeight, oldImage._miNumChannels, false);
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
 		{
-			_mpData[iIndex] = old._mpData[iIndexOld];		// Red
-			_mpData[iIndex + 1] = old._mpData[iIndexOld + 1];	// Green
-			_mpData[iIndex + 2] = old._mpData[iIndexOld + 2];	// Blue
-			iIndex += 3;
-			iIndexOld += 4;
-		}
+			convolveRows(oldImage._mpData, _mpData, _miWidth, _miHeight, _miNumChannels, kernel, border, iFirstRow, iLastRow, bFilterAlpha, fUnsharpAmount);
+		}, bMultithreaded);
+	}
+
+	void CImage::removeAlphaChannel(void)
+	{
+		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
+		ThrowIfTrue(_miNumChannels != 4, "Some image data exists, but the alpha data doesn't exist (Image doesn't hold 4 channels)");
+		_detach();
+
+		// Pack the RGB of each pixel down in place. Each pixel is written no later in memory than it's read from, so nothing is overwritten before it's read.
+		// The buffer keeps its size, the last quarter simply being unused.
+		_miNumChannels = 3;
+		_muiDataSize = _miWidth * _miHeight * _miNumChannels;
+		_mvSourcePNG.clear();
+		SPixelKernels::get().removeAlphaChannel(_mpData, _mpData, size_t(_miWidth) * _miHeight);
 	}
 
 	void CImage::addAlphaChannel(unsigned char ucAlpha)
 	{
 		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
+		_detach();
 
 		// Simply overwrite alpha channel values with the one passed in
 		if (4 == _miNumChannels)
@@ -1090,23 +1601,12 @@ namespace X
 		}
 		else if (3 == _miNumChannels)
 		{
-			// Copy this image to a new tmp image
-			CImage old;
-			copyTo(old);
+			// Take this image's data rather than copying it
+			CImage old(std::move(*this));
 			// Recreate this one, but with 4 channels
-			createBlank(old.getWidth(), old.getHeight(), 4);
+			createBlank(old.getWidth(), old.getHeight(), 4, false);
 			// Copy RGB from old to this...
-			unsigned int iIndex = 0;
-			int iIndexOld = 0;
-			while (iIndex < _muiDataSize)
-			{
-				_mpData[iIndex] = old._mpData[iIndexOld];			// Red
-				_mpData[iIndex + 1] = old._mpData[iIndexOld + 1];	// Green
-				_mpData[iIndex + 2] = old._mpData[iIndexOld + 2];	// Blue
-				_mpData[iIndex + 3] = ucAlpha;	// Alpha
-				iIndex += 4;
-				iIndexOld += 3;
-			}
+			SPixelKernels::get().addAlphaChannel(old._mpData, _mpData, size_t(_miWidth) * _miHeight, ucAlpha);
 			return;
 		}
 		else
@@ -1119,6 +1619,7 @@ namespace X
 	{
 		ThrowIfTrue(!_mpData, "Image data doesn't exist.");
 		ThrowIfTrue(_miNumChannels != 4, "Some image data exists, but the alpha data doesn't exist (Image doesn't hold 4 channels)");
+		_detach();
 
 		unsigned int iIndex = 0;
 		while (iIndex < _muiDataSize)
@@ -1149,96 +1650,106 @@ namespace X
 		outputImage.createBlank(_miWidth, _miHeight, 3);
 
 		// Now loop through greyscale image, computing each normal and storing in the output image.
-		unsigned char r[3], g[3], b[3], a;
 		float fX, fY, fZ;
 		float fLength;
-		for (int y = 0; y < _miHeight; y++)
+		imageGreyscale.dispatchChannels([&](auto channels)
 		{
-			for (int ix = 0; ix < _miWidth; ix++)
+			constexpr int iNumChannels = decltype(channels)::value;
+			const CImage& greyscale = imageGreyscale;
+			for (int y = 0; y < _miHeight; y++)
 			{
 				// we add +1 to imageGreyscale pixel positions as it has a border
+				const SPixel<iNumChannels>* pRow = greyscale.getRow<iNumChannels>(y + 1).data();
+				const SPixel<iNumChannels>* pRowAbove = greyscale.getRow<iNumChannels>(y + 2).data();
+				std::span<SPixel<3>> rowOutput = outputImage.getRow<3>(y);
+				for (int ix = 0; ix < _miWidth; ix++)
+				{
+					// Get height values of centre and surrounding pixels
+					const unsigned char ucCentre = pRow[ix + 1].uc[0];	// Current pixel
+					const unsigned char ucLeft = pRow[ix].uc[0];		// Left pixel
+					const unsigned char ucAbove = pRowAbove[ix + 1].uc[0];	// Above pixel
 
-				// Get height values of centre and surrounding pixels
-				imageGreyscale.getPixel(ix + 1, y + 1, r[0], g[0], b[0], a);	// Current pixel
-				imageGreyscale.getPixel(ix, y + 1, r[1], g[1], b[1], a);		// Left pixel
-				imageGreyscale.getPixel(ix + 1, y + 2, r[2], g[2], b[2], a);	// Above pixel
+					fX = float(ucLeft - ucCentre) / 255.0f;	// Convert to -1.0f to 1.0f
+					fY = float(ucAbove - ucCentre) / 255.0f;	// ....
+					fZ = fScale;
 
-				fX = float(r[1] - r[0]) / 255.0f;	// Convert to -1.0f to 1.0f
-				fY = float(r[2] - r[0]) / 255.0f;	// ....
-				fZ = fScale;
+					// Compute length of vector and normalize
+					fLength = sqrt((fX * fX) + (fY * fY) + (fZ * fZ));
+					if (areFloatsEqual(fLength, 0.0f))	// If length is nearly zero, just set as up vector
+					{
+						fX = 0.0f;
+						fY = 0.0f;
+						fZ = fScale;
+					}
+					else
+					{
+						fX = fX / fLength;
+						fY = fY / fLength;
+						fZ = fZ / fLength;
+					}
 
-				// Compute length of vector and normalize
-				fLength = sqrt((fX * fX) + (fY * fY) + (fZ * fZ));
-				if (areFloatsEqual(fLength, 0.0f))	// If length is nearly zero, just set as up vector
-				{
-					fX = 0.0f;
-					fY = 0.0f;
-					fZ = fScale;
-				}
-				else
-				{
-					fX = fX / fLength;
-					fY = fY / fLength;
-					fZ = fZ / fLength;
+					// Convert from -1, +1 to 0, 255
+					fX += 1.0f;	fX *= 127.0f;
+					fY += 1.0f;	fY *= 127.0f;
+					fZ += 1.0f;	fZ *= 127.0f;
+					rowOutput[ix].uc[0] = unsigned char(fX);
+					rowOutput[ix].uc[1] = unsigned char(fY);
+					rowOutput[ix].uc[2] = unsigned char(fZ);
 				}
-
-				// Convert from -1, +1 to 0, 255
-				fX += 1.0f;	fX *= 127.0f;
-				fY += 1.0f;	fY *= 127.0f;
-				fZ += 1.0f;	fZ *= 127.0f;
-				r[0] = unsigned char(fX);
-				g[0] = unsigned char(fY);
-				b[0] = unsigned char(fZ);
-				outputImage.setPixel(ix, y, r[0], g[0], b[0], a);
 			}
-		}
+		});
 	}
 
 	void CImage::createColourWheel(unsigned int iWidthAndHeightOfImage, unsigned char ucBrightness)
 	{
 		ThrowIfTrue(iWidthAndHeightOfImage < 1, "Parsed iWidthAndHeightOfImage must be at least 1");
-		createBlank(iWidthAndHeightOfImage, iWidthAndHeightOfImage, 4);
+		createBlank(iWidthAndHeightOfImage, iWidthAndHeightOfImage, 4, false);
 
 		float fBrightness = float(ucBrightness) / 255.0f;
 		CVector2f vCentrePixelPosition;
 		vCentrePixelPosition.x = float(iWidthAndHeightOfImage) * 0.5f;
 		vCentrePixelPosition.y = vCentrePixelPosition.x;
 
-		CVector2f vCurrentPixelPosition;
-		CVector2f vCurrentPixelOffsetFromCentre;
-		CColourf colour;
 		float fCircleRadius = float(iWidthAndHeightOfImage) * 0.5f;
-		float fDistanceFromCentre;
-		float fSaturation;	// 0.0f = white, 1.0f = full colour
-		float fAngleDegrees;
 		float fOneOver360 = 1.0f / 360.0f;
-		unsigned int iPixelIndex = 0;
-		for (unsigned int iPosX = 0; iPosX < (unsigned int)_miWidth; iPosX++)
+
+		// X is the outer loop, so each row of the image's data is filled from one X position, and the bands are of X positions
+		_forEachRowBand(_miWidth, _miHeight, [&](int iFirstPosX, int iLastPosX)
 		{
-			vCurrentPixelPosition.x = (float)iPosX;
-			for (unsigned int iPosY = 0; iPosY < (unsigned int)_miHeight; iPosY++)
+			CVector2f vCurrentPixelPosition;
+			CVector2f vCurrentPixelOffsetFromCentre;
+			CColourf colour;
+			float fDistanceFromCentre;
+			float fSaturation;	// 0.0f = white, 1.0f = full colour
+			float fAngleDegrees;
+			unsigned int iPixelIndex = iFirstPosX * _miHeight * 4;
+			for (unsigned int iPosX = iFirstPosX; iPosX < (unsigned int)iLastPosX; iPosX++)
 			{
-				vCurrentPixelPosition.y = (float)iPosY;
-				vCurrentPixelOffsetFromCentre = vCurrentPixelPosition - vCentrePixelPosition;
-				fDistanceFromCentre = vCurrentPixelOffsetFromCentre.getMagnitude();
-				fSaturation = fCircleRadius - fDistanceFromCentre;
-				fSaturation /= fCircleRadius;	// 0 at edge of circle, 1 at centre. Can be < 0 which is outside circle
-				fAngleDegrees = vCurrentPixelOffsetFromCentre.getAngleDegrees360();
-				fAngleDegrees *= fOneOver360;	// 0 when pixel is north, 0.25 when east etc.
-				if (fSaturation < 0.0f)
-					colour.set(0.0f, 0.0f, 0.0f, 0.0f);
-				else
+				vCurrentPixelPosition.x = (float)iPosX;
+				for (unsigned int iPosY = 0; iPosY < (unsigned int)_miHeight; iPosY++)
 				{
-					colour.setFromHSB(fAngleDegrees, fSaturation, fBrightness);
-					colour.alpha = 1.0f;
+					vCurrentPixelPosition.y = (float)iPosY;
+					vCurrentPixelOffsetFromCentre = vCurrentPixelPosition - vCentrePixelPosition;
+					fDistanceFromCentre = vCurrentPixelOffsetFromCentre.getMagnitude();
+					fSaturation = fCircleRadius - fDistanceFromCentre;
+					fSaturation /= fCircleRadius;	// 0 at edge of circle, 1 at centre. Can be < 0 which is outside circle
+					fAngleDegrees = vCurrentPixelOffsetFromCentre.getAngleDegrees360();
+					fAngleDegrees *= fOneOver360;	// 0 when pixel is north, 0.25 when east etc.
+					if (fSaturation < 0.0f)
+						colour.set(0.0f, 0.0f, 0.0f, 0.0f);
+					else
+					{
+						colour.setFromHSB(fAngleDegrees, fSaturation, fBrightness);
+						colour.alpha = 1.0f;
+					}
+					_mpData[iPixelIndex] = unsigned char(colour.red * 255);
+					_mpData[iPixelIndex + 1] = unsigned char(colour.green * 255);
+					_mpData[iPixelIndex + 2] = unsigned char(colour.blue * 255);
+					_mpData[iPixelIndex + 3] = unsigned char(colour.alpha * 255);
+					iPixelIndex += 4;
 				}
-				_mpData[iPixelIndex] = unsigned char(colour.red * 255);
-				_mpData[iPixelIndex + 1] = unsigned char(colour.green * 255);
-				_mpData[iPixelIndex + 2] = unsigned char(colour.blue * 255);
-				_mpData[iPixelIndex + 3] = unsigned char(colour.alpha * 255);
-				iPixelIndex += 4;
 			}
-		}
+		});
 	}
 
 	CColourf CImage::getColourWheelColour(unsigned int iPositionX, unsigned int iPositionY, unsigned int iWidthAndHeightOfImage, unsigned char ucBrightness)
@@ -1271,7 +1782,7 @@ namespace X
 	{
 		ThrowIfTrue(iWidth < 1 || iHeight < 1, "Invalid dimensions given.");
 		ThrowIfTrue(iNumChannels < 3 || iNumChannels > 4, "Number of channels must be either 3 or 4.");
-		createBlank(iWidth, iHeight, iNumChannels);
+		createBlank(iWidth, iHeight, iNumChannels, false);
 		bool bHorizontal = true;
 		if (iHeight > iWidth)
 			bHorizontal = false;
@@ -1317,7 +1828,7 @@ namespace X
 	void CImage::createCircle(unsigned int iWidthAndHeightOfImage, const CColourf& colourInner, const CColourf& colourOuter)
 	{
 		ThrowIfTrue(iWidthAndHeightOfImage < 1, "Parsed iWidthAndHeightOfImage must be at least 1");
-		createBlank(iWidthAndHeightOfImage, iWidthAndHeightOfImage, 4);
+		createBlank(iWidthAndHeightOfImage, iWidthAndHeightOfImage, 4, false);
 
 		CVector2f vCentrePixelPosition;
 		vCentrePixelPosition.x = float(iWidthAndHeightOfImage) * 0.5f;
@@ -1417,9 +1928,13 @@ namespace X
 		_miHeight = static_cast<int>(height);
 		_miNumChannels = static_cast<int>(numChannels);
 		_muiDataSize = static_cast<unsigned int>(dataSize);
-		_mpData = new unsigned char[_muiDataSize];
-		if (!_mpData)
+		try
 		{
+			_allocateData(false);
+		}
+		catch (...)
+		{
+			free();
 			return false;
 		}
 
@@ -1430,8 +1945,7 @@ namespace X
 		file.read(reinterpret_cast<char*>(cMagic), 4);
 		if (cMagic[0] != 'D' || cMagic[1] != 'I' || cMagic[2] != 'F' || cMagic[3] != 0)
 		{
-			delete[] _mpData;
-			_mpData = nullptr;
+			free();
 			return false;
 		}
 
@@ -1547,11 +2061,38 @@ namespace X
 		// If the new dimensions are the same as the current ones, do nothing
 		if (iNewWidth == _miWidth && iNewHeight == _miHeight)
 			return true;
-		
+
+		// Create a new image with the new dimensions
+		// This will hold the resized image data
+		CImage newImage;
+		if (!resizeTo(newImage, iNewWidth, iNewHeight))
+			return false;
+
+		// Take the new image's data rather than copying it
+		*this = std::move(newImage);
+		return true;
+	}
+
+	bool CImage::resizeTo(CImage& outputImage, unsigned int iNewWidth, unsigned int iNewHeight) const
+	{
+		if (!_mpData)	// Image not yet created
+			return false;
+
+		// If the output image is this image, resize() should be used instead
+		if (&outputImage == this)
+			return false;
+
 		// If the new dimensions are invalid
 		if (iNewWidth < 1 || iNewHeight < 1)
 			return false;
 
+		// If the new dimensions are the same as the current ones, simply copy
+		if (iNewWidth == _miWidth && iNewHeight == _miHeight)
+		{
+			copyTo(outputImage);
+			return true;
+		}
+
 		// Set pixel layout for the resize function
 		stbir_pixel_layout pixel_layout;
 		if (3 == _miNumChannels)
@@ -1561,173 +2102,415 @@ namespace X
 		else
 			return false;
 
-		// Create a new image with the new dimensions
-		// This will hold the resized image data
-		CImage newImage;
-		newImage.createBlank(iNewWidth, iNewHeight, _miNumChannels);
+		// Create the output image with the new dimensions
+		outputImage.createBlank(iNewWidth, iNewHeight, _miNumChannels, false);
 
 		// Resize the image
 		unsigned char* result = stbir_resize_uint8_srgb(
-			_mpData,			// Pointer to the image data
-			_miWidth,			// Source image width
-			_miHeight,			// Source image height
-			0,					// Input stride	in bytes
-			newImage._mpData,	// Pointer to the new image data
-			(int)iNewWidth,		// Destination image width
-			(int)iNewHeight,	// Destination image height
-			0,					// Output stride in bytes
-			pixel_layout);		// Number of channels
+			_mpData,				// Pointer to the image data
+			_miWidth,				// Source image width
+			_miHeight,				// Source image height
+			0,						// Input stride	in bytes
+			outputImage._mpData,	// Pointer to the new image data
+			(int)iNewWidth,			// Destination image width
+			(int)iNewHeight,		// Destination image height
+			0,						// Output stride in bytes
+			pixel_layout);			// Number of channels
 
 		if (0 == result)
+		{
+			outputImage.free();
 			return false;
-
-		// Copy the new image to this one
-		newImage.copyTo(*this);
+		}
 		return true;
 	}
 
-	bool CImage::saveAsICO(const std::string& strFilename) const
+	double CImage::computePSNR(const CImage& other) const
+	{
+		ThrowIfTrue(!_mpData || !other._mpData, "Image data doesn't exist.");
+		ThrowIfTrue(_miWidth != other._miWidth || _miHeight != other._miHeight, "Images have different dimensions.");
+		ThrowIfTrue(_miNumChannels != other._miNumChannels, "Images have a different number of channels.");
+
+		// Sum of the squared difference of every colour component
+		// With an alpha channel, the RGB components are compared multiplied by alpha, otherwise
+		// the colour of fully transparent pixels, which is never seen, would count as much as visible ones.
+		double dSumSquaredError = 0.0;
+		double dDiff;
+		double d1Over255 = 1.0 / 255.0;
+		if (4 == _miNumChannels)
+		{
+			for (unsigned int i = 0; i < _muiDataSize; i += 4)
+			{
+				double dAlpha = double(_mpData[i + 3]) * d1Over255;
+				double dAlphaOther = double(other._mpData[i + 3]) * d1Over255;
+				for (unsigned int iChannel = 0; iChannel < 3; ++iChannel)
+				{
+					dDiff = double(_mpData[i + iChannel]) * dAlpha - double(other._mpData[i + iChannel]) * dAlphaOther;
+					dSumSquaredError += dDiff * dDiff;
+				}
+				dDiff = double(_mpData[i + 3]) - double(other._mpData[i + 3]);
+				dSumSquaredError += dDiff * dDiff;
+			}
+		}
+		else
+		{
+			for (unsigned int i = 0; i < _muiDataSize; ++i)
+			{
+				dDiff = double(_mpData[i]) - double(other._mpData[i]);
+				dSumSquaredError += dDiff * dDiff;
+			}
+		}
+
+		// Identical images have infinite PSNR
+		if (dSumSquaredError <= 0.0)
+			return kMaxDouble;
+
+		double dMeanSquaredError = dSumSquaredError / double(_muiDataSize);
+		return 10.0 * log10((255.0 * 255.0) / dMeanSquaredError);
+	}
+
+	bool CImage::saveAsICO(const std::string& strFilename, const SICOSettings& settings) const
+	{
+		std::vector<uint8_t> vICOData;
+		if (!saveAsICOToMemory(vICOData, settings))
+			return false;
+
+		// Change filename to have the .ico extension
+		std::string strOutputFilename = StringUtils::addFilenameExtension(".ico", strFilename);
+
+		// The whole file is already assembled, so write it in one go
+		std::ofstream ofs(strOutputFilename, std::ios::binary);
+		if (!ofs)
+			return false;
+		ofs.write(reinterpret_cast<const char*>(vICOData.data()), std::streamsize(vICOData.size()));
+		ofs.close();
+		return !ofs.fail();
+	}
+
+	bool CImage::saveAsICOToMemory(std::vector<uint8_t>& vICOData, const SICOSettings& settings) const
 	{
+		vICOData.clear();
 		if (!_mpData)
 			return false;
 
-		// Create a source image from this one, ensuring it has an alpha channel
-		CImage imageSourceWithAlpha;
-		this->copyTo(imageSourceWithAlpha);
-		if (3 == imageSourceWithAlpha.getNumChannels())
+		// Make sure the settings are valid
+		if (settings.vIconSizes.empty())
+			return false;
+		for (int size : settings.vIconSizes)
 		{
-			imageSourceWithAlpha.addAlphaChannel(255);
+			if (size < 1 || size > 256)
+				return false;
 		}
+		if (settings.iPaletteBitsPerPixel != 0 && settings.iPaletteBitsPerPixel != 4 && settings.iPaletteBitsPerPixel != 8)
+			return false;
 
-		// Desired icon sizes
-		std::vector<int> iconSizes = { 16, 32, 48, 64, 128, 256 };
+		// Will hold the resized image for each of the icon sizes, in the same order as settings.vIconSizes
+		std::vector<CImage> vImagesResized(settings.vIconSizes.size());
 
-		// Will hold the image data as BMP or PNG for each size image
-		std::vector<std::vector<uint8_t>> vecIcoDataForImages;
+		// Compute the sizes largest first, so that when using the pyramid, each size can be resampled from one computed before it.
+		std::vector<size_t> vOrder(settings.vIconSizes.size());
+		for (size_t i = 0; i < vOrder.size(); ++i)
+		{
+			vOrder[i] = i;
+		}
+		std::stable_sort(vOrder.begin(), vOrder.end(), [&settings](size_t a, size_t b) { return settings.vIconSizes[a] > settings.vIconSizes[b]; });
 
-		// For each icon size
-		for (int size : iconSizes)
+		// For each size, the index into vImagesResized of the pyramid level it is resampled from, or -1 to resample from this image.
+		// This is worked out up front so that every size resamples from the same source, regardless of whether the sizes are computed one after another or concurrently.
+		std::vector<int> vResizeSource(settings.vIconSizes.size(), -1);
+		if (settings.bUseResizePyramid)
 		{
-			// Copy the source image to a new image which will hold the resized image
-			CImage imageResized;
-			imageSourceWithAlpha.copyTo(imageResized);
+			// Indices of the sizes which may be used as a pyramid level, largest first.
+			std::vector<size_t> vPyramidLevels;
+			for (size_t i : vOrder)
+			{
+				int size = settings.vIconSizes[i];
 
-			// Resize the image
-			if (!imageResized.resize(size, size))
-				return false;
+				// Resample from the smallest level which is at least twice this size.
+				// Keeping each step at 2x or more stops the resampling filter's blur from building up over many small steps.
+				// If there's no such level, resize straight from this image, which means we don't need a full resolution copy of it.
+				for (size_t iLevel : vPyramidLevels)
+				{
+					if (settings.vIconSizes[iLevel] >= size * 2)
+						vResizeSource[i] = int(iLevel);
+				}
 
-			// Create ICO image data
-			std::vector<uint8_t> icoData;
-			icoData = _icoCreatePNGData(imageResized.getData(), size, size);
+				// Only use a size as a pyramid level if it was downsampled.
+				// An upsampled size holds no extra detail and would only blur the sizes computed from it.
+				// A size equal to this image is an exact copy of it, so resampling from this image instead gives the same result.
+				const bool bSameAsThis = size == _miWidth && size == _miHeight;
+				if (size <= _miWidth && size <= _miHeight && !bSameAsThis)
+					vPyramidLevels.push_back(i);
+			}
+		}
+
+		// Will hold the encoded PNG or paletted data for each size image
+		std::vector<std::vector<uint8_t>> vEntryData(settings.vIconSizes.size());
+
+		// Whether each size is written as a paletted entry
+		auto isPaletted = [&settings](int size) { return settings.iPaletteBitsPerPixel > 0 && size <= settings.iPaletteMaxSize; };
 
-			// Add the ICO image data to vecIcoDataForImages
-			vecIcoDataForImages.push_back(std::move(icoData));
+		// Non zero for each size which was resized and encoded. (Not vector<bool>, as each element is written by a different thread)
+		std::vector<char> vSucceeded(settings.vIconSizes.size(), 0);
 
+		// For each size, the sizes resampled from it, which can begin once it has been resized.
+		std::vector<std::vector<size_t>> vResampledFrom(settings.vIconSizes.size());
+		for (size_t i : vOrder)
+		{
+			if (vResizeSource[i] >= 0)
+				vResampledFrom[vResizeSource[i]].push_back(i);
 		}
 
-		// Change filename to have the .ico extension
-		std::string strOutputFilename = StringUtils::addFilenameExtension(".ico", strFilename);
-		
-		// vecIcoDataForImages now holds the ICO image data for each of the image sizes.
-		std::ofstream ofs(strOutputFilename, std::ios::binary);
-		if (!ofs)
+		// Resizes and encodes the size at the given index. When run on the thread pool, it then starts the sizes resampled from it,
+		// so nothing ever waits for a pyramid level. Run one after another, it's up to the caller to go largest first.
+		// If this image was loaded from a PNG which can be stored in the .ico file as is and its pixels haven't changed since,
+		// the size matching it uses the file's bytes verbatim rather than being copied and encoded again.
+		const bool bPNGPassthrough = settings.bAllowPNGPassthrough && !_mvSourcePNG.empty() && computeHash64(_mpData, _muiDataSize) == _muiSourcePNGPixelHash;
+
+		CTaskGroup* pGroup = nullptr;
+		std::function<void(size_t)> processSize = [&](size_t i)
+		{
+			int size = settings.vIconSizes[i];
+			if (bPNGPassthrough && size == _miWidth && size == _miHeight && !isPaletted(size))
+			{
+				// No other size is resampled from this one, as it isn't a pyramid level
+				vEntryData[i] = _mvSourcePNG;
+				vSucceeded[i] = 1;
+				return;
+			}
+
+			bool bResized = false;
+			try
+			{
+				const CImage* pResizeSource = vResizeSource[i] >= 0 ? &vImagesResized[vResizeSource[i]] : this;
+				bResized = pResizeSource->resizeTo(vImagesResized[i], size, size);
+			}
+			catch (...)
+			{
+				bResized = false;
+			}
+			// If this size failed, the sizes resampled from it never start, so are left failed too
+			if (!bResized)
+				return;
+			if (pGroup)
+			{
+				for (size_t iResampled : vResampledFrom[i])
+					pGroup->run([&processSize, iResampled]() { processSize(iResampled); });
+			}
+
+			try
+			{
+				// Ensure the image being encoded has an alpha channel.
+				// The resized image may still be being read by the smaller sizes resampled from it, so it's expanded into a separate image.
+				const CImage& imageResized = vImagesResized[i];
+				const CImage* pImageToEncode = &imageResized;
+
+				// Sharpen the sizes which were downscaled, to restore the crispness lost to the resampling filter.
+				// Sharpening writes to a new buffer, so the copy sharing the resized image's pixels leaves them as they were for the sizes resampled from it.
+				CImage imageSharpened;
+				if (settings.fSharpenAmount > 0.0f && (size < _miWidth || size < _miHeight))
+				{
+					imageSharpened = imageResized;
+					imageSharpened.sharpenUnsharpMask(kICOSharpenSigma, settings.fSharpenAmount, SFilterBorder(SFilterBorder::BORDER_MIRROR), false);
+					pImageToEncode = &imageSharpened;
+				}
+
+				CImage imageWithAlpha;
+				if (3 == pImageToEncode->getNumChannels())
+				{
+					imageWithAlpha.createBlank(size, size, 4, false);
+					SPixelKernels::get().addAlphaChannel(pImageToEncode->getData(), imageWithAlpha.getData(), size_t(size) * size, 255);
+					pImageToEncode = &imageWithAlpha;
+				}
+
+				// Create ICO image data
+				bool bCreated = false;
+				if (isPaletted(size))
+					bCreated = _icoCreatePalettedData(pImageToEncode->getData(), size, size, settings, vEntryData[i]);
+				else
+					bCreated = _icoCreatePNGData(pImageToEncode->getData(), size, size, settings.ePNGEffort, settings.bMultithreaded, vEntryData[i]);
+				if (bCreated)
+					vSucceeded[i] = 1;
+			}
+			catch (...)
+			{
+			}
+		};
+
+		if (settings.bMultithreaded && settings.vIconSizes.size() > 1)
+		{
+			// Each size is a task on the shared pool. The largest size dominates, so the total time is roughly that of the largest rather than the sum of all of them.
+			// Only the sizes resampled from this image start now, the rest are started by their pyramid level.
+			CTaskGroup group;
+			pGroup = &group;
+			for (size_t i : vOrder)
+			{
+				if (vResizeSource[i] < 0)
+					group.run([&processSize, i]() { processSize(i); });
+			}
+			group.wait();
+		}
+		else
+		{
+			// Largest first, so each pyramid level is ready before the sizes resampled from it.
+			for (size_t i : vOrder)
+			{
+				processSize(i);
+			}
+		}
+
+		for (size_t i = 0; i < vSucceeded.size(); ++i)
+		{
+			if (!vSucceeded[i])
+				return false;
+		}
+
+		// Every payload's size is now known, so work out the size of the whole file and assemble it into a single buffer.
+		size_t uiTotalSize = sizeof(ICONDIR) + sizeof(ICONDIRENTRY) * settings.vIconSizes.size();
+		for (const std::vector<uint8_t>& vData : vEntryData)
+		{
+			uiTotalSize += vData.size();
+		}
+		// Offsets within the file are stored as 32 bits
+		if (uiTotalSize > 0xFFFFFFFF)
 			return false;
+		vICOData.resize(uiTotalSize);
+		uint8_t* pWrite = vICOData.data();
 
 		ICONDIR iconDir = {};
 		iconDir.idReserved = 0;
 		iconDir.idType = 1; // Icon resource
-		iconDir.idCount = static_cast<uint16_t>(vecIcoDataForImages.size());
+		iconDir.idCount = static_cast<uint16_t>(settings.vIconSizes.size());
+		memcpy(pWrite, &iconDir, sizeof(ICONDIR));
+		pWrite += sizeof(ICONDIR);
 
 		// Calculate the image offset
-		uint32_t imageOffset = uint32_t(sizeof(ICONDIR) + sizeof(ICONDIRENTRY) * vecIcoDataForImages.size());
-
-		// Write ICONDIR
-		ofs.write(reinterpret_cast<const char*>(&iconDir), sizeof(ICONDIR));
+		uint32_t imageOffset = uint32_t(sizeof(ICONDIR) + sizeof(ICONDIRENTRY) * settings.vIconSizes.size());
 
-		// Write ICONDIRENTRY for each image
-		for (size_t i = 0; i < vecIcoDataForImages.size(); ++i)
+		// ICONDIRENTRY for each image
+		for (size_t i = 0; i < settings.vIconSizes.size(); ++i)
 		{
 			ICONDIRENTRY entry = {};
-			int size = iconSizes[i];
+			int size = settings.vIconSizes[i];
 			entry.bWidth = (size == 256) ? 0 : static_cast<uint8_t>(size);
 			entry.bHeight = (size == 256) ? 0 : static_cast<uint8_t>(size);
 			entry.bColorCount = 0; // 256 or more colors
 			entry.bReserved = 0;
 			entry.wPlanes = 1;
 			entry.wBitCount = 32;
-			entry.dwBytesInRes = static_cast<uint32_t>(vecIcoDataForImages[i].size());
+			if (isPaletted(size))
+			{
+				entry.bColorCount = 4 == settings.iPaletteBitsPerPixel ? 16 : 0;
+				entry.wBitCount = static_cast<uint16_t>(settings.iPaletteBitsPerPixel);
+			}
+			entry.dwBytesInRes = static_cast<uint32_t>(vEntryData[i].size());
 			entry.dwImageOffset = imageOffset;
 
-			ofs.write(reinterpret_cast<const char*>(&entry), sizeof(ICONDIRENTRY));
+			memcpy(pWrite, &entry, sizeof(ICONDIRENTRY));
+			pWrite += sizeof(ICONDIRENTRY);
 			imageOffset += entry.dwBytesInRes;
 		}
 
-		// Write Image Data
-		for (const auto& img : vecIcoDataForImages) {
-			ofs.write(reinterpret_cast<const char*>(img.data()), img.size());
+		// Image Data
+		for (size_t i = 0; i < settings.vIconSizes.size(); ++i)
+		{
+			memcpy(pWrite, vEntryData[i].data(), vEntryData[i].size());
+			pWrite += vEntryData[i].size();
 		}
-
-		ofs.close();
 		return true;
 	}
 
-	std::vector<uint8_t> CImage::_icoCreateBMPData(const uint8_t* pixels, int width, int height) const
-	{
-		// Define BITMAPINFOHEADER structure
-#pragma pack(push, 1)
-		struct BITMAPINFOHEADER {
-			uint32_t biSize;
-			int32_t  biWidth;
-			int32_t  biHeight;
-			uint16_t biPlanes;
-			uint16_t biBitCount;
-			uint32_t biCompression;
-			uint32_t biSizeImage;
-			int32_t  biXPelsPerMeter;
-			int32_t  biYPelsPerMeter;
-			uint32_t biClrUsed;
-			uint32_t biClrImportant;
-		};
-#pragma pack(pop)
+	bool CImage::_icoCreatePNGData(const uint8_t* pixels, int width, int height, CPNGEncoder::EEffort eEffort, bool bMultithreaded, std::vector<uint8_t>& vPNGData) const
+	{
+		CPNGEncoder encoder(eEffort, bMultithreaded ? 0 : 1);
+		return encoder.encode(pixels, width, height, 4, vPNGData);
+	}
+
+	bool CImage::_icoCreatePalettedData(const uint8_t* pixels, int width, int height, const SICOSettings& settings, std::vector<uint8_t>& vData) const
+	{
+		const size_t uiNumPixels = size_t(width) * height;
+		bool bAnyTransparent = false;
+		for (size_t ui = 0; ui < uiNumPixels && !bAnyTransparent; ui++)
+			bAnyTransparent = pixels[ui * 4 + 3] < 128;
+
+		// Transparent pixels get an entry of their own, black, after the colours chosen for the rest
+		const int iMaxColours = 1 << settings.iPaletteBitsPerPixel;
+		CPalette palette;
+		palette.createFromPixels(pixels, width, height, 4, bAnyTransparent ? iMaxColours - 1 : iMaxColours);
+		std::vector<uint8_t> vColours = palette.getColours();
+		int iTransparentIndex = -1;
+		if (bAnyTransparent)
+		{
+			iTransparentIndex = palette.getNumColours();
+			vColours.insert(vColours.end(), 3, 0);
+		}
+		const int iNumColours = int(vColours.size() / 3);
+		std::vector<uint8_t> vIndices(uiNumPixels);
+		palette.mapPixels(pixels, width, height, 4, settings.ePaletteDither, iTransparentIndex, vIndices.data());
+
+		if (settings.bPalettePNG)
+		{
+			std::vector<uint8_t> vPaletteRGBA(size_t(iNumColours) * 4);
+			for (int iColour = 0; iColour < iNumColours; iColour++)
+			{
+				memcpy(&vPaletteRGBA[size_t(iColour) * 4], &vColours[size_t(iColour) * 3], 3);
+				vPaletteRGBA[size_t(iColour) * 4 + 3] = iColour == iTransparentIndex ? 0 : 255;
+			}
+			CPNGEncoder encoder(settings.ePNGEffort, 1);
+			return encoder.encodePaletted(vIndices.data(), width, height, vPaletteRGBA.data(), iNumColours, vData);
+		}
+
+		// Header, a full colour table of BGRX entries, the indices with rows padded to 4 bytes, then a 1bpp AND mask also with rows padded to 4 bytes
+		const int iBitCount = settings.iPaletteBitsPerPixel;
+		const size_t uiRowSize = size_t((width * iBitCount + 31) / 32) * 4;
+		const size_t uiMaskRowSize = size_t((width + 31) / 32) * 4;
+		vData.assign(sizeof(BITMAPINFOHEADER) + size_t(iMaxColours) * 4 + (uiRowSize + uiMaskRowSize) * height, 0);
+		uint8_t* pDest = vData.data();
 
 		BITMAPINFOHEADER bih = {};
 		bih.biSize = sizeof(BITMAPINFOHEADER);
 		bih.biWidth = width;
 		bih.biHeight = height * 2; // Image and mask
 		bih.biPlanes = 1;
-		bih.biBitCount = 32;
+		bih.biBitCount = static_cast<uint16_t>(iBitCount);
 		bih.biCompression = 0; // BI_RGB
+		memcpy(pDest, &bih, sizeof(BITMAPINFOHEADER));
+		pDest += sizeof(BITMAPINFOHEADER);
 
-		// Initialize BMP data vector
-		std::vector<uint8_t> bmpData(sizeof(BITMAPINFOHEADER));
-		memcpy(bmpData.data(), &bih, sizeof(BITMAPINFOHEADER));
-
-		// Append pixel data (bottom-up DIB)
-		for (int y = height - 1; y >= 0; --y) {
-			const uint8_t* row = pixels + y * width * 4; // Assuming RGBA format
-			bmpData.insert(bmpData.end(), row, row + width * 4);
+		// Entries past the palette's colours are left black
+		for (int iColour = 0; iColour < iNumColours; iColour++)
+		{
+			pDest[iColour * 4] = vColours[size_t(iColour) * 3 + 2];
+			pDest[iColour * 4 + 1] = vColours[size_t(iColour) * 3 + 1];
+			pDest[iColour * 4 + 2] = vColours[size_t(iColour) * 3];
 		}
+		pDest += size_t(iMaxColours) * 4;
 
-		// Append an empty AND mask (opaque)
-		size_t maskSize = ((width + 31) / 32) * 4 * height;
-		bmpData.resize(bmpData.size() + maskSize, 0xFF);
-
-		return bmpData;
-	}
-
-	std::vector<uint8_t> CImage::_icoCreatePNGData(const uint8_t* pixels, int width, int height) const
-	{
-		std::vector<uint8_t> pngData;
-
-		// Callback function to collect PNG data into pngData vector
-		auto WriteCallback = [](void* context, void* data, int size) {
-			std::vector<uint8_t>* pngData = static_cast<std::vector<uint8_t>*>(context);
-			pngData->insert(pngData->end(), (uint8_t*)data, (uint8_t*)data + size);
-			};
-
-		// Write PNG data using stb_image_write
-		stbi_write_png_to_func(WriteCallback, &pngData, width, height, 4, pixels, width * 4);
+		// Pixel data (bottom-up DIB). At 4 bits per pixel, the first pixel of each pair is in the high bits.
+		for (int y = height - 1; y >= 0; --y)
+		{
+			const uint8_t* row = vIndices.data() + size_t(y) * width;
+			for (int x = 0; x < width; x++)
+			{
+				if (4 == iBitCount)
+					pDest[x / 2] |= uint8_t(row[x] << (x & 1 ? 0 : 4));
+				else
+					pDest[x] = row[x];
+			}
+			pDest += uiRowSize;
+		}
 
-		return pngData;
+		// The AND mask, bottom-up like the pixels, a set bit being transparent
+		for (int y = height - 1; y >= 0; --y)
+		{
+			const uint8_t* row = vIndices.data() + size_t(y) * width;
+			for (int x = 0; x < width; x++)
+			{
+				if (row[x] == iTransparentIndex)
+					pDest[x / 8] |= uint8_t(0x80 >> (x & 7));
+			}
+			pDest += uiMaskRowSize;
+		}
+		return true;
 	}
 }
@@ -2,13 +2,42 @@
 #include "../Core/DataStructures/Colourf.h"
 #include "../Core/DataStructures/colourRamp.h"
 #include "../Core/DataStructures/Dimensions.h"
+#include "../Core/Exceptions.h"
 #include "../Math/Vector2f.h"
+#include "ErrorDiffusion.h"
+#include "ImageFilter.h"
+#include "Palette.h"
+#include "PixelAllocator.h"
+#include "PixelKernels.h"
+#include "PNGEncoder.h"
+#include <atomic>
+#include <functional>
+#include <span>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace X
 {
+	/// \brief The channels of one pixel of an image with iNumChannels channels, 3 or 4, laid out as they are in the image's data.
+	///
+	/// CImage::getRow() and CImage::forEachPixel() give the pixels as these, so loops over them are compiled for each number
+	/// of channels rather than checking it for every pixel as CImage::getPixel() does.
+	template <int iNumChannels>
+	struct SPixel
+	{
+		static const int kNumChannels = iNumChannels;	///< Number of channels, 3 for RGB or 4 for RGBA
+		unsigned char uc[iNumChannels];					///< Red, green, blue, then alpha if there is one
+
+		/// \brief Returns whether the red, green and blue channels are those given
+		bool isRGB(unsigned char r, unsigned char g, unsigned char b) const
+		{
+			return uc[0] == r && uc[1] == g && uc[2] == b;
+		}
+	};
+	static_assert(sizeof(SPixel<3>) == 3 && sizeof(SPixel<4>) == 4, "SPixel must have no padding, as it's laid over an image's data.");
+
 	/// \brief A class for creating/loading/saving/modifying 2D images
 	///
 	/// Can read the following formats...
@@ -23,17 +52,154 @@ namespace X
 	/// PNM(PPM and PGM binary only)
 	/// DIF (Dave's Image Format) - A custom format, real simple for faster loading
 	/// Image pixels are stored in row first, then column. unsigned int iPixelIndex = iPixelPosX + (iPixelPosY * _miWidth);
+	/// Copies made with copyTo(), the copy constructor or assignment share the pixel data rather than duplicating it.
+	/// An image only gets its own copy of the data the first time it's modified, so copies which are only ever read cost nothing.
 	
 	class CImage
 	{
 	public:
+		/// \brief Settings used by saveAsICO() which control how each image stored inside the .ico file is created.
+		struct SICOSettings
+		{
+			/// \brief Constructor, sets the default sizes of 16, 32, 48, 64, 128 and 256
+			///
+			/// Enables the resize pyramid, multithreading and PNG passthrough, uses the default PNG effort, doesn't sharpen and writes no paletted sizes.
+			SICOSettings();
+
+			/// \brief The width and height in pixels of each image stored inside the .ico file, in the order they are written.
+			///
+			/// Each size must be between 1 and 256.
+			std::vector<int> vIconSizes;
+
+			/// \brief Whether to compute the sizes as a downscale pyramid.
+			///
+			/// If true, the largest size is resampled from the full resolution source image and each smaller size is
+			/// resampled from the nearest size already computed which is at least twice as large.
+			/// If false, every size is resampled from the full resolution source image, which is much slower for large images.
+			bool bUseResizePyramid;
+
+			/// \brief Whether to resize and encode each of the sizes as a task on the shared work-stealing CThreadPool, and compress the larger sizes' PNG data on several threads.
+			///
+			/// The .ico file written is byte for byte the same as when this is false.
+			bool bMultithreaded;
+
+			/// \brief How much effort is put into compressing each size's PNG data.
+			///
+			/// CPNGEncoder::EFFORT_STORE or EFFORT_FAST suit quick iteration, while EFFORT_MAX gives the smallest files for release.
+			CPNGEncoder::EEffort ePNGEffort;
+
+			/// \brief Whether the original file's bytes may be stored as is for the size which matches this image.
+			///
+			/// This applies when the image was loaded from a square 8 bit per channel RGBA PNG, of at most 256x256, and its pixels haven't been changed since.
+			/// That size then needs no copying or encoding at all. Set to false to always encode with ePNGEffort instead.
+			bool bAllowPNGPassthrough;
+
+			/// \brief How much the downscaled sizes are sharpened, by sharpenUnsharpMask() with a sigma of kICOSharpenSigma, after resizing.
+			///
+			/// 0, the default, leaves them as resized. Around 0.5 restores the crispness the resampling filter softens at the smallest sizes.
+			/// Sizes which aren't smaller than this image aren't sharpened, and the pyramid is always built from the unsharpened sizes.
+			float fSharpenAmount;
+
+			/// \brief Bits per pixel of the paletted entries written for the smaller sizes, 4 for 16 colours or 8 for 256. 0, the default, writes every size as 32 bit RGBA.
+			///
+			/// Each size no larger than iPaletteMaxSize gets a palette of its own, chosen by CPalette, which its pixels are mapped to with ePaletteDither.
+			/// Paletted entries only hold whether each pixel is transparent or not, pixels with alpha under 128 being transparent.
+			/// If any are, one palette entry is kept for them. Paletted sizes never use PNG passthrough.
+			int iPaletteBitsPerPixel;
+
+			/// \brief The largest size written as a paletted entry when iPaletteBitsPerPixel isn't 0. Defaults to 32.
+			int iPaletteMaxSize;
+
+			/// \brief How each paletted size's pixels are mapped to its palette. Defaults to CPalette::DITHER_FLOYD_STEINBERG.
+			CPalette::EDither ePaletteDither;
+
+			/// \brief Whether paletted sizes are written as paletted PNGs, compressed with ePNGEffort, rather than BMPs.
+			///
+			/// False, the default, writes BMPs, which every version of Windows reads. PNGs are usually smaller, but Windows XP and earlier can't read them.
+			bool bPalettePNG;
+		};
+
+		/// \brief The standard deviation, in pixels, of the blur which SICOSettings::fSharpenAmount sharpens against.
+		/// Under a pixel, so only the detail softened by resampling is sharpened.
+		static constexpr float kICOSharpenSigma = 0.6f;
+
+		/// \brief Shortcuts which fillMandelbrot() and fillMandelbrotMT() may take to avoid iterating points all the way to uiMaxIterations.
+		///
+		/// bSkipBulbs and bCheckPeriodicity only stop points which can never escape, so the image is the same with or without them.
+		/// bSubdivide is an approximation, skipping pixels on the strength of their neighbours, so may change a few isolated pixels, see below.
+		/// Each can be turned on alone, to measure what it saves. exact() turns on those which leave the image the same.
+		struct SMandelbrotShortcuts
+		{
+			/// \brief Constructor, turns every shortcut off, so every pixel is iterated in full
+			SMandelbrotShortcuts();
+
+			/// \brief Returns the shortcuts with bSkipBulbs and bCheckPeriodicity turned on, which give the same image as none. bSubdivide is left off.
+			static SMandelbrotShortcuts exact(void);
+
+			/// \brief Whether points inside the main cardioid or the period 2 bulb, which never escape, are given uiMaxIterations without being iterated.
+			///
+			/// The test for each is a few multiplications, so this saves the most when these large areas are in view.
+			bool bSkipBulbs;
+
+			/// \brief Whether each point's orbit is checked for repeating, as in Brent's cycle detection, stopping once it does.
+			///
+			/// Only an exact repeat counts, which means the orbit can never escape. Points near the edge of the set may never settle on one,
+			/// but most of the interior does so long before uiMaxIterations.
+			bool bCheckPeriodicity;
+
+			/// \brief Whether each tile is filled by Mariani-Silver subdivision, iterating only the border of each rectangle, filling it if the
+			/// whole border has the same count, and otherwise splitting it in two and trying again.
+			///
+			/// The points with at least a given count form a connected area without holes, which contains the whole set. So a rectangle
+			/// with the same count all round its border can only hold a different count if it holds the whole set, and rectangles spanning 0,
+			/// which might, are always split. Rectangles whose border doesn't reach the set are iterated in full instead, as their counts are
+			/// cheap and rarely the same all round. Only the pixels on the border are iterated though, so a thread of lower counts thinner
+			/// than a pixel, crossing the border between two of them, is missed. Close to the edge of the set the odd pixel is lost that way,
+			/// so unlike the other shortcuts this one doesn't promise the same image, and is off unless turned on by itself.
+			bool bSubdivide;
+		};
+
+		/// \brief Frees pixel data which an image has adopted with adoptData(). An empty function means the data was allocated with malloc() and is freed with std::free().
+		typedef std::function<void(unsigned char*)> DataDeleter;
+
 		/// \brief Constructor whereby the image is initially empty
 		CImage();
 		~CImage();
 
+		/// \brief Copy constructor, shares the other image's pixels as copyTo() does. If the other image is empty, so is this one.
+		CImage(const CImage& other);
+
+		/// \brief Move constructor, takes the other image's pixel data without copying it, leaving the other image empty.
+		CImage(CImage&& other) noexcept;
+
 		/// \brief Sets this image to the one on the right
 		CImage& operator=(const CImage& other);
 
+		/// \brief Takes the right hand image's pixel data without copying it, leaving that image empty. This image's previous data is freed.
+		CImage& operator=(CImage&& other) noexcept;
+
+		/// \brief Swaps the contents of this image with another, without copying any pixel data.
+		void swap(CImage& other) noexcept;
+
+		/// \brief Makes an existing buffer of pixels this image's data, without copying it.
+		///
+		/// \param pData The pixels, rows stored top to bottom with no padding, iWidth * iHeight * iNumChannels bytes.
+		/// \param iWidth The width of the image in pixels
+		/// \param iHeight The height of the image in pixels
+		/// \param iNumChannels 3 for RGB or 4 for RGBA
+		/// \param funcDeleter Called with pData when this image no longer needs it. If empty, pData must have come from malloc() and is given to std::free().
+		///
+		/// The previous image is freed first. If invalid params are given, an exception occurs and pData is not taken.
+		void adoptData(unsigned char* pData, unsigned int iWidth, unsigned int iHeight, unsigned short iNumChannels, DataDeleter funcDeleter = DataDeleter());
+
+		/// \brief Gives up ownership of this image's pixel data, leaving the image empty.
+		///
+		/// \param funcDeleter Set to the function which frees the returned data. Never empty, so it may always be called.
+		/// \return The pixel data, which the caller is now responsible for, or nullptr if the image was empty.
+		///
+		/// If the data is shared with other images, they keep it and a copy of it is returned instead.
+		unsigned char* releaseData(DataDeleter& funcDeleter);
+
 		/// \brief Free image and memory so that the image is empty
 		void free(void);
 
@@ -56,19 +222,70 @@ namespace X
 		/// An image of dimensions 4096x4096x4 is 64MB
 		/// An image of dimensions 16384x16384x4 is 1024MB AKA 1GB
 		/// Throws exceptions if invalid params given.
-		void createBlank(unsigned int iWidth, unsigned int iHeight, unsigned short iNumChannels);
+		/// bClear If false, the pixels are left uninitialised rather than black, for when every one of them is about to be written anyway.
+		/// The memory comes from getAllocator(), so it's aligned to CPixelAllocator::kAlignment bytes and may be reused from an image freed earlier.
+		void createBlank(unsigned int iWidth, unsigned int iHeight, unsigned short iNumChannels, bool bClear = true);
+
+		/// \brief Sets the allocator which images get their pixel memory from from now on.
+		///
+		/// \param pAllocator The allocator to use, or nullptr for CPixelAllocator::getGlobal().
+		///
+		/// It must outlive every image allocated from it. Images already allocated keep using the allocator they were allocated from.
+		static void setAllocator(CPixelAllocator* pAllocator);
+
+		/// \brief Returns the allocator which images get their pixel memory from. See setAllocator().
+		static CPixelAllocator& getAllocator(void);
+
+		/// \brief Images with fewer pixels than this are always worked on by the calling thread alone, as splitting them up would cost more than it saves.
+		static const unsigned int kMinPixelsForThreads = 256 * 256;
+
+		/// \brief Width and height of the square tiles fillMandelbrot() and fillMandelbrotMT() work through, small enough for threads to share out the set's interior evenly.
+		static constexpr int kMandelbrotTileSize = 32;
+
+		/// \brief Most iteration counts whose colours fillMandelbrot() and fillMandelbrotMT() look up from a table made up front. Higher counts are looked up on the colour ramp as reached.
+		static constexpr unsigned int kMandelbrotColourTableMax = 65535;
+
+		/// \brief Sets the most threads which operations over a whole image may use from now on.
+		///
+		/// \param uiMaxThreads The calling thread counts as one. 0 uses every thread of CThreadPool::getGlobal() as well, and 1 never uses any other thread.
+		///
+		/// The operations which split an image's rows into bands and work on them concurrently are fill() and the other fill methods,
+		/// swapRedAndBlue(), ditherBayerMatrix(), invert(), greyscaleSimple(), greyscale(), adjustBrightness(), adjustContrast(),
+		/// edgeDetect() and createColourWheel(). ditherErrorDiffusion() works on several rows at once instead.
+		/// Those with a bMultithreaded parameter, such as forEachPixel(), the flips and rotations and convolve(), do the same only while it's true.
+		/// Their results are the same whatever the number of threads.
+		static void setMaxThreads(unsigned int uiMaxThreads);
+
+		/// \brief Returns the most threads which operations over a whole image may use. See setMaxThreads().
+		static unsigned int getMaxThreads(void);
 
 		/// \brief Attempts to load the image data from a file stored on disk.
 		///
 		/// \param strFilename The name of the image file to load.
 		/// \param bFlipForOpenGL Will flip the image vertically if true
+		/// \param iMinSizeNeeded If greater than 0, a JPEG image may be decoded at 1/2, 1/4 or 1/8 of its size, the smallest of those
+		/// which is still at least this many pixels wide and high. Decoding then takes much less time and memory, which suits
+		/// making something small from a large photo, such as an icon. Other formats are always loaded at full size.
 		/// \return false if the image couldn't be loaded.
 		/// 
 		/// Depending upon the file name extension, determines the file type and loads it in.
 		/// If the image couldn't be loaded, false is returned, else true
 		/// The image is freed at the start of this method
 		/// Loads image from file using the stb_image library, unless it's a DIF file, in which case it uses the _loadDIF() method
-		bool load(const std::string& strFilename, bool bFlipForOpenGL = false);
+		/// The file is opened once and memory mapped, then decoded with loadFromMemory().
+		bool load(const std::string& strFilename, bool bFlipForOpenGL = false, int iMinSizeNeeded = 0);
+
+		/// \brief Loads an image from the contents of an image file already in memory.
+		///
+		/// \param pFileData The whole of the image file
+		/// \param uiFileSize The size of the image file in bytes
+		/// \param bFlipForOpenGL Will flip the image vertically if true
+		/// \param iMinSizeNeeded As for load()
+		/// \return false if the image couldn't be decoded.
+		///
+		/// Supports the same formats as load(), except DIF. Greyscale images are expanded to RGB and greyscale with alpha to RGBA.
+		/// The decoded pixels become this image's data without being copied. May be called on many threads at once for different images.
+		bool loadFromMemory(const uint8_t* pFileData, size_t uiFileSize, bool bFlipForOpenGL = false, int iMinSizeNeeded = 0);
 
 		/// \brief Attempts to read only the image width, height and number of channels from the given filename, which is faster than loading the whole thing in.
 		///
@@ -102,9 +319,10 @@ namespace X
 		///
 		/// \param strFilename The filename to save the image data to
 		/// \param bFlipOnSave If true, will flip the data vertically upon saving (Not the data in memory, just what's stored in the file)
+		/// \param ePNGEffort How much effort is put into compressing the data. Large images are compressed using all CPU cores.
 		/// 
 		/// Throws exception if image contains no data or saving fails.
-		void saveAsPNG(const std::string& strFilename, bool bFlipOnSave = false) const;
+		void saveAsPNG(const std::string& strFilename, bool bFlipOnSave = false, CPNGEncoder::EEffort ePNGEffort = CPNGEncoder::EFFORT_DEFAULT) const;
 
 		/// \brief Save image to TGA file to disk
 		///
@@ -125,8 +343,18 @@ namespace X
 		/// \brief Saves image to ICO file to disk
 		/// 
 		/// \param strFilename The filename to save the image data to
+		/// \param settings Settings controlling which sizes are stored and how they are computed
 		/// \return Whether the image was saved or not
-		bool saveAsICO(const std::string& strFilename) const;
+		bool saveAsICO(const std::string& strFilename, const SICOSettings& settings = SICOSettings()) const;
+
+		/// \brief Creates the contents of an ICO file in memory, exactly as saveAsICO() would write it to disk
+		/// 
+		/// \param vICOData Will hold the complete .ico file. Its contents are replaced, but any capacity it already has is reused.
+		/// \param settings Settings controlling which sizes are stored and how they are computed
+		/// \return Whether the data was created or not. If not, vICOData is left empty.
+		/// 
+		/// The size of the whole file is computed once every size has been encoded and the file is then assembled into the one allocation.
+		bool saveAsICOToMemory(std::vector<uint8_t>& vICOData, const SICOSettings& settings = SICOSettings()) const;
 
 		/// \brief Fills the image with the given colour values.
 		///
@@ -171,9 +399,12 @@ namespace X
 		/// \param minY The minimum Y coordinate of the rectangular area in the complex plane to be visualized
 		/// \param maxY The maximum Y coordinate of the rectangular area in the complex plane to be visualized
 		/// \param uiMaxIterations The maximum number of iterations allowed to determine if a point belongs to the Mandelbrot set. Higher values result in more detailed images but take longer to compute.
+		/// \param shortcuts The shortcuts to take, see SMandelbrotShortcuts. None by default.
 		/// 
+		/// Each pixel is iterated a pixel at a time by the plain C++ SPixelKernels::mandelbrot(), and is the reference fillMandelbrotMT() matches.
+		/// A point escapes once the square of |z| reaches 4.
 		/// Throws exception if image hasn't been created yet
-		void fillMandelbrot(CColourRamp colourRamp = CColourRamp(), double minX = -2.5, double maxX = 1.5, double minY = -1, double maxY = 1, unsigned int uiMaxIterations = 100);
+		void fillMandelbrot(CColourRamp colourRamp = CColourRamp(), double minX = -2.5, double maxX = 1.5, double minY = -1, double maxY = 1, unsigned int uiMaxIterations = 100, const SMandelbrotShortcuts& shortcuts = SMandelbrotShortcuts());
 
 		/// \brief Fills this image with a mandelbrot multithreaded
 		/// 
@@ -183,17 +414,30 @@ namespace X
 		/// \param minY The minimum Y coordinate of the rectangular area in the complex plane to be visualized
 		/// \param maxY The maximum Y coordinate of the rectangular area in the complex plane to be visualized
 		/// \param uiMaxIterations The maximum number of iterations allowed to determine if a point belongs to the Mandelbrot set. Higher values result in more detailed images but take longer to compute.
+		/// \param shortcuts The shortcuts to take, see SMandelbrotShortcuts. None by default.
 		/// 
+		/// Gives the same pixels as fillMandelbrot() with the same shortcuts, but iterates several pixels at once with SPixelKernels::get()'s mandelbrot(), and tiles of
+		/// kMandelbrotTileSize pixels square are claimed one at a time by whichever thread is free, up to getMaxThreads().
 		/// Throws exception if image hasn't been created yet
-		void fillMandelbrotMT(CColourRamp colourRamp = CColourRamp(), double minX = -2.5, double maxX = 1.5, double minY = -1, double maxY = 1, unsigned int uiMaxIterations = 100);
+		void fillMandelbrotMT(CColourRamp colourRamp = CColourRamp(), double minX = -2.5, double maxX = 1.5, double minY = -1, double maxY = 1, unsigned int uiMaxIterations = 100, const SMandelbrotShortcuts& shortcuts = SMandelbrotShortcuts());
 
 		/// \brief Return pointer to image data for manual modification.
 		///
 		/// \return Unsigned char pointer to the image data.
 		/// 
 		/// Please, BE CAREFULL if you're using this method to directly access the image data.
+		/// If the data is shared with other images, this image is first given its own copy of it, so that writing to it only affects this image.
+		/// The pointer must not be written through after this image has since been copied, as the copy shares it.
 		/// returns The pointer to the image's data. 
-		unsigned char* getData(void) const;
+		unsigned char* getData(void);
+
+		/// \brief Return pointer to image data for reading.
+		///
+		/// \return Unsigned char pointer to the image data, which may be shared with other images.
+		const unsigned char* getData(void) const;
+
+		/// \brief Returns whether this image's pixel data is currently shared with other images. See copyTo().
+		bool isDataShared(void) const;
 
 		/// \brief Get size of image data in bytes
 		///
@@ -270,6 +514,63 @@ namespace X
 		/// a The colour will be held in here (Alpha). 
 		inline void getPixel(int iX, int iY, unsigned char& r, unsigned char& g, unsigned char& b, unsigned char& a) const;
 
+		/// \brief Calls func with a std::integral_constant holding this image's number of channels, so a generic lambda is compiled for both 3 and 4.
+		///
+		/// This is how loops over the pixels pick their number of channels once per image, rather than once per pixel.
+		/// If this image contains no data, or doesn't have 3 or 4 channels, an exception occurs.
+		/// \code
+		/// image.dispatchChannels([&](auto channels)
+		/// {
+		///		constexpr int iNumChannels = decltype(channels)::value;
+		///		for (int iY = 0; iY < int(image.getHeight()); iY++)
+		///		{
+		///			for (SPixel<iNumChannels>& pixel : image.getRow<iNumChannels>(iY))
+		///				pixel.uc[0] = 255;
+		///		}
+		/// });
+		/// \endcode
+		template <typename TFunc>
+		void dispatchChannels(TFunc func) const;
+
+		/// \brief Returns the pixels of a row of the image.
+		///
+		/// \param iY The row, where 0 is the bottom row
+		///
+		/// iNumChannels must be the image's number of channels, and iY a row within it. If bChecked is true they are checked,
+		/// and an exception occurs if either is wrong. Otherwise nothing is checked, as with getData().
+		/// As the pixels may then be modified, this image first gets its own copy of its data if it is shared with others.
+		template <int iNumChannels, bool bChecked = false>
+		std::span<SPixel<iNumChannels>> getRow(int iY);
+
+		/// \brief Returns the pixels of a row of the image, to be read only. Otherwise the same as the non const version.
+		template <int iNumChannels, bool bChecked = false>
+		std::span<const SPixel<iNumChannels>> getRow(int iY) const;
+
+		/// \brief Calls func(pixel, iX, iY) with each pixel of the image as an SPixel<iNumChannels>, which it may modify.
+		///
+		/// \param func Called for each pixel, with a reference to it and its position
+		/// \param bMultithreaded Whether large images may be worked on by several threads, in which case func must be safe to call from each
+		///
+		/// If this image contains no data, or iNumChannels isn't its number of channels, an exception occurs.
+		template <int iNumChannels, typename TFunc>
+		void forEachPixel(TFunc func, bool bMultithreaded = false);
+
+		/// \brief Calls func(pixel, iX, iY) with each pixel of the image as an SPixel<iNumChannels>, to be read only. Otherwise the same as the non const version.
+		template <int iNumChannels, typename TFunc>
+		void forEachPixel(TFunc func, bool bMultithreaded = false) const;
+
+		/// \brief Calls func(pixel, iX, iY) with each pixel of the image, where func is a generic lambda compiled for both 3 and 4 channels.
+		///
+		/// Picks the number of channels with dispatchChannels(), then is the same as forEachPixel<iNumChannels>().
+		/// \code
+		/// image.forEachPixel([](auto& pixel, int iX, int iY)
+		/// {
+		///		pixel.uc[0] = (unsigned char)iX;
+		/// });
+		/// \endcode
+		template <typename TFunc>
+		void forEachPixel(TFunc func, bool bMultithreaded = false);
+
 		/// \brief Swap red and blue colour components around
 		///
 		/// If this image contains no data, an exception occurs.
@@ -282,13 +583,33 @@ namespace X
 
 		/// \brief Dithers the existing image data using Floyd-Steinberg dithering.
 		///
+		/// The same as ditherErrorDiffusion() with its defaults.
 		/// If no image data currently exists, an exception occurs.
 		void ditherFloydSteinberg(void);
 
-		/// \brief Flip the image vertically
+		/// \brief Dithers the existing image data to black or full intensity for each of red, green and blue, by error diffusion.
+		///
+		/// \param eKernel How each pixel's error is passed on to the pixels after it, see SDiffusionKernel.
+		/// \param bSerpentine If true, odd rows are scanned right to left, which avoids diagonal artifacts, but rows can then only be done one at a time.
+		/// \param bMultithreaded If true, large images have several rows dithered at once, each a little behind the one above. See setMaxThreads().
+		///
+		/// The result is the same whatever the number of threads. Alpha is left as is. See diffuseError().
+		/// If no image data currently exists, an exception occurs.
+		void ditherErrorDiffusion(SDiffusionKernel::EKernel eKernel = SDiffusionKernel::KERNEL_FLOYD_STEINBERG, bool bSerpentine = false, bool bMultithreaded = true);
+
+		/// \brief Flip the image vertically, in place
+		///
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// If this image contains no data, an exception occurs.
+		void flipVertically(bool bMultithreaded = true);
+
+		/// \brief Flip the image horizontally, in place
+		///
+		/// \param bMultithreaded Whether large images may be worked on by several threads
 		///
 		/// If this image contains no data, an exception occurs.
-		void flipVertically(void);
+		void flipHorizontally(bool bMultithreaded = true);
 
 		/// \brief Inverts the colours of the image, AKA new colour = 255 - current colour
 		///
@@ -338,6 +659,7 @@ namespace X
 		/// Silently fails if both this image and the one parsed are actually the same objects, or there is no image data to copy.
 		/// If this image contains no data, an exception occurs.
 		/// The destinationImage is totally replaced. 
+		/// No pixels are copied here, the destination shares this image's data until either image is modified.
 		void copyTo(CImage& destImage) const;
 
 		/// \brief Copies a rectangular region from this object, into the one given.
@@ -349,18 +671,15 @@ namespace X
 		/// \param iSrcHeight The height of the region to copy from the source image
 		/// \param iDestPosX The bottom left position within the destination image to copy to
 		/// \param iDestPosY The bottom left position within the destination image to copy to
+		/// \param bAlphaBlend If true and this image has an alpha channel, each pixel is drawn over the destination's using its alpha,
+		/// rather than replacing it. The destination's alpha becomes that of the two layered together.
 		/// 
-		/// Automatic clipping is done so that if the source region doesn't fit into destination, it will be clipped.
-		/// The destination image can be this image itself IE img.copyRectTo(img)
-		/// destImage The destination image to copy the rectangular region of this object into
-		/// iSrcPosX The bottom left position within the source image to copy from (a value of 0 would be left edge)
-		/// iSrcPosY The bottom left position within the source image to copy from (a value of 0 would be bottom edge)
-		/// iSrcWidth The width of the region to copy from the source image
-		/// iSrcHeight The height of the region to copy from the source image
-		/// iDestPosX The bottom left position within the destination image to copy to
-		/// iDestPosY The bottom left position within the destination image to copy to
+		/// Automatic clipping is done so that if the source region doesn't fit into destination, or lies partly outside of either image, it will be clipped.
+		/// The destination image can be this image itself IE img.copyRectTo(img), and the regions may overlap.
+		/// The images may have different numbers of channels. Alpha is dropped when copying to an image without it, and set to 255 when copying to one with it.
+		/// Whole rows are copied at once, so this costs little more than the memory it moves.
 		/// If this image or the destination image contain no data, an exception occurs.
-		void copyRectTo(CImage& destImage, int iSrcPosX, int iSrcPosY, int iSrcWidth, int iSrcHeight, int iDestPosX, int iDestPosY) const;
+		void copyRectTo(CImage& destImage, int iSrcPosX, int iSrcPosY, int iSrcWidth, int iSrcHeight, int iDestPosX, int iDestPosY, bool bAlphaBlend = false) const;
 
 		/// \brief Copies the contents of this image into the outputImage and gives the output image a border
 		///
@@ -373,9 +692,35 @@ namespace X
 		void copyToAddBorder(CImage& outputImage) const;
 
 		/// \brief Rotates the image 90 degrees clockwise
-		/// 
+		///
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// Square images are rotated in place, others into a new buffer the size of this one, which then replaces it.
+		/// If this image contains no data, an exception occurs.
+		void rotateClockwise(bool bMultithreaded = true);
+
+		/// \brief Rotates the image 90 degrees anti-clockwise
+		///
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// Square images are rotated in place, others into a new buffer the size of this one, which then replaces it.
+		/// If this image contains no data, an exception occurs.
+		void rotateAntiClockwise(bool bMultithreaded = true);
+
+		/// \brief Rotates the image 180 degrees, in place
+		///
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// If this image contains no data, an exception occurs.
+		void rotate180(bool bMultithreaded = true);
+
+		/// \brief Swaps the image's rows and columns, so the pixel at X, Y moves to Y, X
+		///
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// Square images are transposed in place, others into a new buffer the size of this one, which then replaces it.
 		/// If this image contains no data, an exception occurs.
-		void rotateClockwise(void);
+		void transpose(bool bMultithreaded = true);
 
 		/// \brief Edge detection.
 		///
@@ -395,6 +740,39 @@ namespace X
 		/// If this image contains no data, or doesn't have at least 3 channels, an exception occurs.
 		void edgeDetect(CImage& outputImage, unsigned char r, unsigned char g, unsigned char b);
 
+		/// \brief Convolves the image with the given kernel, replacing each pixel with the weighted sum of those around it
+		///
+		/// \param kernel The weights, see SFilterKernel. Separable kernels are applied as a horizontal pass then a vertical one.
+		/// \param border How the pixels beyond the image's edges are made up. The image isn't copied into a larger one to do so.
+		/// \param bFilterAlpha If false, the alpha channel of 4 channel images is left as is.
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// The image is filtered into a new buffer the size of this one, which then replaces it. The result is the same whatever the
+		/// number of threads or the instruction set used, see SPixelKernels. Results are clamped to between 0 and 255.
+		/// If this image contains no data, an exception occurs.
+		void convolve(const SFilterKernel& kernel, const SFilterBorder& border = SFilterBorder(), bool bFilterAlpha = true, bool bMultithreaded = true);
+
+		/// \brief Blurs the image with a Gaussian of the given standard deviation, in pixels
+		///
+		/// \param fSigma The standard deviation of the Gaussian. The blur reaches 3 times this far. Must be greater than 0.
+		/// \param border How the pixels beyond the image's edges are made up.
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// All channels, including alpha, are blurred.
+		/// If this image contains no data, or fSigma isn't greater than 0, an exception occurs.
+		void blurGaussian(float fSigma, const SFilterBorder& border = SFilterBorder(SFilterBorder::BORDER_MIRROR), bool bMultithreaded = true);
+
+		/// \brief Sharpens the image by unsharp masking, adding fAmount times the difference between each pixel and a Gaussian blur of it
+		///
+		/// \param fSigma The standard deviation of the Gaussian blur, in pixels. Smaller values sharpen finer detail. Must be greater than 0.
+		/// \param fAmount How much of the difference is added. 0 leaves the image as is, 1 doubles the contrast of detail.
+		/// \param border How the pixels beyond the image's edges are made up.
+		/// \param bMultithreaded Whether large images may be worked on by several threads
+		///
+		/// Alpha is left as is. Used by saveAsICO() and saveAsICOToMemory() to restore the crispness lost when downscaling, see SICOSettings::fSharpenAmount.
+		/// If this image contains no data, or fSigma isn't greater than 0, an exception occurs.
+		void sharpenUnsharpMask(float fSigma, float fAmount, const SFilterBorder& border = SFilterBorder(SFilterBorder::BORDER_MIRROR), bool bMultithreaded = true);
+
 		/// \brief Removes the alpha channel of the image, leaving the RGB components
 		///
 		/// If this image contains no data, or doesn't have 4 channels, an exception occurs.
@@ -477,25 +855,110 @@ namespace X
 		/// 
 		/// Downsamples with Mitchell filter, upsamples with cubic interpolation, clamps to edge.
 		bool resize(unsigned int iNewWidth, unsigned int iNewHeight);
+
+		/// \brief Resamples this image to the given dimensions, storing the result in outputImage
+		///
+		/// \param outputImage The image which will hold the resized image. It is totally replaced.
+		/// \param iNewWidth The width of the resized image
+		/// \param iNewHeight The height of the resized image
+		/// \return Whether the image was resized or not
+		/// 
+		/// This image is left unaffected, so unlike resize(), no copy of this image is needed to keep the original.
+		/// Downsamples with Mitchell filter, upsamples with cubic interpolation, clamps to edge.
+		bool resizeTo(CImage& outputImage, unsigned int iNewWidth, unsigned int iNewHeight) const;
+
+		/// \brief Computes the peak signal-to-noise ratio between this image and another one, in decibels
+		///
+		/// \param other The image to compare this one against
+		/// \return The PSNR in decibels. Higher is closer, identical images return kMaxDouble.
+		/// 
+		/// If the images have an alpha channel, the RGB components are compared after being multiplied by alpha.
+		/// Used to check that a faster way of computing an image gives an equivalent result to a slower reference way, such as
+		/// the resize pyramid used by saveAsICO(). Values above roughly 40dB are visually indistinguishable.
+		/// If either image contains no data, or their dimensions or number of channels differ, an exception occurs.
+		double computePSNR(const CImage& other) const;
 	private:
-		unsigned char* _mpData;
+		unsigned char* _mpData;		///< The pixels, the same as _mpBuffer->pData
 		unsigned int _muiDataSize;
+
+		/// \brief Pixel data which may be shared by several images. The last image to let go of it frees it.
+		struct SPixelBuffer
+		{
+			unsigned char* pData;					///< The pixels
+			DataDeleter funcDeleter;				///< Frees pData, or empty for std::free(). See adoptData().
+			CPixelAllocator* pAllocator;			///< The allocator pData came from, or nullptr if it didn't come from one and funcDeleter frees it
+			size_t uiAllocatedSize;					///< The size pData was allocated with, if it came from pAllocator
+			std::atomic<unsigned int> uiRefCount;	///< Number of images using pData
+		};
+		SPixelBuffer* _mpBuffer;	///< Owner of _mpData, or nullptr if the image is empty
+
 		int _miWidth;
 		int _miHeight;
 		int _miNumChannels;
 
-		// Used by edgeDetect()
-		inline bool _isPixelEdge(int iPosX, int iPosY, unsigned char r, unsigned char g, unsigned char b);
+		/// \brief When loaded from a PNG which could be stored in a .ico file as is, holds the bytes of that file, otherwise empty. See _keepSourcePNGIfSuitable().
+		std::vector<uint8_t> _mvSourcePNG;
 
-		/// \brief Multithreaded method called from fillMandelbrotMT() for multiple threads, for Mandelbrot computation.
-		/// 
-		/// \param colourRamp A CColourRamp to use for the colour gradients.
-		/// \param minX The minimum X coordinate of the rectangular area in the complex plane to be visualized
-		/// \param maxX The maximum X coordinate of the rectangular area in the complex plane to be visualized
-		/// \param minY The minimum Y coordinate of the rectangular area in the complex plane to be visualized
-		/// \param maxY The maximum Y coordinate of the rectangular area in the complex plane to be visualized
-		/// \param uiMaxIterations The maximum number of iterations allowed to determine if a point belongs to the Mandelbrot set. Higher values result in more detailed images but take longer to compute.
-		void _fillMandelbrotMT_threadMain(unsigned int uiYFirst, unsigned int uiYLast, CColourRamp colourRamp = CColourRamp(), double minX = -2.5, double maxX = 1.5, double minY = -1, double maxY = 1, unsigned int uiMaxIterations = 100);
+		/// \brief computeHash64() of the pixels as loaded from _mvSourcePNG, so saveAsICOToMemory() can tell whether they have been changed since.
+		uint64_t _muiSourcePNGPixelHash;
+
+		/// \brief Makes the given pixels this image's data, owned by a new buffer which isn't shared. The image must be empty.
+		void _setData(unsigned char* pData, DataDeleter funcDeleter);
+
+		/// \brief Makes a buffer from getAllocator() of _muiDataSize bytes this image's data. The image must otherwise be empty.
+		///
+		/// \param bClear Whether the pixels are set to zero, or left uninitialised to be written by the caller.
+		void _allocateData(bool bClear);
+
+		/// \brief Calls funcBody with bands of rows which together cover iNumRows rows, each of iRowLength pixels, concurrently if there are enough pixels.
+		///
+		/// Each band is given as its first row and one past its last. See setMaxThreads().
+		/// If bMultithreaded is false, funcBody is called once with every row on the calling thread.
+		static void _forEachRowBand(int iNumRows, int iRowLength, const std::function<void(int iFirstRow, int iLastRow)>& funcBody, bool bMultithreaded = true);
+
+		/// \brief Replaces this image with one of its height by its width, taking each pixel X, Y from the old pixels at
+		/// iSrcOrigin + X * iSrcStepX + Y * iSrcStepY pixels. Used by the rotations and transpose of images which aren't square.
+		void _transformInto(ptrdiff_t iSrcOrigin, ptrdiff_t iSrcStepX, ptrdiff_t iSrcStepY, bool bMultithreaded);
+
+		/// \brief Replaces this image with it convolved by convolveRows(). Used by convolve(), blurGaussian() and sharpenUnsharpMask().
+		void _filter(const SFilterKernel& kernel, const SFilterBorder& border, bool bFilterAlpha, float fUnsharpAmount, bool bMultithreaded);
+
+		/// \brief Lets go of this image's buffer, freeing it if no other image is using it. Only _mpBuffer and _mpData are reset.
+		void _releaseBuffer(void);
+
+		/// \brief Called before modifying the pixels. If the data is shared with other images, this image is given its own copy of it.
+		inline void _detach(void);
+
+		/// \brief Called by _detach() to give this image its own copy of the shared data
+		void _detachShared(void);
+
+		/// \brief Called by loadFromMemory() to keep the loaded file's bytes in _mvSourcePNG, if it is a PNG which could be stored in a .ico file as is.
+		///
+		/// \param pFileData The whole of the file which was just loaded
+		/// \param uiFileSize The size of the file in bytes
+		///
+		/// That's a square, 8 bits per channel RGBA, non-interlaced PNG of at most 256x256.
+		void _keepSourcePNGIfSuitable(const uint8_t* pFileData, size_t uiFileSize);
+
+		/// \brief Used by edgeDetect(), returns whether the pixel at iX in pRow isn't the given colour, but one of its 8 neighbours is.
+		///
+		/// pRowBelow and pRowAbove are the rows either side of pRow. Each row must be readable a pixel either side of iX, as those of CBorderedRows are.
+		template <int iNumChannels>
+		static inline bool _isPixelEdge(const SPixel<iNumChannels>* pRowBelow, const SPixel<iNumChannels>* pRow, const SPixel<iNumChannels>* pRowAbove, int iX, unsigned char r, unsigned char g, unsigned char b);
+
+		/// \brief Returns the colour of each iteration count from 0 to uiMaxIterations, or kMandelbrotColourTableMax if less, as 4 bytes of RGBA, for fillMandelbrot() and fillMandelbrotMT()
+		std::vector<unsigned char> _mandelbrotColourTable(CColourRamp& colourRamp, unsigned int uiMaxIterations) const;
+
+		/// \brief Returns the number of kMandelbrotTileSize square tiles covering the image, numbered along each row of tiles from the top left
+		size_t _getNumMandelbrotTiles(void) const;
+
+		/// \brief Used by fillMandelbrot() and fillMandelbrotMT(), fills the tiles numbered from uiFirstTile up to uiLastTile.
+		///
+		/// \param kernels The kernels to iterate each row of a tile with
+		/// \param vColourTable The colours returned by _mandelbrotColourTable(). Counts beyond it are looked up on colourRamp.
+		/// The other parameters are those of fillMandelbrot().
+		void _fillMandelbrotTiles(size_t uiFirstTile, size_t uiLastTile, const SPixelKernels& kernels, const std::vector<unsigned char>& vColourTable, CColourRamp colourRamp,
+			double minX, double maxX, double minY, double maxY, unsigned int uiMaxIterations, const SMandelbrotShortcuts& shortcuts);
 		
 		/// \brief Loads the image data from a DIF file stored on disk. Called by load() if the filename extension is DIF.
 		///
@@ -515,31 +978,30 @@ namespace X
 		/// Called from loadInfo if the filename has the DIF extension.
 		bool _loadInfoDIF(const std::string& strFilename, int& iWidth, int& iHeight, int& iNumChannels);
 
-		/// \brief Used by the ditherFloydSteinberg() method to add error to a pixel
-		///
-		/// \param x The X position of the pixel to add error to
-		/// \param y The Y position of the pixel to add error to
-		/// \param r The red colour component of the pixel
-		/// \param g The green colour component of the pixel
-		/// \param b The blue colour component of the pixel
-		/// \param factor The factor to multiply the error by
-		void _ditherFloydSteinbergAddError(int x, int y, int r, int g, int b, double factor);
-
-		/// \brief Used by saveAsICO() to create the .ico file's image data in BMP format
+		/// \brief Used by saveAsICOToMemory() to create the .ico file's image data in PNG format
 		///
 		/// \param pixels The image data to use
 		/// \param width The width of the image
 		/// \param height The height of the image
-		/// \return The image data in BMP format
-		std::vector<uint8_t> _icoCreateBMPData(const uint8_t* pixels, int width, int height) const;
+		/// \param eEffort How much effort is put into compressing the data
+		/// \param bMultithreaded Whether the data may be compressed on several threads
+		/// \param vPNGData Will hold the image data in PNG format
+		/// \return Whether the data was created or not
+		/// 
+		/// This uses CPNGEncoder rather than stb_image_write, as it has no global state and so is safe to call from each size's thread.
+		bool _icoCreatePNGData(const uint8_t* pixels, int width, int height, CPNGEncoder::EEffort eEffort, bool bMultithreaded, std::vector<uint8_t>& vPNGData) const;
 
-		/// \brief Used by saveAsICO() to create the .ico file's image data in PNG format
+		/// \brief Used by saveAsICOToMemory() to create the .ico file's image data as a paletted BMP or PNG
 		///
-		/// \param pixels The image data to use
+		/// \param pixels The image data to use, in RGBA format
 		/// \param width The width of the image
 		/// \param height The height of the image
-		/// \return The image data in PNG format
-		std::vector<uint8_t> _icoCreatePNGData(const uint8_t* pixels, int width, int height) const;
+		/// \param settings Give the bits per pixel, dithering, format and PNG effort, see SICOSettings::iPaletteBitsPerPixel
+		/// \param vData Will hold the image data, a BITMAPINFOHEADER, colour table, indices and AND mask, or a PNG file
+		/// \return Whether the data was created or not
+		///
+		/// Only uses the calling thread, as the paletted sizes are small.
+		bool _icoCreatePalettedData(const uint8_t* pixels, int width, int height, const SICOSettings& settings, std::vector<uint8_t>& vData) const;
 	};
 
 
@@ -558,6 +1020,7 @@ namespace X
 		if (iY >= _miHeight)
 			return;
 
+		_detach();
 		unsigned int iIndex = iX + (iY * _miWidth);
 		iIndex *= _miNumChannels;
 		switch (_miNumChannels)
@@ -607,88 +1070,101 @@ namespace X
 		}
 	}
 
-	inline bool CImage::_isPixelEdge(int iPosX, int iPosY, unsigned char r, unsigned char g, unsigned char b)
+	inline void CImage::_detach(void)
 	{
-		// Don't check edge pixels of image
-		if (iPosX == 0)
-			return false;
-		if (iPosY == 0)
-			return false;
-		if (iPosX >= int(_miWidth) - 1)
-			return false;
-		if (iPosY >= int(_miHeight) - 1)
-			return false;
+		if (_mpBuffer && _mpBuffer->uiRefCount.load(std::memory_order_acquire) > 1)
+			_detachShared();
+	}
+
+	template <typename TFunc>
+	inline void CImage::dispatchChannels(TFunc func) const
+	{
+		ThrowIfTrue(!_mpData, "Image not yet created.");
+		if (3 == _miNumChannels)
+			func(std::integral_constant<int, 3>());
+		else if (4 == _miNumChannels)
+			func(std::integral_constant<int, 4>());
+		else
+			Throw("Image doesn't have 3 or 4 channels.");
+	}
+
+	template <int iNumChannels, bool bChecked>
+	inline std::span<SPixel<iNumChannels>> CImage::getRow(int iY)
+	{
+		if constexpr (bChecked)
+		{
+			ThrowIfTrue(!_mpData, "Image not yet created.");
+			ThrowIfTrue(iNumChannels != _miNumChannels, "Image doesn't have the number of channels asked for.");
+			ThrowIfTrue(iY < 0 || iY >= _miHeight, "Row is outside of the image.");
+		}
+		_detach();
+		return std::span<SPixel<iNumChannels>>(reinterpret_cast<SPixel<iNumChannels>*>(_mpData) + size_t(iY) * _miWidth, size_t(_miWidth));
+	}
+
+	template <int iNumChannels, bool bChecked>
+	inline std::span<const SPixel<iNumChannels>> CImage::getRow(int iY) const
+	{
+		if constexpr (bChecked)
+		{
+			ThrowIfTrue(!_mpData, "Image not yet created.");
+			ThrowIfTrue(iNumChannels != _miNumChannels, "Image doesn't have the number of channels asked for.");
+			ThrowIfTrue(iY < 0 || iY >= _miHeight, "Row is outside of the image.");
+		}
+		return std::span<const SPixel<iNumChannels>>(reinterpret_cast<const SPixel<iNumChannels>*>(_mpData) + size_t(iY) * _miWidth, size_t(_miWidth));
+	}
+
+	template <int iNumChannels, typename TFunc>
+	inline void CImage::forEachPixel(TFunc func, bool bMultithreaded)
+	{
+		// Checks the image, and gives it its own data before any threads start, so the rows below needn't
+		getRow<iNumChannels, true>(0);
+		SPixel<iNumChannels>* pPixels = reinterpret_cast<SPixel<iNumChannels>*>(_mpData);
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
+		{
+			for (int iY = iFirstRow; iY < iLastRow; iY++)
+			{
+				SPixel<iNumChannels>* pRow = pPixels + size_t(iY) * _miWidth;
+				for (int iX = 0; iX < _miWidth; iX++)
+					func(pRow[iX], iX, iY);
+			}
+		}, bMultithreaded);
+	}
 
-		// Get center pixel colour values
-		unsigned char col[4];
-		getPixel(iPosX, iPosY, col[0], col[1], col[2], col[3]);
+	template <int iNumChannels, typename TFunc>
+	inline void CImage::forEachPixel(TFunc func, bool bMultithreaded) const
+	{
+		getRow<iNumChannels, true>(0);
+		const SPixel<iNumChannels>* pPixels = reinterpret_cast<const SPixel<iNumChannels>*>(_mpData);
+		_forEachRowBand(_miHeight, _miWidth, [&](int iFirstRow, int iLastRow)
+		{
+			for (int iY = iFirstRow; iY < iLastRow; iY++)
+			{
+				const SPixel<iNumChannels>* pRow = pPixels + size_t(iY) * _miWidth;
+				for (int iX = 0; iX < _miWidth; iX++)
+					func(pRow[iX], iX, iY);
+			}
+		}, bMultithreaded);
+	}
+
+	template <typename TFunc>
+	inline void CImage::forEachPixel(TFunc func, bool bMultithreaded)
+	{
+		dispatchChannels([&](auto channels)
+		{
+			forEachPixel<decltype(channels)::value>(func, bMultithreaded);
+		});
+	}
 
+	template <int iNumChannels>
+	inline bool CImage::_isPixelEdge(const SPixel<iNumChannels>* pRowBelow, const SPixel<iNumChannels>* pRow, const SPixel<iNumChannels>* pRowAbove, int iX, unsigned char r, unsigned char g, unsigned char b)
+	{
 		// If the center pixel's colour is same as mask, it's not an edge
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return false;
-
-		// If we get here, the center pixel is not the same as the mask colour
-
-		// Get bordering pixels of center pixel
-		// If they are the same as the mask, then it's an edge
-
-		// Left
-		getPixel(iPosX - 1, iPosY, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-		// Right
-		getPixel(iPosX + 1, iPosY, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		// Top
-		getPixel(iPosX, iPosY - 1, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		// Bottom
-		getPixel(iPosX, iPosY + 1, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		// Top left
-		getPixel(iPosX - 1, iPosY - 1, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		// Top right
-		getPixel(iPosX + 1, iPosY - 1, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		// Bottom left
-		getPixel(iPosX - 1, iPosY + 1, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		// Bottom right
-		getPixel(iPosX + 1, iPosY + 1, col[0], col[1], col[2], col[3]);
-		if (col[0] == r)
-			if (col[1] == g)
-				if (col[2] == b)
-					return true;
-
-		return false;	// Shouldn't get here, keep compiler happy
+		if (pRow[iX].isRGB(r, g, b))
+			return false;
+
+		// If any bordering pixel is the same as the mask, then it's an edge
+		return pRow[iX - 1].isRGB(r, g, b) || pRow[iX + 1].isRGB(r, g, b) ||
+			pRowBelow[iX - 1].isRGB(r, g, b) || pRowBelow[iX].isRGB(r, g, b) || pRowBelow[iX + 1].isRGB(r, g, b) ||
+			pRowAbove[iX - 1].isRGB(r, g, b) || pRowAbove[iX].isRGB(r, g, b) || pRowAbove[iX + 1].isRGB(r, g, b);
 	}
 }
\ No newline at end of file
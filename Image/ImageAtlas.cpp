@@ -1,6 +1,7 @@
 #include "ImageAtlas.h"
 #include "../Core/Exceptions.h"
 #include "../Core/StringUtils.h"
+#include <algorithm>
 
 namespace X
 {
@@ -65,8 +66,12 @@ namespace X
 			ThrowIfFalse(pNewImage, "Unable to allocate memory for individual image.");
 			vImages.push_back(pNewImage);
 
-			// Load each individual image
-			ThrowIfFalse(vImages[ui]->load(vStrImageFilenames[ui], false), "Unable to load image from file: " + vStrImageFilenames[ui] + ".");
+			// Load each individual image. An image given more than once shares the pixels of the one already loaded rather than being loaded again.
+			auto itLoaded = std::find(vStrImageFilenames.begin(), vStrImageFilenames.begin() + ui, vStrImageFilenames[ui]);
+			if (itLoaded != vStrImageFilenames.begin() + ui)
+				vImages[itLoaded - vStrImageFilenames.begin()]->copyTo(*vImages[ui]);
+			else
+				ThrowIfFalse(vImages[ui]->load(vStrImageFilenames[ui], false), "Unable to load image from file: " + vStrImageFilenames[ui] + ".");
 
 			// We check to see if the loaded image's dimensions are not the same as the first one and throw an exception
 //			bool bNotSameDims = vImages[ui]->getWidth() != vImages[0]->getWidth() || vImages[ui]->getHeight() != vImages[0]->getHeight();
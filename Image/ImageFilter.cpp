@@ -0,0 +1,198 @@
+#include "ImageFilter.h"
+#include "../Core/Exceptions.h"
+#include "Image.h"
+#include "PixelKernels.h"
+#include <cmath>
+
+namespace X
+{
+	SFilterBorder::SFilterBorder(EMode eModeIn)
+	{
+		eMode = eModeIn;
+		memset(ucConstant, 0, sizeof(ucConstant));
+	}
+
+	SFilterBorder SFilterBorder::constant(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+	{
+		SFilterBorder border(BORDER_CONSTANT);
+		border.ucConstant[0] = r;
+		border.ucConstant[1] = g;
+		border.ucConstant[2] = b;
+		border.ucConstant[3] = a;
+		return border;
+	}
+
+	int SFilterBorder::mapPosition(int iPos, int iSize) const
+	{
+		if (iPos >= 0 && iPos < iSize)
+			return iPos;
+		switch (eMode)
+		{
+		case BORDER_WRAP:
+			return ((iPos % iSize) + iSize) % iSize;
+		case BORDER_MIRROR:
+		{
+			// Reflecting back and forth repeats every 2 * (iSize - 1) pixels
+			if (1 == iSize)
+				return 0;
+			const int iPeriod = 2 * (iSize - 1);
+			const int iPhase = ((iPos % iPeriod) + iPeriod) % iPeriod;
+			return iPhase < iSize ? iPhase : iPeriod - iPhase;
+		}
+		case BORDER_CONSTANT:
+			return -1;
+		default:
+			return iPos < 0 ? 0 : iSize - 1;
+		}
+	}
+
+	SFilterKernel SFilterKernel::separable(const std::vector<float>& vfWeightsX, const std::vector<float>& vfWeightsY)
+	{
+		ThrowIfTrue(vfWeightsX.size() % 2 != 1, "The number of horizontal weights must be odd.");
+		ThrowIfTrue(vfWeightsY.size() % 2 != 1, "The number of vertical weights must be odd.");
+		SFilterKernel kernel;
+		kernel.iRadiusX = int(vfWeightsX.size() / 2);
+		kernel.iRadiusY = int(vfWeightsY.size() / 2);
+		kernel.bSeparable = true;
+		kernel.vfWeightsX = vfWeightsX;
+		kernel.vfWeightsY = vfWeightsY;
+		return kernel;
+	}
+
+	SFilterKernel SFilterKernel::nonSeparable(int iRadiusX, int iRadiusY, const std::vector<float>& vfWeights)
+	{
+		ThrowIfTrue(iRadiusX < 0 || iRadiusY < 0, "Kernel radius must not be negative.");
+		ThrowIfTrue(vfWeights.size() != size_t(2 * iRadiusX + 1) * size_t(2 * iRadiusY + 1), "Number of weights doesn't match the kernel's radius.");
+		SFilterKernel kernel;
+		kernel.iRadiusX = iRadiusX;
+		kernel.iRadiusY = iRadiusY;
+		kernel.bSeparable = false;
+		kernel.vfWeights = vfWeights;
+		return kernel;
+	}
+
+	SFilterKernel SFilterKernel::gaussian(float fSigma)
+	{
+		ThrowIfTrue(!(fSigma > 0.0f), "Gaussian sigma must be greater than 0.");
+		const int iRadius = std::max(1, int(std::ceil(fSigma * 3.0f)));
+		std::vector<float> vfWeights(size_t(2 * iRadius + 1));
+		double dTotal = 0.0;
+		for (int i = -iRadius; i <= iRadius; i++)
+		{
+			const double dWeight = std::exp(-double(i * i) / (2.0 * double(fSigma) * double(fSigma)));
+			vfWeights[size_t(i + iRadius)] = float(dWeight);
+			dTotal += dWeight;
+		}
+		for (float& fWeight : vfWeights)
+			fWeight = float(fWeight / dTotal);
+		return separable(vfWeights, vfWeights);
+	}
+
+	namespace
+	{
+		template <int iNumChannels>
+		void convolveRowsOf(const unsigned char* pSrc, unsigned char* pDst, int iWidth, int iHeight, const SFilterKernel& kernel, const SFilterBorder& border,
+			int iFirstRow, int iLastRow, bool bFilterAlpha, float fUnsharpAmount)
+		{
+			const SPixelKernels& kernels = SPixelKernels::get();
+			const int iNumTapsX = 2 * kernel.iRadiusX + 1;
+			const int iNumTapsY = 2 * kernel.iRadiusY + 1;
+			const size_t uiRowValues = size_t(iWidth) * iNumChannels;
+			const size_t uiExtendedValues = (size_t(iWidth) + 2 * size_t(kernel.iRadiusX)) * iNumChannels;
+
+			// Each row the kernel reaches is extended by the border and converted to floats once. A separable kernel's horizontal
+			// pass is then done straight away, keeping just its result. Otherwise the extended rows are kept, for each row of weights.
+			// Either way the rows are kept in a ring, the slot of each being its number modulo the kernel's height.
+			CBorderedRows<SPixel<iNumChannels>> rowsBordered(reinterpret_cast<const SPixel<iNumChannels>*>(pSrc), iWidth, iHeight, kernel.iRadiusX, 0, border);
+			const size_t uiRingRowValues = kernel.bSeparable ? uiRowValues : uiExtendedValues;
+			std::vector<float> vfRing(uiRingRowValues * iNumTapsY);
+			std::vector<int> viRingRowHeld(size_t(iNumTapsY), INT_MIN);
+			std::vector<float> vfExtended(kernel.bSeparable ? uiExtendedValues : 0);
+			std::vector<float> vfFiltered(uiRowValues);
+			std::vector<float> vfSource(0.0f != fUnsharpAmount ? uiRowValues : 0);
+			std::vector<const float*> vpTaps(size_t(std::max(iNumTapsX + 1, iNumTapsY)));
+			std::vector<float> vfTapWeights(vpTaps.size());
+			std::vector<const float*> vpTapsX(iNumTapsX);
+
+			auto getRingRow = [&](int iY) -> const float*
+			{
+				const int iSlot = ((iY % iNumTapsY) + iNumTapsY) % iNumTapsY;
+				float* pRow = vfRing.data() + size_t(iSlot) * uiRingRowValues;
+				if (viRingRowHeld[iSlot] != iY)
+				{
+					viRingRowHeld[iSlot] = iY;
+					const unsigned char* pExtendedBytes = reinterpret_cast<const unsigned char*>(rowsBordered.getRows(iY)[0] - kernel.iRadiusX);
+					float* pExtended = kernel.bSeparable ? vfExtended.data() : pRow;
+					kernels.bytesToFloats(pExtendedBytes, pExtended, uiExtendedValues);
+					if (kernel.bSeparable)
+					{
+						// Each tap is the extended row starting a pixel further along
+						for (int iTap = 0; iTap < iNumTapsX; iTap++)
+							vpTapsX[iTap] = pExtended + size_t(iTap) * iNumChannels;
+						kernels.weightedSum(vpTapsX.data(), kernel.vfWeightsX.data(), iNumTapsX, pRow, uiRowValues);
+					}
+				}
+				return pRow;
+			};
+
+			for (int iY = iFirstRow; iY < iLastRow; iY++)
+			{
+				if (kernel.bSeparable)
+				{
+					for (int iTap = 0; iTap < iNumTapsY; iTap++)
+						vpTaps[iTap] = getRingRow(iY - kernel.iRadiusY + iTap);
+					kernels.weightedSum(vpTaps.data(), kernel.vfWeightsY.data(), iNumTapsY, vfFiltered.data(), uiRowValues);
+				}
+				else
+				{
+					// Each row of weights is a horizontal pass over its row, added to the sum of the passes before it
+					for (int iKernelRow = 0; iKernelRow < iNumTapsY; iKernelRow++)
+					{
+						const float* pExtended = getRingRow(iY - kernel.iRadiusY + iKernelRow);
+						unsigned int uiNumTaps = 0;
+						if (iKernelRow > 0)
+						{
+							vpTaps[uiNumTaps] = vfFiltered.data();
+							vfTapWeights[uiNumTaps++] = 1.0f;
+						}
+						for (int iTap = 0; iTap < iNumTapsX; iTap++)
+						{
+							vpTaps[uiNumTaps] = pExtended + size_t(iTap) * iNumChannels;
+							vfTapWeights[uiNumTaps++] = kernel.vfWeights[size_t(iKernelRow) * iNumTapsX + iTap];
+						}
+						kernels.weightedSum(vpTaps.data(), vfTapWeights.data(), uiNumTaps, vfFiltered.data(), uiRowValues);
+					}
+				}
+
+				// Unsharp masking is source + amount * (source - filtered), so the source's weight is 1 + amount and the filtered's -amount
+				const unsigned char* pSrcRow = pSrc + size_t(iY) * uiRowValues;
+				if (0.0f != fUnsharpAmount)
+				{
+					kernels.bytesToFloats(pSrcRow, vfSource.data(), uiRowValues);
+					const float* ppMix[2] = { vfFiltered.data(), vfSource.data() };
+					const float fMixWeights[2] = { -fUnsharpAmount, 1.0f + fUnsharpAmount };
+					kernels.weightedSum(ppMix, fMixWeights, 2, vfFiltered.data(), uiRowValues);
+				}
+
+				unsigned char* pDstRow = pDst + size_t(iY) * uiRowValues;
+				kernels.floatsToBytes(vfFiltered.data(), pDstRow, uiRowValues);
+				if (!bFilterAlpha && 4 == iNumChannels)
+				{
+					for (size_t ui = 3; ui < uiRowValues; ui += 4)
+						pDstRow[ui] = pSrcRow[ui];
+				}
+			}
+		}
+	}
+
+	void convolveRows(const unsigned char* pSrc, unsigned char* pDst, int iWidth, int iHeight, int iNumChannels, const SFilterKernel& kernel, const SFilterBorder& border,
+		int iFirstRow, int iLastRow, bool bFilterAlpha, float fUnsharpAmount)
+	{
+		if (3 == iNumChannels)
+			convolveRowsOf<3>(pSrc, pDst, iWidth, iHeight, kernel, border, iFirstRow, iLastRow, bFilterAlpha, fUnsharpAmount);
+		else if (4 == iNumChannels)
+			convolveRowsOf<4>(pSrc, pDst, iWidth, iHeight, kernel, border, iFirstRow, iLastRow, bFilterAlpha, fUnsharpAmount);
+		else
+			Throw("Image doesn't have 3 or 4 channels.");
+	}
+}
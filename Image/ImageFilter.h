@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+namespace X
+{
+	/// \brief How a filter makes up the pixels beyond an image's edges, so that it can read every neighbour of every pixel
+	/// without the image being copied into a larger one with a border first.
+	struct SFilterBorder
+	{
+		/// \brief The ways of making up the pixels beyond an image's edges
+		enum EMode
+		{
+			BORDER_CLAMP,		///< The nearest edge pixel is repeated
+			BORDER_WRAP,		///< The image repeats, so the pixel left of the left edge is the rightmost one
+			BORDER_MIRROR,		///< The image is reflected about its edge pixels, so the pixel left of the left edge is the second one
+			BORDER_CONSTANT		///< Every pixel beyond the edges is ucConstant
+		};
+
+		EMode eMode;					///< How the pixels beyond the edges are made up
+		unsigned char ucConstant[4];	///< The RGBA colour of every pixel beyond the edges, for BORDER_CONSTANT. Only the image's number of channels are used.
+
+		/// \brief Constructor, sets the mode and a constant colour of transparent black
+		SFilterBorder(EMode eMode = BORDER_CLAMP);
+
+		/// \brief Returns a border of the given constant colour
+		static SFilterBorder constant(unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255);
+
+		/// \brief Returns which of iSize pixels along an axis stands in for the position iPos, which may be beyond either end.
+		///
+		/// \return The position from 0 to iSize - 1, or -1 for BORDER_CONSTANT when iPos is beyond either end.
+		int mapPosition(int iPos, int iSize) const;
+	};
+
+	/// \brief The weights of a convolution filter, centred on the pixel being filtered.
+	///
+	/// A separable kernel is its horizontal weights times its vertical ones, so is applied as a horizontal pass then a vertical one,
+	/// costing the sum of its width and height per pixel rather than their product.
+	/// \code
+	/// CImage image;
+	/// image.convolve(SFilterKernel::gaussian(2.0f), SFilterBorder(SFilterBorder::BORDER_MIRROR));
+	/// \endcode
+	struct SFilterKernel
+	{
+		int iRadiusX;					///< How many pixels the kernel reaches either side of the pixel being filtered
+		int iRadiusY;					///< How many pixels the kernel reaches above and below the pixel being filtered
+		bool bSeparable;				///< Whether the weights are vfWeightsX times vfWeightsY, otherwise they're vfWeights
+		std::vector<float> vfWeightsX;	///< If separable, the 2 * iRadiusX + 1 horizontal weights, from the left
+		std::vector<float> vfWeightsY;	///< If separable, the 2 * iRadiusY + 1 vertical weights, from the bottom
+		std::vector<float> vfWeights;	///< If not separable, the (2 * iRadiusX + 1) * (2 * iRadiusY + 1) weights, a row at a time from the bottom
+
+		/// \brief Returns a separable kernel of the given horizontal and vertical weights. Each must have an odd number of weights.
+		static SFilterKernel separable(const std::vector<float>& vfWeightsX, const std::vector<float>& vfWeightsY);
+
+		/// \brief Returns a kernel of the given weights, a row at a time from the bottom. There must be (2 * iRadiusX + 1) * (2 * iRadiusY + 1) of them.
+		static SFilterKernel nonSeparable(int iRadiusX, int iRadiusY, const std::vector<float>& vfWeights);
+
+		/// \brief Returns a separable Gaussian blur kernel of the given standard deviation in pixels, reaching out to 3 of them, whose weights add up to 1.
+		static SFilterKernel gaussian(float fSigma);
+	};
+
+	/// \brief Gives the rows around each row of an image in turn, each extended either side with the pixels made up by an SFilterBorder.
+	///
+	/// For neighbourhood filters, such as CImage::edgeDetect(), which can then read every neighbour of every pixel without checks.
+	/// The 2 * iRadiusY + 1 extended rows last used are kept, so working up the image only extends each row once.
+	/// Only the extended rows are held, never a copy of the whole image, so one of these per band of rows may be used concurrently.
+	template <typename TPixel>
+	class CBorderedRows
+	{
+	public:
+		/// \brief Constructor
+		///
+		/// \param pPixels The image's pixels, which must stay unchanged while this is used
+		/// \param iWidth The width of the image
+		/// \param iHeight The height of the image
+		/// \param iRadiusX How many pixels beyond each end of a row may be read
+		/// \param iRadiusY How many rows either side of a row are given along with it
+		/// \param border How the pixels beyond the image's edges are made up
+		CBorderedRows(const TPixel* pPixels, int iWidth, int iHeight, int iRadiusX, int iRadiusY, const SFilterBorder& border);
+
+		/// \brief Returns the 2 * iRadiusY + 1 rows from iY - iRadiusY up to iY + iRadiusY, any of which may be beyond the image.
+		///
+		/// Each points at its pixel 0 and may be read from -iRadiusX up to iWidth + iRadiusX - 1.
+		/// They stay valid until the next call.
+		const TPixel* const* getRows(int iY);
+	private:
+		const TPixel* _mpPixels;			///< The image's pixels
+		int _miWidth;						///< Width of the image
+		int _miHeight;						///< Height of the image
+		int _miRadiusX;						///< Number of pixels each row is extended by either side
+		int _miRadiusY;						///< Number of rows given either side of the one asked for
+		SFilterBorder _mBorder;				///< How the pixels beyond the image's edges are made up
+		TPixel _mConstant;					///< _mBorder's constant colour as a pixel
+		std::vector<TPixel> _mvExtended;	///< The extended rows, one after another
+		std::vector<int> _mviRowHeld;		///< Which row each of the extended rows holds, INT_MIN for none yet
+		std::vector<const TPixel*> _mvpRows;///< The rows returned by getRows()
+
+		/// \brief Returns the extended row iY, extending it first unless it's held already
+		const TPixel* _getRow(int iY);
+	};
+
+	/// \brief Convolves rows iFirstRow to iLastRow - 1 of an image with a kernel, writing them to another image of the same size.
+	///
+	/// \param pSrc The pixels of the image to filter
+	/// \param pDst The pixels to write the filtered rows to, which mustn't overlap pSrc
+	/// \param iWidth The width of both images
+	/// \param iHeight The height of both images
+	/// \param iNumChannels The number of channels of both images, 3 or 4
+	/// \param kernel The kernel to convolve with
+	/// \param border How the pixels beyond the image's edges are made up
+	/// \param iFirstRow The first row to filter
+	/// \param iLastRow One past the last row to filter
+	/// \param bFilterAlpha If false, the alpha of 4 channel pixels is copied as is rather than filtered
+	/// \param fUnsharpAmount If not 0, each pixel becomes the source pixel plus this times its difference from the filtered one, which sharpens when the kernel blurs.
+	///
+	/// Works a row at a time as floats, through the SPixelKernels for the CPU. Separate bands of rows may be done concurrently.
+	void convolveRows(const unsigned char* pSrc, unsigned char* pDst, int iWidth, int iHeight, int iNumChannels, const SFilterKernel& kernel, const SFilterBorder& border,
+		int iFirstRow, int iLastRow, bool bFilterAlpha = true, float fUnsharpAmount = 0.0f);
+
+	template <typename TPixel>
+	CBorderedRows<TPixel>::CBorderedRows(const TPixel* pPixels, int iWidth, int iHeight, int iRadiusX, int iRadiusY, const SFilterBorder& border) :
+		_mpPixels(pPixels),
+		_miWidth(iWidth),
+		_miHeight(iHeight),
+		_miRadiusX(iRadiusX),
+		_miRadiusY(iRadiusY),
+		_mBorder(border)
+	{
+		static_assert(sizeof(TPixel) <= sizeof(border.ucConstant), "The border's constant colour must fill a pixel.");
+		memcpy(&_mConstant, border.ucConstant, sizeof(TPixel));
+		const size_t uiNumRows = size_t(2 * iRadiusY + 1);
+		_mvExtended.resize(uiNumRows * (size_t(iWidth) + 2 * size_t(iRadiusX)));
+		_mviRowHeld.assign(uiNumRows, INT_MIN);
+		_mvpRows.resize(uiNumRows);
+	}
+
+	template <typename TPixel>
+	const TPixel* const* CBorderedRows<TPixel>::getRows(int iY)
+	{
+		for (size_t ui = 0; ui < _mvpRows.size(); ui++)
+			_mvpRows[ui] = _getRow(iY - _miRadiusY + int(ui));
+		return _mvpRows.data();
+	}
+
+	template <typename TPixel>
+	const TPixel* CBorderedRows<TPixel>::_getRow(int iY)
+	{
+		// Rows are held in the slot of their number modulo the number of slots, so the rows around any one row never share a slot
+		const int iNumSlots = int(_mviRowHeld.size());
+		const int iSlot = ((iY % iNumSlots) + iNumSlots) % iNumSlots;
+		const size_t uiExtendedWidth = size_t(_miWidth) + 2 * size_t(_miRadiusX);
+		TPixel* pExtended = _mvExtended.data() + size_t(iSlot) * uiExtendedWidth;
+		if (_mviRowHeld[iSlot] != iY)
+		{
+			_mviRowHeld[iSlot] = iY;
+			const int iSrcRow = _mBorder.mapPosition(iY, _miHeight);
+			if (iSrcRow < 0)
+				std::fill(pExtended, pExtended + uiExtendedWidth, _mConstant);
+			else
+			{
+				const TPixel* pSrcRow = _mpPixels + size_t(iSrcRow) * _miWidth;
+				std::copy_n(pSrcRow, _miWidth, pExtended + _miRadiusX);
+				for (int iX = 1; iX <= _miRadiusX; iX++)
+				{
+					const int iLeft = _mBorder.mapPosition(-iX, _miWidth);
+					const int iRight = _mBorder.mapPosition(_miWidth - 1 + iX, _miWidth);
+					pExtended[_miRadiusX - iX] = iLeft < 0 ? _mConstant : pSrcRow[iLeft];
+					pExtended[_miRadiusX + _miWidth - 1 + iX] = iRight < 0 ? _mConstant : pSrcRow[iRight];
+				}
+			}
+		}
+		return pExtended + _miRadiusX;
+	}
+}
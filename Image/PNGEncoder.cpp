@@ -0,0 +1,998 @@
+#include "PNGEncoder.h"
+#include "../Core/Multithreading.h"
+#include "../Core/Utilities.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace X
+{
+	namespace
+	{
+		const int kWindowSize = 32768;				///< Largest distance a deflate match may reach back
+		const int kWindowMask = kWindowSize - 1;
+		const int kHashBits = 15;
+		const int kHashSize = 1 << kHashBits;
+		const int kMinMatch = 3;
+		const int kMaxMatch = 258;
+		const size_t kMaxBlockSymbols = 32768;		///< Symbols gathered before a block is written, each block getting its own Huffman codes
+		const size_t kMaxStoredBlockSize = 65535;
+		const size_t kParallelChunkSize = 128 * 1024;	///< Bytes of data compressed by each thread at a time
+
+		const uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		const uint8_t kLengthExtraBits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		const uint16_t kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		const uint8_t kDistanceExtraBits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		const uint8_t kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		/// \brief Reverses the lowest iNumBits bits of the given code, as deflate writes Huffman codes starting with their most significant bit.
+		uint16_t reverseBits(uint16_t uiCode, int iNumBits)
+		{
+			uint16_t uiResult = 0;
+			for (int i = 0; i < iNumBits; i++)
+			{
+				uiResult = uint16_t((uiResult << 1) | (uiCode & 1));
+				uiCode >>= 1;
+			}
+			return uiResult;
+		}
+
+		/// \brief Assigns canonical Huffman codes for the given code lengths, bit reversed ready for writing.
+		void buildCodes(const uint8_t* pLengths, int iNumSymbols, uint16_t* pCodes)
+		{
+			uint16_t uiLengthCount[16] = {};
+			for (int i = 0; i < iNumSymbols; i++)
+			{
+				uiLengthCount[pLengths[i]]++;
+			}
+			uiLengthCount[0] = 0;
+			uint16_t uiNextCode[16] = {};
+			uint16_t uiCode = 0;
+			for (int iBits = 1; iBits < 16; iBits++)
+			{
+				uiCode = uint16_t((uiCode + uiLengthCount[iBits - 1]) << 1);
+				uiNextCode[iBits] = uiCode;
+			}
+			for (int i = 0; i < iNumSymbols; i++)
+			{
+				if (pLengths[i])
+					pCodes[i] = reverseBits(uiNextCode[pLengths[i]]++, pLengths[i]);
+				else
+					pCodes[i] = 0;
+			}
+		}
+
+		/// \brief Computes Huffman code lengths for the given symbol frequencies, none longer than iMaxLength.
+		///
+		/// At least two symbols are always given a code, as a single code of length zero can't be written.
+		/// If the optimal code is too long, the frequencies are flattened and the code is rebuilt until it fits.
+		/// That's slightly worse than package-merge, but the limit is rarely hit for image data.
+		void buildCodeLengths(const uint32_t* pFrequencies, int iNumSymbols, int iMaxLength, uint8_t* pLengths)
+		{
+			std::vector<uint32_t> vFrequencies(pFrequencies, pFrequencies + iNumSymbols);
+			int iNumUsed = 0;
+			for (int i = 0; i < iNumSymbols; i++)
+			{
+				if (vFrequencies[i])
+					iNumUsed++;
+			}
+			for (int i = 0; i < iNumSymbols && iNumUsed < 2; i++)
+			{
+				if (!vFrequencies[i])
+				{
+					vFrequencies[i] = 1;
+					iNumUsed++;
+				}
+			}
+
+			struct SNode
+			{
+				uint32_t uiFrequency;
+				int iSymbol;	///< The symbol for leaves, -1 for internal nodes
+				int iParent;
+			};
+			std::vector<SNode> vNodes;
+			vNodes.reserve(iNumUsed * 2);
+			std::vector<int> vDepth;
+			for (;;)
+			{
+				// Leaves sorted by frequency, then internal nodes are created in order of increasing frequency,
+				// so the two lowest frequency nodes are always at the front of one of the two queues.
+				vNodes.clear();
+				for (int i = 0; i < iNumSymbols; i++)
+				{
+					if (vFrequencies[i])
+						vNodes.push_back({ vFrequencies[i], i, -1 });
+				}
+				std::stable_sort(vNodes.begin(), vNodes.end(), [](const SNode& a, const SNode& b) { return a.uiFrequency < b.uiFrequency; });
+				const int iNumLeaves = int(vNodes.size());
+				int iNextLeaf = 0;
+				int iNextInternal = iNumLeaves;
+				auto takeLowest = [&]()
+				{
+					if (iNextLeaf < iNumLeaves && (iNextInternal >= int(vNodes.size()) || vNodes[iNextLeaf].uiFrequency <= vNodes[iNextInternal].uiFrequency))
+						return iNextLeaf++;
+					return iNextInternal++;
+				};
+				for (int i = 0; i < iNumLeaves - 1; i++)
+				{
+					int iFirst = takeLowest();
+					int iSecond = takeLowest();
+					int iParent = int(vNodes.size());
+					vNodes.push_back({ vNodes[iFirst].uiFrequency + vNodes[iSecond].uiFrequency, -1, -1 });
+					vNodes[iFirst].iParent = iParent;
+					vNodes[iSecond].iParent = iParent;
+				}
+
+				// Parents always come after their children, so depths can be worked out from the root down in one pass
+				vDepth.assign(vNodes.size(), 0);
+				int iMaxDepth = 0;
+				for (int i = int(vNodes.size()) - 2; i >= 0; i--)
+				{
+					vDepth[i] = vDepth[vNodes[i].iParent] + 1;
+					iMaxDepth = std::max(iMaxDepth, vDepth[i]);
+				}
+				if (iMaxDepth <= iMaxLength)
+					break;
+				for (uint32_t& uiFrequency : vFrequencies)
+				{
+					if (uiFrequency)
+						uiFrequency = (uiFrequency >> 1) | 1;
+				}
+			}
+
+			memset(pLengths, 0, iNumSymbols);
+			for (size_t i = 0; i < vNodes.size(); i++)
+			{
+				if (vNodes[i].iSymbol >= 0)
+					pLengths[vNodes[i].iSymbol] = uint8_t(vDepth[i]);
+			}
+		}
+
+		/// \brief Lookup tables which are built once, on first use. (Initialisation of a function's static is thread safe)
+		struct STables
+		{
+			STables()
+			{
+				for (int iCode = 0; iCode < 29; iCode++)
+				{
+					int iEnd = (iCode == 28) ? 259 : kLengthBase[iCode] + (1 << kLengthExtraBits[iCode]);
+					for (int iLength = kLengthBase[iCode]; iLength < iEnd && iLength < 259; iLength++)
+						uiLengthCode[iLength] = uint8_t(iCode);
+				}
+				// Distances up to 256 are looked up directly, and above that by (distance - 1) >> 7, as every code there spans a multiple of 128.
+				for (int iCode = 0; iCode < 30; iCode++)
+				{
+					for (int iDistance = kDistanceBase[iCode] - 1; iDistance < kDistanceBase[iCode] - 1 + (1 << kDistanceExtraBits[iCode]); iDistance++)
+					{
+						if (iDistance < 256)
+							uiDistanceCodeLow[iDistance] = uint8_t(iCode);
+						else
+							uiDistanceCodeHigh[iDistance >> 7] = uint8_t(iCode);
+					}
+				}
+
+				for (int i = 0; i < 288; i++)
+				{
+					if (i < 144)		uiFixedLiteralLengths[i] = 8;
+					else if (i < 256)	uiFixedLiteralLengths[i] = 9;
+					else if (i < 280)	uiFixedLiteralLengths[i] = 7;
+					else				uiFixedLiteralLengths[i] = 8;
+				}
+				buildCodes(uiFixedLiteralLengths, 288, uiFixedLiteralCodes);
+				for (int i = 0; i < 30; i++)
+				{
+					uiFixedDistanceLengths[i] = 5;
+				}
+				buildCodes(uiFixedDistanceLengths, 30, uiFixedDistanceCodes);
+
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t uiCRC = i;
+					for (int iBit = 0; iBit < 8; iBit++)
+						uiCRC = (uiCRC & 1) ? 0xEDB88320u ^ (uiCRC >> 1) : uiCRC >> 1;
+					uiCRCTable[i] = uiCRC;
+				}
+			}
+
+			int distanceCode(int iDistance) const
+			{
+				return iDistance <= 256 ? uiDistanceCodeLow[iDistance - 1] : uiDistanceCodeHigh[(iDistance - 1) >> 7];
+			}
+
+			uint8_t uiLengthCode[259];			///< Match length to length code (0-28, add 257 for the symbol)
+			uint8_t uiDistanceCodeLow[256];
+			uint8_t uiDistanceCodeHigh[256];
+			uint8_t uiFixedLiteralLengths[288];
+			uint16_t uiFixedLiteralCodes[288];
+			uint8_t uiFixedDistanceLengths[30];
+			uint16_t uiFixedDistanceCodes[30];
+			uint32_t uiCRCTable[256];
+		};
+
+		const STables& getTables(void)
+		{
+			static const STables tables;
+			return tables;
+		}
+
+		/// \brief Writes bits least significant first, as deflate requires.
+		class CBitWriter
+		{
+		public:
+			CBitWriter(std::vector<uint8_t>& vOutput) : _mvOutput(vOutput), _muiBits(0), _miNumBits(0) {}
+
+			void write(uint32_t uiValue, int iNumBits)
+			{
+				_muiBits |= uint64_t(uiValue) << _miNumBits;
+				_miNumBits += iNumBits;
+				while (_miNumBits >= 8)
+				{
+					_mvOutput.push_back(uint8_t(_muiBits));
+					_muiBits >>= 8;
+					_miNumBits -= 8;
+				}
+			}
+
+			/// \brief Pads with zero bits up to the next byte boundary
+			void alignToByte(void)
+			{
+				if (_miNumBits > 0)
+					write(0, 8 - _miNumBits);
+			}
+
+			/// \brief Appends bytes directly. Only valid when aligned to a byte boundary.
+			void writeBytes(const uint8_t* pData, size_t uiSize)
+			{
+				_mvOutput.insert(_mvOutput.end(), pData, pData + uiSize);
+			}
+		private:
+			std::vector<uint8_t>& _mvOutput;
+			uint64_t _muiBits;
+			int _miNumBits;
+		};
+
+		/// \brief Writes blocks of uncompressed data
+		void writeStoredBlocks(CBitWriter& writer, const uint8_t* pData, size_t uiSize, bool bFinal)
+		{
+			do
+			{
+				size_t uiBlockSize = std::min(uiSize, kMaxStoredBlockSize);
+				bool bLast = uiBlockSize == uiSize;
+				writer.write((bFinal && bLast) ? 1 : 0, 1);
+				writer.write(0, 2);
+				writer.alignToByte();
+				writer.write(uint32_t(uiBlockSize), 16);
+				writer.write(uint32_t(~uiBlockSize) & 0xFFFF, 16);
+				writer.writeBytes(pData, uiBlockSize);
+				pData += uiBlockSize;
+				uiSize -= uiBlockSize;
+			} while (uiSize > 0);
+		}
+
+		/// \brief Gathers the literals and matches found by the match finders and writes them as deflate blocks,
+		/// choosing whichever of dynamic Huffman, fixed Huffman or stored is smallest for each block.
+		class CBlockWriter
+		{
+		public:
+			CBlockWriter(CBitWriter& writer, const uint8_t* pData, size_t uiStart) : _mWriter(writer), _mpData(pData), _muiBlockStart(uiStart)
+			{
+				_mvSymbols.reserve(kMaxBlockSymbols);
+				_resetFrequencies();
+			}
+
+			void literal(uint8_t uiLiteral)
+			{
+				_mvSymbols.push_back({ uiLiteral, 0 });
+				_muiLiteralFrequencies[uiLiteral]++;
+			}
+
+			void match(int iLength, int iDistance)
+			{
+				const STables& tables = getTables();
+				_mvSymbols.push_back({ uint16_t(iLength), uint16_t(iDistance) });
+				_muiLiteralFrequencies[257 + tables.uiLengthCode[iLength]]++;
+				_muiDistanceFrequencies[tables.distanceCode(iDistance)]++;
+			}
+
+			bool isFull(void) const
+			{
+				return _mvSymbols.size() >= kMaxBlockSymbols;
+			}
+
+			/// \brief Writes everything gathered so far as a block
+			///
+			/// \param uiBlockEnd The position in the input data up to which has been gathered
+			/// \param bFinal Whether this is the last block of the stream
+			void flush(size_t uiBlockEnd, bool bFinal)
+			{
+				const STables& tables = getTables();
+				_muiLiteralFrequencies[256]++;	// End of block
+
+				uint8_t uiLiteralLengths[286];
+				uint8_t uiDistanceLengths[30];
+				buildCodeLengths(_muiLiteralFrequencies, 286, 15, uiLiteralLengths);
+				buildCodeLengths(_muiDistanceFrequencies, 30, 15, uiDistanceLengths);
+
+				// Work out the code length codes which describe the two codes above
+				int iNumLiteralCodes = 286;
+				while (iNumLiteralCodes > 257 && 0 == uiLiteralLengths[iNumLiteralCodes - 1])
+					iNumLiteralCodes--;
+				int iNumDistanceCodes = 30;
+				while (iNumDistanceCodes > 1 && 0 == uiDistanceLengths[iNumDistanceCodes - 1])
+					iNumDistanceCodes--;
+				uint8_t uiAllLengths[286 + 30];
+				memcpy(uiAllLengths, uiLiteralLengths, iNumLiteralCodes);
+				memcpy(uiAllLengths + iNumLiteralCodes, uiDistanceLengths, iNumDistanceCodes);
+				const int iNumAllLengths = iNumLiteralCodes + iNumDistanceCodes;
+
+				struct SCodeLengthSymbol
+				{
+					uint8_t uiSymbol;
+					uint8_t uiExtra;
+				};
+				std::vector<SCodeLengthSymbol> vCodeLengthSymbols;
+				vCodeLengthSymbols.reserve(iNumAllLengths);
+				uint32_t uiCodeLengthFrequencies[19] = {};
+				auto addCodeLengthSymbol = [&](int iSymbol, int iExtra)
+				{
+					vCodeLengthSymbols.push_back({ uint8_t(iSymbol), uint8_t(iExtra) });
+					uiCodeLengthFrequencies[iSymbol]++;
+				};
+				for (int i = 0; i < iNumAllLengths;)
+				{
+					const uint8_t uiLength = uiAllLengths[i];
+					int iRun = 1;
+					while (i + iRun < iNumAllLengths && uiAllLengths[i + iRun] == uiLength)
+						iRun++;
+					i += iRun;
+					if (0 == uiLength)
+					{
+						while (iRun >= 11)
+						{
+							int iCount = std::min(iRun, 138);
+							addCodeLengthSymbol(18, iCount - 11);
+							iRun -= iCount;
+						}
+						if (iRun >= 3)
+						{
+							addCodeLengthSymbol(17, iRun - 3);
+							iRun = 0;
+						}
+					}
+					else
+					{
+						addCodeLengthSymbol(uiLength, 0);
+						iRun--;
+						while (iRun >= 3)
+						{
+							int iCount = std::min(iRun, 6);
+							addCodeLengthSymbol(16, iCount - 3);
+							iRun -= iCount;
+						}
+					}
+					while (iRun-- > 0)
+						addCodeLengthSymbol(uiLength, 0);
+				}
+				uint8_t uiCodeLengthLengths[19];
+				buildCodeLengths(uiCodeLengthFrequencies, 19, 7, uiCodeLengthLengths);
+				int iNumCodeLengthCodes = 19;
+				while (iNumCodeLengthCodes > 4 && 0 == uiCodeLengthLengths[kCodeLengthOrder[iNumCodeLengthCodes - 1]])
+					iNumCodeLengthCodes--;
+
+				// Work out the size of the block for each block type
+				uint64_t uiExtraBits = 0;
+				uint64_t uiDynamicBits = 3 + 14 + 3 * uint64_t(iNumCodeLengthCodes);
+				uint64_t uiFixedBits = 3;
+				for (const SCodeLengthSymbol& symbol : vCodeLengthSymbols)
+				{
+					uiDynamicBits += uiCodeLengthLengths[symbol.uiSymbol];
+					uiDynamicBits += (16 == symbol.uiSymbol) ? 2 : (17 == symbol.uiSymbol) ? 3 : (18 == symbol.uiSymbol) ? 7 : 0;
+				}
+				for (int i = 0; i < 286; i++)
+				{
+					uiDynamicBits += uint64_t(_muiLiteralFrequencies[i]) * uiLiteralLengths[i];
+					uiFixedBits += uint64_t(_muiLiteralFrequencies[i]) * tables.uiFixedLiteralLengths[i];
+					if (i >= 257)
+						uiExtraBits += uint64_t(_muiLiteralFrequencies[i]) * kLengthExtraBits[i - 257];
+				}
+				for (int i = 0; i < 30; i++)
+				{
+					uiDynamicBits += uint64_t(_muiDistanceFrequencies[i]) * uiDistanceLengths[i];
+					uiFixedBits += uint64_t(_muiDistanceFrequencies[i]) * 5;
+					uiExtraBits += uint64_t(_muiDistanceFrequencies[i]) * kDistanceExtraBits[i];
+				}
+				uiDynamicBits += uiExtraBits;
+				uiFixedBits += uiExtraBits;
+				const size_t uiBlockSize = uiBlockEnd - _muiBlockStart;
+				const uint64_t uiStoredBits = (uiBlockSize + 5 * (uiBlockSize / kMaxStoredBlockSize + 1)) * 8 + 7;
+
+				if (uiStoredBits <= uiDynamicBits && uiStoredBits <= uiFixedBits)
+					writeStoredBlocks(_mWriter, _mpData + _muiBlockStart, uiBlockSize, bFinal);
+				else if (uiFixedBits <= uiDynamicBits)
+				{
+					_mWriter.write(bFinal ? 1 : 0, 1);
+					_mWriter.write(1, 2);
+					_writeSymbols(tables.uiFixedLiteralLengths, tables.uiFixedLiteralCodes, tables.uiFixedDistanceLengths, tables.uiFixedDistanceCodes);
+				}
+				else
+				{
+					_mWriter.write(bFinal ? 1 : 0, 1);
+					_mWriter.write(2, 2);
+					_mWriter.write(iNumLiteralCodes - 257, 5);
+					_mWriter.write(iNumDistanceCodes - 1, 5);
+					_mWriter.write(iNumCodeLengthCodes - 4, 4);
+					for (int i = 0; i < iNumCodeLengthCodes; i++)
+					{
+						_mWriter.write(uiCodeLengthLengths[kCodeLengthOrder[i]], 3);
+					}
+					uint16_t uiCodeLengthCodes[19];
+					buildCodes(uiCodeLengthLengths, 19, uiCodeLengthCodes);
+					for (const SCodeLengthSymbol& symbol : vCodeLengthSymbols)
+					{
+						_mWriter.write(uiCodeLengthCodes[symbol.uiSymbol], uiCodeLengthLengths[symbol.uiSymbol]);
+						if (16 == symbol.uiSymbol)
+							_mWriter.write(symbol.uiExtra, 2);
+						else if (17 == symbol.uiSymbol)
+							_mWriter.write(symbol.uiExtra, 3);
+						else if (18 == symbol.uiSymbol)
+							_mWriter.write(symbol.uiExtra, 7);
+					}
+					uint16_t uiLiteralCodes[286];
+					uint16_t uiDistanceCodes[30];
+					buildCodes(uiLiteralLengths, 286, uiLiteralCodes);
+					buildCodes(uiDistanceLengths, 30, uiDistanceCodes);
+					_writeSymbols(uiLiteralLengths, uiLiteralCodes, uiDistanceLengths, uiDistanceCodes);
+				}
+
+				_mvSymbols.clear();
+				_resetFrequencies();
+				_muiBlockStart = uiBlockEnd;
+			}
+		private:
+			struct SSymbol
+			{
+				uint16_t uiLiteralOrLength;	///< The literal byte, or the match length if uiDistance isn't zero
+				uint16_t uiDistance;		///< The match distance, or zero for a literal
+			};
+
+			CBitWriter& _mWriter;
+			const uint8_t* _mpData;
+			size_t _muiBlockStart;
+			std::vector<SSymbol> _mvSymbols;
+			uint32_t _muiLiteralFrequencies[286];
+			uint32_t _muiDistanceFrequencies[30];
+
+			void _resetFrequencies(void)
+			{
+				memset(_muiLiteralFrequencies, 0, sizeof(_muiLiteralFrequencies));
+				memset(_muiDistanceFrequencies, 0, sizeof(_muiDistanceFrequencies));
+			}
+
+			void _writeSymbols(const uint8_t* pLiteralLengths, const uint16_t* pLiteralCodes, const uint8_t* pDistanceLengths, const uint16_t* pDistanceCodes)
+			{
+				const STables& tables = getTables();
+				for (const SSymbol& symbol : _mvSymbols)
+				{
+					if (0 == symbol.uiDistance)
+					{
+						_mWriter.write(pLiteralCodes[symbol.uiLiteralOrLength], pLiteralLengths[symbol.uiLiteralOrLength]);
+						continue;
+					}
+					const int iLengthCode = tables.uiLengthCode[symbol.uiLiteralOrLength];
+					_mWriter.write(pLiteralCodes[257 + iLengthCode], pLiteralLengths[257 + iLengthCode]);
+					if (kLengthExtraBits[iLengthCode])
+						_mWriter.write(symbol.uiLiteralOrLength - kLengthBase[iLengthCode], kLengthExtraBits[iLengthCode]);
+					const int iDistanceCode = tables.distanceCode(symbol.uiDistance);
+					_mWriter.write(pDistanceCodes[iDistanceCode], pDistanceLengths[iDistanceCode]);
+					if (kDistanceExtraBits[iDistanceCode])
+						_mWriter.write(symbol.uiDistance - kDistanceBase[iDistanceCode], kDistanceExtraBits[iDistanceCode]);
+				}
+				_mWriter.write(pLiteralCodes[256], pLiteralLengths[256]);
+			}
+		};
+
+		/// \brief Only matches runs of the same byte, at a distance of one. After PNG filtering, flat areas become long runs of zeros, so this gets much of the gain for little work.
+		///
+		/// Compresses pData[uiStart] up to pData[uiEnd]. Anything before uiStart is taken to have already been written to the stream.
+		void deflateRLE(CBitWriter& writer, const uint8_t* pData, size_t uiStart, size_t uiEnd, bool bFinal)
+		{
+			CBlockWriter blockWriter(writer, pData, uiStart);
+			size_t uiPos = uiStart;
+			while (uiPos < uiEnd)
+			{
+				size_t uiRun = 0;
+				if (uiPos > 0)
+				{
+					const size_t uiMaxRun = std::min(size_t(kMaxMatch), uiEnd - uiPos);
+					const uint8_t uiPrevious = pData[uiPos - 1];
+					while (uiRun < uiMaxRun && pData[uiPos + uiRun] == uiPrevious)
+						uiRun++;
+				}
+				if (uiRun >= size_t(kMinMatch))
+				{
+					blockWriter.match(int(uiRun), 1);
+					uiPos += uiRun;
+				}
+				else
+				{
+					blockWriter.literal(pData[uiPos]);
+					uiPos++;
+				}
+				if (blockWriter.isFull())
+					blockWriter.flush(uiPos, false);
+			}
+			blockWriter.flush(uiPos, bFinal);
+		}
+
+		/// \brief Finds matches by following chains of earlier positions which share the same hash of their first three bytes.
+		///
+		/// \param iMaxChain How many earlier positions are tried for each match
+		/// \param iNiceLength A match at least this long is taken without searching further
+		/// \param bLazy If true, a match is put off by one byte whenever the next position has a longer match
+		///
+		/// Compresses pData[uiStart] up to pData[uiEnd]. Anything before uiStart is taken to have already been written to the stream,
+		/// so the 32K before it is used as a dictionary which matches may refer back to.
+		void deflateHashChain(CBitWriter& writer, const uint8_t* pData, size_t uiStart, size_t uiEnd, bool bFinal, int iMaxChain, int iNiceLength, bool bLazy)
+		{
+			std::vector<int32_t> vHead(kHashSize, -1);
+			std::vector<int32_t> vPrevious(kWindowSize, -1);
+			auto hash = [pData](size_t uiPos)
+			{
+				uint32_t uiValue = uint32_t(pData[uiPos]) | (uint32_t(pData[uiPos + 1]) << 8) | (uint32_t(pData[uiPos + 2]) << 16);
+				return (uiValue * 2654435761u) >> (32 - kHashBits);
+			};
+			auto insert = [&](size_t uiPos)
+			{
+				if (uiPos + kMinMatch > uiEnd)
+					return;
+				uint32_t uiHash = hash(uiPos);
+				vPrevious[uiPos & kWindowMask] = vHead[uiHash];
+				vHead[uiHash] = int32_t(uiPos);
+			};
+			auto findMatch = [&](size_t uiPos, int& iDistance)
+			{
+				if (uiPos + kMinMatch > uiEnd)
+					return 0;
+				const int iMaxLength = int(std::min(size_t(kMaxMatch), uiEnd - uiPos));
+				const uint8_t* pCurrent = pData + uiPos;
+				int iBestLength = 0;
+				int iChain = iMaxChain;
+				int32_t iCandidate = vHead[hash(uiPos)];
+				while (iCandidate >= 0 && iChain-- > 0)
+				{
+					const int iCandidateDistance = int(uiPos - size_t(iCandidate));
+					if (iCandidateDistance > kWindowSize)
+						break;
+					const uint8_t* pCandidate = pData + iCandidate;
+					// Check the byte which would make this match longer than the best so far first, as it's the most likely to differ
+					if (pCandidate[iBestLength] == pCurrent[iBestLength] && pCandidate[0] == pCurrent[0])
+					{
+						int iLength = 0;
+						while (iLength < iMaxLength && pCandidate[iLength] == pCurrent[iLength])
+							iLength++;
+						if (iLength > iBestLength)
+						{
+							iBestLength = iLength;
+							iDistance = iCandidateDistance;
+							if (iLength >= iNiceLength || iLength == iMaxLength)
+								break;
+						}
+					}
+					int32_t iNext = vPrevious[iCandidate & kWindowMask];
+					if (iNext >= iCandidate)
+						break;
+					iCandidate = iNext;
+				}
+				// A minimum length match far away costs more bits than the three literals it replaces
+				if (iBestLength < kMinMatch || (kMinMatch == iBestLength && iDistance > 4096))
+					return 0;
+				return iBestLength;
+			};
+
+			for (size_t uiPos = uiStart > size_t(kWindowSize) ? uiStart - kWindowSize : 0; uiPos < uiStart; uiPos++)
+			{
+				insert(uiPos);
+			}
+
+			CBlockWriter blockWriter(writer, pData, uiStart);
+			size_t uiPos = uiStart;
+			while (uiPos < uiEnd)
+			{
+				int iDistance = 0;
+				int iLength = findMatch(uiPos, iDistance);
+				insert(uiPos);
+				if (bLazy && iLength > 0 && iLength < iNiceLength)
+				{
+					int iNextDistance = 0;
+					if (findMatch(uiPos + 1, iNextDistance) > iLength)
+						iLength = 0;
+				}
+				if (iLength > 0)
+				{
+					blockWriter.match(iLength, iDistance);
+					for (size_t i = 1; i < size_t(iLength); i++)
+						insert(uiPos + i);
+					uiPos += iLength;
+				}
+				else
+				{
+					blockWriter.literal(pData[uiPos]);
+					uiPos++;
+				}
+				if (blockWriter.isFull())
+					blockWriter.flush(uiPos, false);
+			}
+			blockWriter.flush(uiPos, bFinal);
+		}
+
+		void appendBigEndian32(std::vector<uint8_t>& vOutput, uint32_t uiValue)
+		{
+			vOutput.push_back(uint8_t(uiValue >> 24));
+			vOutput.push_back(uint8_t(uiValue >> 16));
+			vOutput.push_back(uint8_t(uiValue >> 8));
+			vOutput.push_back(uint8_t(uiValue));
+		}
+
+		int paethPredictor(int iLeft, int iUp, int iUpLeft)
+		{
+			int p = iLeft + iUp - iUpLeft;
+			int pa = abs(p - iLeft);
+			int pb = abs(p - iUp);
+			int pc = abs(p - iUpLeft);
+			if (pa <= pb && pa <= pc)
+				return iLeft;
+			if (pb <= pc)
+				return iUp;
+			return iUpLeft;
+		}
+	}
+
+	CPNGEncoder::CPNGEncoder(EEffort eEffort, unsigned int uiMaxThreads)
+	{
+		_meEffort = eEffort;
+		_muiMaxThreads = uiMaxThreads;
+	}
+
+	void CPNGEncoder::setEffort(EEffort eEffort)
+	{
+		_meEffort = eEffort;
+	}
+
+	CPNGEncoder::EEffort CPNGEncoder::getEffort(void) const
+	{
+		return _meEffort;
+	}
+
+	void CPNGEncoder::setMaxThreads(unsigned int uiMaxThreads)
+	{
+		_muiMaxThreads = uiMaxThreads;
+	}
+
+	unsigned int CPNGEncoder::getMaxThreads(void) const
+	{
+		return _muiMaxThreads;
+	}
+
+	bool CPNGEncoder::encode(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, std::vector<uint8_t>& vPNGData, bool bFlipVertically) const
+	{
+		vPNGData.clear();
+		if (!pPixels || iWidth < 1 || iHeight < 1 || iNumChannels < 1 || iNumChannels > 4)
+			return false;
+
+		std::vector<uint8_t> vFiltered;
+		_filterRows(pPixels, iWidth, iHeight, iNumChannels, vFiltered, bFlipVertically);
+		if (EFFORT_STORE == _meEffort)
+			vPNGData.reserve(vFiltered.size() + (vFiltered.size() / kMaxStoredBlockSize + 1) * 5 + 64);
+		else
+			vPNGData.reserve(vFiltered.size() / 2 + 64);
+
+		const uint8_t uiSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		vPNGData.insert(vPNGData.end(), uiSignature, uiSignature + 8);
+
+		const uint8_t uiColourTypes[4] = { 0, 4, 2, 6 };	// Grey, grey and alpha, RGB, RGBA
+		size_t uiChunk = _beginChunk(vPNGData, "IHDR");
+		appendBigEndian32(vPNGData, uint32_t(iWidth));
+		appendBigEndian32(vPNGData, uint32_t(iHeight));
+		vPNGData.push_back(8);	// Bit depth
+		vPNGData.push_back(uiColourTypes[iNumChannels - 1]);
+		vPNGData.push_back(0);	// Compression method
+		vPNGData.push_back(0);	// Filter method
+		vPNGData.push_back(0);	// No interlacing
+		_endChunk(vPNGData, uiChunk);
+
+		uiChunk = _beginChunk(vPNGData, "IDAT");
+		zlibCompress(vFiltered.data(), vFiltered.size(), _meEffort, vPNGData, _muiMaxThreads);
+		if (vPNGData.size() - uiChunk - 8 > 0x7FFFFFFF)
+		{
+			// Chunks are limited to 2^31 - 1 bytes
+			vPNGData.clear();
+			return false;
+		}
+		_endChunk(vPNGData, uiChunk);
+
+		uiChunk = _beginChunk(vPNGData, "IEND");
+		_endChunk(vPNGData, uiChunk);
+		return true;
+	}
+
+	bool CPNGEncoder::encodePaletted(const uint8_t* pIndices, int iWidth, int iHeight, const uint8_t* pPalette, int iNumColours, std::vector<uint8_t>& vPNGData) const
+	{
+		vPNGData.clear();
+		if (!pIndices || !pPalette || iWidth < 1 || iHeight < 1 || iNumColours < 1 || iNumColours > 256)
+			return false;
+
+		// Each row is prefixed with filter type None. At 4 bits per pixel, the first pixel of each pair is in the high bits.
+		const int iBitDepth = iNumColours <= 16 ? 4 : 8;
+		const size_t uiRowSize = 4 == iBitDepth ? (size_t(iWidth) + 1) / 2 : size_t(iWidth);
+		std::vector<uint8_t> vRows((uiRowSize + 1) * iHeight, 0);
+		for (int y = 0; y < iHeight; y++)
+		{
+			const uint8_t* pRow = pIndices + size_t(y) * iWidth;
+			uint8_t* pOut = vRows.data() + (uiRowSize + 1) * y + 1;
+			for (int x = 0; x < iWidth; x++)
+			{
+				if (pRow[x] >= iNumColours)
+					return false;
+				if (4 == iBitDepth)
+					pOut[x / 2] |= uint8_t(pRow[x] << (x & 1 ? 0 : 4));
+				else
+					pOut[x] = pRow[x];
+			}
+		}
+
+		const uint8_t uiSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		vPNGData.insert(vPNGData.end(), uiSignature, uiSignature + 8);
+
+		size_t uiChunk = _beginChunk(vPNGData, "IHDR");
+		appendBigEndian32(vPNGData, uint32_t(iWidth));
+		appendBigEndian32(vPNGData, uint32_t(iHeight));
+		vPNGData.push_back(uint8_t(iBitDepth));
+		vPNGData.push_back(3);	// Paletted
+		vPNGData.push_back(0);	// Compression method
+		vPNGData.push_back(0);	// Filter method
+		vPNGData.push_back(0);	// No interlacing
+		_endChunk(vPNGData, uiChunk);
+
+		uiChunk = _beginChunk(vPNGData, "PLTE");
+		int iNumAlpha = 0;
+		for (int i = 0; i < iNumColours; i++)
+		{
+			vPNGData.insert(vPNGData.end(), pPalette + i * 4, pPalette + i * 4 + 3);
+			if (pPalette[i * 4 + 3] != 255)
+				iNumAlpha = i + 1;
+		}
+		_endChunk(vPNGData, uiChunk);
+
+		// The alpha of each colour up to the last which isn't opaque, the rest being opaque
+		if (iNumAlpha > 0)
+		{
+			uiChunk = _beginChunk(vPNGData, "tRNS");
+			for (int i = 0; i < iNumAlpha; i++)
+				vPNGData.push_back(pPalette[i * 4 + 3]);
+			_endChunk(vPNGData, uiChunk);
+		}
+
+		uiChunk = _beginChunk(vPNGData, "IDAT");
+		zlibCompress(vRows.data(), vRows.size(), _meEffort, vPNGData, _muiMaxThreads);
+		_endChunk(vPNGData, uiChunk);
+
+		uiChunk = _beginChunk(vPNGData, "IEND");
+		_endChunk(vPNGData, uiChunk);
+		return true;
+	}
+
+	void CPNGEncoder::zlibCompress(const uint8_t* pData, size_t uiDataSize, EEffort eEffort, std::vector<uint8_t>& vOutput, unsigned int uiMaxThreads)
+	{
+		// zlib header. Deflate with a 32K window, along with a hint of the effort used.
+		const uint8_t uiCMF = 0x78;
+		uint8_t uiFLG = 0;
+		switch (eEffort)
+		{
+		case EFFORT_STORE:
+		case EFFORT_FAST:		uiFLG = 0 << 6;	break;
+		case EFFORT_DEFAULT:	uiFLG = 2 << 6;	break;
+		case EFFORT_MAX:		uiFLG = 3 << 6;	break;
+		}
+		uiFLG = uint8_t(uiFLG + 31 - (uiCMF * 256 + uiFLG) % 31);
+		vOutput.push_back(uiCMF);
+		vOutput.push_back(uiFLG);
+
+		// Stored blocks are limited by memory bandwidth rather than computation, so there's nothing to gain from splitting them up
+		if (EFFORT_STORE == eEffort)
+		{
+			CBitWriter writer(vOutput);
+			writeStoredBlocks(writer, pData, uiDataSize, true);
+			writer.alignToByte();
+			appendBigEndian32(vOutput, adler32(pData, uiDataSize));
+			return;
+		}
+
+		// Split the data into chunks which are compressed independently, each ending on a byte boundary with a sync flush
+		// (an empty stored block) so that their output can simply be joined together, as pigz does.
+		// Each chunk still uses the 32K of data before it as a dictionary, so very little compression is lost.
+		// The chunks depend only on the size of the data, so the output is the same however many threads are used.
+		const size_t uiNumChunks = uiDataSize > kParallelChunkSize ? (uiDataSize + kParallelChunkSize - 1) / kParallelChunkSize : 1;
+		std::vector<std::vector<uint8_t>> vChunkOutputs(uiNumChunks);
+		std::vector<uint32_t> vChunkAdlers(uiNumChunks);
+		CThreadPool::getGlobal().parallelFor(0, uiNumChunks, 1, [&](size_t uiFirstChunk, size_t uiLastChunk)
+		{
+			for (size_t uiChunk = uiFirstChunk; uiChunk < uiLastChunk; uiChunk++)
+			{
+				const size_t uiStart = uiChunk * kParallelChunkSize;
+				const size_t uiEnd = std::min(uiDataSize, uiStart + kParallelChunkSize);
+				const bool bFinal = uiChunk + 1 == uiNumChunks;
+
+				std::vector<uint8_t>& vChunkOutput = vChunkOutputs[uiChunk];
+				vChunkOutput.reserve((uiEnd - uiStart) / 2);
+				CBitWriter writer(vChunkOutput);
+				if (EFFORT_FAST == eEffort)
+					deflateRLE(writer, pData, uiStart, uiEnd, bFinal);
+				else if (EFFORT_DEFAULT == eEffort)
+					deflateHashChain(writer, pData, uiStart, uiEnd, bFinal, 32, 128, false);
+				else
+					deflateHashChain(writer, pData, uiStart, uiEnd, bFinal, 1024, 258, true);
+				if (!bFinal)
+				{
+					// Sync flush
+					writer.write(0, 3);
+					writer.alignToByte();
+					writer.write(0x0000, 16);
+					writer.write(0xFFFF, 16);
+				}
+				writer.alignToByte();
+				vChunkAdlers[uiChunk] = adler32(pData + uiStart, uiEnd - uiStart);
+			}
+		}, uiMaxThreads);
+
+		size_t uiTotalSize = 4;
+		for (const std::vector<uint8_t>& vChunkOutput : vChunkOutputs)
+		{
+			uiTotalSize += vChunkOutput.size();
+		}
+		vOutput.reserve(vOutput.size() + uiTotalSize);
+		uint32_t uiAdler = 1;
+		for (size_t i = 0; i < uiNumChunks; i++)
+		{
+			vOutput.insert(vOutput.end(), vChunkOutputs[i].begin(), vChunkOutputs[i].end());
+			const size_t uiStart = i * kParallelChunkSize;
+			uiAdler = adler32Combine(uiAdler, vChunkAdlers[i], std::min(uiDataSize, uiStart + kParallelChunkSize) - uiStart);
+		}
+		appendBigEndian32(vOutput, uiAdler);
+	}
+
+	uint32_t CPNGEncoder::adler32Combine(uint32_t uiAdler1, uint32_t uiAdler2, size_t uiLength2)
+	{
+		// The sums of the second part are offset by the first part's sum, once for each of its bytes
+		const uint32_t kBase = 65521;
+		const uint32_t uiRemainder = uint32_t(uiLength2 % kBase);
+		uint32_t uiSum1 = uiAdler1 & 0xFFFF;
+		uint32_t uiSum2 = uint32_t((uint64_t(uiRemainder) * uiSum1) % kBase);
+		uiSum1 += (uiAdler2 & 0xFFFF) + kBase - 1;
+		uiSum2 += (uiAdler1 >> 16) + (uiAdler2 >> 16) + kBase - uiRemainder;
+		if (uiSum1 >= kBase)
+			uiSum1 -= kBase;
+		if (uiSum1 >= kBase)
+			uiSum1 -= kBase;
+		if (uiSum2 >= kBase * 2)
+			uiSum2 -= kBase * 2;
+		if (uiSum2 >= kBase)
+			uiSum2 -= kBase;
+		return (uiSum2 << 16) | uiSum1;
+	}
+
+	uint32_t CPNGEncoder::crc32(const uint8_t* pData, size_t uiDataSize, uint32_t uiCRC)
+	{
+		const uint32_t* pTable = getTables().uiCRCTable;
+		uiCRC = ~uiCRC;
+		for (size_t i = 0; i < uiDataSize; i++)
+		{
+			uiCRC = pTable[(uiCRC ^ pData[i]) & 0xFF] ^ (uiCRC >> 8);
+		}
+		return ~uiCRC;
+	}
+
+	uint32_t CPNGEncoder::adler32(const uint8_t* pData, size_t uiDataSize, uint32_t uiAdler)
+	{
+		const uint32_t kBase = 65521;
+		const size_t kMaxRun = 5552;	// Most bytes which can be summed before the 32 bit sums may overflow
+		uint32_t a = uiAdler & 0xFFFF;
+		uint32_t b = uiAdler >> 16;
+		while (uiDataSize > 0)
+		{
+			size_t uiRun = std::min(uiDataSize, kMaxRun);
+			uiDataSize -= uiRun;
+			while (uiRun--)
+			{
+				a += *pData++;
+				b += a;
+			}
+			a %= kBase;
+			b %= kBase;
+		}
+		return (b << 16) | a;
+	}
+
+	void CPNGEncoder::_filterRows(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, std::vector<uint8_t>& vFiltered, bool bFlipVertically) const
+	{
+		const size_t uiRowSize = size_t(iWidth) * iNumChannels;
+		auto getRow = [&](int y)
+		{
+			return pPixels + uiRowSize * (bFlipVertically ? iHeight - 1 - y : y);
+		};
+		vFiltered.resize((uiRowSize + 1) * iHeight);
+
+		// Storing gives up on compression, so don't spend any time filtering either
+		if (EFFORT_STORE == _meEffort)
+		{
+			for (int y = 0; y < iHeight; y++)
+			{
+				uint8_t* pOut = vFiltered.data() + (uiRowSize + 1) * y;
+				pOut[0] = 0;
+				memcpy(pOut + 1, getRow(y), uiRowSize);
+			}
+			return;
+		}
+
+		// One row for each of the filters Sub, Up, Average and Paeth. None is read straight from the pixels.
+		std::vector<uint8_t> vCandidates(uiRowSize * 4);
+		std::vector<uint8_t> vZeroRow(uiRowSize, 0);
+		const size_t bpp = size_t(iNumChannels);
+		for (int y = 0; y < iHeight; y++)
+		{
+			const uint8_t* pRow = getRow(y);
+			const uint8_t* pAbove = y > 0 ? getRow(y - 1) : vZeroRow.data();
+			uint8_t* pSub = vCandidates.data();
+			uint8_t* pUp = pSub + uiRowSize;
+			uint8_t* pAverage = pUp + uiRowSize;
+			uint8_t* pPaeth = pAverage + uiRowSize;
+			uint32_t uiSums[5] = {};
+			for (size_t x = 0; x < uiRowSize; x++)
+			{
+				const int iLeft = x >= bpp ? pRow[x - bpp] : 0;
+				const int iUpLeft = x >= bpp ? pAbove[x - bpp] : 0;
+				const int iUp = pAbove[x];
+				const int iCurrent = pRow[x];
+				pSub[x] = uint8_t(iCurrent - iLeft);
+				pUp[x] = uint8_t(iCurrent - iUp);
+				pAverage[x] = uint8_t(iCurrent - ((iLeft + iUp) >> 1));
+				pPaeth[x] = uint8_t(iCurrent - paethPredictor(iLeft, iUp, iUpLeft));
+				uiSums[0] += abs(int(int8_t(pRow[x])));
+				uiSums[1] += abs(int(int8_t(pSub[x])));
+				uiSums[2] += abs(int(int8_t(pUp[x])));
+				uiSums[3] += abs(int(int8_t(pAverage[x])));
+				uiSums[4] += abs(int(int8_t(pPaeth[x])));
+			}
+			int iBest = 0;
+			for (int i = 1; i < 5; i++)
+			{
+				if (uiSums[i] < uiSums[iBest])
+					iBest = i;
+			}
+			uint8_t* pOut = vFiltered.data() + (uiRowSize + 1) * y;
+			pOut[0] = uint8_t(iBest);
+			memcpy(pOut + 1, 0 == iBest ? pRow : vCandidates.data() + uiRowSize * (iBest - 1), uiRowSize);
+		}
+	}
+
+	size_t CPNGEncoder::_beginChunk(std::vector<uint8_t>& vPNGData, const char* pType) const
+	{
+		size_t uiChunkOffset = vPNGData.size();
+		appendBigEndian32(vPNGData, 0);	// Length, filled in by _endChunk()
+		vPNGData.insert(vPNGData.end(), pType, pType + 4);
+		return uiChunkOffset;
+	}
+
+	void CPNGEncoder::_endChunk(std::vector<uint8_t>& vPNGData, size_t uiChunkOffset) const
+	{
+		const uint32_t uiLength = uint32_t(vPNGData.size() - uiChunkOffset - 8);
+		vPNGData[uiChunkOffset] = uint8_t(uiLength >> 24);
+		vPNGData[uiChunkOffset + 1] = uint8_t(uiLength >> 16);
+		vPNGData[uiChunkOffset + 2] = uint8_t(uiLength >> 8);
+		vPNGData[uiChunkOffset + 3] = uint8_t(uiLength);
+		// The CRC covers the chunk type and data, but not the length
+		appendBigEndian32(vPNGData, crc32(vPNGData.data() + uiChunkOffset + 4, uiLength + 4));
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace X
+{
+	/// \brief Encodes 8 bit per channel images to PNG using its own deflate implementation.
+	///
+	/// Unlike stb_image_write, there is no global state. All settings are held by the object and every call to encode() only
+	/// uses memory local to that call, so any number of threads may encode at the same time, either with their own
+	/// CPNGEncoder objects or by sharing one.
+	///
+	/// Large images are compressed in 128K chunks spread over several threads, joined into one standard zlib stream.
+	/// The output doesn't depend on the number of threads used.
+	///
+	/// The effort level trades encoding speed for file size...
+	/// \code
+	/// CPNGEncoder encoder(CPNGEncoder::EFFORT_MAX);
+	/// std::vector<uint8_t> vPNGData;
+	/// if (encoder.encode(image.getData(), image.getWidth(), image.getHeight(), image.getNumChannels(), vPNGData))
+	///		// vPNGData holds the complete .png file
+	/// \endcode
+	class CPNGEncoder
+	{
+	public:
+		/// \brief How much work is done compressing the image data
+		enum EEffort
+		{
+			EFFORT_STORE,	///< No compression or filtering, the pixels are only wrapped in stored deflate blocks. Fastest, but the largest output.
+			EFFORT_FAST,	///< Adaptive row filtering, then only runs of repeated bytes are matched. Much smaller than EFFORT_STORE for little extra time.
+			EFFORT_DEFAULT,	///< Adaptive row filtering, then greedy matching along short hash chains.
+			EFFORT_MAX		///< Adaptive row filtering, then lazy matching along long hash chains. Slowest, but the smallest output.
+		};
+
+		/// \brief Constructor
+		///
+		/// \param eEffort The effort level used by encode()
+		/// \param uiMaxThreads The most threads encode() may use. 0 uses one per logical CPU core.
+		CPNGEncoder(EEffort eEffort = EFFORT_DEFAULT, unsigned int uiMaxThreads = 0);
+
+		/// \brief Sets the effort level used by encode()
+		///
+		/// \param eEffort The effort level
+		void setEffort(EEffort eEffort);
+
+		/// \brief Returns the effort level used by encode()
+		///
+		/// \return The effort level
+		EEffort getEffort(void) const;
+
+		/// \brief Sets the most threads encode() may use to compress large images
+		///
+		/// \param uiMaxThreads The number of threads. 0 uses one per logical CPU core and 1 compresses on the calling thread only.
+		void setMaxThreads(unsigned int uiMaxThreads);
+
+		/// \brief Returns the most threads encode() may use to compress large images
+		///
+		/// \return The number of threads, or 0 for one per logical CPU core
+		unsigned int getMaxThreads(void) const;
+
+		/// \brief Encodes the given pixels as a complete PNG file.
+		///
+		/// \param pPixels The pixel data, rows stored top to bottom with no padding between them.
+		/// \param iWidth The width of the image in pixels
+		/// \param iHeight The height of the image in pixels
+		/// \param iNumChannels 1 (grey), 2 (grey and alpha), 3 (RGB) or 4 (RGBA)
+		/// \param vPNGData Will hold the PNG file. Its contents are replaced.
+		/// \param bFlipVertically If true, the rows are stored bottom to top.
+		/// \return False if the given parameters are invalid, in which case vPNGData is left empty.
+		///
+		/// This may be called from many threads at once.
+		bool encode(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, std::vector<uint8_t>& vPNGData, bool bFlipVertically = false) const;
+
+		/// \brief Encodes a paletted image as a complete PNG file.
+		///
+		/// \param pIndices Each pixel's index into the palette, one byte per pixel, rows stored top to bottom with no padding between them.
+		/// \param iWidth The width of the image in pixels
+		/// \param iHeight The height of the image in pixels
+		/// \param pPalette The palette's colours, four bytes of RGBA each
+		/// \param iNumColours The number of colours in the palette, from 1 to 256. Every index must be less than this.
+		/// \param vPNGData Will hold the PNG file. Its contents are replaced.
+		/// \return False if the given parameters are invalid, in which case vPNGData is left empty.
+		///
+		/// Palettes of up to 16 colours are stored at 4 bits per pixel, larger ones at 8. Alpha is only stored if a colour isn't opaque.
+		/// Rows aren't filtered, as the PNG specification recommends for paletted images. This may be called from many threads at once.
+		bool encodePaletted(const uint8_t* pIndices, int iWidth, int iHeight, const uint8_t* pPalette, int iNumColours, std::vector<uint8_t>& vPNGData) const;
+
+		/// \brief Compresses the given data into a zlib stream (RFC 1950) holding deflate data (RFC 1951).
+		///
+		/// \param pData The data to compress
+		/// \param uiDataSize Number of bytes of data
+		/// \param eEffort How much effort is put into compressing the data
+		/// \param vOutput The zlib stream is appended to this.
+		/// \param uiMaxThreads The most threads to compress with, the calling thread and those of CThreadPool::getGlobal(). 0 uses as many as there are.
+		///
+		/// Data larger than 128K is split into chunks which may be compressed concurrently. Each chunk ends with a sync flush
+		/// so the chunks join into a single valid deflate stream, and the checksums of the chunks are combined with adler32Combine().
+		/// This may be called from many threads at once.
+		static void zlibCompress(const uint8_t* pData, size_t uiDataSize, EEffort eEffort, std::vector<uint8_t>& vOutput, unsigned int uiMaxThreads = 1);
+
+		/// \brief Computes the CRC-32 used by PNG chunks.
+		///
+		/// \param pData The data to compute the CRC of
+		/// \param uiDataSize Number of bytes of data
+		/// \param uiCRC The CRC of any data preceding this, so that the CRC may be computed in pieces. 0 to begin with.
+		/// \return The CRC of all data so far
+		static uint32_t crc32(const uint8_t* pData, size_t uiDataSize, uint32_t uiCRC = 0);
+
+		/// \brief Computes the Adler-32 checksum used by zlib streams.
+		///
+		/// \param pData The data to compute the checksum of
+		/// \param uiDataSize Number of bytes of data
+		/// \param uiAdler The checksum of any data preceding this, so that the checksum may be computed in pieces. 1 to begin with.
+		/// \return The checksum of all data so far
+		static uint32_t adler32(const uint8_t* pData, size_t uiDataSize, uint32_t uiAdler = 1);
+
+		/// \brief Combines the Adler-32 checksums of two consecutive pieces of data into the checksum of both.
+		///
+		/// \param uiAdler1 The checksum of the first piece
+		/// \param uiAdler2 The checksum of the second piece, computed on its own (starting from 1)
+		/// \param uiLength2 The length of the second piece in bytes
+		/// \return The checksum of the first piece followed by the second
+		static uint32_t adler32Combine(uint32_t uiAdler1, uint32_t uiAdler2, size_t uiLength2);
+	private:
+		EEffort _meEffort;				///< The effort level used by encode()
+		unsigned int _muiMaxThreads;	///< The most threads encode() may use, 0 for one per logical CPU core
+
+		/// \brief Filters each row of the image with the PNG filter which is likely to compress best, and prefixes each row with the filter type.
+		///
+		/// \param pPixels The pixel data
+		/// \param iWidth The width of the image in pixels
+		/// \param iHeight The height of the image in pixels
+		/// \param iNumChannels Number of bytes per pixel
+		/// \param vFiltered Will hold the filtered rows
+		/// \param bFlipVertically If true, the rows are filtered bottom to top
+		///
+		/// The filter for each row is the one with the lowest sum of absolute values of its output bytes, treating them as signed.
+		/// It's the heuristic recommended by the PNG specification and is a good estimate of how well the row will compress.
+		void _filterRows(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, std::vector<uint8_t>& vFiltered, bool bFlipVertically) const;
+
+		/// \brief Appends the length and type of a PNG chunk. The chunk's data is then appended directly after it, followed by a call to _endChunk().
+		///
+		/// \param vPNGData The PNG data to append the chunk to
+		/// \param pType The four character chunk type
+		/// \return The offset of the chunk within vPNGData, to pass to _endChunk()
+		///
+		/// Writing the data in place means the compressed image data never has to be copied into its chunk.
+		size_t _beginChunk(std::vector<uint8_t>& vPNGData, const char* pType) const;
+
+		/// \brief Fills in the length of a chunk begun with _beginChunk() and appends its CRC.
+		///
+		/// \param vPNGData The PNG data holding the chunk
+		/// \param uiChunkOffset The value returned by _beginChunk()
+		void _endChunk(std::vector<uint8_t>& vPNGData, size_t uiChunkOffset) const;
+	};
+}
@@ -0,0 +1,384 @@
+#include "Palette.h"
+#include "../Core/Exceptions.h"
+#include "ErrorDiffusion.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief Bits per channel of the histogram createFromPixels() counts colours into
+		const int kHistogramBits = 5;
+
+		/// \brief Rounds of k-means which refine the median cut palette. Each moves the colours less, and 3 gets nearly all of the gain.
+		const int kKMeansIterations = 3;
+
+		/// \brief The pixels which fell into one cell of the histogram
+		struct SColourCell
+		{
+			uint32_t uiCount;	///< Number of pixels
+			float fMean[3];		///< Their mean colour
+		};
+
+		/// \brief A run of cells which median cut treats as one colour until it's split
+		struct SColourBox
+		{
+			size_t uiFirst;		///< First cell
+			size_t uiLast;		///< One past the last cell
+			int iAxis;			///< Channel along which the cells' means spread the furthest
+			double dError;		///< Sum of each pixel's squared distance from the box's mean along iAxis. 0 if the box can't be split.
+		};
+
+		/// \brief Works out a box's widest channel and how much splitting it would gain
+		void measureBox(const std::vector<SColourCell>& vCells, SColourBox& box)
+		{
+			float fMin[3] = { 255.0f, 255.0f, 255.0f };
+			float fMax[3] = { 0.0f, 0.0f, 0.0f };
+			double dCount = 0.0;
+			double dSum[3] = { 0.0, 0.0, 0.0 };
+			double dSumSquares[3] = { 0.0, 0.0, 0.0 };
+			for (size_t ui = box.uiFirst; ui < box.uiLast; ui++)
+			{
+				const SColourCell& cell = vCells[ui];
+				dCount += cell.uiCount;
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+				{
+					fMin[iChannel] = std::min(fMin[iChannel], cell.fMean[iChannel]);
+					fMax[iChannel] = std::max(fMax[iChannel], cell.fMean[iChannel]);
+					dSum[iChannel] += double(cell.fMean[iChannel]) * cell.uiCount;
+					dSumSquares[iChannel] += double(cell.fMean[iChannel]) * cell.fMean[iChannel] * cell.uiCount;
+				}
+			}
+			box.iAxis = 0;
+			for (int iChannel = 1; iChannel < 3; iChannel++)
+			{
+				if (fMax[iChannel] - fMin[iChannel] > fMax[box.iAxis] - fMin[box.iAxis])
+					box.iAxis = iChannel;
+			}
+			box.dError = 0.0;
+			if (box.uiLast - box.uiFirst > 1)
+				box.dError = dSumSquares[box.iAxis] - dSum[box.iAxis] * dSum[box.iAxis] / dCount;
+		}
+
+		/// \brief Bits of each channel which pick a colour's cell of CCandidateGrid. 8 cells along each channel balances the time taken
+		/// to list each cell's candidates against the time taken to search them.
+		const int kCandidateGridBits = 3;
+
+		/// \brief Finds the nearest palette colour to each of many colours, for mapPixels().
+		///
+		/// The colour cube is split into a coarse grid of cells. The first time a colour in a cell is looked up, the palette colours
+		/// which could be nearest to any colour in the cell are listed, those no further from the cell than the furthest point of the
+		/// cell is from the palette colour nearest all of it. Each lookup then only compares the cell's few candidates.
+		/// Pixels fall in few cells, so this is many times quicker than comparing every palette colour with each, and gives the same result.
+		class CCandidateGrid
+		{
+		public:
+			/// \brief Constructor, no cells are listed yet
+			CCandidateGrid(const std::vector<uint8_t>& vColours) :
+				_mvCellFirst(size_t(1) << (3 * kCandidateGridBits), -1),
+				_mvCellCount(size_t(1) << (3 * kCandidateGridBits), 0)
+			{
+				_miNumColours = int(vColours.size() / 3);
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+				{
+					_mvChannels[iChannel].resize(size_t(_miNumColours));
+					for (int iColour = 0; iColour < _miNumColours; iColour++)
+						_mvChannels[iChannel][size_t(iColour)] = vColours[size_t(iColour) * 3 + iChannel];
+				}
+			}
+
+			/// \brief Returns the index of the palette colour nearest the given one. Of equally near colours, the lowest index is returned.
+			int findNearest(int r, int g, int b)
+			{
+				const int kShift = 8 - kCandidateGridBits;
+				const size_t uiCell = (size_t(r >> kShift) << (2 * kCandidateGridBits)) | (size_t(g >> kShift) << kCandidateGridBits) | size_t(b >> kShift);
+				if (_mvCellFirst[uiCell] < 0)
+					_listCell(uiCell, r >> kShift << kShift, g >> kShift << kShift, b >> kShift << kShift);
+
+				// Candidates are listed in index order, so the first of equally near colours is kept
+				const uint8_t* pCandidates = _mvCandidates.data() + _mvCellFirst[uiCell];
+				const int iNumCandidates = _mvCellCount[uiCell];
+				const int* pR = _mvChannels[0].data();
+				const int* pG = _mvChannels[1].data();
+				const int* pB = _mvChannels[2].data();
+				int iBest = 0;
+				int iBestDistance = INT_MAX;
+				for (int iCandidate = 0; iCandidate < iNumCandidates; iCandidate++)
+				{
+					const int iColour = pCandidates[iCandidate];
+					const int iDifferenceR = r - pR[iColour];
+					const int iDifferenceG = g - pG[iColour];
+					const int iDifferenceB = b - pB[iColour];
+					const int iDistance = iDifferenceR * iDifferenceR + iDifferenceG * iDifferenceG + iDifferenceB * iDifferenceB;
+					// Selected rather than branched on, as which candidate is nearer is too random to predict
+					const bool bNearer = iDistance < iBestDistance;
+					iBestDistance = bNearer ? iDistance : iBestDistance;
+					iBest = bNearer ? iColour : iBest;
+				}
+				return iBest;
+			}
+		private:
+			int _miNumColours;						///< Number of colours in the palette
+			std::vector<int> _mvChannels[3];		///< Each channel of the palette's colours, kept apart so each cell's colours are measured many at a time
+			std::vector<int> _mvCellFirst;			///< For each cell, the position of its first candidate in _mvCandidates, or -1 if not yet listed
+			std::vector<int> _mvCellCount;			///< For each cell, the number of candidates
+			std::vector<uint8_t> _mvCandidates;		///< The candidates of every cell listed so far
+
+			/// \brief Lists the candidates of the cell whose lowest corner is given
+			void _listCell(size_t uiCell, int iLowR, int iLowG, int iLowB)
+			{
+				// For each colour, the least and greatest squared distance from it to any point of the cell. No colour whose least
+				// distance is more than the smallest of the greatest distances can be nearest anywhere in the cell.
+				const int kCellSize = 1 << (8 - kCandidateGridBits);
+				const int iLow[3] = { iLowR, iLowG, iLowB };
+				int iMinDistance[256] = {};
+				int iMaxDistance[256] = {};
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+				{
+					const int* pValues = _mvChannels[iChannel].data();
+					const int iLowChannel = iLow[iChannel];
+					const int iHighChannel = iLow[iChannel] + kCellSize - 1;
+					for (int iColour = 0; iColour < _miNumColours; iColour++)
+					{
+						const int iOutside = std::max(0, std::max(iLowChannel - pValues[iColour], pValues[iColour] - iHighChannel));
+						const int iFurthest = std::max(pValues[iColour] - iLowChannel, iHighChannel - pValues[iColour]);
+						iMinDistance[iColour] += iOutside * iOutside;
+						iMaxDistance[iColour] += iFurthest * iFurthest;
+					}
+				}
+				int iThreshold = INT_MAX;
+				for (int iColour = 0; iColour < _miNumColours; iColour++)
+					iThreshold = std::min(iThreshold, iMaxDistance[iColour]);
+
+				_mvCellFirst[uiCell] = int(_mvCandidates.size());
+				for (int iColour = 0; iColour < _miNumColours; iColour++)
+				{
+					if (iMinDistance[iColour] <= iThreshold)
+						_mvCandidates.push_back(uint8_t(iColour));
+				}
+				_mvCellCount[uiCell] = int(_mvCandidates.size()) - _mvCellFirst[uiCell];
+			}
+		};
+
+		/// \brief The 4x4 Bayer matrix, as used by CImage::ditherBayerMatrix()
+		const int kBayerMatrix[4][4] =
+		{
+			{  0,  8,  2, 10 },
+			{ 12,  4, 14,  6 },
+			{  3, 11,  1,  9 },
+			{ 15,  7, 13,  5 }
+		};
+
+		/// \brief Clamps a channel value to between 0 and 255
+		inline int clampChannel(int iValue)
+		{
+			return iValue < 0 ? 0 : (iValue > 255 ? 255 : iValue);
+		}
+	}
+
+	CPalette::CPalette()
+	{
+	}
+
+	void CPalette::createFromPixels(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, int iMaxColours)
+	{
+		ThrowIfTrue(iNumChannels != 3 && iNumChannels != 4, "Palettes can only be created from 3 or 4 channel pixels.");
+		ThrowIfTrue(iMaxColours < 1 || iMaxColours > 256, "Palettes must have from 1 to 256 colours.");
+
+		// Count the pixels into the histogram, keeping each cell's sums to find the mean of its pixels
+		const int kShift = 8 - kHistogramBits;
+		const size_t uiNumCells = size_t(1) << (3 * kHistogramBits);
+		std::vector<uint32_t> vCounts(uiNumCells, 0);
+		std::vector<uint64_t> vSums(uiNumCells * 3, 0);
+		const size_t uiNumPixels = size_t(iWidth) * size_t(iHeight);
+		for (size_t ui = 0; ui < uiNumPixels; ui++)
+		{
+			const uint8_t* pPixel = pPixels + ui * iNumChannels;
+			if (4 == iNumChannels && pPixel[3] < 128)
+				continue;
+			const size_t uiCell = (size_t(pPixel[0] >> kShift) << (2 * kHistogramBits)) | (size_t(pPixel[1] >> kShift) << kHistogramBits) | size_t(pPixel[2] >> kShift);
+			vCounts[uiCell]++;
+			vSums[uiCell * 3] += pPixel[0];
+			vSums[uiCell * 3 + 1] += pPixel[1];
+			vSums[uiCell * 3 + 2] += pPixel[2];
+		}
+		std::vector<SColourCell> vCells;
+		for (size_t uiCell = 0; uiCell < uiNumCells; uiCell++)
+		{
+			if (!vCounts[uiCell])
+				continue;
+			SColourCell cell;
+			cell.uiCount = vCounts[uiCell];
+			for (int iChannel = 0; iChannel < 3; iChannel++)
+				cell.fMean[iChannel] = float(double(vSums[uiCell * 3 + iChannel]) / cell.uiCount);
+			vCells.push_back(cell);
+		}
+
+		_mvColours.clear();
+		if (vCells.empty())
+		{
+			_mvColours.assign(3, 0);
+			return;
+		}
+		auto appendMean = [this](double dCount, const double* pdSum)
+		{
+			for (int iChannel = 0; iChannel < 3; iChannel++)
+				_mvColours.push_back(uint8_t(clampChannel(int(pdSum[iChannel] / dCount + 0.5))));
+		};
+		if (vCells.size() <= size_t(iMaxColours))
+		{
+			for (const SColourCell& cell : vCells)
+			{
+				const double dSum[3] = { cell.fMean[0], cell.fMean[1], cell.fMean[2] };
+				appendMean(1.0, dSum);
+			}
+			return;
+		}
+
+		// Median cut. Split the box with the most error at the median pixel along its widest channel, until there are enough boxes.
+		std::vector<SColourBox> vBoxes(1);
+		vBoxes[0].uiFirst = 0;
+		vBoxes[0].uiLast = vCells.size();
+		measureBox(vCells, vBoxes[0]);
+		while (vBoxes.size() < size_t(iMaxColours))
+		{
+			size_t uiSplit = 0;
+			for (size_t ui = 1; ui < vBoxes.size(); ui++)
+			{
+				if (vBoxes[ui].dError > vBoxes[uiSplit].dError)
+					uiSplit = ui;
+			}
+			SColourBox& box = vBoxes[uiSplit];
+			if (box.dError <= 0.0)
+				break;
+
+			const int iAxis = box.iAxis;
+			std::stable_sort(vCells.begin() + box.uiFirst, vCells.begin() + box.uiLast, [iAxis](const SColourCell& a, const SColourCell& b) { return a.fMean[iAxis] < b.fMean[iAxis]; });
+			uint64_t uiTotal = 0;
+			for (size_t ui = box.uiFirst; ui < box.uiLast; ui++)
+				uiTotal += vCells[ui].uiCount;
+			uint64_t uiBelow = 0;
+			size_t uiMedian = box.uiFirst;
+			while (uiMedian < box.uiLast - 1 && (uiBelow + vCells[uiMedian].uiCount) * 2 <= uiTotal)
+				uiBelow += vCells[uiMedian++].uiCount;
+			// Both halves must have at least one cell
+			if (uiMedian == box.uiFirst)
+				uiMedian++;
+
+			SColourBox boxAbove;
+			boxAbove.uiFirst = uiMedian;
+			boxAbove.uiLast = box.uiLast;
+			box.uiLast = uiMedian;
+			measureBox(vCells, box);
+			measureBox(vCells, boxAbove);
+			vBoxes.push_back(boxAbove);
+		}
+		for (const SColourBox& box : vBoxes)
+		{
+			double dCount = 0.0;
+			double dSum[3] = { 0.0, 0.0, 0.0 };
+			for (size_t ui = box.uiFirst; ui < box.uiLast; ui++)
+			{
+				dCount += vCells[ui].uiCount;
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+					dSum[iChannel] += double(vCells[ui].fMean[iChannel]) * vCells[ui].uiCount;
+			}
+			appendMean(dCount, dSum);
+		}
+
+		// k-means. Move each colour to the mean of the cells nearest it. A colour which no cell is nearest stays where it is.
+		for (int iIteration = 0; iIteration < kKMeansIterations; iIteration++)
+		{
+			const int iNumColours = getNumColours();
+			std::vector<double> vdCounts(size_t(iNumColours), 0.0);
+			std::vector<double> vdSums(size_t(iNumColours) * 3, 0.0);
+			CCandidateGrid grid(_mvColours);
+			for (const SColourCell& cell : vCells)
+			{
+				const int iNearest = grid.findNearest(int(cell.fMean[0] + 0.5f), int(cell.fMean[1] + 0.5f), int(cell.fMean[2] + 0.5f));
+				vdCounts[iNearest] += cell.uiCount;
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+					vdSums[size_t(iNearest) * 3 + iChannel] += double(cell.fMean[iChannel]) * cell.uiCount;
+			}
+			std::vector<uint8_t> vOldColours;
+			vOldColours.swap(_mvColours);
+			for (int iColour = 0; iColour < iNumColours; iColour++)
+			{
+				if (vdCounts[iColour] > 0.0)
+					appendMean(vdCounts[iColour], &vdSums[size_t(iColour) * 3]);
+				else
+					_mvColours.insert(_mvColours.end(), vOldColours.begin() + iColour * 3, vOldColours.begin() + iColour * 3 + 3);
+			}
+		}
+	}
+
+	void CPalette::setColours(const std::vector<uint8_t>& vRGB)
+	{
+		ThrowIfTrue(vRGB.empty() || vRGB.size() % 3 != 0 || vRGB.size() > 256 * 3, "Palettes must have from 1 to 256 colours.");
+		_mvColours = vRGB;
+	}
+
+	const std::vector<uint8_t>& CPalette::getColours(void) const
+	{
+		return _mvColours;
+	}
+
+	int CPalette::getNumColours(void) const
+	{
+		return int(_mvColours.size() / 3);
+	}
+
+	void CPalette::mapPixels(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, EDither eDither, int iTransparentIndex, uint8_t* pIndices) const
+	{
+		ThrowIfTrue(_mvColours.empty(), "Palette has no colours.");
+		ThrowIfTrue(iNumChannels != 3 && iNumChannels != 4, "Only 3 or 4 channel pixels can be mapped to a palette.");
+		auto isTransparent = [&](size_t uiPixel) { return iTransparentIndex >= 0 && 4 == iNumChannels && pPixels[uiPixel * 4 + 3] < 128; };
+		CCandidateGrid grid(_mvColours);
+
+		if (DITHER_FLOYD_STEINBERG == eDither)
+		{
+			// diffuseError() replaces each pixel with its quantised colour, so it works on a copy
+			std::vector<uint8_t> vPixels(pPixels, pPixels + size_t(iWidth) * size_t(iHeight) * iNumChannels);
+			auto quantise = [&](int iX, int iY, int* piRGB)
+			{
+				const size_t uiPixel = size_t(iY) * iWidth + iX;
+				if (isTransparent(uiPixel))
+				{
+					// Left as is, so there's no error to pass on
+					pIndices[uiPixel] = uint8_t(iTransparentIndex);
+					return;
+				}
+				const int iNearest = grid.findNearest(piRGB[0], piRGB[1], piRGB[2]);
+				pIndices[uiPixel] = uint8_t(iNearest);
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+					piRGB[iChannel] = _mvColours[size_t(iNearest) * 3 + iChannel];
+			};
+			const SDiffusionKernel& kernel = SDiffusionKernel::get(SDiffusionKernel::KERNEL_FLOYD_STEINBERG);
+			if (3 == iNumChannels)
+				diffuseError<3>(vPixels.data(), iWidth, iHeight, kernel, false, 1, quantise);
+			else
+				diffuseError<4>(vPixels.data(), iWidth, iHeight, kernel, false, 1, quantise);
+			return;
+		}
+
+		// With a Bayer matrix, each pixel is offset by up to half the typical distance between palette colours either way
+		const int iSpread = DITHER_BAYER == eDither ? int(255.0 / std::cbrt(double(getNumColours())) + 0.5) : 0;
+		for (int iY = 0; iY < iHeight; iY++)
+		{
+			for (int iX = 0; iX < iWidth; iX++)
+			{
+				const size_t uiPixel = size_t(iY) * iWidth + iX;
+				if (isTransparent(uiPixel))
+				{
+					pIndices[uiPixel] = uint8_t(iTransparentIndex);
+					continue;
+				}
+				const uint8_t* pPixel = pPixels + uiPixel * iNumChannels;
+				const int iOffset = (kBayerMatrix[iY & 3][iX & 3] * 2 - 15) * iSpread / 32;
+				pIndices[uiPixel] = uint8_t(grid.findNearest(clampChannel(pPixel[0] + iOffset), clampChannel(pPixel[1] + iOffset), clampChannel(pPixel[2] + iOffset)));
+			}
+		}
+	}
+}
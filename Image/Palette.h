@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace X
+{
+	/// \brief A palette of up to 256 colours, chosen to suit an image, which images' pixels can be mapped to.
+	///
+	/// Used by CImage::saveAsICOToMemory() to write the small sizes of an icon as 4 or 8 bit per pixel paletted images.
+	/// \code
+	/// CPalette palette;
+	/// palette.createFromPixels(image.getData(), image.getWidth(), image.getHeight(), image.getNumChannels(), 256);
+	/// std::vector<uint8_t> vIndices(size_t(image.getWidth()) * image.getHeight());
+	/// palette.mapPixels(image.getData(), image.getWidth(), image.getHeight(), image.getNumChannels(), CPalette::DITHER_FLOYD_STEINBERG, -1, vIndices.data());
+	/// \endcode
+	class CPalette
+	{
+	public:
+		/// \brief How mapPixels() spreads the difference between each pixel and the nearest palette colour
+		enum EDither
+		{
+			DITHER_NONE,			///< Each pixel is the nearest palette colour. Flat areas stay flat, but gradients band.
+			DITHER_BAYER,			///< Each pixel is offset by a 4x4 Bayer matrix first, giving a regular pattern, as ditherBayerMatrix() does
+			DITHER_FLOYD_STEINBERG	///< Each pixel's error is passed on to the pixels after it by diffuseError(), which best keeps the average colour
+		};
+
+		/// \brief Constructor, the palette is empty
+		CPalette();
+
+		/// \brief Chooses at most iMaxColours colours to represent the given pixels, replacing any colours already held.
+		///
+		/// \param pPixels The pixels, rows packed top to bottom
+		/// \param iWidth The width of the image
+		/// \param iHeight The height of the image
+		/// \param iNumChannels 3 or 4. Pixels with alpha under 128 are transparent, so are left out.
+		/// \param iMaxColours The most colours to choose, from 1 to 256
+		///
+		/// Colours are counted into a histogram of 5 bits per channel. The histogram's cells are split into iMaxColours boxes by median cut,
+		/// the box with the most squared error being split next, then the means of the boxes are refined by a few rounds of k-means.
+		/// If there are no more cells than colours, each cell's mean is used as is. If every pixel is transparent, the palette is black alone.
+		/// If iNumChannels or iMaxColours are invalid, an exception occurs.
+		void createFromPixels(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, int iMaxColours);
+
+		/// \brief Sets the palette to the given RGB colours, replacing any already held.
+		///
+		/// \param vRGB Three bytes per colour, from 1 up to 256 colours. If not, an exception occurs.
+		void setColours(const std::vector<uint8_t>& vRGB);
+
+		/// \brief Returns the colours, three bytes of RGB per colour
+		const std::vector<uint8_t>& getColours(void) const;
+
+		/// \brief Returns the number of colours
+		int getNumColours(void) const;
+
+		/// \brief Sets each pixel's index to that of the palette colour which represents it.
+		///
+		/// \param pPixels The pixels, rows packed top to bottom
+		/// \param iWidth The width of the image
+		/// \param iHeight The height of the image
+		/// \param iNumChannels 3 or 4
+		/// \param eDither How the colours are matched, see EDither
+		/// \param iTransparentIndex If not -1, pixels with alpha under 128 are set to this index and neither matched nor dithered.
+		/// \param pIndices Where to write each pixel's index, iWidth * iHeight of them, rows packed top to bottom.
+		///
+		/// Each pixel's index is that of the palette colour nearest its colour by squared distance, once offset or with error added when dithering,
+		/// the lowest index of equally near colours. It's found by comparing only the colours which could be nearest within a coarse cell of the
+		/// colour cube, listed as each cell is first reached.
+		/// Works on the calling thread alone, as saveAsICOToMemory() already calls it from within a task on the shared thread pool.
+		/// If the palette is empty or iNumChannels is invalid, an exception occurs.
+		void mapPixels(const uint8_t* pPixels, int iWidth, int iHeight, int iNumChannels, EDither eDither, int iTransparentIndex, uint8_t* pIndices) const;
+	private:
+		std::vector<uint8_t> _mvColours;	///< Three bytes of RGB per colour
+	};
+}
@@ -0,0 +1,145 @@
+#include "PixelAllocator.h"
+#include <cstring>
+#include <new>
+
+namespace X
+{
+	CPixelAllocator::CPixelAllocator(size_t uiMaxPooledBytes)
+	{
+		_muiMaxPooledBytes = uiMaxPooledBytes;
+		_mStats = {};
+	}
+
+	CPixelAllocator::~CPixelAllocator()
+	{
+		trim();
+	}
+
+	unsigned char* CPixelAllocator::allocate(size_t uiSize, bool bClear)
+	{
+		if (0 == uiSize)
+			return nullptr;
+		const size_t uiClassSize = getSizeClass(uiSize);
+		if (uiClassSize < uiSize)	// Overflowed
+			return nullptr;
+
+		unsigned char* pData = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(_mMutex);
+			auto it = _mmapFreeBuffers.find(uiClassSize);
+			if (it != _mmapFreeBuffers.end() && !it->second.empty())
+			{
+				pData = it->second.back();
+				it->second.pop_back();
+				_mStats.uiBytesPooled -= uiClassSize;
+				_mStats.uiNumHits++;
+			}
+			else
+				_mStats.uiNumMisses++;
+			_mStats.uiBytesInUse += uiClassSize;
+			if (_mStats.uiPeakBytesInUse < _mStats.uiBytesInUse)
+				_mStats.uiPeakBytesInUse = _mStats.uiBytesInUse;
+		}
+
+		// The system allocation and clearing are done outside of the lock, as they're what takes the time
+		if (!pData)
+		{
+			pData = static_cast<unsigned char*>(::operator new(uiClassSize, std::align_val_t(kAlignment), std::nothrow));
+			if (!pData)
+			{
+				std::lock_guard<std::mutex> lock(_mMutex);
+				_mStats.uiBytesInUse -= uiClassSize;
+				return nullptr;
+			}
+		}
+		if (bClear)
+			memset(pData, 0, uiSize);
+		return pData;
+	}
+
+	void CPixelAllocator::deallocate(unsigned char* pData, size_t uiSize)
+	{
+		if (!pData)
+			return;
+		const size_t uiClassSize = getSizeClass(uiSize);
+		{
+			std::lock_guard<std::mutex> lock(_mMutex);
+			_mStats.uiBytesInUse -= uiClassSize;
+			if (_mStats.uiBytesPooled + uiClassSize <= _muiMaxPooledBytes)
+			{
+				_mmapFreeBuffers[uiClassSize].push_back(pData);
+				_mStats.uiBytesPooled += uiClassSize;
+				return;
+			}
+		}
+		::operator delete(pData, std::align_val_t(kAlignment));
+	}
+
+	void CPixelAllocator::trim(void)
+	{
+		std::lock_guard<std::mutex> lock(_mMutex);
+		_trimTo(0);
+	}
+
+	void CPixelAllocator::setMaxPooledBytes(size_t uiMaxPooledBytes)
+	{
+		std::lock_guard<std::mutex> lock(_mMutex);
+		_muiMaxPooledBytes = uiMaxPooledBytes;
+		_trimTo(uiMaxPooledBytes);
+	}
+
+	size_t CPixelAllocator::getMaxPooledBytes(void) const
+	{
+		std::lock_guard<std::mutex> lock(_mMutex);
+		return _muiMaxPooledBytes;
+	}
+
+	CPixelAllocator::SStats CPixelAllocator::getStats(void) const
+	{
+		std::lock_guard<std::mutex> lock(_mMutex);
+		return _mStats;
+	}
+
+	void CPixelAllocator::resetStats(void)
+	{
+		std::lock_guard<std::mutex> lock(_mMutex);
+		_mStats.uiNumHits = 0;
+		_mStats.uiNumMisses = 0;
+		_mStats.uiPeakBytesInUse = _mStats.uiBytesInUse;
+	}
+
+	size_t CPixelAllocator::getSizeClass(size_t uiSize)
+	{
+		if (uiSize <= kAlignment)
+			return kAlignment;
+
+		// Step of a quarter of the power of two below uiSize, so 1025 to 1280 bytes is one class, 1281 to 1536 the next and so on
+		size_t uiPowerOfTwo = 1;
+		while (uiPowerOfTwo <= (uiSize - 1) / 2)
+			uiPowerOfTwo *= 2;
+		size_t uiStep = uiPowerOfTwo / 4;
+		if (uiStep < kAlignment)
+			uiStep = kAlignment;
+		return (uiSize + uiStep - 1) / uiStep * uiStep;
+	}
+
+	CPixelAllocator& CPixelAllocator::getGlobal(void)
+	{
+		// Never destroyed, as images in other globals may still be freeing their pixels as the program exits
+		static CPixelAllocator* pGlobal = new CPixelAllocator;
+		return *pGlobal;
+	}
+
+	void CPixelAllocator::_trimTo(size_t uiMaxPooledBytes)
+	{
+		for (auto it = _mmapFreeBuffers.rbegin(); it != _mmapFreeBuffers.rend() && _mStats.uiBytesPooled > uiMaxPooledBytes; ++it)
+		{
+			while (!it->second.empty() && _mStats.uiBytesPooled > uiMaxPooledBytes)
+			{
+				::operator delete(it->second.back(), std::align_val_t(kAlignment));
+				it->second.pop_back();
+				_mStats.uiBytesPooled -= it->first;
+			}
+		}
+	}
+}
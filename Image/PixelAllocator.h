@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace X
+{
+	/// \brief Allocates CImage pixel buffers, aligned for vector instructions and kept in a pool to be reused once freed.
+	///
+	/// Every buffer starts on a kAlignment byte boundary and its size is rounded up to a size class, which is a multiple of kAlignment,
+	/// so code working on whole 64 byte blocks may read past the last pixel up to the end of the buffer.
+	/// Freed buffers are kept, one list per size class, and handed out again for any later request of the same class. Making
+	/// many images of similar sizes, such as converting thousands of files to icons, then stops going to the system allocator at all.
+	/// The pool is limited to a total size, beyond which freed buffers really are freed.
+	///
+	/// CImage uses getGlobal() unless CImage::setAllocator() is given another. Any number of threads may use one object at once.
+	/// \code
+	/// CPixelAllocator& allocator = CPixelAllocator::getGlobal();
+	/// unsigned char* pData = allocator.allocate(256 * 256 * 4, false);
+	/// // Fill every byte of pData, use it, then...
+	/// allocator.deallocate(pData, 256 * 256 * 4);
+	/// CPixelAllocator::SStats stats = allocator.getStats();
+	/// \endcode
+	class CPixelAllocator
+	{
+	public:
+		/// \brief The alignment of every buffer in bytes, that of a cache line and of the widest vector loads
+		static const size_t kAlignment = 64;
+
+		/// \brief Counts of what an allocator has done, from getStats()
+		struct SStats
+		{
+			uint64_t uiNumHits;			///< Number of allocations given a pooled buffer
+			uint64_t uiNumMisses;		///< Number of allocations which had to get a new buffer from the system
+			size_t uiBytesInUse;		///< Total size of the buffers currently allocated and not yet deallocated
+			size_t uiPeakBytesInUse;	///< The largest uiBytesInUse has been
+			size_t uiBytesPooled;		///< Total size of the freed buffers being kept for reuse
+		};
+
+		/// \brief Constructor
+		///
+		/// \param uiMaxPooledBytes The total size of the freed buffers which are kept for reuse. 0 disables pooling.
+		CPixelAllocator(size_t uiMaxPooledBytes = 64 * 1024 * 1024);
+
+		/// \brief Destructor, frees the pooled buffers. Every buffer allocated must have been deallocated first.
+		~CPixelAllocator();
+
+		CPixelAllocator(const CPixelAllocator&) = delete;
+		CPixelAllocator& operator=(const CPixelAllocator&) = delete;
+
+		/// \brief Returns a buffer of at least uiSize bytes, starting on a kAlignment byte boundary.
+		///
+		/// \param uiSize The number of bytes needed. Must be at least 1.
+		/// \param bClear Whether to set the first uiSize bytes to zero. Pass false when every byte is about to be written anyway.
+		/// \return The buffer, or nullptr if there isn't enough memory.
+		unsigned char* allocate(size_t uiSize, bool bClear);
+
+		/// \brief Gives a buffer back, to be reused or freed.
+		///
+		/// \param pData A buffer returned by allocate() of this object, or nullptr which does nothing.
+		/// \param uiSize The size which was given to allocate()
+		void deallocate(unsigned char* pData, size_t uiSize);
+
+		/// \brief Frees every pooled buffer. Buffers in use are unaffected.
+		void trim(void);
+
+		/// \brief Sets the total size of the freed buffers which are kept for reuse, freeing pooled buffers if they are over it. 0 disables pooling.
+		void setMaxPooledBytes(size_t uiMaxPooledBytes);
+
+		/// \brief Returns the total size of the freed buffers which are kept for reuse.
+		size_t getMaxPooledBytes(void) const;
+
+		/// \brief Returns counts of what this allocator has done.
+		SStats getStats(void) const;
+
+		/// \brief Sets the hit and miss counts to zero and the peak bytes in use to those currently in use.
+		void resetStats(void);
+
+		/// \brief Returns the size of the buffer which allocate() gives for the given size.
+		///
+		/// Sizes are rounded up to 4 classes per power of two, so at most a quarter of a buffer is ever unused, and never to less than kAlignment.
+		static size_t getSizeClass(size_t uiSize);
+
+		/// \brief Returns the allocator used by every CImage unless told otherwise, created when first called.
+		static CPixelAllocator& getGlobal(void);
+	private:
+		mutable std::mutex _mMutex;												///< Guards everything below
+		std::map<size_t, std::vector<unsigned char*>> _mmapFreeBuffers;		///< The pooled buffers of each size class
+		size_t _muiMaxPooledBytes;												///< Limit of _mStats.uiBytesPooled
+		SStats _mStats;															///< Counts returned by getStats()
+
+		/// \brief Frees pooled buffers, largest first, until no more than uiMaxPooledBytes are pooled. _mMutex must be locked.
+		void _trimTo(size_t uiMaxPooledBytes);
+	};
+}
@@ -0,0 +1,858 @@
+#include "PixelKernels.h"
+#include "../Core/Utilities.h"
+#include <cstring>
+#include <utility>
+
+// Vector kernels are only built for x86 and x64. MSVC allows any instruction set's intrinsics in any function, whereas
+// GCC and Clang need each function to say which instruction sets it uses.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXELKERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define PIXELKERNELS_TARGET_AVX2
+#else
+#define PIXELKERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace X
+{
+	namespace
+	{
+		// Scalar kernels. These are the reference which every other version must match exactly.
+
+		void swapRedAndBlueScalar(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels)
+		{
+			const unsigned char* pEnd = pData + uiNumPixels * uiNumChannels;
+			for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+				std::swap(p[0], p[2]);
+		}
+
+		void invertScalar(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, bool bInvertColour, bool bInvertAlpha)
+		{
+			const unsigned char* pEnd = pData + uiNumPixels * uiNumChannels;
+			if (bInvertColour)
+			{
+				for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+				{
+					p[0] = 255 - p[0];
+					p[1] = 255 - p[1];
+					p[2] = 255 - p[2];
+				}
+			}
+			if (4 == uiNumChannels && bInvertAlpha)
+			{
+				for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+					p[3] = 255 - p[3];
+			}
+		}
+
+		void greyscaleScalar(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, float fRedSensitivity, float fGreenSensitivity, float fBlueSensitivity)
+		{
+			const unsigned char* pEnd = pData + uiNumPixels * uiNumChannels;
+			for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+			{
+				float fTmp = float(p[0]) * fRedSensitivity;
+				fTmp += float(p[1]) * fGreenSensitivity;
+				fTmp += float(p[2]) * fBlueSensitivity;
+
+				// Through int, so a sum over 255, which the default sensitivities can give, wraps around the same way on every compiler
+				const unsigned char cTmp = (unsigned char)(int)fTmp;
+				p[0] = cTmp;
+				p[1] = cTmp;
+				p[2] = cTmp;
+			}
+		}
+
+		void adjustBrightnessScalar(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, int iAmount)
+		{
+			const unsigned char* pEnd = pData + uiNumPixels * uiNumChannels;
+			int iCol;
+			for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+			{
+				for (int iChannel = 0; iChannel < 3; iChannel++)
+				{
+					iCol = (int)p[iChannel] + iAmount;
+					clamp(iCol, 0, 255);
+					p[iChannel] = (unsigned char)iCol;
+				}
+			}
+		}
+
+		/// \brief The contrast curve of a single value
+		inline unsigned char contrastOf(unsigned char ucValue, double dContrast)
+		{
+			double dPixel = double(ucValue) * (1.0 / 255.0);
+			dPixel -= 0.5;
+			dPixel *= dContrast;
+			dPixel += 0.5;
+			dPixel *= 255;
+			clamp(dPixel, 0.0, 255.0);
+			return (unsigned char)dPixel;
+		}
+
+		void adjustContrastScalar(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, double dContrast)
+		{
+			const unsigned char* pEnd = pData + uiNumPixels * uiNumChannels;
+			for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+			{
+				p[0] = contrastOf(p[0], dContrast);
+				p[1] = contrastOf(p[1], dContrast);
+				p[2] = contrastOf(p[2], dContrast);
+			}
+		}
+
+		void addAlphaChannelScalar(const unsigned char* pRGB, unsigned char* pRGBA, size_t uiNumPixels, unsigned char ucAlpha)
+		{
+			for (size_t i = 0; i < uiNumPixels; i++)
+			{
+				pRGBA[i * 4] = pRGB[i * 3];
+				pRGBA[i * 4 + 1] = pRGB[i * 3 + 1];
+				pRGBA[i * 4 + 2] = pRGB[i * 3 + 2];
+				pRGBA[i * 4 + 3] = ucAlpha;
+			}
+		}
+
+		void removeAlphaChannelScalar(const unsigned char* pRGBA, unsigned char* pRGB, size_t uiNumPixels)
+		{
+			// Forwards, so each pixel is written no later in memory than it's read from when packing down in place
+			for (size_t i = 0; i < uiNumPixels; i++)
+			{
+				pRGB[i * 3] = pRGBA[i * 4];
+				pRGB[i * 3 + 1] = pRGBA[i * 4 + 1];
+				pRGB[i * 3 + 2] = pRGBA[i * 4 + 2];
+			}
+		}
+
+		void bytesToFloatsScalar(const unsigned char* pBytes, float* pFloats, size_t uiNumValues)
+		{
+			for (size_t i = 0; i < uiNumValues; i++)
+				pFloats[i] = float(pBytes[i]);
+		}
+
+		/// \brief Converts a float to a byte as floatsToBytes() does
+		inline unsigned char byteOf(float fValue)
+		{
+			fValue = fValue > 0.0f ? fValue : 0.0f;
+			fValue = fValue < 255.0f ? fValue : 255.0f;
+			return (unsigned char)int(fValue + 0.5f);
+		}
+
+		void floatsToBytesScalar(const float* pFloats, unsigned char* pBytes, size_t uiNumValues)
+		{
+			for (size_t i = 0; i < uiNumValues; i++)
+				pBytes[i] = byteOf(pFloats[i]);
+		}
+
+		/// \brief Computes the weighted sum of value i of each run, as weightedSum() does
+		inline float weightedSumOf(const float* const* ppSrc, const float* pWeights, unsigned int uiNumTaps, size_t i)
+		{
+			float fSum = ppSrc[0][i] * pWeights[0];
+			for (unsigned int uiTap = 1; uiTap < uiNumTaps; uiTap++)
+				fSum += ppSrc[uiTap][i] * pWeights[uiTap];
+			return fSum;
+		}
+
+		void weightedSumScalar(const float* const* ppSrc, const float* pWeights, unsigned int uiNumTaps, float* pDst, size_t uiNumValues)
+		{
+			for (size_t i = 0; i < uiNumValues; i++)
+				pDst[i] = weightedSumOf(ppSrc, pWeights, uiNumTaps, i);
+		}
+
+		/// \brief How many iterations apart mandelbrot() compares z with its saved value, a power of 2
+		const unsigned int kMandelbrotPeriodicityStep = 4;
+
+		/// \brief Returns whether c lies inside the main cardioid or the period 2 bulb, where no point escapes
+		inline bool isMandelbrotBulb(double dReal, double dImaginary)
+		{
+			const double dImaginarySquared = dImaginary * dImaginary;
+			const double dCardioidReal = dReal - 0.25;
+			const double dQ = dCardioidReal * dCardioidReal + dImaginarySquared;
+			if (dQ * (dQ + dCardioidReal) < 0.25 * dImaginarySquared)
+				return true;
+			const double dBulbReal = dReal + 1.0;
+			return dBulbReal * dBulbReal + dImaginarySquared < 0.0625;
+		}
+
+		/// \brief Returns the number of iterations before the point c escapes, as mandelbrot() computes them
+		///
+		/// If bCheckPeriodicity, z is compared with the value it had after the last power of 2 iterations, as in Brent's cycle detection.
+		/// Once z repeats exactly it can only go round the same values again, so the point never escapes. The comparison is made every
+		/// kMandelbrotPeriodicityStep iterations, which still finds any cycle, a little later, for a fraction of the cost.
+		template <bool bCheckPeriodicity>
+		inline unsigned int mandelbrotIterationsOf(double dReal, double dImaginary, unsigned int uiMaxIterations)
+		{
+			double dZReal = 0.0;
+			double dZImaginary = 0.0;
+			double dSavedReal = 0.0;
+			double dSavedImaginary = 0.0;
+			unsigned int uiNextSave = kMandelbrotPeriodicityStep;
+			unsigned int uiIterations = 0;
+			while (dZReal * dZReal + dZImaginary * dZImaginary < 4.0 && uiIterations < uiMaxIterations)
+			{
+				const double dNewReal = (dZReal * dZReal - dZImaginary * dZImaginary) + dReal;
+				dZImaginary = (dZReal * dZImaginary + dZImaginary * dZReal) + dImaginary;
+				dZReal = dNewReal;
+				uiIterations++;
+				if (bCheckPeriodicity && 0 == uiIterations % kMandelbrotPeriodicityStep)
+				{
+					if (dZReal == dSavedReal && dZImaginary == dSavedImaginary)
+						return uiMaxIterations;
+					if (uiIterations == uiNextSave)
+					{
+						// Past 2^31 this wraps to 0, which is never reached, so z is kept from then on
+						dSavedReal = dZReal;
+						dSavedImaginary = dZImaginary;
+						uiNextSave *= 2;
+					}
+				}
+			}
+			return uiIterations;
+		}
+
+		void mandelbrotScalar(const SPixelKernels::SMandelbrotView& view, unsigned int uiX, unsigned int uiY, bool bColumn, unsigned int* puiIterations, size_t uiNumPixels)
+		{
+			for (size_t i = 0; i < uiNumPixels; i++)
+			{
+				const double dReal = view.dRealMin + double(bColumn ? uiX : uiX + i) * view.dRealStep;
+				const double dImaginary = view.dImaginaryMin + double(bColumn ? uiY + i : uiY) * view.dImaginaryStep;
+				if (view.bSkipBulbs && isMandelbrotBulb(dReal, dImaginary))
+					puiIterations[i] = view.uiMaxIterations;
+				else if (view.bCheckPeriodicity)
+					puiIterations[i] = mandelbrotIterationsOf<true>(dReal, dImaginary, view.uiMaxIterations);
+				else
+					puiIterations[i] = mandelbrotIterationsOf<false>(dReal, dImaginary, view.uiMaxIterations);
+			}
+		}
+
+		/// \brief Applies the contrast curve through a table of all 256 values, so each byte costs a load rather than a run of double
+		/// arithmetic. The table is computed by contrastOf(), so the result is exactly the scalar kernel's.
+		void adjustContrastLookup(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, double dContrast)
+		{
+			// Filling the table costs more than it saves for a handful of pixels
+			if (uiNumPixels < 256)
+			{
+				adjustContrastScalar(pData, uiNumPixels, uiNumChannels, dContrast);
+				return;
+			}
+			unsigned char ucTable[256];
+			for (int i = 0; i < 256; i++)
+				ucTable[i] = contrastOf((unsigned char)i, dContrast);
+			const unsigned char* pEnd = pData + uiNumPixels * uiNumChannels;
+			for (unsigned char* p = pData; p < pEnd; p += uiNumChannels)
+			{
+				p[0] = ucTable[p[0]];
+				p[1] = ucTable[p[1]];
+				p[2] = ucTable[p[2]];
+			}
+		}
+
+#ifdef PIXELKERNELS_X86
+		/// \brief Returns the amount to saturating add or subtract from each byte for adjustBrightness(), clamped to what a byte can hold
+		inline unsigned char brightnessStep(int iAmount)
+		{
+			if (iAmount >= 255 || iAmount <= -255)
+				return 255;
+			return (unsigned char)(iAmount < 0 ? -iAmount : iAmount);
+		}
+
+		/// \brief Returns a 32 bit pattern for each 4 channel pixel with ucColour in the RGB bytes and ucAlpha in the alpha byte
+		inline int pixelPattern(unsigned char ucColour, unsigned char ucAlpha)
+		{
+			return int(uint32_t(ucColour) * 0x00010101u | uint32_t(ucAlpha) << 24);
+		}
+
+		/// \brief Stores the low 12 bytes of v, being 4 RGB pixels
+		inline void store12(unsigned char* p, __m128i v)
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+			const int iLast = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+			memcpy(p + 8, &iLast, 4);
+		}
+
+		/// \brief Computes the grey value, from 0 to 255, of each of 4 pixels held as RGBX in the 32 bit lanes of v, as greyscaleScalar() does
+		inline __m128i greyOf4(__m128i v, __m128 vRed, __m128 vGreen, __m128 vBlue)
+		{
+			const __m128i vByteMask = _mm_set1_epi32(0xFF);
+			const __m128i vR = _mm_and_si128(v, vByteMask);
+			const __m128i vG = _mm_and_si128(_mm_srli_epi32(v, 8), vByteMask);
+			const __m128i vB = _mm_and_si128(_mm_srli_epi32(v, 16), vByteMask);
+
+			// Multiplied and added in the same order as the scalar kernel, and never fused, so rounding is identical
+			__m128 vSum = _mm_mul_ps(_mm_cvtepi32_ps(vR), vRed);
+			vSum = _mm_add_ps(vSum, _mm_mul_ps(_mm_cvtepi32_ps(vG), vGreen));
+			vSum = _mm_add_ps(vSum, _mm_mul_ps(_mm_cvtepi32_ps(vB), vBlue));
+			return _mm_and_si128(_mm_cvttps_epi32(vSum), vByteMask);
+		}
+
+		// SSE2 kernels. Those needing byte shuffles for 3 channel pixels leave them to the scalar kernels.
+
+		void swapRedAndBlueSSE2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels)
+		{
+			if (4 != uiNumChannels)
+			{
+				swapRedAndBlueScalar(pData, uiNumPixels, uiNumChannels);
+				return;
+			}
+			const __m128i vKeepMask = _mm_set1_epi32(int(0xFF00FF00));
+			const __m128i vByteMask = _mm_set1_epi32(0xFF);
+			size_t i = 0;
+			for (; i + 4 <= uiNumPixels; i += 4)
+			{
+				__m128i* p = reinterpret_cast<__m128i*>(pData + i * 4);
+				const __m128i v = _mm_loadu_si128(p);
+				const __m128i vRed = _mm_slli_epi32(_mm_and_si128(v, vByteMask), 16);
+				const __m128i vBlue = _mm_and_si128(_mm_srli_epi32(v, 16), vByteMask);
+				_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(v, vKeepMask), _mm_or_si128(vRed, vBlue)));
+			}
+			swapRedAndBlueScalar(pData + i * 4, uiNumPixels - i, 4);
+		}
+
+		void invertSSE2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, bool bInvertColour, bool bInvertAlpha)
+		{
+			// Every byte of 3 channel pixels is colour, so every byte takes the same mask
+			const unsigned char ucColour = bInvertColour ? 255 : 0;
+			const unsigned char ucAlpha = 4 == uiNumChannels ? (bInvertAlpha ? 255 : 0) : ucColour;
+			const __m128i vMask = _mm_set1_epi32(pixelPattern(ucColour, ucAlpha));
+			const size_t uiNumVectorPixels = uiNumPixels / 16 * 16;	// 16 pixels are a whole number of vectors whether of 3 or 4 channels
+			const size_t uiNumVectorBytes = uiNumVectorPixels * uiNumChannels;
+			for (size_t i = 0; i < uiNumVectorBytes; i += 16)
+			{
+				__m128i* p = reinterpret_cast<__m128i*>(pData + i);
+				_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), vMask));
+			}
+			invertScalar(pData + uiNumVectorBytes, uiNumPixels - uiNumVectorPixels, uiNumChannels, bInvertColour, bInvertAlpha);
+		}
+
+		void greyscaleSSE2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, float fRedSensitivity, float fGreenSensitivity, float fBlueSensitivity)
+		{
+			if (4 != uiNumChannels)
+			{
+				greyscaleScalar(pData, uiNumPixels, uiNumChannels, fRedSensitivity, fGreenSensitivity, fBlueSensitivity);
+				return;
+			}
+			const __m128 vRed = _mm_set1_ps(fRedSensitivity);
+			const __m128 vGreen = _mm_set1_ps(fGreenSensitivity);
+			const __m128 vBlue = _mm_set1_ps(fBlueSensitivity);
+			const __m128i vAlphaMask = _mm_set1_epi32(int(0xFF000000));
+			size_t i = 0;
+			for (; i + 4 <= uiNumPixels; i += 4)
+			{
+				__m128i* p = reinterpret_cast<__m128i*>(pData + i * 4);
+				const __m128i v = _mm_loadu_si128(p);
+				const __m128i vGrey = greyOf4(v, vRed, vGreen, vBlue);
+				const __m128i vGreyRGB = _mm_or_si128(vGrey, _mm_or_si128(_mm_slli_epi32(vGrey, 8), _mm_slli_epi32(vGrey, 16)));
+				_mm_storeu_si128(p, _mm_or_si128(vGreyRGB, _mm_and_si128(v, vAlphaMask)));
+			}
+			greyscaleScalar(pData + i * 4, uiNumPixels - i, 4, fRedSensitivity, fGreenSensitivity, fBlueSensitivity);
+		}
+
+		void adjustBrightnessSSE2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, int iAmount)
+		{
+			// Saturating adds and subtracts clamp to 0 and 255 just as the scalar kernel does. Alpha gets an amount of 0.
+			const unsigned char ucStep = brightnessStep(iAmount);
+			const __m128i vStep = _mm_set1_epi32(pixelPattern(ucStep, 4 == uiNumChannels ? 0 : ucStep));
+			const size_t uiNumVectorPixels = uiNumPixels / 16 * 16;
+			const size_t uiNumVectorBytes = uiNumVectorPixels * uiNumChannels;
+			for (size_t i = 0; i < uiNumVectorBytes; i += 16)
+			{
+				__m128i* p = reinterpret_cast<__m128i*>(pData + i);
+				const __m128i v = _mm_loadu_si128(p);
+				_mm_storeu_si128(p, iAmount >= 0 ? _mm_adds_epu8(v, vStep) : _mm_subs_epu8(v, vStep));
+			}
+			adjustBrightnessScalar(pData + uiNumVectorBytes, uiNumPixels - uiNumVectorPixels, uiNumChannels, iAmount);
+		}
+
+		void bytesToFloatsSSE2(const unsigned char* pBytes, float* pFloats, size_t uiNumValues)
+		{
+			const __m128i vZero = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= uiNumValues; i += 16)
+			{
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBytes + i));
+				const __m128i vLow = _mm_unpacklo_epi8(v, vZero);
+				const __m128i vHigh = _mm_unpackhi_epi8(v, vZero);
+				_mm_storeu_ps(pFloats + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(vLow, vZero)));
+				_mm_storeu_ps(pFloats + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(vLow, vZero)));
+				_mm_storeu_ps(pFloats + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(vHigh, vZero)));
+				_mm_storeu_ps(pFloats + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(vHigh, vZero)));
+			}
+			bytesToFloatsScalar(pBytes + i, pFloats + i, uiNumValues - i);
+		}
+
+		/// \brief Converts 4 floats to whole numbers from 0 to 255 as byteOf() does
+		inline __m128i roundedBytesOf4(const float* pFloats)
+		{
+			__m128 v = _mm_max_ps(_mm_loadu_ps(pFloats), _mm_setzero_ps());
+			v = _mm_min_ps(v, _mm_set1_ps(255.0f));
+			return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+		}
+
+		void floatsToBytesSSE2(const float* pFloats, unsigned char* pBytes, size_t uiNumValues)
+		{
+			size_t i = 0;
+			for (; i + 16 <= uiNumValues; i += 16)
+			{
+				const __m128i vLow = _mm_packs_epi32(roundedBytesOf4(pFloats + i), roundedBytesOf4(pFloats + i + 4));
+				const __m128i vHigh = _mm_packs_epi32(roundedBytesOf4(pFloats + i + 8), roundedBytesOf4(pFloats + i + 12));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pBytes + i), _mm_packus_epi16(vLow, vHigh));
+			}
+			floatsToBytesScalar(pFloats + i, pBytes + i, uiNumValues - i);
+		}
+
+		void weightedSumSSE2(const float* const* ppSrc, const float* pWeights, unsigned int uiNumTaps, float* pDst, size_t uiNumValues)
+		{
+			// Every tap for 4 values at a time, so each value is only stored once
+			size_t i = 0;
+			for (; i + 4 <= uiNumValues; i += 4)
+			{
+				__m128 vSum = _mm_mul_ps(_mm_loadu_ps(ppSrc[0] + i), _mm_set1_ps(pWeights[0]));
+				for (unsigned int uiTap = 1; uiTap < uiNumTaps; uiTap++)
+					vSum = _mm_add_ps(vSum, _mm_mul_ps(_mm_loadu_ps(ppSrc[uiTap] + i), _mm_set1_ps(pWeights[uiTap])));
+				_mm_storeu_ps(pDst + i, vSum);
+			}
+			for (; i < uiNumValues; i++)
+				pDst[i] = weightedSumOf(ppSrc, pWeights, uiNumTaps, i);
+		}
+
+		/// \brief Returns all ones in the lanes whose c lies inside the main cardioid or the period 2 bulb, as isMandelbrotBulb() does
+		inline __m128d isMandelbrotBulbSSE2(__m128d vReal, __m128d vImaginary)
+		{
+			const __m128d vImaginarySquared = _mm_mul_pd(vImaginary, vImaginary);
+			const __m128d vCardioidReal = _mm_sub_pd(vReal, _mm_set1_pd(0.25));
+			const __m128d vQ = _mm_add_pd(_mm_mul_pd(vCardioidReal, vCardioidReal), vImaginarySquared);
+			const __m128d vCardioid = _mm_cmplt_pd(_mm_mul_pd(vQ, _mm_add_pd(vQ, vCardioidReal)), _mm_mul_pd(_mm_set1_pd(0.25), vImaginarySquared));
+			const __m128d vBulbReal = _mm_add_pd(vReal, _mm_set1_pd(1.0));
+			const __m128d vBulb = _mm_cmplt_pd(_mm_add_pd(_mm_mul_pd(vBulbReal, vBulbReal), vImaginarySquared), _mm_set1_pd(0.0625));
+			return _mm_or_pd(vCardioid, vBulb);
+		}
+
+		template <bool bCheckPeriodicity>
+		void mandelbrotOfSSE2(const SPixelKernels::SMandelbrotView& view, unsigned int uiX, unsigned int uiY, bool bColumn, unsigned int* puiIterations, size_t uiNumPixels)
+		{
+			// 4 pixels at a time, as two vectors of 2 so one's multiplications overlap the other's. Each lane's count is 64 bits, and is
+			// stepped by subtracting its all ones mask while it's still active. A lane stays inactive once it has escaped.
+			// Lanes found never to escape, by the bulb test or by repeating, are made inactive too, and given uiMaxIterations at the end.
+			// The last pixels are iterated as a group of 4 with the lanes past the end inactive from the start, rather than a pixel at a time.
+			const __m128d vRealMin = _mm_set1_pd(view.dRealMin);
+			const __m128d vRealStep = _mm_set1_pd(view.dRealStep);
+			const __m128d vImaginaryMin = _mm_set1_pd(view.dImaginaryMin);
+			const __m128d vImaginaryStep = _mm_set1_pd(view.dImaginaryStep);
+			const __m128d vFour = _mm_set1_pd(4.0);
+			const unsigned int uiMaxIterations = view.uiMaxIterations;
+			for (size_t i = 0; i < uiNumPixels; i += 4)
+			{
+				const double dNumLeft = double(uiNumPixels - i);
+				const __m128d vInRange0 = _mm_cmplt_pd(_mm_setr_pd(0.0, 1.0), _mm_set1_pd(dNumLeft));
+				const __m128d vInRange1 = _mm_cmplt_pd(_mm_setr_pd(2.0, 3.0), _mm_set1_pd(dNumLeft));
+				// The column and row of each lane, one of which is the same for them all
+				const double dX = double(bColumn ? uiX : uiX + i);
+				const double dY = double(bColumn ? uiY + i : uiY);
+				const double dXStep = bColumn ? 0.0 : 1.0;
+				const double dYStep = bColumn ? 1.0 : 0.0;
+				const __m128d vReal0 = _mm_add_pd(vRealMin, _mm_mul_pd(_mm_setr_pd(dX, dX + dXStep), vRealStep));
+				const __m128d vReal1 = _mm_add_pd(vRealMin, _mm_mul_pd(_mm_setr_pd(dX + 2.0 * dXStep, dX + 3.0 * dXStep), vRealStep));
+				const __m128d vImaginary0 = _mm_add_pd(vImaginaryMin, _mm_mul_pd(_mm_setr_pd(dY, dY + dYStep), vImaginaryStep));
+				const __m128d vImaginary1 = _mm_add_pd(vImaginaryMin, _mm_mul_pd(_mm_setr_pd(dY + 2.0 * dYStep, dY + 3.0 * dYStep), vImaginaryStep));
+				__m128d vNeverEscapes0 = view.bSkipBulbs ? isMandelbrotBulbSSE2(vReal0, vImaginary0) : _mm_setzero_pd();
+				__m128d vNeverEscapes1 = view.bSkipBulbs ? isMandelbrotBulbSSE2(vReal1, vImaginary1) : _mm_setzero_pd();
+				__m128d vZReal0 = _mm_setzero_pd(), vZImaginary0 = _mm_setzero_pd(), vActive0 = _mm_andnot_pd(vNeverEscapes0, vInRange0);
+				__m128d vZReal1 = _mm_setzero_pd(), vZImaginary1 = _mm_setzero_pd(), vActive1 = _mm_andnot_pd(vNeverEscapes1, vInRange1);
+				__m128d vSavedReal0 = _mm_setzero_pd(), vSavedImaginary0 = _mm_setzero_pd();
+				__m128d vSavedReal1 = _mm_setzero_pd(), vSavedImaginary1 = _mm_setzero_pd();
+				unsigned int uiNextSave = kMandelbrotPeriodicityStep;
+				__m128i vCount0 = _mm_setzero_si128(), vCount1 = _mm_setzero_si128();
+				for (unsigned int uiIteration = 0; uiIteration < uiMaxIterations; uiIteration++)
+				{
+					const __m128d vRealSquared0 = _mm_mul_pd(vZReal0, vZReal0);
+					const __m128d vImaginarySquared0 = _mm_mul_pd(vZImaginary0, vZImaginary0);
+					const __m128d vRealSquared1 = _mm_mul_pd(vZReal1, vZReal1);
+					const __m128d vImaginarySquared1 = _mm_mul_pd(vZImaginary1, vZImaginary1);
+					vActive0 = _mm_and_pd(vActive0, _mm_cmplt_pd(_mm_add_pd(vRealSquared0, vImaginarySquared0), vFour));
+					vActive1 = _mm_and_pd(vActive1, _mm_cmplt_pd(_mm_add_pd(vRealSquared1, vImaginarySquared1), vFour));
+					if (0 == _mm_movemask_pd(_mm_or_pd(vActive0, vActive1)))
+						break;
+					vCount0 = _mm_sub_epi64(vCount0, _mm_castpd_si128(vActive0));
+					vCount1 = _mm_sub_epi64(vCount1, _mm_castpd_si128(vActive1));
+					const __m128d vCross0 = _mm_mul_pd(vZReal0, vZImaginary0);
+					const __m128d vCross1 = _mm_mul_pd(vZReal1, vZImaginary1);
+					vZReal0 = _mm_add_pd(_mm_sub_pd(vRealSquared0, vImaginarySquared0), vReal0);
+					vZReal1 = _mm_add_pd(_mm_sub_pd(vRealSquared1, vImaginarySquared1), vReal1);
+					vZImaginary0 = _mm_add_pd(_mm_add_pd(vCross0, vCross0), vImaginary0);
+					vZImaginary1 = _mm_add_pd(_mm_add_pd(vCross1, vCross1), vImaginary1);
+					if (bCheckPeriodicity && 0 == (uiIteration + 1) % kMandelbrotPeriodicityStep)
+					{
+						// Every lane has been iterated the same number of times, so they're all compared and saved together, as mandelbrotIterationsOf() does
+						const __m128d vRepeated0 = _mm_and_pd(vActive0, _mm_and_pd(_mm_cmpeq_pd(vZReal0, vSavedReal0), _mm_cmpeq_pd(vZImaginary0, vSavedImaginary0)));
+						const __m128d vRepeated1 = _mm_and_pd(vActive1, _mm_and_pd(_mm_cmpeq_pd(vZReal1, vSavedReal1), _mm_cmpeq_pd(vZImaginary1, vSavedImaginary1)));
+						vNeverEscapes0 = _mm_or_pd(vNeverEscapes0, vRepeated0);
+						vNeverEscapes1 = _mm_or_pd(vNeverEscapes1, vRepeated1);
+						vActive0 = _mm_andnot_pd(vRepeated0, vActive0);
+						vActive1 = _mm_andnot_pd(vRepeated1, vActive1);
+						if (uiIteration + 1 == uiNextSave)
+						{
+							vSavedReal0 = vZReal0;
+							vSavedImaginary0 = vZImaginary0;
+							vSavedReal1 = vZReal1;
+							vSavedImaginary1 = vZImaginary1;
+							uiNextSave *= 2;
+						}
+					}
+				}
+				uint64_t uiCounts[4];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(uiCounts), vCount0);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(uiCounts + 2), vCount1);
+				const int iNeverEscapes = _mm_movemask_pd(vNeverEscapes0) | (_mm_movemask_pd(vNeverEscapes1) << 2);
+				const size_t uiNumLanes = uiNumPixels - i < 4 ? uiNumPixels - i : 4;
+				for (size_t uiLane = 0; uiLane < uiNumLanes; uiLane++)
+					puiIterations[i + uiLane] = (iNeverEscapes >> uiLane) & 1 ? uiMaxIterations : (unsigned int)uiCounts[uiLane];
+			}
+		}
+
+		void mandelbrotSSE2(const SPixelKernels::SMandelbrotView& view, unsigned int uiX, unsigned int uiY, bool bColumn, unsigned int* puiIterations, size_t uiNumPixels)
+		{
+			if (view.bCheckPeriodicity)
+				mandelbrotOfSSE2<true>(view, uiX, uiY, bColumn, puiIterations, uiNumPixels);
+			else
+				mandelbrotOfSSE2<false>(view, uiX, uiY, bColumn, puiIterations, uiNumPixels);
+		}
+
+		// AVX2 kernels. 3 channel pixels use 128 bit byte shuffles, which AVX2 CPUs all have.
+
+		PIXELKERNELS_TARGET_AVX2 void swapRedAndBlueAVX2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels)
+		{
+			size_t i = 0;
+			if (4 == uiNumChannels)
+			{
+				const __m256i vShuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+					2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+				for (; i + 8 <= uiNumPixels; i += 8)
+				{
+					__m256i* p = reinterpret_cast<__m256i*>(pData + i * 4);
+					_mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), vShuffle));
+				}
+			}
+			else
+			{
+				// 16 pixels at a time, being 3 vectors. Pixels 5 and 10 straddle two of them, so each vector written is shuffled
+				// together from the one read at the same place and its neighbours.
+				alignas(16) unsigned char ucShuffles[3][3][16];
+				for (int iOut = 0; iOut < 3; iOut++)
+				{
+					for (int iIn = 0; iIn < 3; iIn++)
+					{
+						for (int iByte = 0; iByte < 16; iByte++)
+						{
+							const int iDest = iOut * 16 + iByte;
+							const int iSource = 1 == iDest % 3 ? iDest : iDest - iDest % 3 + 2 - iDest % 3;
+							ucShuffles[iOut][iIn][iByte] = iSource / 16 == iIn ? (unsigned char)(iSource % 16) : 0x80;
+						}
+					}
+				}
+				auto shuffle = [&](__m128i v, int iOut, int iIn) PIXELKERNELS_TARGET_AVX2
+				{
+					return _mm_shuffle_epi8(v, _mm_load_si128(reinterpret_cast<const __m128i*>(ucShuffles[iOut][iIn])));
+				};
+				for (; i + 16 <= uiNumPixels; i += 16)
+				{
+					__m128i* p = reinterpret_cast<__m128i*>(pData + i * 3);
+					const __m128i v0 = _mm_loadu_si128(p);
+					const __m128i v1 = _mm_loadu_si128(p + 1);
+					const __m128i v2 = _mm_loadu_si128(p + 2);
+					_mm_storeu_si128(p, _mm_or_si128(shuffle(v0, 0, 0), shuffle(v1, 0, 1)));
+					_mm_storeu_si128(p + 1, _mm_or_si128(_mm_or_si128(shuffle(v0, 1, 0), shuffle(v1, 1, 1)), shuffle(v2, 1, 2)));
+					_mm_storeu_si128(p + 2, _mm_or_si128(shuffle(v1, 2, 1), shuffle(v2, 2, 2)));
+				}
+			}
+			swapRedAndBlueScalar(pData + i * uiNumChannels, uiNumPixels - i, uiNumChannels);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void invertAVX2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, bool bInvertColour, bool bInvertAlpha)
+		{
+			const unsigned char ucColour = bInvertColour ? 255 : 0;
+			const unsigned char ucAlpha = 4 == uiNumChannels ? (bInvertAlpha ? 255 : 0) : ucColour;
+			const __m256i vMask = _mm256_set1_epi32(pixelPattern(ucColour, ucAlpha));
+			const size_t uiNumVectorPixels = uiNumPixels / 32 * 32;
+			const size_t uiNumVectorBytes = uiNumVectorPixels * uiNumChannels;
+			for (size_t i = 0; i < uiNumVectorBytes; i += 32)
+			{
+				__m256i* p = reinterpret_cast<__m256i*>(pData + i);
+				_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), vMask));
+			}
+			invertScalar(pData + uiNumVectorBytes, uiNumPixels - uiNumVectorPixels, uiNumChannels, bInvertColour, bInvertAlpha);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void greyscaleAVX2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, float fRedSensitivity, float fGreenSensitivity, float fBlueSensitivity)
+		{
+			size_t i = 0;
+			if (4 == uiNumChannels)
+			{
+				const __m256 vRed = _mm256_set1_ps(fRedSensitivity);
+				const __m256 vGreen = _mm256_set1_ps(fGreenSensitivity);
+				const __m256 vBlue = _mm256_set1_ps(fBlueSensitivity);
+				const __m256i vByteMask = _mm256_set1_epi32(0xFF);
+				const __m256i vAlphaMask = _mm256_set1_epi32(int(0xFF000000));
+				for (; i + 8 <= uiNumPixels; i += 8)
+				{
+					__m256i* p = reinterpret_cast<__m256i*>(pData + i * 4);
+					const __m256i v = _mm256_loadu_si256(p);
+					const __m256i vR = _mm256_and_si256(v, vByteMask);
+					const __m256i vG = _mm256_and_si256(_mm256_srli_epi32(v, 8), vByteMask);
+					const __m256i vB = _mm256_and_si256(_mm256_srli_epi32(v, 16), vByteMask);
+					__m256 vSum = _mm256_mul_ps(_mm256_cvtepi32_ps(vR), vRed);
+					vSum = _mm256_add_ps(vSum, _mm256_mul_ps(_mm256_cvtepi32_ps(vG), vGreen));
+					vSum = _mm256_add_ps(vSum, _mm256_mul_ps(_mm256_cvtepi32_ps(vB), vBlue));
+					const __m256i vGrey = _mm256_and_si256(_mm256_cvttps_epi32(vSum), vByteMask);
+					const __m256i vGreyRGB = _mm256_or_si256(vGrey, _mm256_or_si256(_mm256_slli_epi32(vGrey, 8), _mm256_slli_epi32(vGrey, 16)));
+					_mm256_storeu_si256(p, _mm256_or_si256(vGreyRGB, _mm256_and_si256(v, vAlphaMask)));
+				}
+			}
+			else
+			{
+				// 4 pixels at a time, spread out to 32 bits each and packed back down again
+				const __m128 vRed = _mm_set1_ps(fRedSensitivity);
+				const __m128 vGreen = _mm_set1_ps(fGreenSensitivity);
+				const __m128 vBlue = _mm_set1_ps(fBlueSensitivity);
+				const __m128i vSpread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+				const __m128i vPack = _mm_setr_epi8(0, 0, 0, 4, 4, 4, 8, 8, 8, 12, 12, 12, -1, -1, -1, -1);
+				for (; i + 6 <= uiNumPixels; i += 4)
+				{
+					unsigned char* p = pData + i * 3;
+					const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), vSpread);
+					store12(p, _mm_shuffle_epi8(greyOf4(v, vRed, vGreen, vBlue), vPack));
+				}
+			}
+			greyscaleScalar(pData + i * uiNumChannels, uiNumPixels - i, uiNumChannels, fRedSensitivity, fGreenSensitivity, fBlueSensitivity);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void adjustBrightnessAVX2(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, int iAmount)
+		{
+			const unsigned char ucStep = brightnessStep(iAmount);
+			const __m256i vStep = _mm256_set1_epi32(pixelPattern(ucStep, 4 == uiNumChannels ? 0 : ucStep));
+			const size_t uiNumVectorPixels = uiNumPixels / 32 * 32;
+			const size_t uiNumVectorBytes = uiNumVectorPixels * uiNumChannels;
+			for (size_t i = 0; i < uiNumVectorBytes; i += 32)
+			{
+				__m256i* p = reinterpret_cast<__m256i*>(pData + i);
+				const __m256i v = _mm256_loadu_si256(p);
+				_mm256_storeu_si256(p, iAmount >= 0 ? _mm256_adds_epu8(v, vStep) : _mm256_subs_epu8(v, vStep));
+			}
+			adjustBrightnessScalar(pData + uiNumVectorBytes, uiNumPixels - uiNumVectorPixels, uiNumChannels, iAmount);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void addAlphaChannelAVX2(const unsigned char* pRGB, unsigned char* pRGBA, size_t uiNumPixels, unsigned char ucAlpha)
+		{
+			// 4 pixels at a time, reading 16 bytes only while they're all within the run
+			const __m128i vSpread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i vAlpha = _mm_set1_epi32(pixelPattern(0, ucAlpha));
+			size_t i = 0;
+			for (; i + 6 <= uiNumPixels; i += 4)
+			{
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRGB + i * 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBA + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, vSpread), vAlpha));
+			}
+			addAlphaChannelScalar(pRGB + i * 3, pRGBA + i * 4, uiNumPixels - i, ucAlpha);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void removeAlphaChannelAVX2(const unsigned char* pRGBA, unsigned char* pRGB, size_t uiNumPixels)
+		{
+			// 8 pixels at a time. Each is read before any of them is written, and exactly 24 bytes are written, all before the next
+			// pixels to be read, so packing down in place works.
+			const __m256i vPack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			size_t i = 0;
+			for (; i + 8 <= uiNumPixels; i += 8)
+			{
+				const __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRGBA + i * 4)), vPack);
+				store12(pRGB + i * 3, _mm256_castsi256_si128(v));
+				store12(pRGB + i * 3 + 12, _mm256_extracti128_si256(v, 1));
+			}
+			removeAlphaChannelScalar(pRGBA + i * 4, pRGB + i * 3, uiNumPixels - i);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void bytesToFloatsAVX2(const unsigned char* pBytes, float* pFloats, size_t uiNumValues)
+		{
+			size_t i = 0;
+			for (; i + 16 <= uiNumValues; i += 16)
+			{
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBytes + i));
+				_mm256_storeu_ps(pFloats + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+				_mm256_storeu_ps(pFloats + i + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+			}
+			bytesToFloatsScalar(pBytes + i, pFloats + i, uiNumValues - i);
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void weightedSumAVX2(const float* const* ppSrc, const float* pWeights, unsigned int uiNumTaps, float* pDst, size_t uiNumValues)
+		{
+			// Every tap for 16 values at a time, as two independent sums so one's additions overlap the other's
+			size_t i = 0;
+			for (; i + 16 <= uiNumValues; i += 16)
+			{
+				const __m256 vWeight = _mm256_set1_ps(pWeights[0]);
+				__m256 vSum0 = _mm256_mul_ps(_mm256_loadu_ps(ppSrc[0] + i), vWeight);
+				__m256 vSum1 = _mm256_mul_ps(_mm256_loadu_ps(ppSrc[0] + i + 8), vWeight);
+				for (unsigned int uiTap = 1; uiTap < uiNumTaps; uiTap++)
+				{
+					const __m256 vTapWeight = _mm256_set1_ps(pWeights[uiTap]);
+					vSum0 = _mm256_add_ps(vSum0, _mm256_mul_ps(_mm256_loadu_ps(ppSrc[uiTap] + i), vTapWeight));
+					vSum1 = _mm256_add_ps(vSum1, _mm256_mul_ps(_mm256_loadu_ps(ppSrc[uiTap] + i + 8), vTapWeight));
+				}
+				_mm256_storeu_ps(pDst + i, vSum0);
+				_mm256_storeu_ps(pDst + i + 8, vSum1);
+			}
+			for (; i < uiNumValues; i++)
+				pDst[i] = weightedSumOf(ppSrc, pWeights, uiNumTaps, i);
+		}
+
+		/// \brief Returns all ones in the lanes whose c lies inside the main cardioid or the period 2 bulb, as isMandelbrotBulb() does
+		PIXELKERNELS_TARGET_AVX2 inline __m256d isMandelbrotBulbAVX2(__m256d vReal, __m256d vImaginary)
+		{
+			const __m256d vImaginarySquared = _mm256_mul_pd(vImaginary, vImaginary);
+			const __m256d vCardioidReal = _mm256_sub_pd(vReal, _mm256_set1_pd(0.25));
+			const __m256d vQ = _mm256_add_pd(_mm256_mul_pd(vCardioidReal, vCardioidReal), vImaginarySquared);
+			const __m256d vCardioid = _mm256_cmp_pd(_mm256_mul_pd(vQ, _mm256_add_pd(vQ, vCardioidReal)), _mm256_mul_pd(_mm256_set1_pd(0.25), vImaginarySquared), _CMP_LT_OQ);
+			const __m256d vBulbReal = _mm256_add_pd(vReal, _mm256_set1_pd(1.0));
+			const __m256d vBulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(vBulbReal, vBulbReal), vImaginarySquared), _mm256_set1_pd(0.0625), _CMP_LT_OQ);
+			return _mm256_or_pd(vCardioid, vBulb);
+		}
+
+		template <bool bCheckPeriodicity>
+		PIXELKERNELS_TARGET_AVX2 void mandelbrotOfAVX2(const SPixelKernels::SMandelbrotView& view, unsigned int uiX, unsigned int uiY, bool bColumn, unsigned int* puiIterations, size_t uiNumPixels)
+		{
+			// 8 pixels at a time, as two vectors of 4, as mandelbrotOfSSE2() does, the last pixels too
+			const __m256d vRealMin = _mm256_set1_pd(view.dRealMin);
+			const __m256d vRealStep = _mm256_set1_pd(view.dRealStep);
+			const __m256d vImaginaryMin = _mm256_set1_pd(view.dImaginaryMin);
+			const __m256d vImaginaryStep = _mm256_set1_pd(view.dImaginaryStep);
+			const __m256d vFour = _mm256_set1_pd(4.0);
+			const __m256d vLanes = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+			const __m256d vXLanes = bColumn ? _mm256_setzero_pd() : vLanes;
+			const __m256d vYLanes = bColumn ? vLanes : _mm256_setzero_pd();
+			const unsigned int uiMaxIterations = view.uiMaxIterations;
+			for (size_t i = 0; i < uiNumPixels; i += 8)
+			{
+				const __m256d vNumLeft = _mm256_set1_pd(double(uiNumPixels - i));
+				const __m256d vInRange0 = _mm256_cmp_pd(vLanes, vNumLeft, _CMP_LT_OQ);
+				const __m256d vInRange1 = _mm256_cmp_pd(_mm256_add_pd(vLanes, vFour), vNumLeft, _CMP_LT_OQ);
+				const __m256d vX = _mm256_add_pd(_mm256_set1_pd(double(bColumn ? uiX : uiX + i)), vXLanes);
+				const __m256d vY = _mm256_add_pd(_mm256_set1_pd(double(bColumn ? uiY + i : uiY)), vYLanes);
+				const __m256d vReal0 = _mm256_add_pd(vRealMin, _mm256_mul_pd(vX, vRealStep));
+				const __m256d vImaginary0 = _mm256_add_pd(vImaginaryMin, _mm256_mul_pd(vY, vImaginaryStep));
+				const __m256d vReal1 = bColumn ? vReal0 : _mm256_add_pd(vRealMin, _mm256_mul_pd(_mm256_add_pd(vX, vFour), vRealStep));
+				const __m256d vImaginary1 = bColumn ? _mm256_add_pd(vImaginaryMin, _mm256_mul_pd(_mm256_add_pd(vY, vFour), vImaginaryStep)) : vImaginary0;
+				__m256d vNeverEscapes0 = view.bSkipBulbs ? isMandelbrotBulbAVX2(vReal0, vImaginary0) : _mm256_setzero_pd();
+				__m256d vNeverEscapes1 = view.bSkipBulbs ? isMandelbrotBulbAVX2(vReal1, vImaginary1) : _mm256_setzero_pd();
+				__m256d vZReal0 = _mm256_setzero_pd(), vZImaginary0 = _mm256_setzero_pd(), vActive0 = _mm256_andnot_pd(vNeverEscapes0, vInRange0);
+				__m256d vZReal1 = _mm256_setzero_pd(), vZImaginary1 = _mm256_setzero_pd(), vActive1 = _mm256_andnot_pd(vNeverEscapes1, vInRange1);
+				__m256d vSavedReal0 = _mm256_setzero_pd(), vSavedImaginary0 = _mm256_setzero_pd();
+				__m256d vSavedReal1 = _mm256_setzero_pd(), vSavedImaginary1 = _mm256_setzero_pd();
+				unsigned int uiNextSave = kMandelbrotPeriodicityStep;
+				__m256i vCount0 = _mm256_setzero_si256(), vCount1 = _mm256_setzero_si256();
+				for (unsigned int uiIteration = 0; uiIteration < uiMaxIterations; uiIteration++)
+				{
+					const __m256d vRealSquared0 = _mm256_mul_pd(vZReal0, vZReal0);
+					const __m256d vImaginarySquared0 = _mm256_mul_pd(vZImaginary0, vZImaginary0);
+					const __m256d vRealSquared1 = _mm256_mul_pd(vZReal1, vZReal1);
+					const __m256d vImaginarySquared1 = _mm256_mul_pd(vZImaginary1, vZImaginary1);
+					vActive0 = _mm256_and_pd(vActive0, _mm256_cmp_pd(_mm256_add_pd(vRealSquared0, vImaginarySquared0), vFour, _CMP_LT_OQ));
+					vActive1 = _mm256_and_pd(vActive1, _mm256_cmp_pd(_mm256_add_pd(vRealSquared1, vImaginarySquared1), vFour, _CMP_LT_OQ));
+					if (0 == _mm256_movemask_pd(_mm256_or_pd(vActive0, vActive1)))
+						break;
+					vCount0 = _mm256_sub_epi64(vCount0, _mm256_castpd_si256(vActive0));
+					vCount1 = _mm256_sub_epi64(vCount1, _mm256_castpd_si256(vActive1));
+					const __m256d vCross0 = _mm256_mul_pd(vZReal0, vZImaginary0);
+					const __m256d vCross1 = _mm256_mul_pd(vZReal1, vZImaginary1);
+					vZReal0 = _mm256_add_pd(_mm256_sub_pd(vRealSquared0, vImaginarySquared0), vReal0);
+					vZReal1 = _mm256_add_pd(_mm256_sub_pd(vRealSquared1, vImaginarySquared1), vReal1);
+					vZImaginary0 = _mm256_add_pd(_mm256_add_pd(vCross0, vCross0), vImaginary0);
+					vZImaginary1 = _mm256_add_pd(_mm256_add_pd(vCross1, vCross1), vImaginary1);
+					if (bCheckPeriodicity && 0 == (uiIteration + 1) % kMandelbrotPeriodicityStep)
+					{
+						const __m256d vRepeated0 = _mm256_and_pd(vActive0, _mm256_and_pd(_mm256_cmp_pd(vZReal0, vSavedReal0, _CMP_EQ_OQ), _mm256_cmp_pd(vZImaginary0, vSavedImaginary0, _CMP_EQ_OQ)));
+						const __m256d vRepeated1 = _mm256_and_pd(vActive1, _mm256_and_pd(_mm256_cmp_pd(vZReal1, vSavedReal1, _CMP_EQ_OQ), _mm256_cmp_pd(vZImaginary1, vSavedImaginary1, _CMP_EQ_OQ)));
+						vNeverEscapes0 = _mm256_or_pd(vNeverEscapes0, vRepeated0);
+						vNeverEscapes1 = _mm256_or_pd(vNeverEscapes1, vRepeated1);
+						vActive0 = _mm256_andnot_pd(vRepeated0, vActive0);
+						vActive1 = _mm256_andnot_pd(vRepeated1, vActive1);
+						if (uiIteration + 1 == uiNextSave)
+						{
+							vSavedReal0 = vZReal0;
+							vSavedImaginary0 = vZImaginary0;
+							vSavedReal1 = vZReal1;
+							vSavedImaginary1 = vZImaginary1;
+							uiNextSave *= 2;
+						}
+					}
+				}
+				uint64_t uiCounts[8];
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(uiCounts), vCount0);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(uiCounts + 4), vCount1);
+				const int iNeverEscapes = _mm256_movemask_pd(vNeverEscapes0) | (_mm256_movemask_pd(vNeverEscapes1) << 4);
+				const size_t uiNumLanes = uiNumPixels - i < 8 ? uiNumPixels - i : 8;
+				for (size_t uiLane = 0; uiLane < uiNumLanes; uiLane++)
+					puiIterations[i + uiLane] = (iNeverEscapes >> uiLane) & 1 ? uiMaxIterations : (unsigned int)uiCounts[uiLane];
+			}
+		}
+
+		PIXELKERNELS_TARGET_AVX2 void mandelbrotAVX2(const SPixelKernels::SMandelbrotView& view, unsigned int uiX, unsigned int uiY, bool bColumn, unsigned int* puiIterations, size_t uiNumPixels)
+		{
+			if (view.bCheckPeriodicity)
+				mandelbrotOfAVX2<true>(view, uiX, uiY, bColumn, puiIterations, uiNumPixels);
+			else
+				mandelbrotOfAVX2<false>(view, uiX, uiY, bColumn, puiIterations, uiNumPixels);
+		}
+#endif
+
+		const SPixelKernels kernelsScalar =
+		{
+			SPixelKernels::INSTRUCTIONS_SCALAR, "Scalar",
+			swapRedAndBlueScalar, invertScalar, greyscaleScalar, adjustBrightnessScalar, adjustContrastScalar,
+			addAlphaChannelScalar, removeAlphaChannelScalar,
+			bytesToFloatsScalar, floatsToBytesScalar, weightedSumScalar,
+			mandelbrotScalar
+		};
+
+#ifdef PIXELKERNELS_X86
+		const SPixelKernels kernelsSSE2 =
+		{
+			SPixelKernels::INSTRUCTIONS_SSE2, "SSE2",
+			swapRedAndBlueSSE2, invertSSE2, greyscaleSSE2, adjustBrightnessSSE2, adjustContrastLookup,
+			addAlphaChannelScalar, removeAlphaChannelScalar,
+			bytesToFloatsSSE2, floatsToBytesSSE2, weightedSumSSE2,
+			mandelbrotSSE2
+		};
+
+		const SPixelKernels kernelsAVX2 =
+		{
+			SPixelKernels::INSTRUCTIONS_AVX2, "AVX2",
+			swapRedAndBlueAVX2, invertAVX2, greyscaleAVX2, adjustBrightnessAVX2, adjustContrastLookup,
+			addAlphaChannelAVX2, removeAlphaChannelAVX2,
+			bytesToFloatsAVX2, floatsToBytesSSE2, weightedSumAVX2,
+			mandelbrotAVX2
+		};
+#endif
+	}
+
+	const SPixelKernels& SPixelKernels::get(void)
+	{
+		static const SPixelKernels* pKernels = getFor(INSTRUCTIONS_AVX2) ? getFor(INSTRUCTIONS_AVX2) : getFor(INSTRUCTIONS_SSE2) ? getFor(INSTRUCTIONS_SSE2) : &kernelsScalar;
+		return *pKernels;
+	}
+
+	const SPixelKernels* SPixelKernels::getFor(EInstructionSet eInstructionSet)
+	{
+		switch (eInstructionSet)
+		{
+		case INSTRUCTIONS_SCALAR:
+			return &kernelsScalar;
+#ifdef PIXELKERNELS_X86
+		case INSTRUCTIONS_SSE2:
+			return getCPUFeatures().bSSE2 ? &kernelsSSE2 : nullptr;
+		case INSTRUCTIONS_AVX2:
+			return getCPUFeatures().bAVX2 && getCPUFeatures().bSSSE3 ? &kernelsAVX2 : nullptr;
+#endif
+		default:
+			return nullptr;
+		}
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+
+namespace X
+{
+	/// \brief A table of the loops at the heart of CImage's per pixel operations, all written for one vector instruction set.
+	///
+	/// get() returns the table for the widest instruction set the CPU supports, chosen once on first call, and CImage calls
+	/// through it. Every table gives exactly the same results as the scalar one, which is the reference the others are checked against.
+	/// A kernel which gains nothing from an instruction set, or needs one it doesn't include, is the next narrower version.
+	///
+	/// Each kernel works on a run of whole pixels, packed with no gaps, and may be called from several threads at once on
+	/// separate runs. To add a kernel, add its pointer here, then its scalar version and any vector versions to each table in PixelKernels.cpp.
+	/// \code
+	/// const SPixelKernels& kernels = SPixelKernels::get();
+	/// kernels.invert(pData, uiNumPixels, 4, true, false);
+	/// \endcode
+	struct SPixelKernels
+	{
+		/// \brief The instruction sets which tables are written for, narrowest first
+		enum EInstructionSet
+		{
+			INSTRUCTIONS_SCALAR,	///< Plain C++
+			INSTRUCTIONS_SSE2,		///< 128 bit vectors. Every x64 CPU has these.
+			INSTRUCTIONS_AVX2		///< 256 bit vectors, along with the 128 bit byte shuffles of SSSE3
+		};
+
+		EInstructionSet eInstructionSet;	///< The instruction set this table's kernels are written for
+		const char* pszName;				///< Name of the instruction set, for logging
+
+		/// \brief Swaps the first and third channel of each pixel of 3 or 4 channels.
+		void (*swapRedAndBlue)(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels);
+
+		/// \brief Sets each of the chosen channels of each pixel of 3 or 4 channels to 255 minus itself. Alpha is only inverted if there are 4.
+		void (*invert)(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, bool bInvertColour, bool bInvertAlpha);
+
+		/// \brief Sets the RGB of each pixel of 3 or 4 channels to the sum of each multiplied by its sensitivity, converted as CImage::greyscale() does.
+		void (*greyscale)(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, float fRedSensitivity, float fGreenSensitivity, float fBlueSensitivity);
+
+		/// \brief Adds iAmount to the RGB of each pixel of 3 or 4 channels, clamped to between 0 and 255.
+		void (*adjustBrightness)(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, int iAmount);
+
+		/// \brief Applies CImage::adjustContrast()'s curve to the RGB of each pixel of 3 or 4 channels, given the squared contrast from 0 to 4 which it computes.
+		void (*adjustContrast)(unsigned char* pData, size_t uiNumPixels, unsigned int uiNumChannels, double dContrast);
+
+		/// \brief Copies RGB pixels to RGBA ones with the given alpha. The buffers must not overlap.
+		void (*addAlphaChannel)(const unsigned char* pRGB, unsigned char* pRGBA, size_t uiNumPixels, unsigned char ucAlpha);
+
+		/// \brief Copies the RGB of RGBA pixels to RGB ones. pRGB may be the same as pRGBA, to pack the pixels down in place, but mustn't otherwise overlap it.
+		void (*removeAlphaChannel)(const unsigned char* pRGBA, unsigned char* pRGB, size_t uiNumPixels);
+
+		/// \brief Converts each byte to a float holding the same value. Used by the filters in ImageFilter.h, which work on rows of floats.
+		void (*bytesToFloats)(const unsigned char* pBytes, float* pFloats, size_t uiNumValues);
+
+		/// \brief Converts each float to a byte, clamped to between 0 and 255 then rounded to nearest, halves rounded up.
+		void (*floatsToBytes)(const float* pFloats, unsigned char* pBytes, size_t uiNumValues);
+
+		/// \brief Sets each of pDst's values to the sum of the same value of each of the uiNumTaps runs in ppSrc times that run's weight.
+		///
+		/// The products are added in tap order and never fused, so every table rounds identically. pDst may be ppSrc[0], to accumulate
+		/// into it, but mustn't otherwise overlap any of them. Used for both passes of a convolution, the horizontal one by passing the
+		/// same row at a pixel's offset for each tap.
+		void (*weightedSum)(const float* const* ppSrc, const float* pWeights, unsigned int uiNumTaps, float* pDst, size_t uiNumValues);
+
+		/// \brief Where mandelbrot() finds each pixel's point c, and how it iterates it. Pixel x, y's c is
+		/// dRealMin + x * dRealStep along the real axis and dImaginaryMin + y * dImaginaryStep along the imaginary one, as CImage::fillMandelbrot() computes it.
+		struct SMandelbrotView
+		{
+			double dRealMin;				///< The real part of c in column 0
+			double dRealStep;				///< How much the real part of c grows from one column to the next
+			double dImaginaryMin;			///< The imaginary part of c in row 0
+			double dImaginaryStep;			///< How much the imaginary part of c grows from one row to the next
+			unsigned int uiMaxIterations;	///< The most iterations counted, which points that never escape are given
+			bool bSkipBulbs;				///< Whether points inside the main cardioid or the period 2 bulb are given uiMaxIterations without being iterated at all
+			bool bCheckPeriodicity;			///< Whether a point stops being iterated, and is given uiMaxIterations, once z exactly repeats a value it had before
+		};
+
+		/// \brief Sets each of uiNumPixels counts to the number of times z = z * z + c is iterated from z = 0 before |z| reaches 2, at most view.uiMaxIterations.
+		///
+		/// The pixels run along row uiY from column uiX, or down column uiX from row uiY if bColumn.
+		/// |z| is compared as its square against 4, and each iteration is rounded as std::complex<double> rounds z * z + c, with no products
+		/// fused, so every table gives the same counts. Vector versions iterate several pixels at once, ignoring those which have escaped until all have.
+		/// Neither of the view's shortcuts changes any count, as the points they stop early never escape.
+		void (*mandelbrot)(const SMandelbrotView& view, unsigned int uiX, unsigned int uiY, bool bColumn, unsigned int* puiIterations, size_t uiNumPixels);
+
+		/// \brief Returns the table for the widest instruction set which both this CPU and the build support, chosen on first call.
+		static const SPixelKernels& get(void);
+
+		/// \brief Returns the table for the given instruction set, or nullptr if this CPU or build doesn't support it. For testing and benchmarking.
+		static const SPixelKernels* getFor(EInstructionSet eInstructionSet);
+	};
+}
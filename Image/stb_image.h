@@ -524,6 +524,12 @@ extern "C" {
     STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
     STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+    // JPEG only: decode at 1/2, 1/4 or 1/8 scale in the DCT domain, using the smallest of those whose
+    // width and height are still at least min_x and min_y. 0, 0 (the default) always decodes at full size.
+    // The returned x and y are those of the reduced image. Added for Image2Ico, not part of upstream stb_image.
+    STBIDEF void stbi_set_jpeg_min_decode_size(int min_x, int min_y);
+    STBIDEF void stbi_set_jpeg_min_decode_size_thread(int min_x, int min_y);
+
     // ZLIB client - used by PNG, available for other purposes
 
     STBIDEF char* stbi_zlib_decode_malloc_guesssize(const char* buffer, int len, int initial_size, int* outlen);
@@ -1134,6 +1140,31 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_min_decode_x_global = 0, stbi__jpeg_min_decode_y_global = 0;
+
+STBIDEF void stbi_set_jpeg_min_decode_size(int min_x, int min_y)
+{
+    stbi__jpeg_min_decode_x_global = min_x;
+    stbi__jpeg_min_decode_y_global = min_y;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_min_decode_x  stbi__jpeg_min_decode_x_global
+#define stbi__jpeg_min_decode_y  stbi__jpeg_min_decode_y_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_min_decode_x_local, stbi__jpeg_min_decode_y_local, stbi__jpeg_min_decode_set;
+
+STBIDEF void stbi_set_jpeg_min_decode_size_thread(int min_x, int min_y)
+{
+    stbi__jpeg_min_decode_x_local = min_x;
+    stbi__jpeg_min_decode_y_local = min_y;
+    stbi__jpeg_min_decode_set = 1;
+}
+
+#define stbi__jpeg_min_decode_x  (stbi__jpeg_min_decode_set ? stbi__jpeg_min_decode_x_local : stbi__jpeg_min_decode_x_global)
+#define stbi__jpeg_min_decode_y  (stbi__jpeg_min_decode_set ? stbi__jpeg_min_decode_y_local : stbi__jpeg_min_decode_y_global)
+#endif // STBI_THREAD_LOCAL
+
 static void* stbi__load_main(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi__result_info* ri, int bpc)
 {
     memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1995,6 +2026,7 @@ typedef struct
 
     int scan_n, order[4];
     int restart_interval, todo;
+    int scale_shift; // each 8x8 block is decoded to (8 >> scale_shift) pixels square, see stbi_set_jpeg_min_decode_size()
 
     // kernels
     void (*idct_block_kernel)(stbi_uc* out, int out_stride, short data[64]);
@@ -2977,7 +3009,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
                 for (i = 0; i < w; ++i) {
                     int ha = z->img_comp[n].ha;
                     if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+                    z->idct_block_kernel(z->img_comp[n].data + ((z->img_comp[n].w2 * j * 8 + i * 8) >> z->scale_shift), z->img_comp[n].w2, data);
                     // every data block is an MCU, so countdown the restart interval
                     if (--z->todo <= 0) {
                         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -3002,8 +3034,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
                         // by the basic H and V specified for the component
                         for (y = 0; y < z->img_comp[n].v; ++y) {
                             for (x = 0; x < z->img_comp[n].h; ++x) {
-                                int x2 = (i * z->img_comp[n].h + x) * 8;
-                                int y2 = (j * z->img_comp[n].v + y) * 8;
+                                int x2 = (i * z->img_comp[n].h + x) * (8 >> z->scale_shift);
+                                int y2 = (j * z->img_comp[n].v + y) * (8 >> z->scale_shift);
                                 int ha = z->img_comp[n].ha;
                                 if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                                 z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
@@ -3106,7 +3138,7 @@ static void stbi__jpeg_finish(stbi__jpeg* z)
                 for (i = 0; i < w; ++i) {
                     short* data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                     stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+                    z->idct_block_kernel(z->img_comp[n].data + ((z->img_comp[n].w2 * j * 8 + i * 8) >> z->scale_shift), z->img_comp[n].w2, data);
                 }
             }
         }
@@ -3281,6 +3313,60 @@ static int stbi__free_jpeg_components(stbi__jpeg* z, int ncomp, int why)
     return why;
 }
 
+// reduced size idct, used when decoding at 1/2, 1/4 or 1/8 scale. an n point idct of the lowest n x n
+// coefficients gives the block averaged down to n x n pixels, without computing the full 8x8 first.
+// table holds c(u)/2 * cos((2k+1)u*pi/(2n)) for output k and coefficient u, c(0) = 1/sqrt(2), c(u) = 1 otherwise.
+static void stbi__idct_block_scaled(stbi_uc* out, int out_stride, short data[64], const float* table, int n)
+{
+    float tmp[16];
+    int k, u, v, x;
+    // columns
+    for (u = 0; u < n; ++u) {
+        for (k = 0; k < n; ++k) {
+            float sum = 0;
+            for (v = 0; v < n; ++v)
+                sum += table[k * n + v] * data[v * 8 + u];
+            tmp[k * 4 + u] = sum;
+        }
+    }
+    // rows, then level shift back to 0..255
+    for (k = 0; k < n; ++k) {
+        for (x = 0; x < n; ++x) {
+            float sum = 128.5f;
+            for (u = 0; u < n; ++u)
+                sum += table[x * n + u] * tmp[k * 4 + u];
+            out[k * out_stride + x] = stbi__clamp((int)floorf(sum));
+        }
+    }
+}
+
+static void stbi__idct_block_half(stbi_uc* out, int out_stride, short data[64])
+{
+    static const float table[16] = {
+        0.353553391f,  0.461939766f,  0.353553391f,  0.191341716f,
+        0.353553391f,  0.191341716f, -0.353553391f, -0.461939766f,
+        0.353553391f, -0.191341716f, -0.353553391f,  0.461939766f,
+        0.353553391f, -0.461939766f,  0.353553391f, -0.191341716f
+    };
+    stbi__idct_block_scaled(out, out_stride, data, table, 4);
+}
+
+static void stbi__idct_block_quarter(stbi_uc* out, int out_stride, short data[64])
+{
+    static const float table[4] = {
+        0.353553391f,  0.353553391f,
+        0.353553391f, -0.353553391f
+    };
+    stbi__idct_block_scaled(out, out_stride, data, table, 2);
+}
+
+static void stbi__idct_block_eighth(stbi_uc* out, int out_stride, short data[64])
+{
+    // only the DC coefficient, which is 8 times the block's average
+    STBI_NOTUSED(out_stride);
+    out[0] = stbi__clamp((data[0] + 4 + 8 * 128) >> 3);
+}
+
 static int stbi__process_frame_header(stbi__jpeg* z, int scan)
 {
     stbi__context* s = z->s;
@@ -3329,6 +3415,21 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         if (v_max % z->img_comp[i].v != 0) return stbi__err("bad V", "Corrupt JPEG");
     }
 
+    // pick the smallest DCT scaled size which is still at least the minimum asked for
+    z->scale_shift = 0;
+    if (stbi__jpeg_min_decode_x > 0 || stbi__jpeg_min_decode_y > 0) {
+        for (i = 3; i > 0; --i) {
+            if ((int)((s->img_x + (1u << i) - 1) >> i) >= stbi__jpeg_min_decode_x &&
+                (int)((s->img_y + (1u << i) - 1) >> i) >= stbi__jpeg_min_decode_y) {
+                z->scale_shift = i;
+                break;
+            }
+        }
+    }
+    if (z->scale_shift == 1) z->idct_block_kernel = stbi__idct_block_half;
+    else if (z->scale_shift == 2) z->idct_block_kernel = stbi__idct_block_quarter;
+    else if (z->scale_shift == 3) z->idct_block_kernel = stbi__idct_block_eighth;
+
     // compute interleaved mcu info
     z->img_h_max = h_max;
     z->img_v_max = v_max;
@@ -3349,8 +3450,9 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         //
         // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
         // so these muls can't overflow with 32-bit ints (which we require)
-        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+        // when scaled, only the reduced size blocks are kept, so memory shrinks by the same factor as the output
+        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
         z->img_comp[i].coeff = 0;
         z->img_comp[i].raw_coeff = 0;
         z->img_comp[i].linebuf = NULL;
@@ -3360,10 +3462,10 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         // align blocks for idct using mmx/sse
         z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
         if (z->progressive) {
-            // w2, h2 are multiples of 8 (see above)
-            z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-            z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+            // every coefficient is still needed until the end, whatever the scale
+            z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+            z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
             if (z->img_comp[i].raw_coeff == NULL)
                 return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
             z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3895,6 +3997,17 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
     // load a jpeg image from whichever source, but leave in YCbCr format
     if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+    // from here on, work at the reduced size. the component buffers already hold it.
+    if (z->scale_shift) {
+        int f = 1 << z->scale_shift;
+        z->s->img_x = (z->s->img_x + f - 1) >> z->scale_shift;
+        z->s->img_y = (z->s->img_y + f - 1) >> z->scale_shift;
+        for (n = 0; n < z->s->img_n; ++n) {
+            z->img_comp[n].x = (z->img_comp[n].x + f - 1) >> z->scale_shift;
+            z->img_comp[n].y = (z->img_comp[n].y + f - 1) >> z->scale_shift;
+        }
+    }
+
     // determine actual number of components to generate
     n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
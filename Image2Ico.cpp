@@ -4,10 +4,22 @@
 #include "Core/Exceptions.h"
 #include "Core/Utilities.h"
 #include "Core/StringUtils.h"
+#include "Core/JSON.h"
+#include "Core/Multithreading.h"
 #include "Image/Image.h"
+#include "Image/ICOCache.h"
+#include "Core/TimerMinimal.h"
 
 using namespace X;
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
 
 void displayAcceptedImageFormats(void)
 {
@@ -44,6 +56,713 @@ void writeAutorunFile(const std::string& strIcoFilename)
     }
 }
 
+/// \brief Returns true if the given filename has one of the extensions we are able to load.
+bool isSupportedImageFile(const std::string& strFilename)
+{
+    static const char* pExtensions[] = { "png", "jpg", "jpeg", "bmp", "tga", "psd", "gif", "hdr", "pic", "pnm", "ppm", "pgm" };
+    for (const char* pExtension : pExtensions)
+    {
+        if (StringUtils::hasFilenameExtension(strFilename, pExtension))
+            return true;
+    }
+    return false;
+}
+
+/// \brief Returns true if the given command line argument contains any wildcard characters.
+bool isWildcardPattern(const std::string& strArg)
+{
+    return strArg.find_first_of("*?") != std::string::npos;
+}
+
+/// \brief Expands a single batch mode argument into the image files it refers to and appends them to vFiles.
+///
+/// \param strArg A filename, a directory, or a wildcard pattern such as "icons/*.png".
+/// \param bRecursive Whether directories (and the directory of a wildcard pattern) are searched recursively.
+/// \param vFiles Where the found filenames are appended.
+/// \return False if the argument did not name anything which exists.
+/// 
+/// Files found through a directory or pattern are filtered by isSupportedImageFile() and sorted so that the order of the batch is repeatable.
+/// Wildcards are only supported in the filename part of a pattern, not in its directories.
+bool gatherInputFiles(const std::string& strArg, bool bRecursive, std::vector<std::string>& vFiles)
+{
+    std::error_code errorCode;
+    std::vector<std::string> vFound;
+    if (isWildcardPattern(strArg))
+    {
+        std::filesystem::path pathArg(strArg);
+        std::string strPattern = pathArg.filename().string();
+        std::filesystem::path pathDir = pathArg.parent_path();
+        if (pathDir.empty())
+            pathDir = ".";
+        if (isWildcardPattern(pathDir.string()) || !std::filesystem::is_directory(pathDir, errorCode))
+            return false;
+        for (const std::string& strFile : StringUtils::getFilesInDir(pathDir.string(), bRecursive))
+        {
+            if (isSupportedImageFile(strFile) && StringUtils::wildcardMatch(StringUtils::getFilenameFromFullPath(strFile), strPattern, false))
+                vFound.push_back(std::filesystem::path(strFile).lexically_normal().string());
+        }
+    }
+    else if (std::filesystem::is_directory(strArg, errorCode))
+    {
+        for (const std::string& strFile : StringUtils::getFilesInDir(strArg, bRecursive))
+        {
+            if (isSupportedImageFile(strFile))
+                vFound.push_back(std::filesystem::path(strFile).lexically_normal().string());
+        }
+    }
+    else if (std::filesystem::is_regular_file(strArg, errorCode))
+    {
+        // Named explicitly, so don't second guess the extension
+        vFound.push_back(strArg);
+    }
+    else
+        return false;
+
+    std::sort(vFound.begin(), vFound.end());
+    vFiles.insert(vFiles.end(), vFound.begin(), vFound.end());
+    return true;
+}
+
+/// \brief Reads the whole of the given file into vData, replacing its contents.
+///
+/// \return False if the file couldn't be read.
+bool loadFileData(const std::string& strFilename, std::vector<uint8_t>& vData)
+{
+    std::ifstream ifs(strFilename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!ifs)
+        return false;
+    const std::streamoff iSize = ifs.tellg();
+    if (iSize < 0)
+        return false;
+    vData.resize(size_t(iSize));
+    ifs.seekg(0, std::ios::beg);
+    ifs.read(reinterpret_cast<char*>(vData.data()), iSize);
+    return !ifs.fail();
+}
+
+/// \brief Parses a size such as 4096, 512K, 256M or 2G into a number of bytes.
+///
+/// \return False if the text isn't a positive size.
+bool parseSizeInBytes(const std::string& strValue, uint64_t& uiSizeInBytes)
+{
+    char* pEnd = nullptr;
+    const unsigned long long uiValue = std::strtoull(strValue.c_str(), &pEnd, 10);
+    if (pEnd == strValue.c_str() || 0 == uiValue)
+        return false;
+    std::string strSuffix = pEnd;
+    StringUtils::stringToLowercase(strSuffix);
+    uint64_t uiMultiplier = 1;
+    if ("k" == strSuffix || "kb" == strSuffix)
+        uiMultiplier = 1024ull;
+    else if ("m" == strSuffix || "mb" == strSuffix)
+        uiMultiplier = 1024ull * 1024ull;
+    else if ("g" == strSuffix || "gb" == strSuffix)
+        uiMultiplier = 1024ull * 1024ull * 1024ull;
+    else if (!strSuffix.empty())
+        return false;
+    uiSizeInBytes = uiValue * uiMultiplier;
+    return true;
+}
+
+/// \brief Parses the name of a PNG effort level, one of store, fast, default or max, in any case.
+///
+/// \return False if the name isn't one of those.
+bool parsePNGEffort(std::string strValue, CPNGEncoder::EEffort& eEffort)
+{
+    StringUtils::stringToLowercase(strValue);
+    if ("store" == strValue)
+        eEffort = CPNGEncoder::EFFORT_STORE;
+    else if ("fast" == strValue)
+        eEffort = CPNGEncoder::EFFORT_FAST;
+    else if ("default" == strValue)
+        eEffort = CPNGEncoder::EFFORT_DEFAULT;
+    else if ("max" == strValue)
+        eEffort = CPNGEncoder::EFFORT_MAX;
+    else
+        return false;
+    return true;
+}
+
+/// \brief Parses how much to sharpen the downscaled icon sizes, a number from 0 to 4. See CImage::SICOSettings::fSharpenAmount.
+///
+/// \return False if the value isn't such a number.
+bool parseSharpenAmount(const std::string& strValue, float& fAmount)
+{
+    char* pEnd = nullptr;
+    const double dValue = std::strtod(strValue.c_str(), &pEnd);
+    if (strValue.empty() || *pEnd != '\0' || !(dValue >= 0.0 && dValue <= 4.0))
+        return false;
+    fAmount = float(dValue);
+    return true;
+}
+
+/// \brief Parses the bits per pixel of the paletted icon sizes, 0 for none, 4 or 8. See CImage::SICOSettings::iPaletteBitsPerPixel.
+///
+/// \return False if the value isn't one of those.
+bool parsePaletteBits(const std::string& strValue, int& iBitsPerPixel)
+{
+    if ("0" == strValue)
+        iBitsPerPixel = 0;
+    else if ("4" == strValue)
+        iBitsPerPixel = 4;
+    else if ("8" == strValue)
+        iBitsPerPixel = 8;
+    else
+        return false;
+    return true;
+}
+
+/// \brief Parses how the paletted icon sizes are dithered, one of none, bayer or floyd-steinberg.
+///
+/// \return False if the value isn't one of those.
+bool parsePaletteDither(const std::string& strValue, CPalette::EDither& eDither)
+{
+    if ("none" == strValue)
+        eDither = CPalette::DITHER_NONE;
+    else if ("bayer" == strValue)
+        eDither = CPalette::DITHER_BAYER;
+    else if ("floyd-steinberg" == strValue)
+        eDither = CPalette::DITHER_FLOYD_STEINBERG;
+    else
+        return false;
+    return true;
+}
+
+/// \brief Time taken by each step of convertToICO(), in seconds. Steps which didn't happen are 0.
+struct SConversionTimings
+{
+    double dRead = 0.0;     ///< Reading and hashing the input file for the cache, then linking or copying a cached icon
+    double dDecode = 0.0;   ///< Loading the input image
+    double dEncode = 0.0;   ///< Resizing and encoding the icon sizes
+    double dWrite = 0.0;    ///< Writing the icon file and storing it in the cache
+    bool bCacheHit = false; ///< Whether the icon came from the cache, in which case nothing was decoded or encoded
+    size_t uiInputSize = 0; ///< Size of the input file in bytes
+    size_t uiOutputSize = 0;///< Size of the icon file in bytes
+};
+
+/// \brief Converts one image file to an icon file, as done by both batch and serve mode.
+///
+/// \param strInput The image file to load
+/// \param strOutput The icon file to write. Any existing file is removed first rather than overwritten, as it may be hard linked to a cache entry.
+/// \param settings The settings to create the icon with
+/// \param pCache The cache to look the icon up in first and to store it in after, or nullptr for no caching.
+/// \param timings Set to the time taken by each step
+/// \return An empty string on success, otherwise a description of what went wrong.
+///
+/// May be called from many threads at once. Each thread keeps its buffers between calls, so they stay allocated and
+/// warm for the next file rather than being allocated anew each time.
+std::string convertToICO(const std::string& strInput, const std::string& strOutput, const CImage::SICOSettings& settings, CICOCache* pCache, SConversionTimings& timings)
+{
+    thread_local std::vector<uint8_t> vInputData;
+    thread_local std::vector<uint8_t> vICOData;
+    timings = SConversionTimings();
+    CTimerMinimal timer;
+    timer.update();
+    try
+    {
+        std::error_code errorCode;
+        const std::uintmax_t iInputSize = std::filesystem::file_size(strInput, errorCode);
+        if (!errorCode)
+            timings.uiInputSize = size_t(iInputSize);
+
+        uint64_t uiCacheKey = 0;
+        if (pCache)
+        {
+            if (!loadFileData(strInput, vInputData))
+                return "unable to read image file";
+            uiCacheKey = CICOCache::computeKey(vInputData, settings);
+            timings.bCacheHit = pCache->fetch(uiCacheKey, strOutput);
+            timer.update();
+            timings.dRead = timer.getSecondsPast();
+            if (timings.bCacheHit)
+            {
+                const std::uintmax_t iOutputSize = std::filesystem::file_size(strOutput, errorCode);
+                if (!errorCode)
+                    timings.uiOutputSize = size_t(iOutputSize);
+                return "";
+            }
+        }
+
+        // A large JPEG photo only needs decoding at a fraction of its size to cover the largest icon
+        int iMaxIconSize = 0;
+        for (int iSize : settings.vIconSizes)
+            iMaxIconSize = std::max(iMaxIconSize, iSize);
+        // With a cache, the input file is already in memory for hashing, so decode that rather than reading the file again
+        CImage image;
+        const bool bLoaded = pCache ? image.loadFromMemory(vInputData.data(), vInputData.size(), false, iMaxIconSize) : image.load(strInput, false, iMaxIconSize);
+        if (!bLoaded)
+            return "unable to load image file";
+        timer.update();
+        timings.dDecode = timer.getSecondsPast();
+
+        if (!image.saveAsICOToMemory(vICOData, settings))
+            return "unable to create icon";
+        timer.update();
+        timings.dEncode = timer.getSecondsPast();
+
+        std::filesystem::remove(strOutput, errorCode);
+        std::ofstream ofs(strOutput, std::ios::out | std::ios::binary);
+        ofs.write(reinterpret_cast<const char*>(vICOData.data()), std::streamsize(vICOData.size()));
+        ofs.close();
+        if (ofs.fail())
+            return "unable to save icon file";
+        timings.uiOutputSize = vICOData.size();
+        if (pCache)
+            pCache->store(uiCacheKey, vICOData);
+        timer.update();
+        timings.dWrite = timer.getSecondsPast();
+    }
+    catch (CException& exception)
+    {
+        return exception.mstrException;
+    }
+    catch (std::exception& exception)
+    {
+        return exception.what();
+    }
+    return "";
+}
+
+/// \brief Converts many image files to icon files concurrently.
+///
+/// \param vArgs The command line arguments, excluding the program name.
+/// \return The process exit code, non-zero if any argument was invalid or any file failed to convert.
+/// 
+/// Arguments may be files, directories or wildcard patterns, along with these options...
+/// -j N  Convert up to N files at once. Defaults to the number of logical CPU cores.
+/// -r    Search directories recursively.
+/// -e    PNG compression effort for the icon images, one of store, fast, default or max.
+/// --sharpen AMOUNT  Sharpen the downscaled icon sizes by AMOUNT, from 0 to 4. Defaults to 0, no sharpening.
+/// --palette BITS    Write the sizes up to 32x32 as paletted BMPs of BITS, 4 or 8, bits per pixel. Defaults to 0, every size being 32 bit.
+/// --palette-png     Write the paletted sizes as paletted PNGs instead.
+/// --palette-dither MODE  How the paletted sizes are dithered, one of none, bayer or floyd-steinberg, the default.
+/// --cache DIR       Keep converted icons in DIR, keyed by the input file's contents and the settings, and reuse them for unchanged inputs.
+/// --cache-size SIZE Size the cache is trimmed to after the batch, removing the least recently used icons first. Defaults to 256M.
+/// Each output .ico file is written next to its input file. No Autorun.inf file is written in this mode as it can only name one icon.
+int runBatch(const std::vector<std::string>& vArgs)
+{
+    size_t iNumWorkers = getCPULogicalCoresCount();
+    bool bRecursive = false;
+    std::string strCacheDir;
+    uint64_t uiCacheSize = 256ull * 1024ull * 1024ull;
+    CImage::SICOSettings settings;
+    std::vector<std::string> vInputArgs;
+    for (size_t i = 0; i < vArgs.size(); i++)
+    {
+        const std::string& strArg = vArgs[i];
+        if ("-r" == strArg)
+            bRecursive = true;
+        else if ("-j" == strArg || (strArg.length() > 2 && 0 == strArg.compare(0, 2, "-j")))
+        {
+            std::string strValue;
+            if (strArg.length() > 2)
+                strValue = strArg.substr(2);
+            else if (i + 1 < vArgs.size())
+                strValue = vArgs[++i];
+            int iValue = std::atoi(strValue.c_str());
+            if (iValue < 1)
+            {
+                std::cout << "Invalid value given for -j. Please specify the number of files to convert at once, for example -j 4\n";
+                return 1;
+            }
+            iNumWorkers = size_t(iValue);
+        }
+        else if ("-e" == strArg)
+        {
+            if (!parsePNGEffort(i + 1 < vArgs.size() ? vArgs[++i] : "", settings.ePNGEffort))
+            {
+                std::cout << "Invalid value given for -e. Please specify one of store, fast, default or max.\n";
+                return 1;
+            }
+        }
+        else if ("--sharpen" == strArg)
+        {
+            if (!parseSharpenAmount(i + 1 < vArgs.size() ? vArgs[++i] : "", settings.fSharpenAmount))
+            {
+                std::cout << "Invalid value given for --sharpen. Please specify an amount from 0 to 4, for example --sharpen 0.5\n";
+                return 1;
+            }
+        }
+        else if ("--palette" == strArg)
+        {
+            if (!parsePaletteBits(i + 1 < vArgs.size() ? vArgs[++i] : "", settings.iPaletteBitsPerPixel))
+            {
+                std::cout << "Invalid value given for --palette. Please specify the bits per pixel, 4 or 8, for example --palette 8\n";
+                return 1;
+            }
+        }
+        else if ("--palette-png" == strArg)
+            settings.bPalettePNG = true;
+        else if ("--palette-dither" == strArg)
+        {
+            if (!parsePaletteDither(i + 1 < vArgs.size() ? vArgs[++i] : "", settings.ePaletteDither))
+            {
+                std::cout << "Invalid value given for --palette-dither. Please specify one of none, bayer or floyd-steinberg.\n";
+                return 1;
+            }
+        }
+        else if ("--cache" == strArg)
+        {
+            strCacheDir = i + 1 < vArgs.size() ? vArgs[++i] : "";
+            if (strCacheDir.empty())
+            {
+                std::cout << "No directory given for --cache. Please specify the cache directory, for example --cache build/icocache\n";
+                return 1;
+            }
+        }
+        else if ("--cache-size" == strArg)
+        {
+            std::string strValue = i + 1 < vArgs.size() ? vArgs[++i] : "";
+            if (!parseSizeInBytes(strValue, uiCacheSize))
+            {
+                std::cout << "Invalid value given for --cache-size. Please specify a size in bytes, optionally followed by K, M or G, for example --cache-size 512M\n";
+                return 1;
+            }
+        }
+        else if (strArg.length() > 1 && '-' == strArg[0])
+        {
+            std::cout << "Unknown option: " << strArg << "\n";
+            std::cout << "Type: Image2Ico help for more information.\n";
+            return 1;
+        }
+        else
+            vInputArgs.push_back(strArg);
+    }
+
+    // Expand all arguments into a list of files, dropping duplicates so that no two workers ever write the same output file.
+    std::vector<std::string> vFiles;
+    for (const std::string& strArg : vInputArgs)
+    {
+        if (!gatherInputFiles(strArg, bRecursive, vFiles))
+            std::cout << "No such file, directory or matching files: " << strArg << "\n";
+    }
+    std::set<std::string> setOutputs;
+    std::vector<std::string> vUnique;
+    for (const std::string& strFile : vFiles)
+    {
+        std::string strOutput = StringUtils::addFilenameExtension(".ico", strFile);
+        if (setOutputs.insert(strOutput).second)
+            vUnique.push_back(strFile);
+    }
+    vFiles.swap(vUnique);
+    if (vFiles.empty())
+    {
+        std::cout << "No image files found to convert.\n";
+        return 1;
+    }
+    if (iNumWorkers > vFiles.size())
+        iNumWorkers = vFiles.size();
+
+    // With several files in flight there is already enough parallelism, so each file's sizes are done serially
+    // rather than every worker spawning a thread per icon size as well.
+    settings.bMultithreaded = 1 == iNumWorkers;
+
+    std::unique_ptr<CICOCache> pCache;
+    if (!strCacheDir.empty())
+    {
+        try
+        {
+            pCache = std::make_unique<CICOCache>(strCacheDir, uiCacheSize);
+        }
+        catch (CException& exception)
+        {
+            std::cout << exception.mstrException << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "Converting " << vFiles.size() << " file(s) using " << iNumWorkers << " worker(s).\n";
+
+    std::atomic<size_t> atomicNumSucceeded(0);
+    std::atomic<unsigned long long> atomicBytesRead(0);
+    std::mutex mutexOutput;
+    const size_t iNumFilesWidth = std::to_string(vFiles.size()).length();
+
+    auto convertFiles = [&](size_t iFirstFile, size_t iLastFile)
+    {
+        for (size_t iFile = iFirstFile; iFile < iLastFile; iFile++)
+        {
+            const std::string& strInput = vFiles[iFile];
+            const std::string strOutput = StringUtils::addFilenameExtension(".ico", strInput);
+            CTimerMinimal timer;
+            timer.update();
+            SConversionTimings timings;
+            const std::string strError = convertToICO(strInput, strOutput, settings, pCache.get(), timings);
+            timer.update();
+
+            if (strError.empty())
+            {
+                atomicNumSucceeded++;
+                atomicBytesRead += timings.uiInputSize;
+            }
+
+            std::string strIndex = std::to_string(iFile + 1);
+            strIndex.insert(0, iNumFilesWidth - strIndex.length(), ' ');
+            std::string strStatus = "[" + strIndex + "/" + std::to_string(vFiles.size()) + "] ";
+            if (strError.empty())
+                strStatus += "OK    " + strInput + " -> " + strOutput + " (" + StringUtils::doubleToString(timer.getSecondsPast() * 1000.0, 1) + " ms" + (timings.bCacheHit ? ", cached" : "") + ")\n";
+            else
+                strStatus += "FAIL  " + strInput + ": " + strError + "\n";
+            std::lock_guard<std::mutex> lock(mutexOutput);
+            std::cout << strStatus;
+        }
+    };
+
+    CTimerMinimal timerTotal;
+    timerTotal.update();
+    // Files are handed out one at a time to the shared pool's threads and this one. Should more workers be asked for than
+    // that has, a pool of their own is made instead.
+    std::unique_ptr<CThreadPool> pOwnPool;
+    if (iNumWorkers > size_t(CThreadPool::getGlobal().getNumThreads()) + 1)
+        pOwnPool = std::make_unique<CThreadPool>((unsigned int)iNumWorkers - 1);
+    CThreadPool& pool = pOwnPool ? *pOwnPool : CThreadPool::getGlobal();
+    pool.parallelFor(0, vFiles.size(), 1, convertFiles, (unsigned int)iNumWorkers);
+    timerTotal.update();
+
+    const double dSeconds = timerTotal.getSecondsPast() > 0.0 ? timerTotal.getSecondsPast() : 1e-9;
+    const size_t iNumSucceeded = atomicNumSucceeded;
+    const double dMegabytes = double(atomicBytesRead.load()) / (1024.0 * 1024.0);
+    std::cout << "\nConverted " << iNumSucceeded << " of " << vFiles.size() << " file(s)";
+    if (iNumSucceeded != vFiles.size())
+        std::cout << " (" << vFiles.size() - iNumSucceeded << " failed)";
+    std::cout << " in " << StringUtils::doubleToString(dSeconds, 2) << " s.\n";
+    std::cout << "Throughput: " << StringUtils::doubleToString(double(iNumSucceeded) / dSeconds, 1) << " files/s, ";
+    std::cout << StringUtils::doubleToString(dMegabytes / dSeconds, 2) << " MB/s of input images.\n";
+    if (pCache)
+    {
+        const size_t iNumEvicted = pCache->evict();
+        std::cout << "Cache: " << pCache->getNumHits() << " hit(s), " << pCache->getNumMisses() << " miss(es), " << iNumEvicted << " evicted, ";
+        std::cout << StringUtils::doubleToString(double(pCache->getSizeInBytes()) / (1024.0 * 1024.0), 2) << " MB in use.\n";
+    }
+    const CPixelAllocator::SStats allocatorStats = CImage::getAllocator().getStats();
+    std::cout << "Pixel buffers: " << allocatorStats.uiNumHits << " reused, " << allocatorStats.uiNumMisses << " allocated, ";
+    std::cout << StringUtils::doubleToString(double(allocatorStats.uiPeakBytesInUse) / (1024.0 * 1024.0), 2) << " MB peak in use.\n";
+    return iNumSucceeded == vFiles.size() ? 0 : 1;
+}
+
+/// \brief Runs conversions requested as JSON on standard input until it is closed, replying to each as JSON on standard output.
+///
+/// \param vArgs The command line arguments, excluding the program name.
+/// \return The process exit code, non-zero if any argument was invalid.
+/// 
+/// Keeps one process resident for many conversions, so each only costs the conversion itself, not process startup.
+/// Each line of input is one job, an object with these members...
+/// "input"       The image file to convert. Required.
+/// "output"      The icon file to write. Defaults to the input file name with a .ico extension.
+/// "id"          Any value, copied to the reply so replies can be matched to jobs, as they are sent in the order jobs finish.
+/// "sizes"       Array of icon sizes, overriding the default sizes.
+/// "effort"      PNG compression effort, one of store, fast, default or max, overriding -e.
+/// "passthrough" false to always encode the source image's own size rather than storing its PNG as is.
+/// "sharpen"     How much to sharpen the downscaled sizes, from 0 to 4, overriding --sharpen.
+/// "palette"     Bits per pixel of the paletted sizes, 0, 4 or 8, overriding --palette.
+/// "palette_png" true to write the paletted sizes as PNGs, overriding --palette-png.
+/// "palette_dither" One of none, bayer or floyd-steinberg, overriding --palette-dither.
+/// Each reply is one line, an object holding "id" (if given), "ok", then either "error" or "output", "bytes" and "cached",
+/// followed by "timings_ms" holding the milliseconds spent in each step: queued, read, decode, encode, write and total.
+/// Options are -j N, -e effort, --sharpen AMOUNT, --palette BITS, --palette-png, --palette-dither MODE, --cache DIR and --cache-size SIZE, the same as batch mode.
+/// A front end which needs a socket can connect one to this process's standard input and output, with socat for example.
+int runServe(const std::vector<std::string>& vArgs)
+{
+    unsigned int uiNumWorkers = 0;
+    std::string strCacheDir;
+    uint64_t uiCacheSize = 256ull * 1024ull * 1024ull;
+    CImage::SICOSettings settingsDefault;
+    for (size_t i = 0; i < vArgs.size(); i++)
+    {
+        const std::string& strArg = vArgs[i];
+        std::string strValue = i + 1 < vArgs.size() ? vArgs[i + 1] : "";
+        if ("--serve" == strArg)
+            continue;
+        if ("-j" == strArg && std::atoi(strValue.c_str()) > 0)
+            uiNumWorkers = (unsigned int)std::atoi(strValue.c_str());
+        else if ("-e" == strArg && parsePNGEffort(strValue, settingsDefault.ePNGEffort))
+            ;
+        else if ("--sharpen" == strArg && parseSharpenAmount(strValue, settingsDefault.fSharpenAmount))
+            ;
+        else if ("--palette" == strArg && parsePaletteBits(strValue, settingsDefault.iPaletteBitsPerPixel))
+            ;
+        else if ("--palette-png" == strArg)
+        {
+            // Takes no value
+            settingsDefault.bPalettePNG = true;
+            continue;
+        }
+        else if ("--palette-dither" == strArg && parsePaletteDither(strValue, settingsDefault.ePaletteDither))
+            ;
+        else if ("--cache" == strArg && !strValue.empty())
+            strCacheDir = strValue;
+        else if ("--cache-size" == strArg && parseSizeInBytes(strValue, uiCacheSize))
+            ;
+        else
+        {
+            std::cerr << "Invalid option for serve mode: " << strArg << "\n";
+            std::cerr << "Type: Image2Ico help for more information.\n";
+            return 1;
+        }
+        i++;
+    }
+
+    std::unique_ptr<CICOCache> pCache;
+    if (!strCacheDir.empty())
+    {
+        try
+        {
+            pCache = std::make_unique<CICOCache>(strCacheDir, uiCacheSize);
+        }
+        catch (CException& exception)
+        {
+            std::cerr << exception.mstrException << "\n";
+            return 1;
+        }
+    }
+
+    // Without -j, jobs share the pool used by everything else, which has a thread per logical CPU core
+    std::unique_ptr<CThreadPool> pOwnPool;
+    if (uiNumWorkers > 0)
+        pOwnPool = std::make_unique<CThreadPool>(uiNumWorkers);
+    CThreadPool& pool = pOwnPool ? *pOwnPool : CThreadPool::getGlobal();
+    // As with batch mode, concurrent jobs give enough parallelism without each also using a thread per icon size
+    settingsDefault.bMultithreaded = 1 == pool.getNumThreads();
+
+    std::mutex mutexOutput;
+    std::mutex mutexEvict;
+    std::atomic<size_t> atomicNumStored(0);
+    auto sendReply = [&mutexOutput](const CJSONValue& reply)
+    {
+        const std::string strLine = reply.toString() + "\n";
+        std::lock_guard<std::mutex> lock(mutexOutput);
+        std::cout << strLine << std::flush;
+    };
+    auto secondsToMs = [](double dSeconds) { return CJSONValue(std::round(dSeconds * 1000000.0) / 1000.0); };
+
+    std::string strLine;
+    while (std::getline(std::cin, strLine))
+    {
+        if (!strLine.empty() && '\r' == strLine.back())
+            strLine.pop_back();
+        if (strLine.find_first_not_of(" \t") == std::string::npos)
+            continue;
+
+        // Timed from when the job is read, so that time spent waiting for a worker is reported too
+        CTimerMinimal timerQueued;
+        timerQueued.update();
+
+        CJSONValue job;
+        std::string strError;
+        CJSONValue reply = CJSONValue::makeObject();
+        if (!CJSONValue::parse(strLine, job, strError))
+            strError = "invalid JSON: " + strError;
+        else if (!job.isObject())
+            strError = "each job must be a JSON object";
+        if (job.isObject() && job.find("id"))
+            reply.set("id", *job.find("id"));
+
+        // Read the job's settings, so any mistake is replied to straight away rather than queued
+        CImage::SICOSettings settings = settingsDefault;
+        std::string strInput;
+        std::string strOutput;
+        if (strError.empty())
+        {
+            const CJSONValue* pInput = job.find("input");
+            const CJSONValue* pOutput = job.find("output");
+            const CJSONValue* pSizes = job.find("sizes");
+            const CJSONValue* pEffort = job.find("effort");
+            const CJSONValue* pPassthrough = job.find("passthrough");
+            const CJSONValue* pSharpen = job.find("sharpen");
+            const CJSONValue* pPalette = job.find("palette");
+            const CJSONValue* pPalettePNG = job.find("palette_png");
+            const CJSONValue* pPaletteDither = job.find("palette_dither");
+            if (!pInput || !pInput->isString() || pInput->getString().empty())
+                strError = "\"input\" must be the image file name";
+            else if (pOutput && (!pOutput->isString() || pOutput->getString().empty()))
+                strError = "\"output\" must be the icon file name";
+            else if (pEffort && (!pEffort->isString() || !parsePNGEffort(pEffort->getString(), settings.ePNGEffort)))
+                strError = "\"effort\" must be one of store, fast, default or max";
+            else if (pPassthrough && !pPassthrough->isBool())
+                strError = "\"passthrough\" must be true or false";
+            else if (pSharpen && (!pSharpen->isNumber() || !(pSharpen->getNumber() >= 0.0 && pSharpen->getNumber() <= 4.0)))
+                strError = "\"sharpen\" must be a number from 0 to 4";
+            else if (pPalette && (!pPalette->isNumber() || (pPalette->getNumber() != 0.0 && pPalette->getNumber() != 4.0 && pPalette->getNumber() != 8.0)))
+                strError = "\"palette\" must be 0, 4 or 8";
+            else if (pPalettePNG && !pPalettePNG->isBool())
+                strError = "\"palette_png\" must be true or false";
+            else if (pPaletteDither && (!pPaletteDither->isString() || !parsePaletteDither(pPaletteDither->getString(), settings.ePaletteDither)))
+                strError = "\"palette_dither\" must be one of none, bayer or floyd-steinberg";
+            else if (pSizes)
+            {
+                settings.vIconSizes.clear();
+                for (size_t i = 0; pSizes->isArray() && i < pSizes->size(); i++)
+                {
+                    const CJSONValue& size = pSizes->at(i);
+                    if (!size.isNumber() || size.getNumber() < 1 || size.getNumber() > 256 || std::floor(size.getNumber()) != size.getNumber())
+                        break;
+                    settings.vIconSizes.push_back(int(size.getNumber()));
+                }
+                if (!pSizes->isArray() || settings.vIconSizes.empty() || settings.vIconSizes.size() != pSizes->size())
+                    strError = "\"sizes\" must be an array of whole numbers from 1 to 256";
+            }
+            if (strError.empty())
+            {
+                strInput = pInput->getString();
+                strOutput = pOutput ? pOutput->getString() : StringUtils::addFilenameExtension(".ico", strInput);
+                if (pPassthrough)
+                    settings.bAllowPNGPassthrough = pPassthrough->getBool();
+                if (pSharpen)
+                    settings.fSharpenAmount = float(pSharpen->getNumber());
+                if (pPalette)
+                    settings.iPaletteBitsPerPixel = int(pPalette->getNumber());
+                if (pPalettePNG)
+                    settings.bPalettePNG = pPalettePNG->getBool();
+            }
+        }
+        if (!strError.empty())
+        {
+            reply.set("ok", false);
+            reply.set("error", strError);
+            sendReply(reply);
+            continue;
+        }
+
+        pool.add([=, &sendReply, &secondsToMs, &pCache, &mutexEvict, &atomicNumStored]() mutable
+        {
+            timerQueued.update();
+            const double dQueued = timerQueued.getSecondsPast();
+            SConversionTimings timings;
+            const std::string strJobError = convertToICO(strInput, strOutput, settings, pCache.get(), timings);
+
+            reply.set("ok", strJobError.empty());
+            if (strJobError.empty())
+            {
+                reply.set("output", strOutput);
+                reply.set("bytes", double(timings.uiOutputSize));
+                reply.set("cached", timings.bCacheHit);
+            }
+            else
+                reply.set("error", strJobError);
+            CJSONValue timingsMs = CJSONValue::makeObject();
+            timingsMs.set("queued", secondsToMs(dQueued));
+            timingsMs.set("read", secondsToMs(timings.dRead));
+            timingsMs.set("decode", secondsToMs(timings.dDecode));
+            timingsMs.set("encode", secondsToMs(timings.dEncode));
+            timingsMs.set("write", secondsToMs(timings.dWrite));
+            timingsMs.set("total", secondsToMs(dQueued + timings.dRead + timings.dDecode + timings.dEncode + timings.dWrite));
+            reply.set("timings_ms", timingsMs);
+            sendReply(reply);
+
+            // Keep a long running process's cache within its limit as it goes, rather than only when the input is closed
+            if (pCache && strJobError.empty() && !timings.bCacheHit && 0 == ++atomicNumStored % 64)
+            {
+                std::lock_guard<std::mutex> lock(mutexEvict);
+                pCache->evict();
+            }
+        });
+    }
+    pool.waitForAll();
+    if (pCache)
+        pCache->evict();
+    return 0;
+}
+
 /// \brief Main entry point of application
 ///
 /// \param argc The number of arguments passed to the program
@@ -60,6 +779,23 @@ int main(int argc, char* argv[])
         std::cout << "Type: Image2Ico help for more information.\n";
         return 0;
     }
+
+    // Batch mode is used for more than one argument, or for a single directory, pattern or option
+    bool bBatchMode = argc > 2;
+    if (argc == 2)
+    {
+        std::error_code errorCode;
+        const std::string strArg = argv[1];
+        bBatchMode = isWildcardPattern(strArg) || '-' == strArg[0] || std::filesystem::is_directory(strArg, errorCode);
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string("--serve") == argv[i])
+            return runServe(std::vector<std::string>(argv + 1, argv + argc));
+    }
+    if (bBatchMode)
+        return runBatch(std::vector<std::string>(argv + 1, argv + argc));
+
     if (argc == 2)
     {
         std::string strParam = argv[1];
@@ -76,6 +812,28 @@ int main(int argc, char* argv[])
             std::cout << "\n";
             std::cout << "This also creates and saves a text file \"Autorun.inf\" with the name of the converted .ico file.\n";
 			std::cout << "This \"Autorun.inf\" file can be copied, along with the output .ico file to a USB stick, or hard drive, to create a custom icon for the drive.\n";
+            std::cout << "\n";
+            std::cout << "Batch mode converts many images at once.\n";
+            std::cout << "Usage: Image2Ico [-j N] [-r] [-e effort] [--sharpen AMOUNT] [--palette BITS [--palette-png] [--palette-dither MODE]] [--cache DIR [--cache-size SIZE]] <image file, directory or pattern> [more...]\n";
+            std::cout << "Example: Image2Ico -j 8 -r assets/icons \"logos/*.png\" splash.jpg\n";
+            std::cout << "Each image is saved as an icon file next to the original, with a status line per file and a summary of throughput at the end.\n";
+            std::cout << "-j N  Convert up to N files at once. Defaults to the number of logical CPU cores.\n";
+            std::cout << "-r    Search directories, and the directory of a pattern, recursively.\n";
+            std::cout << "-e    PNG compression effort, one of store, fast, default or max. Store is the quickest, max gives the smallest files.\n";
+            std::cout << "--sharpen AMOUNT   Sharpen the icon sizes smaller than the image, from 0 (the default) to 4. Around 0.5 restores detail softened by downscaling.\n";
+            std::cout << "--palette BITS     Write the icon sizes up to 32x32 with a palette of their own, at 4 (16 colours) or 8 (256 colours) bits per pixel, for old software and the smallest files.\n";
+            std::cout << "--palette-png      Write the paletted sizes as PNGs rather than BMPs. Smaller, but Windows XP and earlier can't read them.\n";
+            std::cout << "--palette-dither MODE  How the paletted sizes are dithered, one of none, bayer or floyd-steinberg (the default).\n";
+            std::cout << "--cache DIR        Reuse icons kept in DIR for inputs and settings which are unchanged since an earlier run, without decoding anything.\n";
+            std::cout << "--cache-size SIZE  Size the cache is trimmed to, removing the least recently used icons first, such as 512M or 2G. Defaults to 256M.\n";
+            std::cout << "Patterns may use * and ? in the file name part only. No \"Autorun.inf\" file is written in batch mode.\n";
+            std::cout << "\n";
+            std::cout << "Serve mode stays running and converts images as they are requested, without starting a new process each time.\n";
+            std::cout << "Usage: Image2Ico --serve [-j N] [-e effort] [--sharpen AMOUNT] [--palette BITS [--palette-png] [--palette-dither MODE]] [--cache DIR [--cache-size SIZE]]\n";
+            std::cout << "Each line of standard input is a job such as {\"id\": 1, \"input\": \"logo.png\", \"output\": \"logo.ico\", \"sizes\": [16, 32, 256], \"effort\": \"fast\"}\n";
+            std::cout << "Only \"input\" is required. Each job is replied to with a line on standard output as it finishes, such as...\n";
+            std::cout << "{\"id\":1,\"ok\":true,\"output\":\"logo.ico\",\"bytes\":12345,\"cached\":false,\"timings_ms\":{\"queued\":0.01,\"read\":0,\"decode\":1.2,\"encode\":3.4,\"write\":0.1,\"total\":4.71}}\n";
+            std::cout << "or {\"id\":1,\"ok\":false,\"error\":\"unable to load image file\",...}. The process exits once standard input is closed and all jobs are done.\n";
 			std::cout << "Any issues, please contact the developer.\n";
             std::cout << "Developer's e-mail address is djpcradock@gmail.com\n";
         }
@@ -83,8 +841,11 @@ int main(int argc, char* argv[])
         {
             // strParam should be the file name of the image to convert if we get here
 
+            // A large JPEG only needs decoding at the largest size saveAsICO() writes, so may be decoded smaller than it is
+            const CImage::SICOSettings settings;
+            const int iMaxIconSize = *std::max_element(settings.vIconSizes.begin(), settings.vIconSizes.end());
             CImage image;
-            if (!image.load(argv[1]))
+            if (!image.load(argv[1], false, iMaxIconSize))
             {
 				std::cout << "Unable to load image file: " << strParam << "\n";
                 std::cout << "\n";
@@ -95,13 +856,15 @@ int main(int argc, char* argv[])
             if (image.getWidth() != 256 || image.getHeight() != 256)
             {
                 std::cout << "Input image should ideally have dimensions of 256x256.\n";
-				std::cout << "The input image's current dimensions are: " << image.getWidth() << "x" << image.getHeight() << "\n";
+				std::cout << "The input image's current dimensions, as decoded, are: " << image.getWidth() << "x" << image.getHeight() << "\n";
 				std::cout << "The image will be resized to 256x256.\n";
 				std::cout << "For optimal results, please use an image with dimensions of 256x256.\n";
             }
             
 			strParam = StringUtils::addFilenameExtension(".ico", strParam);
-            if (!image.saveAsICO(strParam))
+            std::error_code errorCode;
+            std::filesystem::remove(strParam, errorCode);   // In case it's hard linked to a batch mode cache entry
+            if (!image.saveAsICO(strParam, settings))
 				std::cout << "Image file could not be saved as an icon file.\n";
             else
 				std::cout << "Image file saved as an icon file: " << strParam << "\n";
@@ -110,13 +873,6 @@ int main(int argc, char* argv[])
             return 0;
         }
     }
-    else
-    {
-		std::cout << "Too many arguments passed. Please specify only the image file name to convert to an icon file.\n";
-		std::cout << "Usage: Image2Ico <image file name>\n";
-		std::cout << "Example: Image2Ico myimage.png\n";
-		std::cout << "Type: Image2Ico help for more information.\n";
-    }
 
     return 0;
 }
@@ -0,0 +1,160 @@
+#include "Tests.h"
+#include "../Image/Image.h"
+#include "../Core/Utilities.h"
+#include <cstring>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief Returns the little endian 16 bit value at pData
+		unsigned int readUInt16(const uint8_t* pData)
+		{
+			return pData[0] | (pData[1] << 8);
+		}
+
+		/// \brief Returns the little endian 32 bit value at pData
+		unsigned int readUInt32(const uint8_t* pData)
+		{
+			return pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((unsigned int)pData[3] << 24);
+		}
+
+		/// \brief Decodes a 4 or 8 bit per pixel BMP entry of a .ico file, as written for paletted sizes, into an RGBA image.
+		///
+		/// Pixels set in the AND mask are given alpha 0, the rest alpha 255. Returns false if the entry isn't such a BMP of iSize pixels square.
+		bool decodeICOPalettedBMP(const uint8_t* pData, size_t uiSize, int iSize, CImage& image)
+		{
+			// BITMAPINFOHEADER, whose height includes the AND mask's rows
+			if (uiSize < 40 || readUInt32(pData) != 40 || readUInt32(pData + 4) != unsigned(iSize) || readUInt32(pData + 8) != unsigned(iSize) * 2)
+				return false;
+			const unsigned int uiBitCount = readUInt16(pData + 14);
+			if (readUInt16(pData + 12) != 1 || (uiBitCount != 4 && uiBitCount != 8) || readUInt32(pData + 16) != 0)
+				return false;
+			const unsigned int uiNumColours = readUInt32(pData + 32) ? readUInt32(pData + 32) : 1u << uiBitCount;
+			const size_t uiRowSize = size_t((iSize * uiBitCount + 31) / 32) * 4;
+			const size_t uiMaskRowSize = size_t((iSize + 31) / 32) * 4;
+			if (uiNumColours > (1u << uiBitCount) || uiSize != 40 + size_t(uiNumColours) * 4 + (uiRowSize + uiMaskRowSize) * iSize)
+				return false;
+
+			// The colour table is BGRX, and both the indices and mask are bottom-up
+			const uint8_t* pColours = pData + 40;
+			const uint8_t* pIndices = pColours + size_t(uiNumColours) * 4;
+			const uint8_t* pMask = pIndices + uiRowSize * iSize;
+			image.createBlank(iSize, iSize, 4);
+			uint8_t* pPixel = image.getData();
+			for (int iY = 0; iY < iSize; iY++)
+			{
+				const uint8_t* pRow = pIndices + uiRowSize * (iSize - 1 - iY);
+				const uint8_t* pMaskRow = pMask + uiMaskRowSize * (iSize - 1 - iY);
+				for (int iX = 0; iX < iSize; iX++, pPixel += 4)
+				{
+					const unsigned int uiIndex = 4 == uiBitCount ? (pRow[iX / 2] >> (iX & 1 ? 0 : 4)) & 15 : pRow[iX];
+					if (uiIndex >= uiNumColours)
+						return false;
+					pPixel[0] = pColours[uiIndex * 4 + 2];
+					pPixel[1] = pColours[uiIndex * 4 + 1];
+					pPixel[2] = pColours[uiIndex * 4];
+					pPixel[3] = pMaskRow[iX / 8] & (0x80 >> (iX & 7)) ? 0 : 255;
+				}
+			}
+			return true;
+		}
+	}
+
+	bool decodeICO(const std::vector<uint8_t>& vICOData, std::vector<CImage>& vEntries)
+	{
+		vEntries.clear();
+		// ICONDIR is 6 bytes, followed by a 16 byte ICONDIRENTRY for each image
+		if (vICOData.size() < 6 || readUInt16(&vICOData[0]) != 0 || readUInt16(&vICOData[2]) != 1)
+			return false;
+		const unsigned int uiNumEntries = readUInt16(&vICOData[4]);
+		if (vICOData.size() < 6 + size_t(16) * uiNumEntries)
+			return false;
+		const uint8_t kPNGSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+		for (unsigned int uiEntry = 0; uiEntry < uiNumEntries; uiEntry++)
+		{
+			const uint8_t* pEntry = &vICOData[6 + size_t(16) * uiEntry];
+			const unsigned int uiSize = pEntry[0] ? pEntry[0] : 256;
+			const size_t uiBytesInRes = readUInt32(pEntry + 8);
+			const size_t uiOffset = readUInt32(pEntry + 12);
+			if (uiOffset > vICOData.size() || uiBytesInRes > vICOData.size() - uiOffset || uiBytesInRes < sizeof(kPNGSignature))
+				return false;
+			const uint8_t* pImageData = &vICOData[uiOffset];
+			CImage image;
+			if (0 != std::memcmp(pImageData, kPNGSignature, sizeof(kPNGSignature)))
+			{
+				if (!decodeICOPalettedBMP(pImageData, uiBytesInRes, int(uiSize), image))
+					return false;
+			}
+			else if (!image.loadFromMemory(pImageData, uiBytesInRes))
+				return false;
+			if (image.getWidth() != uiSize || image.getHeight() != uiSize)
+				return false;
+			if (3 == image.getNumChannels())
+				image.addAlphaChannel(255);
+			vEntries.push_back(image);
+		}
+		return true;
+	}
+
+	void testResizePyramid(CTestResults& results)
+	{
+		// A detailed image, whose fine structure is where resampling from a smaller size rather than the source would differ most,
+		// and one with transparent corners, so alpha is resampled too.
+		// Neither is a power of two, so each size of the pyramid is resampled by a ratio other than exactly two.
+		CImage imageMandelbrot;
+		imageMandelbrot.createBlank(700, 700, 4);
+		CColourRamp colourRamp;
+		colourRamp.addPoint(0.5f, CColourf(1.0f, 0.5f, 0.0f, 1.0f));
+		imageMandelbrot.fillMandelbrotMT(colourRamp, -2.0, 0.5, -1.25, 1.25, 200);
+		CImage imageWheel;
+		imageWheel.createColourWheel(777);
+		const CImage* kSources[] = { &imageMandelbrot, &imageWheel };
+		const char* kSourceNames[] = { "Mandelbrot", "colour wheel" };
+
+		// Each smaller size is resampled from one already resampled, so the floor drops with each step down the pyramid.
+		// The largest size is resampled from the source either way, so must be identical.
+		struct SSize
+		{
+			int iSize;
+			double dMinPSNR;
+		};
+		const SSize kSizes[] =
+		{
+			{ 256, kMaxDouble },
+			{ 128, 42.0 },
+			{ 64, 38.0 },
+			{ 48, 40.0 },
+			{ 32, 35.0 },
+			{ 16, 32.0 }
+		};
+
+		CImage::SICOSettings settings;
+		settings.vIconSizes.clear();
+		for (const SSize& size : kSizes)
+			settings.vIconSizes.push_back(size.iSize);
+		settings.ePNGEffort = CPNGEncoder::EFFORT_FAST;
+		settings.bAllowPNGPassthrough = false;
+		for (size_t uiSource = 0; uiSource < sizeof(kSources) / sizeof(kSources[0]); uiSource++)
+		{
+			std::vector<CImage> vEntries[2];
+			for (int iPyramid = 0; iPyramid < 2; iPyramid++)
+			{
+				settings.bUseResizePyramid = 1 == iPyramid;
+				std::vector<uint8_t> vICOData;
+				const std::string strWhat = std::string(kSourceNames[uiSource]) + (settings.bUseResizePyramid ? " with" : " without") + " the resize pyramid";
+				if (!results.check(kSources[uiSource]->saveAsICOToMemory(vICOData, settings), strWhat + " is saved"))
+					return;
+				if (!results.check(decodeICO(vICOData, vEntries[iPyramid]) && vEntries[iPyramid].size() == settings.vIconSizes.size(), strWhat + " decodes to each size"))
+					return;
+			}
+
+			for (size_t i = 0; i < settings.vIconSizes.size(); i++)
+			{
+				const double dPSNR = vEntries[1][i].computePSNR(vEntries[0][i]);
+				const std::string strSize = std::to_string(kSizes[i].iSize);
+				results.check(dPSNR >= kSizes[i].dMinPSNR, std::string(kSourceNames[uiSource]) + " " + strSize + "x" + strSize + " from the resize pyramid has a PSNR of " + std::to_string(dPSNR) + "dB against resizing the source, under the floor of " + std::to_string(kSizes[i].dMinPSNR) + "dB");
+			}
+		}
+	}
+}
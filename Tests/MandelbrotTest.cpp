@@ -0,0 +1,126 @@
+#include "Tests.h"
+#include "../Image/Image.h"
+#include <cstring>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief A view of the set for fillMandelbrot() and fillMandelbrotMT()
+		struct SMandelbrotView
+		{
+			const char* pszName;			///< Name of the view, for CTestResults::check()
+			double dMinX;					///< Real part of the left edge
+			double dMaxX;					///< Real part of the right edge
+			double dMinY;					///< Imaginary part of the top edge
+			double dMaxY;					///< Imaginary part of the bottom edge
+			unsigned int uiMaxIterations;	///< The most iterations counted
+		};
+
+		/// \brief Returns whether two images hold the same pixels
+		bool isSamePixels(const CImage& a, const CImage& b)
+		{
+			return a.getWidth() == b.getWidth() && a.getHeight() == b.getHeight() && a.getNumChannels() == b.getNumChannels() &&
+				0 == std::memcmp(a.getData(), b.getData(), a.getDataSize());
+		}
+	}
+
+	void testMandelbrot(CTestResults& results)
+	{
+		// The whole set, a zoom into the edge of the set where neighbouring counts vary the most, one deep enough that the steps
+		// between pixels are a few bits from the last of a double's, one iteration alone, and one counting past the colour table
+		const SMandelbrotView kViews[] =
+		{
+			{ "whole set", -2.5, 1.5, -1.0, 1.0, 100 },
+			{ "seahorse valley", -0.7485, -0.7445, 0.0575, 0.1005, 600 },
+			{ "deep zoom", -0.743643887037151 - 2e-12, -0.743643887037151 + 2e-12, 0.13182590420533 - 1.5e-12, 0.13182590420533 + 1.5e-12, 3000 },
+			{ "one iteration", -2.5, 1.5, -1.0, 1.0, 1 },
+			{ "past the colour table", -0.8, -0.7, 0.05, 0.15, CImage::kMandelbrotColourTableMax + 100 }
+		};
+
+		// Sizes either side of a tile, and some which leave part tiles along the right and bottom
+		struct SSize
+		{
+			unsigned int uiWidth;
+			unsigned int uiHeight;
+		};
+		const SSize kSizes[] = { { 1, 1 }, { 31, 33 }, { 100, 37 }, { 97, 70 } };
+
+		CColourRamp colourRamp;
+		colourRamp.addPoint(0.1f, CColourf(0.0f, 0.3f, 1.0f, 1.0f));
+		colourRamp.addPoint(0.5f, CColourf(1.0f, 0.8f, 0.0f, 0.5f));
+
+		for (const SMandelbrotView& view : kViews)
+		{
+			for (const SSize& size : kSizes)
+			{
+				// The largest count costs the most at the larger sizes, and isn't needed to cover their part tiles
+				if (view.uiMaxIterations > CImage::kMandelbrotColourTableMax && size.uiWidth * size.uiHeight > 31 * 33)
+					continue;
+				for (unsigned short usNumChannels = 3; usNumChannels <= 4; usNumChannels++)
+				{
+					for (int iShortcuts = 0; iShortcuts < 8; iShortcuts++)
+					{
+						CImage::SMandelbrotShortcuts shortcuts;
+						shortcuts.bSkipBulbs = 0 != (iShortcuts & 1);
+						shortcuts.bCheckPeriodicity = 0 != (iShortcuts & 2);
+						shortcuts.bSubdivide = 0 != (iShortcuts & 4);
+
+						CImage imageScalar;
+						imageScalar.createBlank(size.uiWidth, size.uiHeight, usNumChannels);
+						imageScalar.fillMandelbrot(colourRamp, view.dMinX, view.dMaxX, view.dMinY, view.dMaxY, view.uiMaxIterations, shortcuts);
+						CImage imageMT;
+						imageMT.createBlank(size.uiWidth, size.uiHeight, usNumChannels);
+						imageMT.fillMandelbrotMT(colourRamp, view.dMinX, view.dMaxX, view.dMinY, view.dMaxY, view.uiMaxIterations, shortcuts);
+						results.check(isSamePixels(imageScalar, imageMT), std::string(view.pszName) + " " + std::to_string(size.uiWidth) + "x" + std::to_string(size.uiHeight) +
+							" of " + std::to_string(usNumChannels) + " channels, shortcuts " + std::to_string(iShortcuts) + ", is the same from fillMandelbrotMT() as fillMandelbrot()");
+					}
+				}
+			}
+		}
+	}
+
+	void testMandelbrotShortcuts(CTestResults& results)
+	{
+		// Large enough that the set's edge crosses many tiles, where subdivision is most likely to miss a pixel
+		const SMandelbrotView kViews[] =
+		{
+			{ "whole set", -2.5, 1.5, -1.0, 1.0, 500 },
+			{ "seahorse valley", -0.7485, -0.7445, 0.0575, 0.1005, 2000 },
+			{ "period 3 bulb", -0.2, 0.0, 0.65, 0.85, 1000 }
+		};
+		const unsigned int kWidth = 960;
+		const unsigned int kHeight = 640;
+		// Subdivision may only miss threads thinner than a pixel, so the pixels it changes must be few
+		const double kMaxSubdividedFraction = 0.001;
+
+		for (const SMandelbrotView& view : kViews)
+		{
+			CImage imagePlain;
+			imagePlain.createBlank(kWidth, kHeight, 4);
+			imagePlain.fillMandelbrotMT(CColourRamp(), view.dMinX, view.dMaxX, view.dMinY, view.dMaxY, view.uiMaxIterations);
+
+			CImage imageExact;
+			imageExact.createBlank(kWidth, kHeight, 4);
+			imageExact.fillMandelbrotMT(CColourRamp(), view.dMinX, view.dMaxX, view.dMinY, view.dMaxY, view.uiMaxIterations, CImage::SMandelbrotShortcuts::exact());
+			results.check(isSamePixels(imagePlain, imageExact), std::string(view.pszName) + " is the same with the exact shortcuts as without");
+
+			CImage::SMandelbrotShortcuts shortcuts = CImage::SMandelbrotShortcuts::exact();
+			shortcuts.bSubdivide = true;
+			CImage imageSubdivided;
+			imageSubdivided.createBlank(kWidth, kHeight, 4);
+			imageSubdivided.fillMandelbrotMT(CColourRamp(), view.dMinX, view.dMaxX, view.dMinY, view.dMaxY, view.uiMaxIterations, shortcuts);
+			size_t uiNumDifferent = 0;
+			const unsigned char* pPlain = imagePlain.getData();
+			const unsigned char* pSubdivided = imageSubdivided.getData();
+			for (size_t uiPixel = 0; uiPixel < size_t(kWidth) * kHeight; uiPixel++)
+			{
+				if (0 != std::memcmp(pPlain + uiPixel * 4, pSubdivided + uiPixel * 4, 4))
+					uiNumDifferent++;
+			}
+			const double dFraction = double(uiNumDifferent) / (double(kWidth) * kHeight);
+			results.check(dFraction <= kMaxSubdividedFraction, std::string(view.pszName) + " subdivided has " + std::to_string(uiNumDifferent) + " pixels different to without, more than " +
+				std::to_string(kMaxSubdividedFraction * 100.0) + "%");
+		}
+	}
+}
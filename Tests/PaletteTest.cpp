@@ -0,0 +1,206 @@
+#include "Tests.h"
+#include "../Image/Image.h"
+#include "../Image/Palette.h"
+#include "../Core/Utilities.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <set>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief Returns the next value of a fixed xorshift sequence, so every run checks the same data.
+		unsigned int nextRandom(void)
+		{
+			static unsigned int uiState = 88172645u;
+			uiState ^= uiState << 13;
+			uiState ^= uiState >> 17;
+			uiState ^= uiState << 5;
+			return uiState;
+		}
+
+		/// \brief Returns the squared distance between two RGB colours
+		int distanceSquared(const uint8_t* pA, const uint8_t* pB)
+		{
+			int iDistance = 0;
+			for (int iChannel = 0; iChannel < 3; iChannel++)
+				iDistance += (int(pA[iChannel]) - int(pB[iChannel])) * (int(pA[iChannel]) - int(pB[iChannel]));
+			return iDistance;
+		}
+
+		/// \brief Returns the index of the colour of vColours nearest pRGB by comparing every one, the lowest of equally near colours
+		int findNearestByBruteForce(const std::vector<uint8_t>& vColours, const uint8_t* pRGB)
+		{
+			int iBest = 0;
+			int iBestDistance = INT_MAX;
+			for (size_t uiColour = 0; uiColour < vColours.size() / 3; uiColour++)
+			{
+				const int iDistance = distanceSquared(&vColours[uiColour * 3], pRGB);
+				if (iDistance < iBestDistance)
+				{
+					iBestDistance = iDistance;
+					iBest = int(uiColour);
+				}
+			}
+			return iBest;
+		}
+
+		/// \brief Checks that mapPixels() without dithering gives each pixel the index a brute force search does
+		void checkMapPixels(CTestResults& results, const CPalette& palette, const std::vector<uint8_t>& vPixels, const std::string& strWhat)
+		{
+			const int iNumPixels = int(vPixels.size() / 3);
+			std::vector<uint8_t> vIndices(vPixels.size() / 3);
+			palette.mapPixels(vPixels.data(), iNumPixels, 1, 3, CPalette::DITHER_NONE, -1, vIndices.data());
+			int iNumWrong = 0;
+			for (int iPixel = 0; iPixel < iNumPixels; iPixel++)
+			{
+				if (vIndices[size_t(iPixel)] != findNearestByBruteForce(palette.getColours(), &vPixels[size_t(iPixel) * 3]))
+					iNumWrong++;
+			}
+			results.check(0 == iNumWrong, strWhat + " maps every pixel to the nearest colour, " + std::to_string(iNumWrong) + " of " + std::to_string(iNumPixels) + " weren't");
+		}
+
+		/// \brief Checks mapPixels() against a brute force search, for random palettes and palettes bunched up where the grid's cells are least even
+		void checkNearest(CTestResults& results)
+		{
+			// Random pixels, and the corners of each of the grid's cells and either side of them
+			std::vector<uint8_t> vPixels(size_t(20000) * 3);
+			for (uint8_t& ucValue : vPixels)
+				ucValue = uint8_t(nextRandom());
+			const int kCellEdges[] = { 0, 1, 31, 32, 33, 63, 64, 127, 128, 129, 223, 224, 254, 255 };
+			for (int r : kCellEdges)
+			{
+				for (int g : kCellEdges)
+				{
+					for (int b : kCellEdges)
+					{
+						vPixels.push_back(uint8_t(r));
+						vPixels.push_back(uint8_t(g));
+						vPixels.push_back(uint8_t(b));
+					}
+				}
+			}
+
+			const int kNumColours[] = { 1, 2, 3, 15, 16, 100, 255, 256 };
+			for (int iNumColours : kNumColours)
+			{
+				// Uniformly random, so most cells have a few candidates
+				std::vector<uint8_t> vColours(size_t(iNumColours) * 3);
+				for (uint8_t& ucValue : vColours)
+					ucValue = uint8_t(nextRandom());
+				CPalette palette;
+				palette.setColours(vColours);
+				checkMapPixels(results, palette, vPixels, std::to_string(iNumColours) + " random colours");
+
+				// Bunched around one colour with many repeated, so distant cells have many candidates and ties are common
+				for (size_t ui = 0; ui < vColours.size(); ui++)
+					vColours[ui] = uint8_t(96 + nextRandom() % 8);
+				palette.setColours(vColours);
+				checkMapPixels(results, palette, vPixels, std::to_string(iNumColours) + " bunched colours");
+			}
+
+			// One chosen by createFromPixels() for the pixels it's then mapped
+			CPalette palette;
+			palette.createFromPixels(vPixels.data(), int(vPixels.size() / 3), 1, 3, 256);
+			checkMapPixels(results, palette, vPixels, "a palette chosen for the pixels");
+		}
+
+		/// \brief Checks that the paletted sizes of .ico files decode, keep their transparency and are close to the same sizes saved as RGBA
+		void checkPalettedICO(CTestResults& results)
+		{
+			// Transparent corners, and a full range of hues to choose a palette for
+			CImage image;
+			image.createColourWheel(200);
+
+			CImage::SICOSettings settings;
+			settings.vIconSizes = { 48, 32, 17, 16 };
+			settings.ePNGEffort = CPNGEncoder::EFFORT_FAST;
+			std::vector<uint8_t> vICOData;
+			std::vector<CImage> vRGBA;
+			if (!results.check(image.saveAsICOToMemory(vICOData, settings) && decodeICO(vICOData, vRGBA), "the RGBA sizes decode"))
+				return;
+
+			const int kBitsPerPixel[] = { 4, 8 };
+			const CPalette::EDither kDithers[] = { CPalette::DITHER_NONE, CPalette::DITHER_BAYER, CPalette::DITHER_FLOYD_STEINBERG };
+			// Floors for PSNR of the opaque pixels against the RGBA sizes, for 4 and 8 bits per pixel
+			const double kMinPSNR[] = { 16.0, 24.0 };
+			for (int iBitsIndex = 0; iBitsIndex < 2; iBitsIndex++)
+			{
+				for (CPalette::EDither eDither : kDithers)
+				{
+					for (int iPNG = 0; iPNG < 2; iPNG++)
+					{
+						settings.iPaletteBitsPerPixel = kBitsPerPixel[iBitsIndex];
+						settings.ePaletteDither = eDither;
+						settings.bPalettePNG = 1 == iPNG;
+						const std::string strSettings = std::to_string(settings.iPaletteBitsPerPixel) + "bpp " + (settings.bPalettePNG ? "PNG" : "BMP") + " dither " + std::to_string(int(eDither));
+						std::vector<CImage> vEntries;
+						if (!results.check(image.saveAsICOToMemory(vICOData, settings) && decodeICO(vICOData, vEntries) && vEntries.size() == vRGBA.size(), strSettings + " decodes"))
+							continue;
+
+						for (size_t uiEntry = 0; uiEntry < vEntries.size(); uiEntry++)
+						{
+							const int iSize = settings.vIconSizes[uiEntry];
+							const std::string strWhat = strSettings + " " + std::to_string(iSize) + "x" + std::to_string(iSize);
+							if (iSize > settings.iPaletteMaxSize)
+							{
+								results.check(kMaxDouble == vEntries[uiEntry].computePSNR(vRGBA[uiEntry]), strWhat + " is the same as without a palette");
+								continue;
+							}
+
+							// Pixels with alpha under 128 are transparent, and the rest opaque
+							const uint8_t* pExpected = vRGBA[uiEntry].getData();
+							const uint8_t* pActual = vEntries[uiEntry].getData();
+							const size_t uiNumPixels = size_t(iSize) * iSize;
+							std::set<uint32_t> setColours;
+							bool bTransparencyKept = true;
+							double dSumSquares = 0.0;
+							size_t uiNumOpaque = 0;
+							for (size_t ui = 0; ui < uiNumPixels; ui++)
+							{
+								const bool bTransparent = pExpected[ui * 4 + 3] < 128;
+								bTransparencyKept = bTransparencyKept && pActual[ui * 4 + 3] == (bTransparent ? 0 : 255);
+								if (bTransparent)
+									continue;
+								setColours.insert(pActual[ui * 4] | (pActual[ui * 4 + 1] << 8) | (pActual[ui * 4 + 2] << 16));
+								dSumSquares += distanceSquared(pExpected + ui * 4, pActual + ui * 4);
+								uiNumOpaque++;
+							}
+							results.check(bTransparencyKept, strWhat + " keeps which pixels are transparent");
+							// One entry is kept for the transparent pixels
+							results.check(setColours.size() < (size_t(1) << settings.iPaletteBitsPerPixel), strWhat + " has " + std::to_string(setColours.size()) + " opaque colours, too many for its palette");
+							const double dPSNR = 10.0 * std::log10(255.0 * 255.0 * 3.0 * double(uiNumOpaque) / std::max(dSumSquares, 1.0));
+							results.check(dPSNR >= kMinPSNR[iBitsIndex], strWhat + " has a PSNR of " + std::to_string(dPSNR) + "dB, under the floor of " + std::to_string(kMinPSNR[iBitsIndex]) + "dB");
+
+							// Undithered, each opaque pixel is the nearest of the palette's colours, all of which are in use by the pixels they're nearest
+							if (CPalette::DITHER_NONE != eDither)
+								continue;
+							std::vector<uint8_t> vUsed;
+							for (uint32_t uiColour : setColours)
+							{
+								vUsed.push_back(uint8_t(uiColour));
+								vUsed.push_back(uint8_t(uiColour >> 8));
+								vUsed.push_back(uint8_t(uiColour >> 16));
+							}
+							bool bNearest = true;
+							for (size_t ui = 0; ui < uiNumPixels; ui++)
+							{
+								if (pExpected[ui * 4 + 3] >= 128)
+									bNearest = bNearest && distanceSquared(pExpected + ui * 4, pActual + ui * 4) == distanceSquared(pExpected + ui * 4, &vUsed[size_t(findNearestByBruteForce(vUsed, pExpected + ui * 4)) * 3]);
+							}
+							results.check(bNearest, strWhat + " has each opaque pixel the nearest colour of its palette");
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void testPalette(CTestResults& results)
+	{
+		checkNearest(results);
+		checkPalettedICO(results);
+	}
+}
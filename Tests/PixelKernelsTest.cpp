@@ -0,0 +1,262 @@
+#include "Tests.h"
+#include "../Image/PixelKernels.h"
+#include "../Core/Utilities.h"
+#include <cstring>
+#include <vector>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief Bytes either side of each run a kernel works on, which it must leave alone. Odd, so the runs start off any vector boundary.
+		const size_t kGuardBytes = 61;
+
+		/// \brief Returns the next value of a fixed xorshift sequence, so every run checks the same data.
+		unsigned int nextRandom(void)
+		{
+			static unsigned int uiState = 2463534242u;
+			uiState ^= uiState << 13;
+			uiState ^= uiState >> 17;
+			uiState ^= uiState << 5;
+			return uiState;
+		}
+
+		/// \brief Returns a buffer of uiNumBytes with kGuardBytes of random bytes either side.
+		///
+		/// The bytes between count up through all 256 values at a stride which is odd, and so coprime with 256, and which moves each channel
+		/// on at a different rate, so every channel of a run of 256 pixels or more sees every byte value. iSeed shifts where they start.
+		std::vector<unsigned char> makeBytes(size_t uiNumBytes, int iSeed)
+		{
+			std::vector<unsigned char> vBytes(uiNumBytes + 2 * kGuardBytes);
+			for (size_t ui = 0; ui < vBytes.size(); ui++)
+				vBytes[ui] = (unsigned char)nextRandom();
+			unsigned char* pRun = vBytes.data() + kGuardBytes;
+			for (size_t ui = 0; ui < uiNumBytes; ui++)
+				pRun[ui] = (unsigned char)(ui * 167 + (ui / 7) * 31 + iSeed);
+			return vBytes;
+		}
+
+		/// \brief Returns a description of a check of one kernel, for CTestResults::check()
+		std::string describe(const SPixelKernels& kernels, const char* pszKernel, size_t uiNumPixels, unsigned int uiNumChannels, double dParameter)
+		{
+			return std::string(kernels.pszName) + " " + pszKernel + " matches scalar for " + std::to_string(uiNumPixels) + " pixels of " +
+				std::to_string(uiNumChannels) + " channels, parameter " + std::to_string(dParameter);
+		}
+
+		/// \brief Runs an in place kernel of scalar and kernels over the same bytes and checks they agree, guard bytes included.
+		template <typename TFunction>
+		void checkInPlace(CTestResults& results, const SPixelKernels& scalar, const SPixelKernels& kernels, const char* pszKernel, size_t uiNumPixels, unsigned int uiNumChannels, double dParameter, int iSeed, TFunction function)
+		{
+			std::vector<unsigned char> vExpected = makeBytes(uiNumPixels * uiNumChannels, iSeed);
+			std::vector<unsigned char> vActual = vExpected;
+			function(scalar, vExpected.data() + kGuardBytes);
+			function(kernels, vActual.data() + kGuardBytes);
+			results.check(vExpected == vActual, describe(kernels, pszKernel, uiNumPixels, uiNumChannels, dParameter));
+		}
+
+		/// \brief Checks each of the byte kernels of kernels against scalar, for runs of uiNumPixels.
+		void checkByteKernels(CTestResults& results, const SPixelKernels& scalar, const SPixelKernels& kernels, size_t uiNumPixels)
+		{
+			const float kSensitivities[][3] =
+			{
+				{ 0.299f, 0.587f, 0.114f },
+				{ 0.2126f, 0.7152f, 0.0722f },
+				{ 1.0f / 3.0f, 1.0f / 3.0f, 1.0f / 3.0f },
+				{ 0.5f, 0.7f, 0.9f },
+				{ -0.2f, 0.3f, 1.7f }
+			};
+			const int kBrightnessAmounts[] = { -100000, -256, -255, -254, -128, -1, 0, 1, 127, 254, 255, 256, 100000 };
+
+			for (unsigned int uiNumChannels = 3; uiNumChannels <= 4; uiNumChannels++)
+			{
+				int iSeed = (int)uiNumPixels;
+				checkInPlace(results, scalar, kernels, "swapRedAndBlue", uiNumPixels, uiNumChannels, 0, iSeed,
+					[&](const SPixelKernels& k, unsigned char* pData) { k.swapRedAndBlue(pData, uiNumPixels, uiNumChannels); });
+
+				for (int iFlags = 0; iFlags < 4; iFlags++)
+					checkInPlace(results, scalar, kernels, "invert", uiNumPixels, uiNumChannels, iFlags, iSeed,
+						[&](const SPixelKernels& k, unsigned char* pData) { k.invert(pData, uiNumPixels, uiNumChannels, 0 != (iFlags & 1), 0 != (iFlags & 2)); });
+
+				for (const float* pfSensitivity : kSensitivities)
+					checkInPlace(results, scalar, kernels, "greyscale", uiNumPixels, uiNumChannels, pfSensitivity[0], iSeed,
+						[&](const SPixelKernels& k, unsigned char* pData) { k.greyscale(pData, uiNumPixels, uiNumChannels, pfSensitivity[0], pfSensitivity[1], pfSensitivity[2]); });
+
+				for (int iAmount : kBrightnessAmounts)
+					checkInPlace(results, scalar, kernels, "adjustBrightness", uiNumPixels, uiNumChannels, iAmount, iSeed,
+						[&](const SPixelKernels& k, unsigned char* pData) { k.adjustBrightness(pData, uiNumPixels, uiNumChannels, iAmount); });
+
+				// The squared contrast CImage::adjustContrast() computes from each of its amounts, -100 to 100
+				for (int iAmount = -100; iAmount <= 100; iAmount += 20)
+				{
+					double dContrast = (100.0 + iAmount) * 0.01;
+					dContrast *= dContrast;
+					checkInPlace(results, scalar, kernels, "adjustContrast", uiNumPixels, uiNumChannels, iAmount, iSeed,
+						[&](const SPixelKernels& k, unsigned char* pData) { k.adjustContrast(pData, uiNumPixels, uiNumChannels, dContrast); });
+				}
+			}
+
+			// Adding an alpha channel, with each of a few alphas
+			for (unsigned int uiAlpha : { 0u, 77u, 255u })
+			{
+				std::vector<unsigned char> vRGB = makeBytes(uiNumPixels * 3, (int)uiAlpha);
+				std::vector<unsigned char> vExpected = makeBytes(uiNumPixels * 4, 0);
+				std::vector<unsigned char> vActual = vExpected;
+				scalar.addAlphaChannel(vRGB.data() + kGuardBytes, vExpected.data() + kGuardBytes, uiNumPixels, (unsigned char)uiAlpha);
+				kernels.addAlphaChannel(vRGB.data() + kGuardBytes, vActual.data() + kGuardBytes, uiNumPixels, (unsigned char)uiAlpha);
+				results.check(vExpected == vActual, describe(kernels, "addAlphaChannel", uiNumPixels, 3, uiAlpha));
+			}
+
+			// Removing the alpha channel into another buffer, then packing the pixels down in place
+			{
+				std::vector<unsigned char> vRGBA = makeBytes(uiNumPixels * 4, 1);
+				std::vector<unsigned char> vExpected = makeBytes(uiNumPixels * 3, 2);
+				std::vector<unsigned char> vActual = vExpected;
+				scalar.removeAlphaChannel(vRGBA.data() + kGuardBytes, vExpected.data() + kGuardBytes, uiNumPixels);
+				kernels.removeAlphaChannel(vRGBA.data() + kGuardBytes, vActual.data() + kGuardBytes, uiNumPixels);
+				results.check(vExpected == vActual, describe(kernels, "removeAlphaChannel", uiNumPixels, 4, 0));
+			}
+			checkInPlace(results, scalar, kernels, "removeAlphaChannel in place", uiNumPixels, 4, 1, 3,
+				[&](const SPixelKernels& k, unsigned char* pData) { k.removeAlphaChannel(pData, pData, uiNumPixels); });
+		}
+
+		/// \brief Checks the float kernels of kernels against scalar, for runs of uiNumValues.
+		void checkFloatKernels(CTestResults& results, const SPixelKernels& scalar, const SPixelKernels& kernels, size_t uiNumValues)
+		{
+			std::vector<unsigned char> vBytes = makeBytes(uiNumValues, 5);
+			std::vector<float> vFloatsExpected(uiNumValues + 2, -1.0f);
+			std::vector<float> vFloatsActual = vFloatsExpected;
+			scalar.bytesToFloats(vBytes.data() + kGuardBytes, vFloatsExpected.data() + 1, uiNumValues);
+			kernels.bytesToFloats(vBytes.data() + kGuardBytes, vFloatsActual.data() + 1, uiNumValues);
+			results.check(vFloatsExpected == vFloatsActual, describe(kernels, "bytesToFloats", uiNumValues, 1, 0));
+
+			// Floats running past either end of a byte's range, every fifth exactly on a quarter so halves are rounded too
+			std::vector<float> vFloats(uiNumValues);
+			for (size_t ui = 0; ui < uiNumValues; ui++)
+				vFloats[ui] = -20.0f + (float)((ui * 37) % 1200) * 0.25f + ((0 == ui % 5) ? 0.0f : (float)(nextRandom() % 1000) * 0.0002f);
+			std::vector<unsigned char> vExpected = makeBytes(uiNumValues, 6);
+			std::vector<unsigned char> vActual = vExpected;
+			scalar.floatsToBytes(vFloats.data(), vExpected.data() + kGuardBytes, uiNumValues);
+			kernels.floatsToBytes(vFloats.data(), vActual.data() + kGuardBytes, uiNumValues);
+			results.check(vExpected == vActual, describe(kernels, "floatsToBytes", uiNumValues, 1, 0));
+
+			// Weighted sums of up to 11 taps, into a buffer of their own and accumulated into the first tap
+			for (unsigned int uiNumTaps = 1; uiNumTaps <= 11; uiNumTaps++)
+			{
+				std::vector<std::vector<float>> vvSources(uiNumTaps, std::vector<float>(uiNumValues + 2));
+				std::vector<float> vWeights(uiNumTaps);
+				for (unsigned int uiTap = 0; uiTap < uiNumTaps; uiTap++)
+				{
+					vWeights[uiTap] = (float)((int)(nextRandom() % 2001) - 1000) * 0.001f;
+					for (float& fValue : vvSources[uiTap])
+						fValue = (float)(nextRandom() % 25600) * 0.01f;
+				}
+				for (int iInPlace = 0; iInPlace < 2; iInPlace++)
+				{
+					std::vector<std::vector<float>> vvExpected = vvSources;
+					std::vector<std::vector<float>> vvActual = vvSources;
+					std::vector<float> vDstExpected(uiNumValues + 2, -1.0f);
+					std::vector<float> vDstActual = vDstExpected;
+					std::vector<const float*> vpExpected, vpActual;
+					for (unsigned int uiTap = 0; uiTap < uiNumTaps; uiTap++)
+					{
+						vpExpected.push_back(vvExpected[uiTap].data() + 1);
+						vpActual.push_back(vvActual[uiTap].data() + 1);
+					}
+					float* pfDstExpected = iInPlace ? vvExpected[0].data() + 1 : vDstExpected.data() + 1;
+					float* pfDstActual = iInPlace ? vvActual[0].data() + 1 : vDstActual.data() + 1;
+					scalar.weightedSum(vpExpected.data(), vWeights.data(), uiNumTaps, pfDstExpected, uiNumValues);
+					kernels.weightedSum(vpActual.data(), vWeights.data(), uiNumTaps, pfDstActual, uiNumValues);
+					results.check(0 == memcmp(pfDstExpected - 1, pfDstActual - 1, (uiNumValues + 2) * sizeof(float)), describe(kernels, "weightedSum", uiNumValues, 1, uiNumTaps));
+				}
+			}
+		}
+
+		/// \brief Checks the mandelbrot kernel of kernels against scalar, along rows and down columns of several views, with and without each shortcut.
+		void checkMandelbrotKernel(CTestResults& results, const SPixelKernels& scalar, const SPixelKernels& kernels)
+		{
+			// The whole set, a view along the edge of the set where neighbouring counts vary the most, and one inside the main cardioid
+			const double kViews[][4] =
+			{
+				{ -2.5, 4.0 / 320.0, -1.0, 2.0 / 200.0 },
+				{ -0.7485, 0.0002 / 7.0, 0.0575, 0.0003 / 11.0 },
+				{ -0.3, 0.001, -0.2, 0.002 }
+			};
+			const unsigned int kMaxIterations[] = { 1, 2, 250, 3000 };
+			std::vector<size_t> vNumPixels;
+			for (size_t ui = 0; ui <= 20; ui++)
+				vNumPixels.push_back(ui);
+			vNumPixels.push_back(61);
+			vNumPixels.push_back(300);
+
+			for (const double* pdView : kViews)
+			{
+				for (unsigned int uiMaxIterations : kMaxIterations)
+				{
+					for (int iShortcuts = 0; iShortcuts < 4; iShortcuts++)
+					{
+						SPixelKernels::SMandelbrotView view;
+						view.dRealMin = pdView[0];
+						view.dRealStep = pdView[1];
+						view.dImaginaryMin = pdView[2];
+						view.dImaginaryStep = pdView[3];
+						view.uiMaxIterations = uiMaxIterations;
+						view.bSkipBulbs = 0 != (iShortcuts & 1);
+						view.bCheckPeriodicity = 0 != (iShortcuts & 2);
+						for (size_t uiNumPixels : vNumPixels)
+						{
+							for (int iColumn = 0; iColumn < 2; iColumn++)
+							{
+								// One count either side of the run, which must be left alone
+								std::vector<unsigned int> vExpected(uiNumPixels + 2, 0xDEADBEEF);
+								std::vector<unsigned int> vActual = vExpected;
+								scalar.mandelbrot(view, 3, 5, 1 == iColumn, vExpected.data() + 1, uiNumPixels);
+								kernels.mandelbrot(view, 3, 5, 1 == iColumn, vActual.data() + 1, uiNumPixels);
+								results.check(vExpected == vActual, describe(kernels, iColumn ? "mandelbrot column" : "mandelbrot row", uiNumPixels, 1, uiMaxIterations) +
+									", view " + std::to_string(pdView[0]) + ", shortcuts " + std::to_string(iShortcuts));
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void testPixelKernels(CTestResults& results)
+	{
+		const SPixelKernels& scalar = *SPixelKernels::getFor(SPixelKernels::INSTRUCTIONS_SCALAR);
+		const SCPUFeatures& cpuFeatures = getCPUFeatures();
+
+		// Every width up to a few vectors of the widest pixels, then some long enough for every channel to see every byte value
+		std::vector<size_t> vNumPixels;
+		for (size_t ui = 0; ui <= 70; ui++)
+			vNumPixels.push_back(ui);
+		vNumPixels.push_back(255);
+		vNumPixels.push_back(256);
+		vNumPixels.push_back(1000);
+		vNumPixels.push_back(4097);
+
+		// Instruction sets the CPU doesn't report are skipped, rather than failing
+		struct SInstructionSet
+		{
+			SPixelKernels::EInstructionSet eInstructionSet;
+			bool bReported;
+		};
+		const SInstructionSet kInstructionSets[] =
+		{
+			{ SPixelKernels::INSTRUCTIONS_SSE2, cpuFeatures.bSSE2 },
+			{ SPixelKernels::INSTRUCTIONS_AVX2, cpuFeatures.bAVX2 && cpuFeatures.bSSSE3 }
+		};
+		for (const SInstructionSet& instructionSet : kInstructionSets)
+		{
+			const SPixelKernels* pKernels = SPixelKernels::getFor(instructionSet.eInstructionSet);
+			if (!instructionSet.bReported || !pKernels)
+				continue;
+			for (size_t uiNumPixels : vNumPixels)
+			{
+				checkByteKernels(results, scalar, *pKernels, uiNumPixels);
+				checkFloatKernels(results, scalar, *pKernels, uiNumPixels);
+			}
+			checkMandelbrotKernel(results, scalar, *pKernels);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+#include "Tests.h"
+#include "../Core/Exceptions.h"
+#include "../Core/JSON.h"
+#include "../Core/Utilities.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+namespace X
+{
+	namespace
+	{
+		/// \brief Returns whether calling function throws a CException
+		template <typename TFunction>
+		bool throwsException(TFunction function)
+		{
+			try
+			{
+				function();
+			}
+			catch (CException&)
+			{
+				return true;
+			}
+			return false;
+		}
+	}
+
+	void testServe(CTestResults& results)
+	{
+		// Each getter and modifier must throw when given a value of another type, as serve mode relies on it to catch a job it failed to check.
+		// Debug builds break into the debugger before throwing, so only a release build checks this.
+#ifndef _DEBUG
+		const CJSONValue number(1.0);
+		const CJSONValue string("text");
+		results.check(throwsException([&]() { number.getBool(); }), "getBool() of a number throws");
+		results.check(throwsException([&]() { string.getNumber(); }), "getNumber() of a string throws");
+		results.check(throwsException([&]() { number.getString(); }), "getString() of a number throws");
+		results.check(throwsException([&]() { string.at(0); }), "at() of a string throws");
+		results.check(throwsException([&]() { CJSONValue value(1.0); value.append(CJSONValue(2.0)); }), "append() to a number throws");
+		results.check(throwsException([&]() { CJSONValue value = CJSONValue::makeArray(); value.set("name", CJSONValue(true)); }), "set() of an array throws");
+		results.check(!throwsException([&]() { CJSONValue(true).getBool(); number.getNumber(); string.getString(); }), "getters of the right type don't throw");
+#endif
+
+		// Run serve mode on a job of each badly typed member, and expect each to be replied to with an error rather than being run
+		const char* kJobs[] =
+		{
+			"{\"id\": 1, \"input\": 5}",
+			"{\"id\": 2, \"input\": \"in.png\", \"output\": 7}",
+			"{\"id\": 3, \"input\": \"in.png\", \"effort\": 1}",
+			"{\"id\": 4, \"input\": \"in.png\", \"passthrough\": \"yes\"}",
+			"{\"id\": 5, \"input\": \"in.png\", \"sizes\": \"16\"}",
+			"{\"id\": 6, \"input\": \"in.png\", \"sizes\": [16, \"32\"]}",
+			"[\"in.png\"]"
+		};
+		const size_t kNumJobs = sizeof(kJobs) / sizeof(kJobs[0]);
+
+		if (!results.check(std::filesystem::exists(results.getImage2IcoPath()), "Image2Ico found at " + results.getImage2IcoPath()))
+			return;
+		const std::filesystem::path pathTemp = std::filesystem::temp_directory_path();
+		const std::string strJobsFilename = (pathTemp / "Image2IcoTests_jobs.ndjson").string();
+		const std::string strRepliesFilename = (pathTemp / "Image2IcoTests_replies.ndjson").string();
+		{
+			std::ofstream ofs(strJobsFilename);
+			for (size_t i = 0; i < kNumJobs; i++)
+				ofs << kJobs[i] << "\n";
+		}
+		std::string strCommand = "\"" + results.getImage2IcoPath() + "\" --serve < \"" + strJobsFilename + "\" > \"" + strRepliesFilename + "\"";
+#ifdef PLATFORM_WINDOWS
+		// cmd.exe removes the first and last quote of the whole command
+		strCommand = "\"" + strCommand + "\"";
+#endif
+		results.check(0 == std::system(strCommand.c_str()), "serve mode exits successfully");
+
+		// Jobs which fail their checks are replied to straight away, so in the order they were sent
+		std::ifstream ifs(strRepliesFilename);
+		std::string strLine;
+		size_t uiNumReplies = 0;
+		while (std::getline(ifs, strLine))
+		{
+			CJSONValue reply;
+			std::string strError;
+			const std::string strWhat = "reply " + std::to_string(uiNumReplies + 1) + " " + strLine;
+			uiNumReplies++;
+			if (!results.check(CJSONValue::parse(strLine, reply, strError) && reply.isObject(), strWhat + " is a JSON object"))
+				continue;
+			const CJSONValue* pId = reply.find("id");
+			const CJSONValue* pOk = reply.find("ok");
+			const CJSONValue* pError = reply.find("error");
+			if (uiNumReplies < kNumJobs)
+				results.check(pId && pId->isNumber() && double(uiNumReplies) == pId->getNumber(), strWhat + " has its job's id");
+			results.check(pOk && pOk->isBool() && !pOk->getBool(), strWhat + " isn't ok");
+			results.check(pError && pError->isString() && !pError->getString().empty(), strWhat + " has an error");
+		}
+		results.check(kNumJobs == uiNumReplies, "one reply to each job");
+
+		std::error_code errorCode;
+		std::filesystem::remove(strJobsFilename, errorCode);
+		std::filesystem::remove(strRepliesFilename, errorCode);
+	}
+}
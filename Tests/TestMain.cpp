@@ -0,0 +1,98 @@
+// TestMain.cpp : Runs each group of Image2Ico's tests, returning non-zero if any check failed.
+//
+// Built by Tests.vcxproj beside Image2Ico itself, which some of the tests run. Pass Image2Ico's path as the only argument to use another build of it.
+//
+#include "Tests.h"
+#include "../Globals.h"
+#include "../Core/Utilities.h"
+#include <filesystem>
+#include <iostream>
+
+using namespace X;
+
+namespace X
+{
+	CTestResults::CTestResults(const std::string& strImage2IcoPath) :
+		_mstrImage2IcoPath(strImage2IcoPath),
+		_muiGroupChecks(0),
+		_muiGroupFailures(0),
+		_muiNumFailures(0)
+	{
+	}
+
+	bool CTestResults::check(bool bPassed, const std::string& strWhat)
+	{
+		_muiGroupChecks++;
+		if (!bPassed)
+		{
+			_muiGroupFailures++;
+			_muiNumFailures++;
+			std::cout << "FAILED " << _mstrGroup << ": " << strWhat << "\n";
+		}
+		return bPassed;
+	}
+
+	void CTestResults::beginGroup(const std::string& strName)
+	{
+		_mstrGroup = strName;
+		_muiGroupChecks = 0;
+		_muiGroupFailures = 0;
+	}
+
+	void CTestResults::endGroup(void)
+	{
+		std::cout << _mstrGroup << ": " << _muiGroupChecks << " checks, " << _muiGroupFailures << " failed\n";
+	}
+
+	unsigned int CTestResults::getNumFailures(void) const
+	{
+		return _muiNumFailures;
+	}
+
+	const std::string& CTestResults::getImage2IcoPath(void) const
+	{
+		return _mstrImage2IcoPath;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	pGlobals = new CGlobals;
+
+	std::string strImage2IcoPath;
+	if (argc > 1)
+		strImage2IcoPath = argv[1];
+	else
+	{
+		std::filesystem::path pathImage2Ico = std::filesystem::path(argv[0]).parent_path() / "Image2Ico";
+#ifdef PLATFORM_WINDOWS
+		pathImage2Ico += ".exe";
+#endif
+		strImage2IcoPath = pathImage2Ico.string();
+	}
+	CTestResults results(strImage2IcoPath);
+
+	struct STestGroup
+	{
+		const char* pszName;
+		void (*test)(CTestResults& results);
+	};
+	const STestGroup kTestGroups[] =
+	{
+		{ "Serve", testServe },
+		{ "PixelKernels", testPixelKernels },
+		{ "Mandelbrot", testMandelbrot },
+		{ "MandelbrotShortcuts", testMandelbrotShortcuts },
+		{ "Palette", testPalette },
+		{ "ResizePyramid", testResizePyramid }
+	};
+	for (const STestGroup& group : kTestGroups)
+	{
+		results.beginGroup(group.pszName);
+		group.test(results);
+		results.endGroup();
+	}
+
+	std::cout << (results.getNumFailures() ? "FAILED\n" : "PASSED\n");
+	return results.getNumFailures() ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace X
+{
+	/// \brief Counts the checks made by Image2Ico's tests, printing each one which fails.
+	///
+	/// Each group of tests is a function taking one of these, defined in a file of its own in this directory and called in turn by main() in TestMain.cpp.
+	/// To add a group, declare its function below, then add it to main()'s list and its file to Tests.vcxproj.
+	/// \code
+	/// void testSomething(CTestResults& results)
+	/// {
+	///		CJSONValue value;
+	///		std::string strError;
+	///		results.check(CJSONValue::parse("[1, 2]", value, strError), "parsing an array");
+	/// }
+	/// \endcode
+	class CTestResults
+	{
+	public:
+		/// \brief Constructor, nothing has been checked yet
+		///
+		/// \param strImage2IcoPath The path of the Image2Ico executable, for tests which run it
+		CTestResults(const std::string& strImage2IcoPath);
+
+		/// \brief Counts a check, printing strWhat along with the current group's name if it failed
+		///
+		/// \param bPassed Whether the check passed
+		/// \param strWhat What was checked, printed if it failed
+		/// \return bPassed, so a test can stop once something the rest of it depends on has failed
+		bool check(bool bPassed, const std::string& strWhat);
+
+		/// \brief Names the group of tests the following checks belong to, and counts its checks and failures from zero
+		void beginGroup(const std::string& strName);
+
+		/// \brief Prints the number of checks and failures of the group named by the last call to beginGroup()
+		void endGroup(void);
+
+		/// \brief Returns the number of checks which have failed, in every group so far
+		unsigned int getNumFailures(void) const;
+
+		/// \brief Returns the path of the Image2Ico executable, given to the constructor
+		const std::string& getImage2IcoPath(void) const;
+	private:
+		std::string _mstrImage2IcoPath;		///< The path of the Image2Ico executable
+		std::string _mstrGroup;				///< Name of the current group
+		unsigned int _muiGroupChecks;		///< Number of checks made in the current group
+		unsigned int _muiGroupFailures;		///< Number of checks which have failed in the current group
+		unsigned int _muiNumFailures;		///< Number of checks which have failed in every group
+	};
+
+	class CImage;
+
+	/// \brief Decodes each image of a .ico file held in memory, in the order of its directory, for tests of what saveAsICOToMemory() writes
+	///
+	/// \param vICOData The .ico file's bytes
+	/// \param vEntries Has each image added to it as RGBA, once cleared
+	/// \return False if the file or any of its images couldn't be decoded, or an image isn't the size its directory entry gives
+	///
+	/// Entries may be PNGs of any kind, or 4 or 8 bit per pixel BMPs as written for SICOSettings::iPaletteBitsPerPixel.
+	bool decodeICO(const std::vector<uint8_t>& vICOData, std::vector<CImage>& vEntries);
+
+	/// \brief Checks that fillMandelbrotMT(), on the widest kernels this CPU supports, fills exactly the same pixels as fillMandelbrot() for several views and shortcuts
+	void testMandelbrot(CTestResults& results);
+
+	/// \brief Checks that the exact Mandelbrot shortcuts give the same image as none, and that subdivision changes few enough pixels
+	void testMandelbrotShortcuts(CTestResults& results);
+
+	/// \brief Checks that CPalette maps each colour to the nearest of its palette, and that the paletted sizes of .ico files decode to the pixels they were made from
+	void testPalette(CTestResults& results);
+
+	/// \brief Checks that each size saved with the resize pyramid is within a PSNR floor of the same size resampled from the source image
+	void testResizePyramid(CTestResults& results);
+
+	/// \brief Checks CJSONValue's type checking, and that serve mode replies with an error to each job with a member of the wrong type
+	void testServe(CTestResults& results);
+
+	/// \brief Checks that each SPixelKernels table this CPU supports gives exactly the same results as the scalar one
+	void testPixelKernels(CTestResults& results);
+}